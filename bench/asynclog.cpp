@@ -0,0 +1,57 @@
+#include "wsudo/asynclog.h"
+
+#include <benchmark/benchmark.h>
+#include <memory>
+
+using namespace wsudo::log;
+
+namespace {
+  std::unique_ptr<AsyncLogWriter> g_writer;
+
+  // The cost of a write on the logging thread. The output drops everything,
+  // so this doesn't measure the console. The rings are flushed untimed now
+  // and then; otherwise they fill up and this times dropping records.
+  void BM_AsyncLogWrite(benchmark::State &state) {
+    if (state.thread_index() == 0) {
+      auto discard = [](std::string_view) {};
+      g_writer = std::make_unique<AsyncLogWriter>(discard, discard);
+    }
+    std::string record(state.range(0), 'x');
+    record.back() = '\n';
+    auto perFlush = AsyncLogWriter::DefaultRingSize / 2 / record.size();
+    size_t written = 0;
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(g_writer->write(AsyncLogWriter::Out, record));
+      if (++written == perFlush) {
+        state.PauseTiming();
+        g_writer->flush();
+        state.ResumeTiming();
+        written = 0;
+      }
+    }
+    if (state.thread_index() == 0) {
+      g_writer->flush();
+      auto stats = g_writer->stats();
+      state.counters["dropped"] = static_cast<double>(stats.dropped);
+      g_writer.reset();
+    }
+    state.SetItemsProcessed(state.iterations());
+  }
+
+  void BM_LogRingPushDrain(benchmark::State &state) {
+    LogRing ring{AsyncLogWriter::DefaultRingSize};
+    std::string record(state.range(0), 'x');
+    std::string scratch;
+    auto sink = [](unsigned, std::string_view text) {
+      benchmark::DoNotOptimize(text.data());
+    };
+    for (auto _ : state) {
+      ring.push(AsyncLogWriter::Out, record);
+      ring.drain(sink, scratch);
+    }
+    state.SetBytesProcessed(state.iterations() * record.size());
+  }
+}
+
+BENCHMARK(BM_AsyncLogWrite)->Arg(80)->Threads(1)->Threads(4)->UseRealTime();
+BENCHMARK(BM_LogRingPushDrain)->Arg(80)->Arg(1024);
@@ -0,0 +1,88 @@
+#include "wsudo/audit.h"
+
+#include <benchmark/benchmark.h>
+#include <map>
+
+using namespace wsudo::audit;
+
+namespace {
+  // Segments in plain memory, so only the log's own work is measured.
+  class MemoryStorage final : public Storage {
+  public:
+    std::vector<uint64_t> list() override {
+      std::vector<uint64_t> sequences;
+      for (auto &[sequence, file] : _files) {
+        sequences.push_back(sequence);
+      }
+      return sequences;
+    }
+
+    std::unique_ptr<Mapping> open(uint64_t sequence, size_t size) override {
+      auto &file = _files[sequence];
+      if (file.empty()) {
+        file.resize(size);
+      }
+      return std::make_unique<MemoryMapping>(file);
+    }
+
+    void remove(uint64_t sequence) override {
+      _files.erase(sequence);
+    }
+
+  private:
+    class MemoryMapping final : public Mapping {
+    public:
+      explicit MemoryMapping(std::vector<char> &file) : _file{file} {}
+
+      char *data() override { return _file.data(); }
+      size_t size() const override { return _file.size(); }
+      bool sync(size_t, size_t) override { return true; }
+
+    private:
+      std::vector<char> &_file;
+    };
+
+    std::map<uint64_t, std::vector<char>> _files;
+  };
+
+  Record sampleRecord() {
+    Record record{};
+    record.time = AuditLog::now();
+    record.logonId = 0x3E7;
+    record.processId = 1234;
+    record.latency = 250;
+    record.event = Event::Bless;
+    record.outcome = Outcome::Allowed;
+    record.clientId = 1;
+    record.setUser("alice");
+    record.setImage("c:\\windows\\system32\\cmd.exe");
+    return record;
+  }
+
+  // What the event loop pays per audited request. The log is flushed
+  // untimed now and then so appends don't just hit the pending limit.
+  void BM_AuditAppend(benchmark::State &state) {
+    AuditLog::Options options;
+    options.segmentRecords = 4096;
+    options.maxSegments = 4;
+    AuditLog log{std::make_unique<MemoryStorage>(), options};
+    auto record = sampleRecord();
+    size_t appended = 0;
+    for (auto _ : state) {
+      log.append(record);
+      if (++appended == options.maxPending / 2) {
+        state.PauseTiming();
+        log.flush();
+        state.ResumeTiming();
+        appended = 0;
+      }
+    }
+    log.flush();
+    auto stats = log.stats();
+    state.counters["commits"] = static_cast<double>(stats.commits);
+    state.counters["dropped"] = static_cast<double>(stats.dropped);
+    state.SetItemsProcessed(state.iterations());
+  }
+}
+
+BENCHMARK(BM_AuditAppend)->UseRealTime();
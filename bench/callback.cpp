@@ -0,0 +1,63 @@
+#include "wsudo/callback.h"
+
+#include <benchmark/benchmark.h>
+
+using namespace wsudo;
+
+namespace {
+  // The connection handler's shape: each step returns the next one.
+  class Machine {
+  public:
+    using Self = Machine;
+    using Callback = recursive_mem_callback<Self>;
+
+    Callback callback{&Self::connect};
+    unsigned messages = 0;
+
+    Callback connect() { return &Self::read; }
+    Callback read() { return &Self::respond; }
+    Callback respond() {
+      return ++messages % 4 ? &Self::read : &Self::reset;
+    }
+    Callback reset() { return &Self::connect; }
+  };
+
+  // The same steps as an enum and a switch, for comparison.
+  class SwitchMachine {
+  public:
+    enum State { Connect, Read, Respond, Reset };
+
+    State state = Connect;
+    unsigned messages = 0;
+
+    void step() {
+      switch (state) {
+      case Connect: state = Read; break;
+      case Read: state = Respond; break;
+      case Respond: state = ++messages % 4 ? Read : Reset; break;
+      case Reset: state = Connect; break;
+      }
+    }
+  };
+
+  void BM_RecursiveMemCallback(benchmark::State &state) {
+    Machine machine;
+    for (auto _ : state) {
+      machine.callback.call_and_swap(machine);
+      benchmark::DoNotOptimize(machine.callback);
+    }
+    state.SetItemsProcessed(state.iterations());
+  }
+
+  void BM_SwitchStateMachine(benchmark::State &state) {
+    SwitchMachine machine;
+    for (auto _ : state) {
+      machine.step();
+      benchmark::DoNotOptimize(machine.state);
+    }
+    state.SetItemsProcessed(state.iterations());
+  }
+}
+
+BENCHMARK(BM_RecursiveMemCallback);
+BENCHMARK(BM_SwitchStateMachine);
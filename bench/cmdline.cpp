@@ -0,0 +1,76 @@
+#include "wsudo/cmdline.h"
+
+#include <benchmark/benchmark.h>
+#include <string>
+#include <vector>
+
+using namespace wsudo;
+
+namespace {
+  // `count` arguments; every fourth needs quotes and every eighth has
+  // backslashes before a quote.
+  std::vector<std::wstring> sampleArguments(size_t count) {
+    std::vector<std::wstring> arguments;
+    for (size_t i = 0; i < count; ++i) {
+      if (i % 8 == 7) {
+        arguments.emplace_back(L"C:\\Path With\\Spaces\\\"quoted\"\\");
+      } else if (i % 4 == 3) {
+        arguments.emplace_back(L"C:\\Program Files\\Tool\\tool.exe");
+      } else {
+        arguments.emplace_back(L"--option=value" + std::to_wstring(i));
+      }
+    }
+    return arguments;
+  }
+
+  std::vector<const wchar_t *> pointers(const std::vector<std::wstring> &v) {
+    std::vector<const wchar_t *> argv;
+    for (auto &argument : v) {
+      argv.push_back(argument.c_str());
+    }
+    return argv;
+  }
+
+  void BM_JoinCommandLine(benchmark::State &state) {
+    auto arguments = sampleArguments(state.range(0));
+    auto argv = pointers(arguments);
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(joinCommandLine(argv.data(), argv.size()));
+    }
+    state.SetItemsProcessed(state.iterations() * argv.size());
+  }
+
+  void BM_SplitCommandLine(benchmark::State &state) {
+    auto arguments = sampleArguments(state.range(0));
+    auto argv = pointers(arguments);
+    auto line = joinCommandLine(argv.data(), argv.size());
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(splitCommandLine(line));
+    }
+    state.SetBytesProcessed(state.iterations() * line.size() *
+                            sizeof(wchar_t));
+  }
+
+  void BM_ScanArgument(benchmark::State &state) {
+    std::wstring argument(state.range(0), L'a');
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(detail::scanArgument(argument));
+    }
+    state.SetBytesProcessed(state.iterations() * argument.size() *
+                            sizeof(wchar_t));
+  }
+
+  void BM_ScanArgumentScalar(benchmark::State &state) {
+    std::wstring argument(state.range(0), L'a');
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(detail::scanArgumentScalar(argument));
+    }
+    state.SetBytesProcessed(state.iterations() * argument.size() *
+                            sizeof(wchar_t));
+  }
+}
+
+BENCHMARK(BM_JoinCommandLine)->Arg(4)->Arg(64);
+BENCHMARK(BM_SplitCommandLine)->Arg(4)->Arg(64);
+BENCHMARK(BM_ScanArgument)->Arg(16)->Arg(256);
+BENCHMARK(BM_ScanArgumentScalar)->Arg(16)->Arg(256);
@@ -0,0 +1,55 @@
+#include "wsudo/decisioncache.h"
+
+#include <benchmark/benchmark.h>
+#include <sodium.h>
+
+using namespace wsudo::server;
+using wsudo::policy::Decision;
+
+namespace {
+  const std::vector<std::string> Groups{"users", "administrators"};
+
+  void BM_DecisionCacheHash(benchmark::State &state) {
+    if (sodium_init() < 0) {
+      state.SkipWithError("Couldn't initialize libsodium.");
+      return;
+    }
+    DecisionCache cache;
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(
+        cache.hash("alice", Groups, "c:\\windows\\system32\\cmd.exe",
+                   "/c dir /s")
+      );
+    }
+  }
+
+  void BM_DecisionCacheFind(benchmark::State &state) {
+    if (sodium_init() < 0) {
+      state.SkipWithError("Couldn't initialize libsodium.");
+      return;
+    }
+    // Keys spread over the whole table, with a hit rate set by the second
+    // argument in percent.
+    DecisionCache cache;
+    std::vector<uint64_t> keys;
+    auto count = static_cast<size_t>(state.range(0));
+    for (size_t i = 0; i < count; ++i) {
+      auto key = cache.hash("user" + std::to_string(i), Groups,
+                            "c:\\tools\\tool.exe", "");
+      if (i * 100 < count * state.range(1)) {
+        cache.insert(1, key, Decision{true, 1});
+      }
+      keys.push_back(key);
+    }
+    size_t next = 0;
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(cache.find(1, keys[next]));
+      next = next + 1 == keys.size() ? 0 : next + 1;
+    }
+    state.counters["hitRate"] = cache.stats().hitRate();
+  }
+}
+
+BENCHMARK(BM_DecisionCacheHash);
+BENCHMARK(BM_DecisionCacheFind)
+  ->Args({256, 100})->Args({256, 50})->ArgNames({"keys", "cached%"});
@@ -0,0 +1,83 @@
+#include "wsudo/digestcache.h"
+
+#include <benchmark/benchmark.h>
+#include <algorithm>
+
+using namespace wsudo;
+using namespace wsudo::server;
+
+namespace {
+  // A temporary file of `size` bytes, deleted when the benchmark ends. The
+  // path is empty if it couldn't be created.
+  class TempFile {
+  public:
+    explicit TempFile(size_t size) {
+      wchar_t directory[MAX_PATH];
+      wchar_t path[MAX_PATH];
+      GetTempPathW(MAX_PATH, directory);
+      GetTempFileNameW(directory, L"wsb", 0, path);
+      HANDLE rawFile = CreateFileW(path, GENERIC_WRITE, 0, nullptr,
+                                   CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL,
+                                   nullptr);
+      if (rawFile == INVALID_HANDLE_VALUE) {
+        return;
+      }
+      _path = path;
+      HObject file{rawFile};
+      std::vector<char> block(64 * 1024, 'x');
+      DWORD written;
+      for (size_t left = size; left; left -= written) {
+        auto chunk = static_cast<DWORD>(std::min(left, block.size()));
+        if (!WriteFile(file, block.data(), chunk, &written, nullptr)) {
+          break;
+        }
+      }
+    }
+
+    ~TempFile() {
+      if (!_path.empty()) {
+        DeleteFileW(_path.c_str());
+      }
+    }
+
+    const std::wstring &path() const { return _path; }
+
+  private:
+    std::wstring _path;
+  };
+
+  // Hashing the whole file, as on the first elevation of a program.
+  void BM_DigestCold(benchmark::State &state) {
+    TempFile file{static_cast<size_t>(state.range(0))};
+    if (file.path().empty()) {
+      state.SkipWithError("Couldn't create a temporary file.");
+      return;
+    }
+    auto program = openProgramFile(file.path());
+    std::vector<HANDLE> files{program};
+    for (auto _ : state) {
+      DigestCache cache;
+      benchmark::DoNotOptimize(cache.digests(files));
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+  }
+
+  // Only the file's identity is read.
+  void BM_DigestWarm(benchmark::State &state) {
+    TempFile file{static_cast<size_t>(state.range(0))};
+    if (file.path().empty()) {
+      state.SkipWithError("Couldn't create a temporary file.");
+      return;
+    }
+    auto program = openProgramFile(file.path());
+    std::vector<HANDLE> files{program};
+    DigestCache cache;
+    cache.digests(files);
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(cache.digests(files));
+    }
+  }
+}
+
+BENCHMARK(BM_DigestCold)->Arg(64 * 1024)->Arg(16 * 1024 * 1024);
+BENCHMARK(BM_DigestWarm)->Arg(16 * 1024 * 1024);
@@ -0,0 +1,51 @@
+#include "wsudo/events.h"
+
+#include <benchmark/benchmark.h>
+
+using namespace wsudo;
+using namespace wsudo::events;
+
+namespace {
+  // Register `state.range(0)` handlers and time dispatching the last one,
+  // so WaitForMultipleObjects scans all of them.
+  void dispatch(benchmark::State &state, EventListener &listener) {
+    HANDLE last = nullptr;
+    for (int i = 0; i < state.range(0); ++i) {
+      last = CreateEventW(nullptr, true, false, nullptr);
+      listener.emplace(last, [last](EventListener &) {
+        ResetEvent(last);
+        return EventStatus::Ok;
+      });
+    }
+    for (auto _ : state) {
+      SetEvent(last);
+      if (listener.next(0) != EventStatus::Ok) {
+        state.SkipWithError("Dispatch failed.");
+        break;
+      }
+    }
+    state.SetItemsProcessed(state.iterations());
+  }
+
+  // Dispatch cost against the number of handlers.
+  void BM_EventListenerDispatch(benchmark::State &state) {
+    EventListener listener;
+    dispatch(state, listener);
+  }
+
+  // The same with a watchdog heartbeat and metrics, as the server runs.
+  void BM_EventListenerDispatchInstrumented(benchmark::State &state) {
+    metrics::Counter iterations;
+    metrics::Histogram queueDelay;
+    metrics::Gauge backlog;
+    metrics::Gauge handlers;
+    watchdog::Heartbeat heartbeat;
+    EventListener listener;
+    listener.setMetrics({&iterations, &queueDelay, &backlog, &handlers});
+    listener.setHeartbeat(&heartbeat);
+    dispatch(state, listener);
+  }
+}
+
+BENCHMARK(BM_EventListenerDispatch)->RangeMultiplier(4)->Range(1, 64);
+BENCHMARK(BM_EventListenerDispatchInstrumented)->Arg(1)->Arg(64);
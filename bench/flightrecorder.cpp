@@ -0,0 +1,29 @@
+#include "wsudo/flightrecorder.h"
+
+#include <benchmark/benchmark.h>
+
+using namespace wsudo;
+
+namespace {
+  // The cost each instrumented call site pays.
+  void BM_FlightRecorderRecord(benchmark::State &state) {
+    uint32_t value = 0;
+    for (auto _ : state) {
+      recorder::record(recorder::Kind::IO, 1, "read", 0, ++value);
+    }
+    state.SetItemsProcessed(state.iterations());
+  }
+
+  void BM_FlightRecorderDump(benchmark::State &state) {
+    for (uint32_t i = 0; i < recorder::RingCapacity; ++i) {
+      recorder::record(recorder::Kind::IO, 1, "read", 0, i);
+    }
+    auto discard = [](void *, const void *, size_t) { return true; };
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(recorder::dump(discard, nullptr, 1, 0));
+    }
+  }
+}
+
+BENCHMARK(BM_FlightRecorderRecord)->Threads(1)->Threads(8);
+BENCHMARK(BM_FlightRecorderDump);
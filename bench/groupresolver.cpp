@@ -0,0 +1,36 @@
+#include "wsudo/groupresolver.h"
+
+#include <benchmark/benchmark.h>
+
+using namespace wsudo::session;
+
+namespace {
+  // The cached path SessionManager::groups takes for each policy check.
+  void BM_GroupResolverHit(benchmark::State &state) {
+    GroupResolver resolver{
+      [](const std::string &) -> std::optional<std::vector<std::string>> {
+        return std::vector<std::string>{"users", "administrators"};
+      }
+    };
+    for (int i = 0; i < 100; ++i) {
+      resolver.resolve("user" + std::to_string(i));
+    }
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(resolver.resolve("User42"));
+    }
+  }
+
+  void BM_GroupSetContains(benchmark::State &state) {
+    std::vector<std::string> names;
+    for (int i = 0; i < state.range(0); ++i) {
+      names.push_back("group" + std::to_string(i));
+    }
+    GroupSet groups{std::move(names)};
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(groups.contains("Group7"));
+    }
+  }
+}
+
+BENCHMARK(BM_GroupResolverHit)->Threads(1)->Threads(4);
+BENCHMARK(BM_GroupSetContains)->Arg(8)->Arg(64);
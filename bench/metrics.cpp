@@ -0,0 +1,44 @@
+#include "wsudo/metrics.h"
+
+#include <benchmark/benchmark.h>
+
+using namespace wsudo;
+
+namespace {
+  metrics::Counter g_counter;
+  metrics::Histogram g_histogram;
+
+  void BM_CounterAdd(benchmark::State &state) {
+    for (auto _ : state) {
+      g_counter.add();
+    }
+    state.SetItemsProcessed(state.iterations());
+  }
+
+  void BM_HistogramRecord(benchmark::State &state) {
+    uint64_t value = 1000;
+    for (auto _ : state) {
+      g_histogram.record(value);
+      value = value * 7 % 1000003;
+    }
+    state.SetItemsProcessed(state.iterations());
+  }
+
+  void BM_RegistrySnapshot(benchmark::State &state) {
+    metrics::Registry registry;
+    for (int i = 0; i < 20; ++i) {
+      registry.counter("counter_" + std::to_string(i), "A counter.").add(i);
+    }
+    for (int i = 0; i < 5; ++i) {
+      registry.histogram("latency_" + std::to_string(i), "A latency.")
+        .record(1000000);
+    }
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(registry.snapshot());
+    }
+  }
+}
+
+BENCHMARK(BM_CounterAdd)->Threads(1)->Threads(8);
+BENCHMARK(BM_HistogramRecord)->Threads(1)->Threads(8);
+BENCHMARK(BM_RegistrySnapshot);
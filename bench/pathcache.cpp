@@ -0,0 +1,86 @@
+#include "wsudo/pathcache.h"
+
+#include <benchmark/benchmark.h>
+#include <map>
+
+using namespace wsudo;
+
+namespace {
+  // In-memory directories that never change.
+  class FakeFileSystem : public PathCache::FileSystem {
+  public:
+    std::map<std::wstring, std::vector<std::wstring>> directories;
+
+    std::optional<uint64_t>
+    directoryTime(const std::wstring &directory) override {
+      if (directories.find(directory) == directories.end()) {
+        return std::nullopt;
+      }
+      return 1;
+    }
+
+    std::optional<std::vector<std::wstring>>
+    list(const std::wstring &directory) override {
+      auto it = directories.find(directory);
+      if (it == directories.end()) {
+        return std::nullopt;
+      }
+      return it->second;
+    }
+  };
+
+  // A PATH of `count` directories with 200 files each. The program is only
+  // in the last one, so every directory is searched.
+  std::vector<std::wstring> samplePath(FakeFileSystem &fs, size_t count) {
+    std::vector<std::wstring> path;
+    for (size_t i = 0; i < count; ++i) {
+      auto directory = L"C:\\Program Files\\Tool" + std::to_wstring(i);
+      auto &names = fs.directories[directory];
+      for (int n = 0; n < 200; ++n) {
+        names.push_back(L"file" + std::to_wstring(n) + L".dll");
+      }
+      path.push_back(std::move(directory));
+    }
+    fs.directories[path.back()].push_back(L"target.exe");
+    return path;
+  }
+
+  const std::wstring_view PathExt = L".COM;.EXE;.BAT;.CMD;.VBS;.JS;.MSC";
+
+  void BM_PathCacheResolveWarm(benchmark::State &state) {
+    FakeFileSystem fs;
+    auto path = samplePath(fs, state.range(0));
+    PathCache cache{fs, PathExt};
+    cache.resolve(L"target", path);
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(cache.resolve(L"target", path));
+    }
+  }
+
+  // A new cache each time: every directory is listed.
+  void BM_PathCacheResolveCold(benchmark::State &state) {
+    FakeFileSystem fs;
+    auto path = samplePath(fs, state.range(0));
+    for (auto _ : state) {
+      PathCache cache{fs, PathExt};
+      benchmark::DoNotOptimize(cache.resolve(L"target", path));
+    }
+  }
+
+  void BM_PathCacheLoad(benchmark::State &state) {
+    FakeFileSystem fs;
+    auto path = samplePath(fs, state.range(0));
+    PathCache cache{fs, PathExt};
+    cache.resolve(L"target", path);
+    auto saved = cache.save();
+    for (auto _ : state) {
+      PathCache loaded{fs, PathExt};
+      benchmark::DoNotOptimize(loaded.load(saved.data(), saved.size()));
+    }
+    state.SetBytesProcessed(state.iterations() * saved.size());
+  }
+}
+
+BENCHMARK(BM_PathCacheResolveWarm)->Arg(8)->Arg(64);
+BENCHMARK(BM_PathCacheResolveCold)->Arg(8)->Arg(64);
+BENCHMARK(BM_PathCacheLoad)->Arg(64);
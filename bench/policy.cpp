@@ -0,0 +1,62 @@
+#include "wsudo/policy.h"
+
+#include <benchmark/benchmark.h>
+#include <string>
+
+using namespace wsudo;
+using namespace wsudo::policy;
+
+namespace {
+  // `rules` rules for as many users, each allowed one program, plus a group
+  // rule and a deny for everyone.
+  std::string sampleText(size_t rules) {
+    std::string text{"%administrators = C:\\Tools\\**\n"
+                     "ALL = !C:\\Windows\\System32\\format.com\n"};
+    for (size_t i = 0; i < rules; ++i) {
+      auto n = std::to_string(i);
+      text += "user" + n + " = C:\\Apps\\" + n + "\\app.exe *\n";
+    }
+    return text;
+  }
+
+  const std::vector<std::string> Groups{"users"};
+
+  void BM_PolicyCompile(benchmark::State &state) {
+    auto text = sampleText(state.range(0));
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(Policy::compile(text));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+  }
+
+  void BM_PolicyEvaluateAllowed(benchmark::State &state) {
+    auto policy = *Policy::compile(sampleText(state.range(0)));
+    auto n = std::to_string(state.range(0) / 2);
+    auto user = "user" + n;
+    auto command = normalizePath("C:\\Apps\\" + n + "\\app.exe");
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(policy.evaluate(user, Groups, command, "-v"));
+    }
+  }
+
+  void BM_PolicyEvaluateDenied(benchmark::State &state) {
+    auto policy = *Policy::compile(sampleText(state.range(0)));
+    auto command = normalizePath("C:\\Windows\\System32\\cmd.exe");
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(policy.evaluate("mallory", Groups, command,
+                                               "/c dir"));
+    }
+  }
+
+  void BM_NormalizePath(benchmark::State &state) {
+    std::string path{"c:/Program Files/Git/bin/../cmd/GIT.EXE"};
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(normalizePath(path));
+    }
+  }
+}
+
+BENCHMARK(BM_PolicyCompile)->Arg(100)->Arg(10000);
+BENCHMARK(BM_PolicyEvaluateAllowed)->Arg(10)->Arg(1000)->Arg(10000);
+BENCHMARK(BM_PolicyEvaluateDenied)->Arg(10)->Arg(1000)->Arg(10000);
+BENCHMARK(BM_NormalizePath);
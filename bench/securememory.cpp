@@ -0,0 +1,55 @@
+#include "wsudo/securememory.h"
+
+#include <benchmark/benchmark.h>
+#include <string>
+
+using namespace wsudo;
+
+namespace {
+  // A password-sized buffer from the arena, filled and wiped.
+  void BM_SecureBufferPassword(benchmark::State &state) {
+    SecureArena arena;
+    std::wstring password(state.range(0), L'p');
+    for (auto _ : state) {
+      SecureBuffer<wchar_t> buffer{password.size() + 1, arena};
+      buffer.append(password.data(), password.size());
+      buffer.push_back(L'\0');
+      benchmark::DoNotOptimize(buffer.data());
+    }
+  }
+
+  void BM_SecureArenaAllocate(benchmark::State &state) {
+    SecureArena arena;
+    auto bytes = static_cast<size_t>(state.range(0));
+    for (auto _ : state) {
+      auto block = arena.allocate(bytes);
+      benchmark::DoNotOptimize(block);
+      arena.deallocate(block, bytes);
+    }
+  }
+
+  // Too large for the arena's blocks, so each one is a guarded allocation.
+  void BM_SecureArenaFallback(benchmark::State &state) {
+    SecureArena arena;
+    auto bytes = SecureArena::MaxBlockSize * 2;
+    for (auto _ : state) {
+      auto block = arena.allocate(bytes);
+      benchmark::DoNotOptimize(block);
+      arena.deallocate(block, bytes);
+    }
+  }
+
+  void BM_SecureWipe(benchmark::State &state) {
+    std::string data(state.range(0), 'x');
+    for (auto _ : state) {
+      secureWipe(data.data(), data.size());
+      benchmark::ClobberMemory();
+    }
+    state.SetBytesProcessed(state.iterations() * data.size());
+  }
+}
+
+BENCHMARK(BM_SecureBufferPassword)->Arg(16)->Arg(256);
+BENCHMARK(BM_SecureArenaAllocate)->Arg(64)->Arg(4096);
+BENCHMARK(BM_SecureArenaFallback);
+BENCHMARK(BM_SecureWipe)->Arg(64)->Arg(4096);
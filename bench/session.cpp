@@ -0,0 +1,42 @@
+#include "wsudo/session.h"
+
+#include <benchmark/benchmark.h>
+
+using namespace wsudo;
+using namespace wsudo::session;
+
+namespace {
+  // A miss is what every first CRED pays before LogonUser.
+  void BM_SessionManagerFindMiss(benchmark::State &state) {
+    SessionManager manager{60};
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(manager.find(L"nobody"));
+    }
+  }
+
+  // Needs a real account in WSUSER and WSPASSWORD, like the logon test.
+  void BM_SessionManagerFindHit(benchmark::State &state) {
+    wchar_t username[256];
+    wchar_t password[256];
+    auto userLength = GetEnvironmentVariableW(L"WSUSER", username, 256);
+    auto passwordLength = GetEnvironmentVariableW(L"WSPASSWORD", password,
+                                                  256);
+    if (!userLength || userLength >= 256 || !passwordLength ||
+        passwordLength >= 256)
+    {
+      state.SkipWithError("Set WSUSER and WSPASSWORD to a local account.");
+      return;
+    }
+    SessionManager manager{60};
+    if (!manager.create(username, L"", password)) {
+      state.SkipWithError("Couldn't log on.");
+      return;
+    }
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(manager.find(username));
+    }
+  }
+}
+
+BENCHMARK(BM_SessionManagerFindMiss);
+BENCHMARK(BM_SessionManagerFindHit);
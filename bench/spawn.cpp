@@ -0,0 +1,44 @@
+#include "wsudo/spawn.h"
+
+#include <benchmark/benchmark.h>
+
+using namespace wsudo;
+
+namespace {
+  // A request with a `length` character command line and a typical
+  // environment block.
+  SpawnRequest sampleRequest(size_t length) {
+    SpawnRequest request;
+    request.input = 0x10;
+    request.output = 0x14;
+    request.error = 0x18;
+    request.commandLine.assign(length, L'x');
+    request.currentDirectory = L"C:\\Users\\user\\source\\repos\\wsudo";
+    for (int i = 0; i < 40; ++i) {
+      request.environment += L"VARIABLE_" + std::to_wstring(i) +
+                             L"=C:\\Some\\Fairly\\Long\\Value";
+      request.environment += L'\0';
+    }
+    request.environment += L'\0';
+    return request;
+  }
+
+  void BM_EncodeSpawnRequest(benchmark::State &state) {
+    auto request = sampleRequest(state.range(0));
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(encodeSpawnRequest(request));
+    }
+  }
+
+  void BM_DecodeSpawnRequest(benchmark::State &state) {
+    auto body = encodeSpawnRequest(sampleRequest(state.range(0)));
+    std::string_view view{body.data(), body.size()};
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(decodeSpawnRequest(view));
+    }
+    state.SetBytesProcessed(state.iterations() * body.size());
+  }
+}
+
+BENCHMARK(BM_EncodeSpawnRequest)->Arg(64)->Arg(4096);
+BENCHMARK(BM_DecodeSpawnRequest)->Arg(64)->Arg(4096);
@@ -0,0 +1,59 @@
+#include "wsudo/utf.h"
+
+#include <benchmark/benchmark.h>
+#include <string>
+
+using namespace wsudo;
+
+namespace {
+  // At least `length` bytes of command line-like text, either all ASCII or
+  // with two, three and four byte sequences mixed in.
+  std::string sampleText(size_t length, bool ascii) {
+    const char *piece = ascii ? "C:\\Tools\\wsudo.exe /s " : "Zürich €5 𝄞 ";
+    std::string text;
+    while (text.size() < length) {
+      text += piece;
+    }
+    return text;
+  }
+
+  void BM_Utf8ToUtf16(benchmark::State &state) {
+    auto text = sampleText(state.range(0), state.range(1));
+    std::u16string out(text.size(), u'\0');
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(
+        utf::utf8ToUtf16(text, out.data(), out.size())
+      );
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+  }
+
+  void BM_Utf16ToUtf8(benchmark::State &state) {
+    auto text = sampleText(state.range(0), state.range(1));
+    std::u16string wide(text.size(), u'\0');
+    wide.resize(*utf::utf8ToUtf16(text, wide.data(), wide.size()));
+    std::string out(wide.size() * 3, '\0');
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(
+        utf::utf16ToUtf8(wide, out.data(), out.size())
+      );
+    }
+    state.SetBytesProcessed(state.iterations() * wide.size() * 2);
+  }
+
+  // The sizing pass callers make before allocating.
+  void BM_Utf8ToUtf16Length(benchmark::State &state) {
+    auto text = sampleText(state.range(0), state.range(1));
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(utf::utf8ToUtf16(text, nullptr, 0));
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+  }
+}
+
+BENCHMARK(BM_Utf8ToUtf16)
+  ->ArgsProduct({{16, 256, 4096}, {1, 0}})->ArgNames({"bytes", "ascii"});
+BENCHMARK(BM_Utf16ToUtf8)
+  ->ArgsProduct({{16, 256, 4096}, {1, 0}})->ArgNames({"bytes", "ascii"});
+BENCHMARK(BM_Utf8ToUtf16Length)
+  ->ArgsProduct({{256, 4096}, {1, 0}})->ArgNames({"bytes", "ascii"});
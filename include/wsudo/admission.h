@@ -0,0 +1,75 @@
+#ifndef WSUDO_ADMISSION_H
+#define WSUDO_ADMISSION_H
+
+#include "wsudo.h"
+
+#include <chrono>
+
+namespace wsudo::server {
+
+using AdmissionClock = std::chrono::steady_clock;
+
+// Decides whether a new client is served or told to come back later.
+//
+// This follows CoDel: each new client reports how long its request waited
+// for the event loop (see EventListener::queueDelay). A short wait is
+// normal, but if waits stay above `target` for a whole `interval`, the
+// server is overloaded and new clients are shed until they drop again.
+// Clients already admitted are always served to completion, so latency for
+// them stays bounded.
+//
+// There's no cap on requests in flight. Requests are handled one at a time
+// on the event loop, so only replies still being written overlap, and the
+// number of pipe instances already limits those.
+class AdmissionController {
+public:
+  using duration = std::chrono::milliseconds;
+
+  struct Decision {
+    bool admitted;
+    // When not admitted, a hint for how long the client should wait.
+    duration retryAfter;
+
+    explicit operator bool() const { return admitted; }
+  };
+
+  explicit AdmissionController(duration target = duration{50},
+                               duration interval = duration{500}) noexcept;
+
+  // Decide whether to admit a new client's first request. If admitted,
+  // release() must be called when its reply is sent.
+  Decision admit(AdmissionClock::duration queueDelay,
+                 AdmissionClock::time_point now = AdmissionClock::now());
+
+  // Count another request from a client that was already admitted.
+  // release() must be called when its reply is sent.
+  void acquire();
+
+  // An admitted request's reply was sent.
+  void release();
+
+  // Record how long a request took to process. Used to estimate how long it
+  // will take the current clients to drain.
+  void recordService(AdmissionClock::duration serviceTime);
+
+  unsigned inFlight() const { return _inFlight; }
+  bool overloaded() const { return _overloaded; }
+
+private:
+  duration retryAfter(AdmissionClock::duration queueDelay) const;
+
+  duration _target;
+  duration _interval;
+  unsigned _inFlight = 0;
+  // Exponentially weighted moving average of request service time, in
+  // microseconds.
+  double _serviceUs = 0;
+  // If set, the time at which the backlog will have been above target for a
+  // whole interval.
+  AdmissionClock::time_point _firstAboveTime{};
+  bool _overloaded = false;
+};
+
+} // namespace wsudo::server
+
+#endif // WSUDO_ADMISSION_H
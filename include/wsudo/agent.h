@@ -0,0 +1,97 @@
+#ifndef WSUDO_AGENT_H
+#define WSUDO_AGENT_H
+
+#include "wsudo.h"
+#include "events.h"
+#include "client.h"
+
+#include <chrono>
+#include <memory>
+#include <string_view>
+
+/**
+ * The agent keeps an authenticated connection to the token server open for
+ * one logon session, much like ssh-agent. wsudo front-ends in the same session
+ * send their bless requests to the agent, which forwards them over its
+ * connection, so each elevation costs one local round trip instead of a
+ * connect and authentication.
+ */
+
+namespace wsudo::agent {
+
+// Maximum concurrent front-end connections.
+constexpr int MaxAgentConnections = 4;
+
+// The agent exits after this long without a request.
+constexpr std::chrono::minutes AgentIdleTimeout{30};
+
+// State shared by all front-end connections.
+struct AgentContext {
+  // This agent's logon session. Only front-ends from it are served.
+  uint64_t logonId;
+  // Authorized connection to the token server.
+  std::unique_ptr<ClientConnection> server;
+  // Waitable timer that stops the agent when it fires.
+  HANDLE idleTimer;
+
+  AgentContext(uint64_t logonId, std::unique_ptr<ClientConnection> server,
+               HANDLE idleTimer)
+    : logonId{logonId}, server{std::move(server)}, idleTimer{idleTimer}
+  {}
+
+  // Connect to the server again and resume with the stored ticket. If the
+  // server doesn't accept the ticket anymore, returns false and clears
+  // `server`.
+  bool reconnect();
+
+  // Push the idle timeout back.
+  void resetIdleTimer();
+};
+
+// Create the agent's pipe, accessible only to the current user. Returns null
+// if another agent is already listening.
+HObject createAgentPipe(const std::wstring &pipeName, bool firstInstance);
+
+class AgentConnectionHandler : public events::EventOverlappedIO {
+public:
+  using Self = AgentConnectionHandler;
+  using Callback = recursive_mem_callback<Self>;
+
+  explicit AgentConnectionHandler(HObject pipe, int clientId,
+                                  AgentContext &context) noexcept;
+
+  bool reset() override;
+
+  events::EventStatus operator()(events::EventListener &) override;
+
+protected:
+  HANDLE fileHandle() const override {
+    return _pipe;
+  }
+
+private:
+  HObject _pipe;
+  int _clientId;
+  AgentContext &_context;
+  Callback _callback;
+
+  void createResponse(const char *header,
+                      std::string_view message = std::string_view{});
+
+  Callback beginConnect();
+  Callback endConnect();
+  Callback read();
+  Callback respond();
+  Callback resetConnection();
+
+  // Returns true to read another message, false to reset the connection.
+  bool dispatchMessage();
+  // True if the front-end is in the agent's logon session.
+  bool isSameLogonSession();
+  // Forward process handles from the front-end to the server.
+  bool bless(const HANDLE *remoteHandles, size_t count);
+};
+
+} // namespace wsudo::agent
+
+#endif // WSUDO_AGENT_H
@@ -0,0 +1,169 @@
+#ifndef WSUDO_ASYNCLOG_H
+#define WSUDO_ASYNCLOG_H
+
+#include <spdlog/sinks/sink.h>
+#include <spdlog/formatter.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace wsudo::log {
+
+// Single producer, single consumer ring of log records. Each thread that
+// logs gets its own, so pushing a record is a couple of copies and atomic
+// stores - no lock and no system call.
+class LogRing {
+public:
+  // Capacity must be a power of two.
+  explicit LogRing(size_t capacity);
+
+  // Producer side. Returns false, writing nothing, if the record doesn't
+  // fit.
+  bool push(unsigned stream, std::string_view text);
+
+  // Consumer side. Calls `sink(stream, text)` for each record, oldest
+  // first. Records that wrap around the end are reassembled in `scratch`.
+  // Returns the number of records.
+  size_t drain(const std::function<void(unsigned, std::string_view)> &sink,
+               std::string &scratch);
+
+  // Set when the producing thread exits; the writer forgets the ring once
+  // it is empty.
+  std::atomic<bool> retired{false};
+
+private:
+  constexpr static size_t HeaderSize = sizeof(uint32_t);
+
+  void copyIn(size_t position, const void *data, size_t size);
+  void copyOut(size_t position, void *data, size_t size) const;
+
+  std::unique_ptr<char[]> _data;
+  size_t _mask;
+  // Each index is only written by one side; keep them on separate lines.
+  alignas(64) std::atomic<size_t> _head{0};
+  alignas(64) std::atomic<size_t> _tail{0};
+};
+
+// Moves log output off the threads that produce it. Records go into the
+// calling thread's LogRing, and a background thread collects them and
+// writes each stream with one call per batch. If a ring is full the record
+// is dropped and counted, so a slow console never blocks the event loop;
+// the writer reports how many were lost.
+//
+// Records from one thread stay in order. Records from different threads are
+// interleaved in batches, not by time.
+class AsyncLogWriter {
+public:
+  enum Stream : unsigned { Out, Err };
+
+  using Output = std::function<void(std::string_view)>;
+
+  struct Stats {
+    uint64_t records = 0;
+    uint64_t dropped = 0;
+    // Calls to an Output.
+    uint64_t writes = 0;
+  };
+
+  constexpr static size_t DefaultRingSize = 64 * 1024;
+  constexpr static std::chrono::milliseconds DefaultInterval{10};
+
+  AsyncLogWriter(Output out, Output err, size_t ringSize = DefaultRingSize,
+                 std::chrono::milliseconds interval = DefaultInterval);
+  // Calls stop().
+  ~AsyncLogWriter();
+
+  AsyncLogWriter(const AsyncLogWriter &) = delete;
+  AsyncLogWriter &operator=(const AsyncLogWriter &) = delete;
+
+  // Queue a record. Returns false if it was dropped. After stop(), records
+  // are written synchronously.
+  bool write(Stream stream, std::string_view text);
+
+  // Wait until everything queued before the call has been written.
+  void flush();
+
+  // Write what is queued and stop the background thread.
+  void stop();
+
+  Stats stats() const;
+
+private:
+  struct ThreadRings;
+
+  LogRing &threadRing();
+  void run();
+  // Drain every ring into the batches and write them. Only called by the
+  // writer thread, or after it has stopped with _syncMutex held.
+  void writeBatches();
+
+  std::array<Output, 2> _outputs;
+  size_t _ringSize;
+  std::chrono::milliseconds _interval;
+  // Distinguishes writers in each thread's ring list.
+  uint64_t _id;
+
+  std::mutex _ringsMutex;
+  std::vector<std::shared_ptr<LogRing>> _rings;
+
+  std::mutex _mutex;
+  std::condition_variable _wake;
+  std::condition_variable _flushed;
+  uint64_t _flushRequested = 0;
+  uint64_t _flushCompleted = 0;
+  bool _stopping = false;
+  std::atomic<bool> _stopped{false};
+  // Serializes output after stop().
+  std::mutex _syncMutex;
+
+  std::array<std::string, 2> _batches;
+  std::string _scratch;
+  std::atomic<uint64_t> _records{0};
+  std::atomic<uint64_t> _dropped{0};
+  std::atomic<uint64_t> _writes{0};
+  uint64_t _droppedReported = 0;
+
+  // Started last, once everything it uses is initialized.
+  std::thread _thread;
+};
+
+// spdlog sink that formats on the calling thread and hands the line to an
+// AsyncLogWriter. Unlike spdlog's own sinks it takes no lock per message:
+// each thread formats with its own copy of the formatter. With `colors`,
+// the level range of the pattern (%^...%$) gets ANSI colors.
+class AsyncSink final : public spdlog::sinks::sink {
+public:
+  AsyncSink(std::shared_ptr<AsyncLogWriter> writer,
+            AsyncLogWriter::Stream stream, bool colors);
+
+  void log(const spdlog::details::log_msg &msg) override;
+  void flush() override;
+  void set_pattern(const std::string &pattern) override;
+  void set_formatter(std::unique_ptr<spdlog::formatter> formatter) override;
+
+private:
+  spdlog::formatter &threadFormatter();
+
+  std::shared_ptr<AsyncLogWriter> _writer;
+  AsyncLogWriter::Stream _stream;
+  bool _colors;
+
+  std::mutex _formatterMutex;
+  std::unique_ptr<spdlog::formatter> _formatter;
+  // Changes with every new formatter; threads compare it to their copy's.
+  std::atomic<uint64_t> _formatterVersion;
+};
+
+} // namespace wsudo::log
+
+#endif // WSUDO_ASYNCLOG_H
@@ -0,0 +1,242 @@
+#ifndef WSUDO_AUDIT_H
+#define WSUDO_AUDIT_H
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+/**
+ * Audit log of authentication and elevation requests.
+ *
+ * Records have a fixed binary layout and are appended to a series of
+ * segment files, each a header followed by a fixed number of record slots.
+ * The server maps the current segment into memory and copies records into
+ * it; a background thread commits them in groups, with one flush to disk
+ * per group, so the request path never waits on the disk. When a segment is
+ * full the log moves on to the next one and deletes the oldest beyond a
+ * limit.
+ *
+ * Within a segment, record times never decrease, and the header keeps the
+ * time of the first and last record. A reader can skip whole segments by
+ * their headers and binary search the rest, so a time range out of millions
+ * of records is found without reading them all.
+ */
+
+namespace wsudo::audit {
+
+enum class Event : uint8_t {
+  Logon = 1,
+  Resume,
+  Bless,
+  Spawn,
+};
+
+enum class Outcome : uint8_t {
+  Allowed = 1,
+  Denied,
+  // Rejected by the login throttle without checking anything.
+  Throttled,
+  // The request was allowed but couldn't be carried out.
+  Failed,
+};
+
+const char *eventToString(Event event);
+const char *outcomeToString(Outcome outcome);
+std::optional<Event> eventFromString(std::string_view name);
+std::optional<Outcome> outcomeFromString(std::string_view name);
+
+struct Record {
+  // Microseconds since the Unix epoch.
+  uint64_t time;
+  // The peer's logon session, or 0 if it couldn't be determined.
+  uint64_t logonId;
+  uint32_t processId;
+  // Microseconds from receiving the request to deciding it.
+  uint32_t latency;
+  Event event;
+  Outcome outcome;
+  uint16_t reserved;
+  uint32_t clientId;
+  // Null padded UTF-8; longer values are cut short.
+  char user[32];
+  // End of the program path, which is the part that identifies it.
+  char image[32];
+  // SHA-256 of the program, or zero if it wasn't needed.
+  std::array<unsigned char, 32> digest;
+
+  void setUser(std::string_view value);
+  void setImage(std::string_view value);
+  std::string_view userName() const;
+  std::string_view imageName() const;
+};
+static_assert(sizeof(Record) == 128);
+
+constexpr char SegmentMagic[4] = {'W', 'S', 'A', 'U'};
+constexpr uint32_t SegmentVersion = 1;
+
+struct SegmentHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t recordSize;
+  // Record slots that follow the header.
+  uint32_t capacity;
+  uint64_t sequence;
+  // Committed records. Slots after these are zero.
+  uint64_t count;
+  // Times of the first and last committed records.
+  uint64_t firstTime;
+  uint64_t lastTime;
+  unsigned char reserved[16];
+};
+static_assert(sizeof(SegmentHeader) == 64);
+
+inline size_t segmentSize(size_t capacity) {
+  return sizeof(SegmentHeader) + capacity * sizeof(Record);
+}
+
+// Where segments are kept.
+class Storage {
+public:
+  // A segment mapped into memory.
+  class Mapping {
+  public:
+    virtual ~Mapping() = default;
+    virtual char *data() = 0;
+    virtual size_t size() const = 0;
+    // Make a range durable.
+    virtual bool sync(size_t offset, size_t length) = 0;
+  };
+
+  virtual ~Storage() = default;
+  // Sequence numbers of the segments that exist, in any order.
+  virtual std::vector<uint64_t> list() = 0;
+  // Open segment `sequence` for writing, creating it zero filled with
+  // `size` bytes if it doesn't exist. Returns null on failure.
+  virtual std::unique_ptr<Mapping> open(uint64_t sequence, size_t size) = 0;
+  virtual void remove(uint64_t sequence) = 0;
+};
+
+// Appends records to segments in a Storage.
+class AuditLog {
+public:
+  struct Options {
+    // Records per segment; 64K records make an 8 MiB segment.
+    size_t segmentRecords = 64 * 1024;
+    // Older segments are deleted beyond this many.
+    size_t maxSegments = 64;
+    // Commit once this many records are waiting...
+    size_t batchRecords = 256;
+    // ...or once the oldest has waited this long.
+    std::chrono::milliseconds commitInterval{100};
+    // Records beyond this many waiting are dropped rather than queued.
+    size_t maxPending = 64 * 1024;
+  };
+
+  struct Stats {
+    uint64_t records = 0;
+    uint64_t commits = 0;
+    uint64_t dropped = 0;
+    uint64_t failures = 0;
+  };
+
+  // A null storage makes a log that drops everything.
+  explicit AuditLog(std::unique_ptr<Storage> storage);
+  AuditLog(std::unique_ptr<Storage> storage, Options options);
+  // Commits everything appended so far.
+  ~AuditLog();
+
+  AuditLog(const AuditLog &) = delete;
+  AuditLog &operator=(const AuditLog &) = delete;
+
+  // Queue a record. Its time is raised if needed so times never go
+  // backwards. Never waits for the disk.
+  void append(Record record);
+
+  // Wait until everything appended before the call is committed.
+  void flush();
+
+  Stats stats() const;
+
+  // Microseconds since the Unix epoch.
+  static uint64_t now();
+
+private:
+  void run();
+  // Write and sync a batch, returning how many records were written. Only
+  // called by the commit thread.
+  size_t commit(const std::vector<Record> &batch);
+  // Open the newest segment if it has room, or start the next one.
+  bool openSegment();
+  bool startSegment(uint64_t sequence);
+  void removeOldSegments();
+
+  std::unique_ptr<Storage> _storage;
+  Options _options;
+
+  // Only touched by the commit thread once it has started.
+  std::unique_ptr<Storage::Mapping> _segment;
+  SegmentHeader *_header = nullptr;
+  Record *_records = nullptr;
+  // Never reuses a sequence, even if a segment couldn't be opened.
+  uint64_t _nextSequence = 1;
+
+  mutable std::mutex _mutex;
+  std::condition_variable _wake;
+  std::condition_variable _committed;
+  std::vector<Record> _pending;
+  std::chrono::steady_clock::time_point _oldestPending;
+  uint64_t _lastTime = 0;
+  // Records appended and committed (or failed) so far, for flush().
+  uint64_t _appended = 0;
+  uint64_t _written = 0;
+  uint64_t _flushTarget = 0;
+  bool _stopping = false;
+  Stats _stats;
+
+  // Started last, once everything it uses is initialized.
+  std::thread _thread;
+};
+
+// Records of a segment that passed validation.
+struct SegmentView {
+  const SegmentHeader *header = nullptr;
+  const Record *records = nullptr;
+  size_t count = 0;
+};
+
+// Check a segment's header and find its committed records. Returns nothing
+// if it isn't a segment.
+std::optional<SegmentView> viewSegment(const char *data, size_t size);
+
+struct Filter {
+  uint64_t since = 0;
+  uint64_t until = std::numeric_limits<uint64_t>::max();
+  // Empty to match every user.
+  std::string user;
+  std::optional<Event> event;
+  std::optional<Outcome> outcome;
+
+  // Whether a segment could have records in the time range.
+  bool overlaps(const SegmentHeader &header) const;
+  bool matches(const Record &record) const;
+};
+
+// Call `visit` on each matching record, oldest first, until it returns
+// false. Returns the number of records visited. Only the records in the
+// time range are looked at.
+size_t scan(const SegmentView &segment, const Filter &filter,
+            const std::function<bool(const Record &)> &visit);
+
+} // namespace wsudo::audit
+
+#endif // WSUDO_AUDIT_H
@@ -0,0 +1,51 @@
+#ifndef WSUDO_AUDITSTORE_H
+#define WSUDO_AUDITSTORE_H
+
+#include "wsudo.h"
+#include "audit.h"
+
+#include <memory>
+#include <string>
+
+/**
+ * Audit segments as files in a directory, one file per segment, named by
+ * sequence number. The server maps the current segment for writing; the
+ * wsudo-audit reader maps segments read only, and can do so while the
+ * server is writing them.
+ */
+
+namespace wsudo::server {
+
+class AuditDirectory final : public audit::Storage {
+public:
+  // Nothing is created or changed until create(), so readers only see
+  // what's already there.
+  explicit AuditDirectory(std::wstring directory) noexcept;
+
+  // Create the directory and its parent, readable only by SYSTEM and
+  // Administrators, or take them over if they exist. The server calls this
+  // before writing. Returns false if they can't be created or secured.
+  bool create();
+
+  // True if the directory exists.
+  bool exists() const;
+
+  std::vector<uint64_t> list() override;
+  std::unique_ptr<Mapping> open(uint64_t sequence, size_t size) override;
+  void remove(uint64_t sequence) override;
+
+  // Map a segment for reading. Returns null if it can't be opened.
+  std::shared_ptr<const char> read(uint64_t sequence, size_t &size) const;
+
+  std::wstring segmentPath(uint64_t sequence) const;
+
+private:
+  std::wstring _directory;
+};
+
+// Default audit directory, under ProgramData.
+std::wstring defaultAuditDirectory();
+
+} // namespace wsudo::server
+
+#endif // WSUDO_AUDITSTORE_H
@@ -2,7 +2,14 @@
 #define WSUDO_CLIENT_H
 
 #include "wsudo.h"
+#include "securememory.h"
+#include "spawn.h"
 
+#include <chrono>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
 #include <vector>
 
 namespace wsudo {
@@ -41,29 +48,155 @@ static inline const char *clientExitToString(ClientExitCode code) {
 }
 
 class ClientConnection {
+  std::wstring _pipeName;
   HObject _pipe;
+  // Outgoing message; kept until the server accepts it in case it has to be
+  // resent after a busy response.
+  std::vector<char> _message;
+  // Server response.
   std::vector<char> _buffer;
+  std::minstd_rand _random;
+  // Resumption ticket from the last successful negotiate.
+  std::vector<char> _ticket;
 
-  constexpr static int MaxConnectAttempts = 3;
+  constexpr static int MaxConnectAttempts = 5;
+  constexpr static int MaxBusyRetries = 8;
+  // Backoff before the first retry; doubles with each attempt.
+  constexpr static std::chrono::milliseconds BackoffBase{50};
+  constexpr static std::chrono::milliseconds BackoffCap{5000};
 
-  void connect(
-    LPSECURITY_ATTRIBUTES secAttr,
-    const wchar_t *pipeName,
-    int attempts
-  );
+  bool connect(int attempts = MaxConnectAttempts);
+
+  // Sleep for about `delay`, randomized so that clients turned away at the
+  // same time don't all come back at the same time.
+  void backoff(std::chrono::milliseconds delay);
+
+  // Send a message and read the response into _buffer, retrying if the
+  // server is busy. Unless quiet, errors from the server are printed.
+  bool transact(const char *messageName, std::string_view message,
+                bool quiet);
+  bool transact(const char *messageName, bool quiet = false) {
+    return transact(messageName, {_message.data(), _message.size()}, quiet);
+  }
+
+  // Returns the server's retry hint if _buffer holds a busy response.
+  std::optional<std::chrono::milliseconds> busyRetryAfter() const;
 
 public:
-  explicit ClientConnection(const wchar_t *pipeName);
+  explicit ClientConnection(const wchar_t *pipeName,
+                            int connectAttempts = MaxConnectAttempts);
 
   bool good() const { return !!_pipe; }
   explicit operator bool() const { return good(); }
 
-  bool negotiate(const char *credentials, size_t length);
-  bool bless(HANDLE process);
+  // Log on with a password. The message is built and sent from secure
+  // memory, so the password is never copied into _message.
+  bool negotiate(std::wstring_view username, std::wstring_view password,
+                 bool quiet = false);
+  // Try to authorize with a ticket instead of credentials. On failure,
+  // negotiate can still be called.
+  bool resume(const std::vector<char> &ticket);
+  // Elevate one suspended process. Returns true only if it was elevated.
+  bool bless(HANDLE process, bool quiet = false);
+  // Elevate up to msg::MaxBlessTargets suspended processes in one request.
+  // Returns false if the request failed; otherwise, statuses holds the result
+  // for each process.
+  bool bless(const HANDLE *processes, size_t count,
+             std::vector<msg::BlessStatus> &statuses, bool quiet = false);
+
+  // Have the server create an elevated process. On success, process is a
+  // handle to it that can be waited on.
+  bool spawn(const SpawnRequest &request, HObject &process,
+             bool quiet = false);
+
+  bool readServerMessage(bool quiet = false);
+
+  // Describes the last response if it was an error.
+  std::string errorMessage() const;
+
+  const std::vector<char> &ticket() const { return _ticket; }
+
+  // The last response from the server, including the header. Empty if the
+  // connection failed.
+  const std::vector<char> &response() const { return _buffer; }
+
+  // Logon session of the process on the other end of the pipe. Returns
+  // nothing if it can't be opened, which is the case for other users'
+  // processes.
+  std::optional<uint64_t> serverLogonId() const;
+};
+
+// Longest password the prompt accepts, in UTF-16 code units.
+constexpr size_t MaxPasswordLength = 256;
 
-  bool readServerMessage();
+// Prompt for the password and send credentials to the server.
+ClientExitCode logon(ClientConnection &conn);
+
+// Authorize the connection with a stored ticket, or prompt for the password
+// if there is no valid ticket.
+ClientExitCode authenticate(ClientConnection &conn);
+
+// Name of the pipe the agent for a logon session listens on.
+std::wstring agentPipeName(uint64_t logonId);
+
+// One command of a command line, between separators.
+struct Command {
+  int argc;
+  wchar_t **argv;
+  // Connect this command's stdout to the next command's stdin.
+  bool pipeToNext;
 };
 
+// A suspended process created for a Command.
+struct Process {
+  HObject process;
+  HObject thread;
+};
+
+// Split a command line on "|" (pipe to the next command) and "&" (run the
+// next command alongside). Returns nothing if a command is empty.
+std::optional<std::vector<Command>> splitCommands(int argc, wchar_t *argv[]);
+
+// Full path of each program named on a command line. Bare names are looked up
+// in PATH using a cache of PATH directory listings kept under LocalAppData
+// (see PathCache). Names with a directory or drive, and names not found in
+// PATH, are returned as is; CreateProcess looks for those relative to the
+// current directory.
+std::vector<std::wstring>
+resolvePrograms(const std::vector<std::wstring_view> &names);
+
+// Create a suspended process for a command running `program` with the given
+// stdin and stdout.
+std::optional<Process> createProcess(const Command &command,
+                                     const std::wstring &program,
+                                     HANDLE input, HANDLE output);
+
+// Create every command suspended, connected by pipes where requested. If one
+// fails, the ones already created are terminated.
+std::optional<std::vector<Process>>
+createProcesses(const std::vector<Command> &commands);
+
+// Build a spawn request for a command line, using this process's standard
+// handles, directory and environment. The handles in `inherit` are the
+// inheritable copies named in the request; they must stay open until the
+// request completes.
+SpawnRequest makeSpawnRequest(int argc, wchar_t *argv[],
+                              std::vector<HObject> &inherit);
+
+// Run each line of a file ("-" for stdin) as an elevated command, with up to
+// `jobs` running at once. Exit codes are reported on stderr as commands
+// finish, or in file order if `ordered` is set. Returns 0 if every command
+// exited with 0, or else the first nonzero exit code in file order.
+int runBatch(ClientConnection &conn, const wchar_t *path, unsigned jobs,
+             bool ordered);
+
+// Resumption tickets are stored per logon session under LocalAppData. They
+// are encrypted by the server and only accepted from the session they were
+// issued to.
+std::vector<char> loadTicket();
+void saveTicket(const std::vector<char> &ticket);
+void deleteTicket();
+
 } // namespace wsudo
 
 #endif // WSUDO_CLIENT_H
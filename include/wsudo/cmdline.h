@@ -0,0 +1,53 @@
+#ifndef WSUDO_CMDLINE_H
+#define WSUDO_CMDLINE_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace wsudo {
+
+// Windows passes a process its command line as one string, and each program
+// splits it into arguments itself. These follow the rules of
+// CommandLineToArgvW, which the C runtime also uses:
+//
+// - The first argument is the program name. It ends at the next quote if it
+//   starts with one, or else at the first space or tab. Backslashes have no
+//   special meaning in it.
+// - Other arguments are separated by spaces and tabs, except inside quotes.
+// - 2n backslashes followed by a quote are n backslashes, and the quote
+//   starts or ends a quoted part. 2n+1 backslashes followed by a quote are n
+//   backslashes and a literal quote. Other backslashes are literal.
+// - In a run of quotes, every third quote is a literal quote.
+
+// Join arguments into a command line that splits back into the same
+// arguments. The first argument is the program name; file names can't
+// contain quotes, so any quotes in it are dropped. The result is sized
+// exactly before anything is written.
+std::wstring joinCommandLine(const wchar_t *const *argv, size_t argc);
+
+// Split a command line into arguments like CommandLineToArgvW. Unlike
+// CommandLineToArgvW, an empty command line has no arguments rather than the
+// current program's name.
+std::vector<std::wstring> splitCommandLine(std::wstring_view commandLine);
+
+namespace detail {
+  // What an argument contains, as found by scanArgument.
+  enum : unsigned {
+    // A space, tab, newline or vertical tab, so it has to be quoted.
+    ScanSpace = 1,
+    // A quote, which has to be escaped.
+    ScanQuote = 2,
+    // A backslash, which has to be escaped if it comes before a quote.
+    ScanBackslash = 4,
+  };
+
+  // Uses SSE2 when it's available.
+  unsigned scanArgument(std::wstring_view argument);
+  unsigned scanArgumentScalar(std::wstring_view argument);
+} // namespace detail
+
+} // namespace wsudo
+
+#endif // WSUDO_CMDLINE_H
@@ -0,0 +1,81 @@
+#ifndef WSUDO_DECISIONCACHE_H
+#define WSUDO_DECISIONCACHE_H
+
+#include "policy.h"
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace wsudo::server {
+
+// Fixed size cache of policy decisions, so that the same user running the
+// same command again skips policy evaluation. Entries are tagged with the
+// policy generation they were decided under; a lookup ignores entries from
+// any other generation, so loading a new policy invalidates the whole cache
+// without touching it. Like the throttle tables, the cache is set
+// associative and never allocates. Each set evicts with the CLOCK
+// algorithm: a hit marks an entry, and the hand passes over (and unmarks)
+// marked entries before evicting one.
+class DecisionCache {
+public:
+  constexpr static size_t Sets = 256;
+  constexpr static size_t Ways = 4;
+
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+
+    // Fraction of lookups that hit, or 0 if there were none.
+    double hitRate() const {
+      auto total = hits + misses;
+      return total ? static_cast<double>(hits) / total : 0.0;
+    }
+  };
+
+  // Requires sodium_init to have been called.
+  explicit DecisionCache() noexcept;
+
+  // Keyed hash of a request. The key is random per server instance, so a
+  // client can't pick a command line that collides with one it is allowed
+  // to run. The program's digest, if known, is part of the key, so a
+  // rewritten program gets a new decision.
+  uint64_t hash(std::string_view user, const std::vector<std::string> &groups,
+                std::string_view command, std::string_view arguments,
+                const policy::Digest *digest = nullptr) const;
+
+  // Look up a decision made under `generation`, which must not be zero.
+  std::optional<policy::Decision> find(uint64_t generation, uint64_t key);
+
+  // Remember a decision made under `generation`, which must not be zero.
+  void insert(uint64_t generation, uint64_t key, policy::Decision decision);
+
+  const Stats &stats() const { return _stats; }
+
+private:
+  constexpr static size_t KeySize = 32;
+
+  struct Slot {
+    uint64_t key;
+    // Zero marks an empty slot.
+    uint64_t generation;
+    uint32_t line;
+    bool allowed;
+    // CLOCK reference bit.
+    bool referenced;
+  };
+
+  std::array<unsigned char, KeySize> _key;
+  std::array<Slot, Sets * Ways> _slots{};
+  // CLOCK hand for each set.
+  std::array<uint8_t, Sets> _hands{};
+  Stats _stats;
+};
+
+} // namespace wsudo::server
+
+#endif // WSUDO_DECISIONCACHE_H
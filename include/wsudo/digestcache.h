@@ -0,0 +1,85 @@
+#ifndef WSUDO_DIGESTCACHE_H
+#define WSUDO_DIGESTCACHE_H
+
+#include "wsudo.h"
+#include "policy.h"
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace wsudo::server {
+
+// Identifies one version of a file: the file itself (volume and file index,
+// which together play the part of a Unix device and inode) and its size and
+// last write time. Rewriting a file changes its write time, so a cached
+// digest is never used for different contents.
+struct FileIdentity {
+  uint32_t volumeSerial;
+  uint64_t fileIndex;
+  uint64_t size;
+  uint64_t lastWriteTime;
+
+  bool operator==(const FileIdentity &other) const {
+    return volumeSerial == other.volumeSerial &&
+           fileIndex == other.fileIndex && size == other.size &&
+           lastWriteTime == other.lastWriteTime;
+  }
+};
+
+// Fixed size cache of program file digests for policy rules that pin one.
+// Hashing a large program on every elevation would be slow, but the same few
+// programs are elevated over and over, so the digest is computed once per
+// version of the file. Like the other server caches, this is set associative
+// and never allocates; a full set recycles its least recently used entry.
+class DigestCache {
+public:
+  constexpr static size_t Sets = 64;
+  constexpr static size_t Ways = 4;
+
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    // Files that couldn't be opened or read.
+    uint64_t failures = 0;
+  };
+
+  // Digest of each file in `files`, which are open for reading, or nullopt
+  // for a file that can't be read. A null handle, for a file the caller
+  // couldn't open, counts as a failure. Files not in the cache are hashed at
+  // the same time, each on its own thread, up to the number of processors.
+  std::vector<std::optional<policy::Digest>>
+  digests(const std::vector<HANDLE> &files);
+
+  const Stats &stats() const { return _stats; }
+
+private:
+  struct Slot {
+    FileIdentity identity;
+    policy::Digest digest;
+    // Time of the last use; zero marks an empty slot.
+    uint64_t used;
+  };
+
+  Slot *find(const FileIdentity &identity);
+  void insert(const FileIdentity &identity, const policy::Digest &digest);
+
+  std::array<Slot, Sets * Ways> _slots{};
+  uint64_t _clock = 0;
+  Stats _stats;
+};
+
+// Open a program file to hash it. Only read access is shared, so the file
+// can't be written, deleted or renamed while the handle is open. Null if it
+// can't be opened.
+HObject openProgramFile(const std::wstring &path);
+
+// SHA-256 of an open file's first `size` bytes, read through a series of
+// mapped views.
+std::optional<policy::Digest> sha256File(HANDLE file, uint64_t size);
+
+} // namespace wsudo::server
+
+#endif // WSUDO_DIGESTCACHE_H
@@ -0,0 +1,120 @@
+#ifndef WSUDO_ELEVATOR_H
+#define WSUDO_ELEVATOR_H
+
+#include "wsudo.h"
+#include "client.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Embeddable client API.
+ *
+ * An Elevator owns one connection to the token server - or to the logon
+ * session's agent, if one is running - and a worker thread that talks to it.
+ * Operations are queued to the worker and run in the order they were
+ * submitted. Each one returns a future, or takes a callback that is invoked
+ * on the worker thread when it completes. Nothing is printed; failures are
+ * described in the returned Result.
+ *
+ * Processes to elevate must be created suspended by the caller and resumed
+ * once their elevation succeeds:
+ *
+ *   wsudo::Elevator elevator;
+ *   elevator.connect();
+ *   if (!elevator.authenticate().get()) {
+ *     wsudo::SecureBuffer<wchar_t> password{wsudo::MaxPasswordLength};
+ *     // ... fill in the password ...
+ *     elevator.authenticate(username, std::move(password));
+ *   }
+ *   auto results = elevator.elevate({process1, process2}).get();
+ */
+
+namespace wsudo {
+
+class Elevator {
+public:
+  struct Result {
+    bool ok;
+    // Why the operation failed.
+    std::string error;
+
+    explicit operator bool() const { return ok; }
+  };
+
+  template<typename T>
+  using Callback = std::function<void(T)>;
+
+  // If useAgent is true, connect() tries this logon session's agent before
+  // the server.
+  explicit Elevator(std::wstring pipeName = PipeFullPath,
+                    bool useAgent = true);
+  // Finishes the queued operations before returning.
+  ~Elevator();
+
+  Elevator(const Elevator &) = delete;
+  Elevator &operator=(const Elevator &) = delete;
+
+  // Connect to the agent or server. Other operations connect first if needed.
+  std::future<Result> connect();
+  void connect(Callback<Result> callback);
+
+  // Authorize with the ticket stored for this logon session.
+  std::future<Result> authenticate();
+  void authenticate(Callback<Result> callback);
+
+  // Authorize with a password. On success, the ticket is stored so the next
+  // authenticate() without a password can use it. The password stays in
+  // secure memory until it is written to the pipe, and is wiped after.
+  std::future<Result> authenticate(std::wstring username,
+                                   SecureBuffer<wchar_t> password);
+  void authenticate(std::wstring username, SecureBuffer<wchar_t> password,
+                    Callback<Result> callback);
+
+  // Elevate suspended processes; the result for each is in the same order.
+  // They are sent msg::MaxBlessTargets at a time, so most calls take a
+  // single round trip. The handles must stay open until the operation
+  // completes.
+  std::future<std::vector<Result>> elevate(std::vector<HANDLE> processes);
+  void elevate(std::vector<HANDLE> processes,
+               Callback<std::vector<Result>> callback);
+
+private:
+  std::wstring _pipeName;
+  bool _useAgent;
+  // Only touched by the worker thread.
+  std::unique_ptr<ClientConnection> _connection;
+  bool _viaAgent = false;
+
+  std::mutex _mutex;
+  std::condition_variable _queueChanged;
+  std::deque<std::function<void()>> _queue;
+  bool _stopping = false;
+  // Started last, once everything it uses is initialized.
+  std::thread _worker;
+
+  // These run on the worker thread.
+  Result doConnect();
+  Result doResume();
+  Result doLogon(const std::wstring &username,
+                 const SecureBuffer<wchar_t> &password);
+  std::vector<Result> doElevate(const std::vector<HANDLE> &processes);
+
+  template<typename T>
+  std::future<T> submit(std::function<T()> work);
+  template<typename T>
+  void submit(std::function<T()> work, Callback<T> callback);
+  void post(std::function<void()> task);
+  void run();
+};
+
+} // namespace wsudo
+
+#endif // WSUDO_ELEVATOR_H
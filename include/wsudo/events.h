@@ -2,9 +2,14 @@
 #define WSUDO_EVENTS_H
 
 #include <vector>
+#include <chrono>
 #include <cstdint>
 
 #include "wsudo.h"
+#include "trace.h"
+#include "flightrecorder.h"
+#include "metrics.h"
+#include "watchdog.h"
 
 /**
  * Windows Event Server/Client
@@ -45,6 +50,10 @@ public:
   // does nothing and returns false.
   virtual bool reset();
 
+  // Optional - a static name for what the handler does next, which stall
+  // reports show. The default is "handler".
+  virtual const char *stateName() const;
+
   // Event handler implementation.
   virtual EventStatus operator()(EventListener &) = 0;
 };
@@ -113,6 +122,9 @@ public:
   // Returns the overlapped trigger event.
   HANDLE event() const override { return _overlapped.hEvent; }
 
+  // "read" or "write" while IO is in progress, otherwise "idle".
+  const char *stateName() const override;
+
   // Subclasses should call this first to handle chunked reading/writing.
   // Returns EventStatus::Finished when reading/writing is done.
   EventStatus operator()(EventListener &) override;
@@ -120,22 +132,38 @@ public:
 protected:
   OVERLAPPED _overlapped{};
   std::vector<uint8_t> _buffer{};
+  // Trace and flight recorder track for this handler's reads and writes.
+  uint32_t _traceTrack = 0;
+
+  // "read", "write" or "failed", or null if no IO is in progress.
+  const char *ioStateName() const;
 
   // Subclasses should return an overlapped readable/writable handle here.
   virtual HANDLE fileHandle() const = 0;
 
   // Begin reading from the file handle. Subclasses must call operator() for
   // this to work.
-  EventStatus readToBuffer() { _offset = 0; return beginRead(); }
+  EventStatus readToBuffer() {
+    _offset = 0;
+    _ioStart = trace::enabled() ? trace::now() : 0;
+    return beginRead();
+  }
 
   // Begin writing to the file handle. Subclasses must call operator() for
   // this to work.
-  EventStatus writeFromBuffer() { _offset = 0; return beginWrite(); }
+  EventStatus writeFromBuffer() {
+    _offset = 0;
+    _ioStart = trace::enabled() ? trace::now() : 0;
+    return beginWrite();
+  }
 
 private:
   // Position in buffer to begin reading or writing, depending on IO state.
   size_t _offset = 0;
 
+  // When the current read or write started, if it is traced.
+  uint64_t _ioStart = 0;
+
   // Determines if any IO action needs to take place.
   enum class IOState {
     // No IO is queued.
@@ -153,6 +181,9 @@ private:
   // Max amount to read/write at once.
   const DWORD ChunkSize = static_cast<DWORD>(PipeBufferSize);
 
+  // Record the current read or write as a span if it was traced.
+  void traceIO(const char *name);
+
   // Begins an overlapped read operation.
   EventStatus beginRead();
   // Finishes an overlapped read operation. Not all the data may be read at
@@ -168,6 +199,17 @@ private:
 // Manages a set of event handlers.
 class EventListener final {
 public:
+  // Loop numbers kept up to date for the admin pipe. Any may be null.
+  struct Metrics {
+    metrics::Counter *iterations = nullptr;
+    // How long each event waited to be dispatched; see queueDelay().
+    metrics::Histogram *queueDelay = nullptr;
+    // Events dispatched since the loop last found none ready, a stand-in for
+    // queue depth, which WaitForMultipleObjects doesn't report.
+    metrics::Gauge *backlog = nullptr;
+    metrics::Gauge *handlers = nullptr;
+  };
+
   explicit EventListener() = default;
 
   EventListener(const EventListener &) = delete;
@@ -190,6 +232,7 @@ public:
       *_handlers.emplace_back(std::make_unique<H>(std::forward<Args>(args)...))
     );
     _events.emplace_back(handler.event());
+    _readyAfter.emplace_back(std::chrono::steady_clock::now());
     return handler;
   }
 
@@ -217,16 +260,40 @@ public:
   bool isRunning() const { return _running; }
   void stop() { _running = false; }
 
+  void setMetrics(const Metrics &metrics) { _metrics = metrics; }
+
+  // Mark each handler call on `heartbeat` for a watchdog.
+  void setHeartbeat(watchdog::Heartbeat *heartbeat) { _heartbeat = heartbeat; }
+
+  // Upper bound on how long the event being handled waited to be dispatched.
+  // This is the time since the loop last saw that event unsignaled, so it
+  // only grows while the event itself is kept waiting behind others.
+  std::chrono::steady_clock::duration queueDelay() const {
+    return _queueDelay;
+  }
+
 private:
   // List of events to pass to WaitForMultipleObjects.
   std::vector<HANDLE> _events;
   // List of handlers, must be kept in sync with the event list.
   std::vector<std::unique_ptr<EventHandler>> _handlers;
+  // Last time each event was known not to be signaled, kept in sync with the
+  // event list. WaitForMultipleObjects returns the lowest signaled index, so
+  // every event before it was unsignaled when the wait returned.
+  std::vector<std::chrono::steady_clock::time_point> _readyAfter;
   // Active flag.
   bool _running;
+  // How long the current event waited to be dispatched.
+  std::chrono::steady_clock::duration _queueDelay{};
+  // Events dispatched since the loop last found none ready.
+  int64_t _backlog = 0;
+  Metrics _metrics;
+  watchdog::Heartbeat *_heartbeat = nullptr;
 
   // Remove an event handler from the list.
   void remove(size_t index);
+  // Update the metrics for an event about to be dispatched.
+  void recordDispatch();
 };
 
 } // namespace wsudo::events
@@ -0,0 +1,35 @@
+#ifndef WSUDO_FLIGHTDUMP_H
+#define WSUDO_FLIGHTDUMP_H
+
+#include "wsudo.h"
+#include "flightrecorder.h"
+
+#include <string>
+
+/**
+ * Writing flight recorder dumps to files. A dump is taken on request, and
+ * after installCrashHandler(), when the process hits an unhandled
+ * exception.
+ */
+
+namespace wsudo::recorder {
+
+// Write a dump to `path`. Returns false if the file can't be written.
+bool writeDump(const wchar_t *path) noexcept;
+
+// A new dump file name in `directory`, which is created for admins only if
+// it doesn't exist; e.g. flight-1234-20240501T120000.bin. Empty if the
+// directory can't be created or secured.
+std::wstring newDumpPath(const std::wstring &directory);
+
+// Dump to `directory` when the process crashes. The file name is worked out
+// now, so the handler doesn't allocate. Nothing is installed if the
+// directory can't be created or secured.
+void installCrashHandler(const std::wstring &directory);
+
+// Default dump directory, under ProgramData.
+std::wstring defaultDumpDirectory();
+
+} // namespace wsudo::recorder
+
+#endif // WSUDO_FLIGHTDUMP_H
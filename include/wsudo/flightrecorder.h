@@ -0,0 +1,100 @@
+#ifndef WSUDO_FLIGHTRECORDER_H
+#define WSUDO_FLIGHTRECORDER_H
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Always-on flight recorder.
+ *
+ * Each thread records small fixed-size entries - state changes, I/O
+ * completions, event handler results and errors - into its own ring, and
+ * the newest entries survive for a post-mortem. Recording takes no lock and
+ * never allocates after a thread's first entry. The rings can be dumped at
+ * any time, including from a crash handler: dump() only copies into static
+ * memory and hands bytes to a callback. wsudo-flight decodes a dump into a
+ * timeline.
+ */
+
+namespace wsudo::recorder {
+
+enum class Kind : uint16_t {
+  // A connection moved to another step, or started a message; the tag
+  // names it.
+  State = 1,
+  // A read or write finished; `value` is the byte count.
+  IO,
+  // An event handler returned; `code` is its EventStatus.
+  Result,
+  // A call failed; `code` is GetLastError() or errno, or an NTSTATUS.
+  Error,
+  // Anything else.
+  Note,
+};
+
+const char *kindToString(Kind kind);
+
+struct Entry {
+  // Nanoseconds on the steady clock.
+  uint64_t time;
+  // The recording thread's ring, from 1. Rings of exited threads are only
+  // reused once MaxThreads rings exist.
+  uint32_t thread;
+  Kind kind;
+  // The client slot or handler index it concerns, or 0.
+  uint16_t track;
+  uint32_t code;
+  uint32_t value;
+  // Short ASCII label; not null terminated if it fills the field.
+  char tag[8];
+
+  std::string_view tagName() const;
+};
+static_assert(sizeof(Entry) == 32);
+
+// Entries each thread keeps.
+constexpr size_t RingCapacity = 4096;
+// Threads beyond this many at once record nothing.
+constexpr size_t MaxThreads = 64;
+
+// Monotonic time in nanoseconds.
+uint64_t now() noexcept;
+
+// Record an entry for the calling thread. `tag` is cut to 8 characters and
+// `track` to 16 bits.
+void record(Kind kind, uint32_t track, const char *tag, uint32_t code = 0,
+            uint32_t value = 0) noexcept;
+
+// Receives dump data; returns false to stop.
+using DumpWriter = bool (*)(void *context, const void *data, size_t size);
+
+// Write every thread's entries, oldest first, to `write`. `wallTime` is the
+// current time in microseconds since the Unix epoch, which lets the decoder
+// show real times. Safe to call from a crash handler or while other threads
+// record; entries overwritten during the dump are left out. Returns false if
+// the writer failed or another dump is in progress.
+bool dump(DumpWriter write, void *context, uint32_t processId,
+          uint64_t wallTime) noexcept;
+
+struct Dump {
+  uint32_t processId = 0;
+  // Microseconds since the Unix epoch when the dump was taken.
+  uint64_t wallTime = 0;
+  // Steady clock time when the dump was taken.
+  uint64_t steadyTime = 0;
+  // All threads' entries, by time.
+  std::vector<Entry> entries;
+};
+
+// Read a dump. Returns nothing if it isn't one or is cut short.
+std::optional<Dump> parseDump(std::string_view data);
+
+// One line of a timeline, without a newline. Times are relative to the dump.
+std::string formatEntry(const Entry &entry, uint64_t steadyTime);
+
+} // namespace wsudo::recorder
+
+#endif // WSUDO_FLIGHTRECORDER_H
@@ -0,0 +1,95 @@
+#ifndef WSUDO_GROUPRESOLVER_H
+#define WSUDO_GROUPRESOLVER_H
+
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace wsudo::session {
+
+using GroupClock = std::chrono::steady_clock;
+
+// A user's groups as a sorted list of unique, lowercase names, so that sets
+// can be compared and searched without hashing, and the same groups always
+// produce the same decision cache key.
+class GroupSet {
+public:
+  explicit GroupSet() = default;
+  explicit GroupSet(std::vector<std::string> names);
+
+  const std::vector<std::string> &names() const { return _names; }
+  bool contains(std::string_view name) const;
+  // True if the sets have a group in common.
+  bool intersects(const GroupSet &other) const;
+
+private:
+  std::vector<std::string> _names;
+};
+
+// Caches each user's groups, since asking the OS (and possibly a domain
+// controller) for them is slow. Results expire after `ttl`; a failed lookup
+// is remembered as a failure for the shorter `negativeTtl`, so a missing
+// user or unreachable domain doesn't cost a lookup every time. When
+// several threads want the same user's groups at once, only one looks them
+// up and the rest wait for its result.
+class GroupResolver {
+public:
+  // Looks up a user's groups, returning nullopt on failure.
+  using Lookup =
+    std::function<std::optional<std::vector<std::string>>(const std::string &)>;
+
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t failures = 0;
+  };
+
+  explicit GroupResolver(
+    Lookup lookup,
+    GroupClock::duration ttl = std::chrono::minutes{5},
+    GroupClock::duration negativeTtl = std::chrono::seconds{30}
+  ) noexcept;
+  GroupResolver(const GroupResolver &) = delete;
+  GroupResolver &operator=(const GroupResolver &) = delete;
+
+  // The user's groups, looked up if they aren't cached, or null if the
+  // lookup failed. A failure is never an empty set, since a user who seems
+  // to be in no groups escapes rules that deny a group.
+  std::shared_ptr<const GroupSet>
+  resolve(std::string_view username,
+          GroupClock::time_point now = GroupClock::now());
+
+  // Forget everything, for example after group membership changes.
+  void clear();
+
+  Stats stats() const;
+
+private:
+  using Result = std::shared_ptr<const GroupSet>;
+
+  struct Entry {
+    Result groups;
+    GroupClock::time_point expires;
+  };
+
+  Lookup _lookup;
+  GroupClock::duration _ttl;
+  GroupClock::duration _negativeTtl;
+  mutable std::mutex _mutex;
+  // Keyed by lowercase user name.
+  std::unordered_map<std::string, Entry> _entries;
+  // Lookups in progress.
+  std::unordered_map<std::string, std::shared_future<Result>> _inFlight;
+  Stats _stats;
+};
+
+} // namespace wsudo::session
+
+#endif // WSUDO_GROUPRESOLVER_H
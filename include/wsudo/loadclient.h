@@ -0,0 +1,145 @@
+#ifndef WSUDO_LOADCLIENT_H
+#define WSUDO_LOADCLIENT_H
+
+#include "wsudo.h"
+#include "events.h"
+#include "loadgen.h"
+#include "loadtest.h"
+
+#include <chrono>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+/**
+ * Simulated clients for wsudo-loadgen. Each worker thread runs an event loop
+ * of up to MaxClientsPerWorker clients, since WaitForMultipleObjects takes at
+ * most 64 handles, plus a timer that releases open-loop requests as they
+ * come due and retries clients the server had no pipe instance for.
+ */
+
+namespace wsudo::loadgen {
+
+// The event loop's last handle is the worker's timer.
+constexpr size_t MaxClientsPerWorker = MAXIMUM_WAIT_OBJECTS - 1;
+
+struct Options {
+  std::wstring pipeName{LoadTestPipeFullPath};
+  Mix mix;
+  // Simulated clients, which is also the most requests in flight at once.
+  size_t clients = 64;
+  // Requests per second for an open-loop test, or 0 for a closed loop.
+  double rate = 0;
+  std::chrono::seconds duration{10};
+  // Requests each client sends before reconnecting.
+  unsigned perConnection = 1;
+  std::string username{"loadtest"};
+  std::string password{LoadTestPassword};
+};
+
+class LoadClient;
+
+// One thread's share of the clients and the schedule.
+class Worker {
+public:
+  // Runs `clients` clients from `start` to `end`. In an open loop, the
+  // worker sends its clients' share of the requests, starting a little after
+  // the worker before it, by `index`.
+  explicit Worker(const Options &options, Results &results, size_t clients,
+                  size_t index, Clock::time_point start,
+                  Clock::time_point end);
+
+  Worker(const Worker &) = delete;
+  Worker &operator=(const Worker &) = delete;
+
+  // Run the clients until the end time. Returns false if the event loop
+  // failed.
+  bool run();
+
+  // Open-loop requests that came due but weren't sent before the end, for
+  // want of a free client.
+  uint64_t unsent() const { return _unsent; }
+
+  const Options &options() const { return _options; }
+  Results &results() { return _results; }
+
+  // When the next request for an idle client was due, or now in a closed
+  // loop. Nothing if an open-loop test has nothing due yet.
+  std::optional<Clock::time_point> nextRequest(Clock::time_point now);
+  Request pickRequest();
+
+  // Wake `client` when its next request comes due.
+  void waitForRequest(LoadClient &client);
+  // Wake `client` on the next timer tick.
+  void retryLater(LoadClient &client);
+
+private:
+  const Options &_options;
+  Results &_results;
+  size_t _clients;
+  Clock::time_point _end;
+  std::optional<Schedule> _schedule;
+  // Open-loop requests handed to clients so far.
+  uint64_t _sent = 0;
+  uint64_t _unsent = 0;
+  std::minstd_rand _random;
+  std::vector<LoadClient *> _idle;
+  std::vector<LoadClient *> _retry;
+
+  // Returns false when the run is over.
+  bool tick(Clock::time_point now);
+};
+
+// One simulated client. A request connects if needed, sends the message,
+// reads the answer, and disconnects once the client has sent
+// Options::perConnection requests. Bless requests send credentials first on
+// a connection that hasn't authenticated.
+class LoadClient : public events::EventOverlappedIO {
+public:
+  using Self = LoadClient;
+  using Callback = recursive_mem_callback<Self>;
+
+  explicit LoadClient(Worker &worker) noexcept;
+  // Waits for any pending IO to be cancelled.
+  ~LoadClient();
+
+  events::EventStatus operator()(events::EventListener &) override;
+
+  // Run the next step from the event loop.
+  void wake();
+
+protected:
+  HANDLE fileHandle() const override {
+    return _pipe;
+  }
+
+private:
+  Worker &_worker;
+  HObject _pipe;
+  Callback _callback;
+  Request _request{};
+  // When the current request was due; its latency is measured from here.
+  Clock::time_point _due{};
+  // Requests sent on this connection.
+  unsigned _sent = 0;
+  bool _authenticated = false;
+  // True while the credentials sent ahead of a bless request are pending.
+  bool _authenticating = false;
+
+  void createRequest(const char *header,
+                     std::string_view message = std::string_view{});
+  void disconnect();
+
+  Callback start();
+  Callback connect();
+  Callback send();
+  Callback receive();
+  Callback received();
+  // Record the request's outcome and go on to the next one.
+  Callback finish(Outcome outcome);
+};
+
+} // namespace wsudo::loadgen
+
+#endif // WSUDO_LOADCLIENT_H
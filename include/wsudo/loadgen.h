@@ -0,0 +1,106 @@
+#ifndef WSUDO_LOADGEN_H
+#define WSUDO_LOADGEN_H
+
+#include "metrics.h"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+/**
+ * Load generation for the token server.
+ *
+ * A closed-loop test keeps a fixed number of clients busy: each sends its
+ * next request as soon as the last one is answered. That finds the server's
+ * throughput, but when the server stalls the clients stop sending, so the
+ * stall shows up as a handful of slow samples instead of every request that
+ * would have been waiting (coordinated omission). An open-loop test sends
+ * requests on a fixed schedule whether or not earlier ones were answered,
+ * and times each from when it was due, so time spent waiting for a free
+ * client or pipe instance counts as latency.
+ */
+
+namespace wsudo::loadgen {
+
+using Clock = std::chrono::steady_clock;
+
+enum class Request : uint8_t { Query, Credential, Bless };
+constexpr size_t RequestTypes = 3;
+
+// The request's message header, like "QSES".
+const char *requestName(Request request);
+
+// How often each request type is sent, relative to the others.
+class Mix {
+public:
+  // Parse weights like "qses=1,cred=1,bles=8". Types that aren't listed
+  // aren't sent. Returns nothing if the text is malformed or every weight is
+  // zero.
+  static std::optional<Mix> parse(std::string_view text);
+
+  uint32_t weight(Request request) const;
+  uint32_t total() const;
+
+  // The type for a uniformly random number; only `random % total()` counts.
+  Request pick(uint32_t random) const;
+
+private:
+  std::array<uint32_t, RequestTypes> _weights{};
+};
+
+// When each request of an open-loop test is due, evenly spaced.
+class Schedule {
+public:
+  explicit Schedule(double ratePerSecond, Clock::time_point start);
+
+  // When request `n`, counting from 0, is due.
+  Clock::time_point at(uint64_t n) const;
+  // How many requests are due by `now`.
+  uint64_t due(Clock::time_point now) const;
+
+private:
+  double _rate;
+  Clock::time_point _start;
+};
+
+enum class Outcome : uint8_t {
+  // Answered as expected.
+  Success,
+  // Answered with AccessDenied, or a bless status other than BlessOk.
+  Denied,
+  // Turned away by the server's admission controller.
+  Busy,
+  // Couldn't connect, the connection broke, or the answer made no sense.
+  Error,
+};
+constexpr size_t Outcomes = 4;
+
+const char *outcomeName(Outcome outcome);
+
+// What happened to each request, by type. Safe to record from many threads.
+class Results {
+public:
+  // Latency is only kept for answered requests, Success and Denied; busy
+  // answers and errors are quick and would make the server look faster.
+  void record(Request request, Outcome outcome,
+              Clock::duration latency) noexcept;
+
+  uint64_t count(Request request, Outcome outcome) const;
+  metrics::Histogram::Snapshot latency(Request request) const;
+
+  // A table of answered requests per second and p50/p99/p99.9 latency for
+  // each type and all together, with outcome counts, for a run that took
+  // `elapsed`.
+  std::string report(Clock::duration elapsed) const;
+
+private:
+  std::array<metrics::Histogram, RequestTypes> _latency;
+  metrics::Counter _outcomes[RequestTypes][Outcomes];
+};
+
+} // namespace wsudo::loadgen
+
+#endif // WSUDO_LOADGEN_H
@@ -0,0 +1,22 @@
+#ifndef WSUDO_LOADTEST_H
+#define WSUDO_LOADTEST_H
+
+/**
+ * What a token server in load test mode (TokenServer --load-test) and
+ * wsudo-loadgen agree on. Clients never include this: a load test server
+ * fakes logons, so it listens on a pipe of its own, where they don't look.
+ */
+
+namespace wsudo {
+
+/// File path to the pipe a server in load test mode listens on, in place of
+/// PipeFullPath.
+constexpr const wchar_t *LoadTestPipeFullPath =
+  L"\\\\.\\pipe\\wsudo_load_test";
+
+/// The only password a server in load test mode accepts, for any user.
+constexpr const char *LoadTestPassword = "wsudo-load-test";
+
+} // namespace wsudo
+
+#endif // WSUDO_LOADTEST_H
@@ -0,0 +1,152 @@
+#ifndef WSUDO_METRICS_H
+#define WSUDO_METRICS_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/**
+ * Runtime numbers for the admin pipe.
+ *
+ * Counters and histograms are split into cache-line sized shards, and each
+ * thread adds to its own shard, so recording is one uncontended atomic add.
+ * A snapshot sums the shards with relaxed loads; it takes no lock the
+ * recording threads use. The registry formats a snapshot as Prometheus text.
+ */
+
+namespace wsudo::metrics {
+
+constexpr size_t Shards = 8;
+
+namespace detail {
+  inline std::atomic<size_t> g_nextShard{0};
+
+  // The calling thread's shard, assigned round robin.
+  inline size_t shard() noexcept {
+    static thread_local size_t index =
+      g_nextShard.fetch_add(1, std::memory_order_relaxed) % Shards;
+    return index;
+  }
+
+  struct alignas(64) Cell {
+    std::atomic<uint64_t> value{0};
+  };
+}
+
+// A count that only goes up.
+class Counter {
+public:
+  void add(uint64_t n = 1) noexcept {
+    _cells[detail::shard()].value.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  uint64_t value() const noexcept;
+
+private:
+  detail::Cell _cells[Shards];
+};
+
+// A value that is set, like a size or a count mirrored from elsewhere.
+class Gauge {
+public:
+  void set(int64_t value) noexcept {
+    _value.store(value, std::memory_order_relaxed);
+  }
+
+  void add(int64_t n) noexcept {
+    _value.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  int64_t value() const noexcept {
+    return _value.load(std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<int64_t> _value{0};
+};
+
+// Distribution of durations in nanoseconds. Buckets are log-linear like an
+// HDR histogram: each power of two is split into SubBuckets, so a bucket's
+// bounds are within 12.5% of each other at any scale.
+class Histogram {
+public:
+  constexpr static size_t SubBucketBits = 3;
+  constexpr static size_t SubBuckets = size_t{1} << SubBucketBits;
+  constexpr static size_t Buckets = (64 - SubBucketBits + 1) * SubBuckets;
+
+  struct Snapshot {
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    std::vector<uint64_t> buckets;
+
+    // Upper bound of the bucket holding the `q` quantile, or 0 if empty.
+    uint64_t quantile(double q) const;
+  };
+
+  Histogram();
+  ~Histogram();
+
+  void record(uint64_t nanoseconds) noexcept;
+
+  Snapshot snapshot() const;
+
+  static size_t bucketIndex(uint64_t value) noexcept;
+  // Smallest and largest value in a bucket.
+  static uint64_t bucketLowerBound(size_t index) noexcept;
+  static uint64_t bucketUpperBound(size_t index) noexcept;
+
+private:
+  struct Shard;
+  std::unique_ptr<Shard[]> _shards;
+};
+
+using Labels = std::vector<std::pair<std::string, std::string>>;
+
+// Owns metrics by name and labels. Register everything at startup; the
+// returned references stay valid for the registry's lifetime.
+class Registry {
+public:
+  Registry();
+  ~Registry();
+
+  Registry(const Registry &) = delete;
+  Registry &operator=(const Registry &) = delete;
+
+  Counter &counter(std::string_view name, std::string_view help,
+                   Labels labels = {});
+  Gauge &gauge(std::string_view name, std::string_view help,
+               Labels labels = {});
+  // A gauge exported as a counter, for mirroring a count kept elsewhere.
+  Gauge &counterGauge(std::string_view name, std::string_view help,
+                      Labels labels = {});
+  // Exported as a summary in seconds, with quantiles.
+  Histogram &histogram(std::string_view name, std::string_view help,
+                       Labels labels = {});
+
+  // Run `update` on the reading thread before each snapshot, to set gauges
+  // from sources that are safe to read there.
+  void onSnapshot(std::function<void()> update);
+
+  // Every metric in the Prometheus text exposition format.
+  std::string snapshot();
+
+private:
+  enum class Type { Counter, Gauge, CounterGauge, Histogram };
+  struct Family;
+
+  std::mutex _mutex;
+  std::vector<std::unique_ptr<Family>> _families;
+  std::vector<std::function<void()>> _updates;
+
+  Family &family(std::string_view name, std::string_view help, Type type);
+};
+
+} // namespace wsudo::metrics
+
+#endif // WSUDO_METRICS_H
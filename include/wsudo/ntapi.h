@@ -18,10 +18,35 @@ typedef struct _PROCESS_ACCESS_TOKEN {
 
 constexpr ::PROCESSINFOCLASS ProcessAccessToken = (::PROCESSINFOCLASS)9;
 
+// Returns a UNICODE_STRING followed by its buffer. Windows 8.1 and later.
+constexpr ::PROCESSINFOCLASS ProcessCommandLineInformation =
+  (::PROCESSINFOCLASS)60;
+
+// Takes a file handle as input, and succeeds only if that file is the one
+// mapped as the process's image.
+constexpr ::PROCESSINFOCLASS ProcessImageFileMapping = (::PROCESSINFOCLASS)44;
+
+// Returns a THREAD_BASIC_INFORMATION.
+constexpr ::THREADINFOCLASS ThreadBasicInformation = (::THREADINFOCLASS)0;
+
+typedef struct _THREAD_BASIC_INFORMATION {
+    NTSTATUS ExitStatus;
+    // Starts with an NT_TIB.
+    PVOID TebBaseAddress;
+    HANDLE UniqueProcess;
+    HANDLE UniqueThread;
+    KAFFINITY AffinityMask;
+    LONG Priority;
+    LONG BasePriority;
+} THREAD_BASIC_INFORMATION, *PTHREAD_BASIC_INFORMATION;
+
 typedef ULONG (WINAPI *RtlNtStatusToDosError_t)(NTSTATUS);
 typedef NTSTATUS (WINAPI *NtQueryInformationProcess_t)(
     HANDLE, PROCESSINFOCLASS, PVOID, ULONG, PULONG
 );
+typedef NTSTATUS (WINAPI *NtQueryInformationThread_t)(
+    HANDLE, THREADINFOCLASS, PVOID, ULONG, PULONG
+);
 typedef NTSTATUS (WINAPI *NtSetInformationProcess_t)(
     HANDLE, PROCESSINFOCLASS, PVOID, ULONG
 );
@@ -0,0 +1,83 @@
+#ifndef WSUDO_PATHCACHE_H
+#define WSUDO_PATHCACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace wsudo {
+
+// Finds programs named without a path the way cmd.exe does: each PATH
+// directory in order, trying the name as given if it has an extension and
+// then the name with each PATHEXT extension appended.
+//
+// Probing every candidate would cost a file system call for each directory
+// and extension. Instead, the cache keeps the names of the programs in each
+// directory along with the directory's last write time, which changes
+// whenever a file is added, removed or renamed in it. A warm lookup only
+// reads the write times of the directories up to the one with the program,
+// and a directory is listed again only when its write time has changed. The
+// cache can be saved and loaded so it lasts between runs.
+class PathCache {
+public:
+  // File system access, replaceable for tests.
+  class FileSystem {
+  public:
+    virtual ~FileSystem() = default;
+    // Last write time of a directory, or nullopt if it doesn't exist.
+    virtual std::optional<uint64_t>
+    directoryTime(const std::wstring &directory) = 0;
+    // Names of the files in a directory.
+    virtual std::optional<std::vector<std::wstring>>
+    list(const std::wstring &directory) = 0;
+  };
+
+  // `pathExt` is the PATHEXT variable, like ".COM;.EXE;.BAT".
+  explicit PathCache(FileSystem &fileSystem, std::wstring_view pathExt);
+
+  // Full path of the program `name` in one of `path`'s directories, or
+  // nullopt if there isn't one.
+  std::optional<std::wstring> resolve(std::wstring_view name,
+                                      const std::vector<std::wstring> &path);
+
+  // True if lookups have changed the cache since it was loaded.
+  bool dirty() const { return _dirty; }
+
+  std::vector<char> save() const;
+  // Replace the cache with a saved one. Returns false, leaving the cache
+  // empty, if the data is invalid or was saved with another PATHEXT.
+  bool load(const char *data, size_t size);
+
+private:
+  struct Listing {
+    uint64_t time;
+    // Sorted, lowercase program names.
+    std::vector<std::wstring> names;
+  };
+
+  const Listing *listing(const std::wstring &directory);
+  bool isProgram(std::wstring_view lowerName) const;
+
+  FileSystem &_fileSystem;
+  std::wstring _pathExt;
+  // Lowercase extensions, with the dot.
+  std::vector<std::wstring> _extensions;
+  // Keyed by lowercase directory path.
+  std::unordered_map<std::wstring, Listing> _listings;
+  bool _dirty = false;
+};
+
+// Split a PATH variable into directories, dropping quotes and empty entries.
+std::vector<std::wstring> splitPath(std::wstring_view path);
+
+// True if a program name has no directory or drive in it, so it should be
+// looked up in PATH.
+bool isBareName(std::wstring_view name);
+
+} // namespace wsudo
+
+#endif // WSUDO_PATHCACHE_H
@@ -0,0 +1,214 @@
+#ifndef WSUDO_POLICY_H
+#define WSUDO_POLICY_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * The policy decides which programs a user may elevate. It is written in a
+ * small sudoers-like language, one rule per line:
+ *
+ *   # Comments start with '#'.
+ *   <who>[, <who>...] = [sha256:<digest>] [!]<command> [<arguments>]
+ *
+ *   alice = C:\Windows\System32\cmd.exe
+ *   %Administrators = ALL
+ *   bob, carol = C:\Tools\**
+ *   carol = "C:\Program Files\Git\bin\git.exe" pull *
+ *   dave = C:\Windows\System32\net.exe ""
+ *   ALL = !C:\Windows\System32\format.com
+ *   erin = sha256:9f86d081884c7d65...(64 hex digits) C:\Tools\deploy.exe
+ *
+ * <who> is a user name, a group name prefixed with '%', or ALL. A local
+ * account is named on its own, any other as DOMAIN\name. <command> is
+ * an absolute path or ALL; it may be quoted if it contains spaces. Path
+ * segments may use the globs '*' and '?', and a final '**' segment matches
+ * anything under a directory. A '!' makes the rule deny instead of allow.
+ * If arguments are given, the command's arguments (the rest of its command
+ * line, as one string) must match them as a glob; "" means no arguments.
+ * Names and paths are compared without regard to (ASCII) case. A rule with
+ * a SHA-256 digest, like sudo's digest option, only matches if the program's
+ * file has that digest.
+ *
+ * Like sudoers, the last matching rule wins, and nothing is allowed unless a
+ * rule allows it.
+ *
+ * Rules are compiled into flat tables: a hash table of principals, each
+ * with a trie over path segments. Evaluating a request walks the trie of the
+ * user, each of their groups and ALL, so the cost depends on the length of
+ * the command and not on the number of rules. The tables can be saved as a
+ * binary image (see wsudo-policy) that is used in place.
+ *
+ * This file doesn't depend on Windows.
+ */
+
+namespace wsudo::policy {
+
+// Why a policy failed to compile.
+struct CompileError {
+  // 1-based line number.
+  uint32_t line = 0;
+  std::string message;
+};
+
+// SHA-256 digest of a program file.
+using Digest = std::array<unsigned char, 32>;
+
+struct Decision {
+  bool allowed;
+  // 1-based line of the deciding rule, or 0 if no rule matched.
+  uint32_t line;
+
+  explicit operator bool() const { return allowed; }
+};
+
+class Policy {
+public:
+  // Version of the binary image format, bumped on any incompatible change.
+  constexpr static uint32_t ImageVersion = 2;
+
+  // An empty policy, which denies everything.
+  Policy() = default;
+
+  // Compile policy text. Returns nothing and fills in `error` (if given) if
+  // the text is invalid.
+  static std::optional<Policy> compile(std::string_view text,
+                                       CompileError *error = nullptr);
+
+  // Compile policy text to a binary image for `load`.
+  static std::optional<std::vector<char>>
+  compileImage(std::string_view text, CompileError *error = nullptr);
+
+  // Use a binary image in place, without copying or parsing it. `image`
+  // must be 8-byte aligned and is kept alive as long as the policy or a copy
+  // of it exists. Only the header is validated, so this takes constant time
+  // however large the policy is; indexes in the image are checked as they
+  // are used, so a corrupt image can give wrong answers but can't cause a
+  // read outside of it.
+  static std::optional<Policy> load(std::shared_ptr<const void> image,
+                                    size_t size);
+
+  // Decide whether `user`, a member of `groups`, may run `command` (a full
+  // path) with `arguments`. Rules with a digest only match if `digest` is
+  // the command file's digest.
+  Decision evaluate(std::string_view user,
+                    const std::vector<std::string> &groups,
+                    std::string_view command,
+                    std::string_view arguments,
+                    const Digest *digest = nullptr) const;
+
+  size_t ruleCount() const { return _rules.count; }
+
+  // True if any rule has a digest, so it's worth computing one.
+  bool usesDigests() const { return _usesDigests; }
+
+private:
+  // The image is a header followed by these tables, each 8-byte aligned.
+  // All references are indexes or offsets, so the image can be mapped
+  // anywhere.
+
+  struct StringRef {
+    uint32_t offset;
+    uint32_t length;
+  };
+
+  enum class Arguments : uint8_t {
+    // No arguments were given in the rule.
+    Any,
+    // The rule said "".
+    None,
+    // The rule's argument glob must match.
+    Pattern,
+  };
+
+  struct Rule {
+    uint32_t line;
+    uint8_t deny;
+    Arguments arguments;
+    uint16_t reserved;
+    StringRef pattern;
+    // Raw digest bytes, or empty.
+    StringRef digest;
+  };
+
+  struct Node {
+    // Literal segment edges, sorted by hash.
+    uint32_t firstEdge, edgeCount;
+    // Glob segment edges, tried in order.
+    uint32_t firstGlob, globCount;
+    // Rules for a command ending at this node.
+    uint32_t firstRule, ruleCount;
+    // Rules for any command under this node ('**').
+    uint32_t firstSubtreeRule, subtreeRuleCount;
+  };
+
+  struct Edge {
+    uint64_t hash;
+    StringRef segment;
+    uint32_t child;
+    uint32_t reserved;
+  };
+
+  struct Principal {
+    uint64_t hash;
+    StringRef key;
+    uint32_t root;
+    uint32_t reserved;
+  };
+
+  template<typename T>
+  struct Table {
+    const T *data = nullptr;
+    uint32_t count = 0;
+
+    const T *at(size_t index) const {
+      return index < count ? data + index : nullptr;
+    }
+  };
+
+  std::string_view str(StringRef ref) const {
+    if (ref.offset > _strings.count ||
+        ref.length > _strings.count - ref.offset)
+    {
+      return std::string_view{};
+    }
+    return std::string_view{_strings.data + ref.offset, ref.length};
+  }
+  const Principal *findPrincipal(std::string_view key) const;
+  void walk(uint32_t root, std::string_view command,
+            std::string_view arguments, const Digest *digest,
+            Decision &best) const;
+  void consider(uint32_t firstRule, uint32_t count,
+                std::string_view arguments, const Digest *digest,
+                Decision &best) const;
+
+  std::shared_ptr<const void> _image;
+  Table<char> _strings;
+  Table<Principal> _principals;
+  // Open addressed; each slot is a principal index plus one, or zero. The
+  // count is a power of two.
+  Table<uint32_t> _principalSlots;
+  Table<Node> _nodes;
+  Table<Edge> _edges;
+  Table<Edge> _globs;
+  // Rule indexes, grouped by node.
+  Table<uint32_t> _nodeRules;
+  Table<Rule> _rules;
+  bool _usesDigests = false;
+};
+
+// Match a glob with '*' and '?' against text.
+bool globMatch(std::string_view pattern, std::string_view text);
+
+// Lowercase ASCII letters and use backslashes as path separators.
+std::string normalizePath(std::string_view path);
+
+} // namespace wsudo::policy
+
+#endif // WSUDO_POLICY_H
@@ -0,0 +1,89 @@
+#ifndef WSUDO_POLICYSTORE_H
+#define WSUDO_POLICYSTORE_H
+
+#include "wsudo.h"
+#include "events.h"
+#include "policy.h"
+
+#include <memory>
+#include <optional>
+#include <string>
+
+/**
+ * The server's copy of the policy. Policies are compiled ahead of time with
+ * wsudo-policy into an image that the server maps and uses in place, so
+ * loading one costs the same however many rules it has. The directory is
+ * watched, and a new image replaces the old one with an atomic pointer swap:
+ * a request that already took the old policy finishes with it, and the old
+ * mapping goes away with the last reference.
+ */
+
+namespace wsudo::server {
+
+// Compiled policy image, in the policy directory.
+constexpr const wchar_t *PolicyImageName = L"policy.bin";
+
+// Policy source, used only if there is no image.
+constexpr const wchar_t *PolicySourceName = L"policy";
+
+// A loaded policy and when it was loaded.
+struct ActivePolicy {
+  policy::Policy policy;
+  // Increases each time the store loads a policy; never zero.
+  uint64_t generation;
+};
+
+class PolicyStore {
+public:
+  explicit PolicyStore(std::wstring directory) noexcept;
+
+  PolicyStore(const PolicyStore &) = delete;
+  PolicyStore &operator=(const PolicyStore &) = delete;
+
+  // (Re)load the policy. With neither an image nor a source file, there is
+  // no policy and everything is allowed. A file that is present but can't be
+  // used gives an empty policy, so a mistake denies everything. So does a
+  // directory or file that anyone but SYSTEM and Administrators can change.
+  void reload();
+
+  // The active policy, or null if there is none. Callers should hold on to
+  // the pointer for the whole request.
+  std::shared_ptr<const ActivePolicy> current() const {
+    return std::atomic_load(&_policy);
+  }
+
+  const std::wstring &directory() const { return _directory; }
+
+private:
+  std::optional<policy::Policy> loadImage(const std::wstring &path);
+  std::optional<policy::Policy> loadSource(const std::wstring &path);
+
+  std::wstring _directory;
+  std::shared_ptr<const ActivePolicy> _policy;
+  uint64_t _generation = 0;
+};
+
+// Reloads a policy store when a file in its directory changes.
+class PolicyWatcher final : public events::EventHandler {
+public:
+  // Takes ownership of a handle from FindFirstChangeNotification on the
+  // store's directory.
+  explicit PolicyWatcher(PolicyStore &store, HANDLE notification) noexcept
+    : _store{store}, _notification{notification}
+  {}
+
+  HANDLE event() const override { return _notification; }
+
+  events::EventStatus operator()(events::EventListener &) override;
+
+private:
+  PolicyStore &_store;
+  Handle<HANDLE, FindCloseChangeNotification> _notification;
+};
+
+// Default policy directory, under ProgramData.
+std::wstring defaultPolicyDirectory();
+
+} // namespace wsudo::server
+
+#endif // WSUDO_POLICYSTORE_H
@@ -0,0 +1,200 @@
+#ifndef WSUDO_SECUREMEMORY_H
+#define WSUDO_SECUREMEMORY_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+namespace wsudo {
+
+// Memory for passwords and anything derived from them. The arena is one
+// region from sodium_malloc, so it is locked into RAM (it never reaches the
+// page file), surrounded by guard pages, and checked for overruns by a
+// canary when it is freed. All of that costs several system calls, so it is
+// done once per arena rather than per allocation; blocks are carved out of
+// the region by size class and wiped when they are released.
+//
+// Requests larger than the largest class, or made while the arena is full,
+// each get their own sodium_malloc region. They are just as protected, only
+// slower.
+class SecureArena {
+public:
+  constexpr static size_t DefaultSize = 64 * 1024;
+  // Blocks are 64 << n bytes for each class n.
+  constexpr static size_t MinBlockSize = 64;
+  constexpr static size_t Classes = 7;
+  constexpr static size_t MaxBlockSize = MinBlockSize << (Classes - 1);
+
+  struct Stats {
+    // Bytes of arena blocks handed out, counting whole blocks.
+    size_t bytesInUse = 0;
+    // Allocations that needed their own region.
+    uint64_t fallbacks = 0;
+  };
+
+  // Initializes libsodium if needed. Throws std::bad_alloc if the region
+  // can't be allocated.
+  explicit SecureArena(size_t size = DefaultSize);
+  ~SecureArena();
+
+  SecureArena(const SecureArena &) = delete;
+  SecureArena &operator=(const SecureArena &) = delete;
+
+  // The arena SecureBuffer uses by default.
+  static SecureArena &global();
+
+  // Throws std::bad_alloc if no memory is available. Blocks are aligned for
+  // any fundamental type.
+  void *allocate(size_t bytes);
+  // Wipe and release a block; `bytes` must be what it was allocated with.
+  void deallocate(void *block, size_t bytes) noexcept;
+
+  Stats stats() const;
+
+private:
+  // Size class for a request, or Classes if it is too large.
+  static size_t classOf(size_t bytes);
+  bool owns(const void *block) const;
+
+  mutable std::mutex _mutex;
+  unsigned char *_base;
+  size_t _size;
+  // Start of the never used part of the region.
+  size_t _next = 0;
+  // Released blocks of each class, linked through their first bytes.
+  std::array<void *, Classes> _free{};
+  Stats _stats;
+};
+
+// Wipe memory in a way the compiler won't optimize out.
+void secureWipe(void *data, size_t size) noexcept;
+
+// A fixed capacity buffer in a SecureArena. It never reallocates, so its
+// contents are never copied anywhere the buffer doesn't know about, and it
+// is wiped when cleared or destroyed. The element type has to be trivial.
+template<typename T>
+class SecureBuffer {
+  static_assert(std::is_trivially_copyable_v<T>);
+
+public:
+  SecureBuffer() noexcept = default;
+
+  explicit SecureBuffer(size_t capacity,
+                        SecureArena &arena = SecureArena::global())
+    : _arena{&arena},
+      _data{capacity
+              ? static_cast<T *>(arena.allocate(capacity * sizeof(T)))
+              : nullptr},
+      _capacity{capacity}
+  {}
+
+  SecureBuffer(SecureBuffer &&other) noexcept
+    : _arena{other._arena},
+      _data{std::exchange(other._data, nullptr)},
+      _size{std::exchange(other._size, 0)},
+      _capacity{std::exchange(other._capacity, 0)}
+  {}
+
+  SecureBuffer &operator=(SecureBuffer &&other) noexcept {
+    if (this != &other) {
+      release();
+      _arena = other._arena;
+      _data = std::exchange(other._data, nullptr);
+      _size = std::exchange(other._size, 0);
+      _capacity = std::exchange(other._capacity, 0);
+    }
+    return *this;
+  }
+
+  SecureBuffer(const SecureBuffer &) = delete;
+  SecureBuffer &operator=(const SecureBuffer &) = delete;
+
+  ~SecureBuffer() { release(); }
+
+  T *data() { return _data; }
+  const T *data() const { return _data; }
+  size_t size() const { return _size; }
+  size_t capacity() const { return _capacity; }
+  bool empty() const { return _size == 0; }
+
+  T &operator[](size_t index) { return _data[index]; }
+  const T &operator[](size_t index) const { return _data[index]; }
+
+  std::basic_string_view<T> view() const {
+    return std::basic_string_view<T>{_data, _size};
+  }
+
+  // These return false, changing nothing, if the buffer would overflow.
+  bool push_back(T value) {
+    if (_size == _capacity) {
+      return false;
+    }
+    _data[_size++] = value;
+    return true;
+  }
+
+  bool append(const T *values, size_t count) {
+    if (_capacity - _size < count) {
+      return false;
+    }
+    std::copy(values, values + count, _data + _size);
+    _size += count;
+    return true;
+  }
+
+  // Elements that are added are value initialized. Returns false if `size`
+  // is more than the capacity.
+  bool resize(size_t size) {
+    if (size > _capacity) {
+      return false;
+    }
+    if (size > _size) {
+      std::fill(_data + _size, _data + size, T{});
+    } else {
+      wipe(size, _size);
+    }
+    _size = size;
+    return true;
+  }
+
+  void pop_back() {
+    if (_size) {
+      wipe(_size - 1, _size);
+      --_size;
+    }
+  }
+
+  void clear() {
+    wipe(0, _size);
+    _size = 0;
+  }
+
+private:
+  SecureArena *_arena = nullptr;
+  T *_data = nullptr;
+  size_t _size = 0;
+  size_t _capacity = 0;
+
+  void wipe(size_t begin, size_t end) {
+    secureWipe(_data + begin, (end - begin) * sizeof(T));
+  }
+
+  void release() {
+    if (_data) {
+      // The arena wipes the whole block.
+      _arena->deallocate(_data, _capacity * sizeof(T));
+      _data = nullptr;
+    }
+    _size = 0;
+    _capacity = 0;
+  }
+};
+
+} // namespace wsudo
+
+#endif // WSUDO_SECUREMEMORY_H
@@ -4,11 +4,22 @@
 #include "wsudo.h"
 #include "events.h"
 #include "session.h"
+#include "throttle.h"
+#include "admission.h"
+#include "ticket.h"
+#include "spawn.h"
+#include "policystore.h"
+#include "decisioncache.h"
+#include "digestcache.h"
+#include "audit.h"
+#include "metrics.h"
 
 #include <memory>
+#include <optional>
 #include <type_traits>
 #include <vector>
 #include <string_view>
+#include <thread>
 #include <AclAPI.h>
 
 namespace wsudo::server {
@@ -20,6 +31,7 @@ enum Status : int {
   StatusCreatePipeFailed,
   StatusTimedOut,
   StatusEventFailed,
+  StatusCryptoInitFailed,
 };
 
 inline const char *statusToString(Status status) {
@@ -30,6 +42,7 @@ inline const char *statusToString(Status status) {
     case StatusCreatePipeFailed: return "pipe creation failed";
     case StatusTimedOut: return "timed out";
     case StatusEventFailed: return "event failed";
+    case StatusCryptoInitFailed: return "crypto initialization failed";
   }
 }
 
@@ -59,17 +72,103 @@ private:
   SECURITY_ATTRIBUTES _securityAttributes;
 };
 
+// Numbers the admin pipe reports. The event loop thread updates them and
+// the admin thread reads them, so nothing here is read from the loop's own
+// data structures at snapshot time.
+struct ServerMetrics {
+  // Message types counted separately; anything else is Invalid.
+  enum Message {
+    Credential, Resume, Bless, Spawn, Query, Invalid, MessageTypes
+  };
+
+  metrics::Registry registry;
+  metrics::Counter *messages[MessageTypes];
+  metrics::Histogram *messageLatency[MessageTypes];
+  // Audited decisions, indexed by audit::Event and audit::Outcome less one.
+  metrics::Counter *decisions[4][4];
+  // Clients the admission controller turned away.
+  metrics::Counter *busy;
+  // Handler calls the watchdog caught running too long.
+  metrics::Counter *stalls;
+  metrics::Gauge *pipeInstances;
+  metrics::Gauge *connectedClients;
+  metrics::Gauge *inFlight;
+  metrics::Gauge *sessions;
+  metrics::Gauge *decisionCacheHits;
+  metrics::Gauge *decisionCacheMisses;
+  metrics::Gauge *decisionCacheEvictions;
+  metrics::Gauge *digestCacheHits;
+  metrics::Gauge *digestCacheMisses;
+  metrics::Gauge *digestCacheFailures;
+  events::EventListener::Metrics loop;
+
+  ServerMetrics();
+
+  static Message messageType(std::string_view header);
+};
+
+// Server-wide state shared by all client connections.
+struct ServerContext {
+  session::SessionManager sessionManager;
+  LoginThrottle loginThrottle;
+  AdmissionController admission;
+  TicketKeyRing ticketKeys;
+  // Where the ticket keys are saved, or empty to keep them in memory only.
+  std::wstring ticketKeyPath;
+  PolicyStore policy;
+  DecisionCache decisionCache;
+  DigestCache digestCache;
+  audit::AuditLog auditLog;
+  ServerMetrics metrics;
+  // Fake authentication and elevation for capacity tests; see Config.
+  bool loadTest = false;
+
+  explicit ServerContext(unsigned sessionTtlSeconds,
+                         std::wstring ticketKeyPath,
+                         std::wstring policyDirectory,
+                         std::unique_ptr<audit::Storage> auditStorage)
+    : sessionManager{sessionTtlSeconds},
+      ticketKeyPath{std::move(ticketKeyPath)},
+      policy{std::move(policyDirectory)},
+      auditLog{std::move(auditStorage)}
+  {}
+
+  // Copy numbers only the event loop thread may read into metrics. Called
+  // on that thread after each message.
+  void publishStats();
+};
+
+// The program a process runs, as the policy sees it.
+struct ProcessCommand {
+  // Full path of the program file.
+  std::wstring path;
+  // The same path, normalized for policy lookups.
+  std::string image;
+  std::string arguments;
+};
+
+// The policy's answer for one process, and what the audit log records
+// about it.
+struct Permission {
+  bool allowed = false;
+  std::string image;
+  std::optional<policy::Digest> digest;
+};
+
 class ClientConnectionHandler : public events::EventOverlappedIO {
 public:
   using Self = ClientConnectionHandler;
   using Callback = recursive_mem_callback<Self>;
 
   explicit ClientConnectionHandler(HObject pipe, int clientId,
-                                   session::SessionManager &sessionManager)
-                                   noexcept;
+                                   ServerContext &context) noexcept;
+  ~ClientConnectionHandler();
 
   bool reset() override;
 
+  // The pending IO, or the connection step that runs next.
+  const char *stateName() const override;
+
   events::EventStatus operator()(events::EventListener &) override;
 
 protected:
@@ -80,23 +179,116 @@ protected:
 private:
   HObject _pipe;
   int _clientId;
-  session::SessionManager &_sessionManager;
+  ServerContext &_context;
   Callback _callback;
   HObject _userToken{};
+  // The authenticated user and their local groups, for policy checks.
+  std::string _username;
+  std::shared_ptr<const session::GroupSet> _groups;
+  // True if the admission controller let this client in.
+  bool _admitted = false;
+  // True from when a request is admitted until its reply is written; it
+  // holds an admission slot meanwhile.
+  bool _inFlight = false;
+  // How long the current event waited in the event loop.
+  std::chrono::steady_clock::duration _queueDelay{};
+  // When the current message was received, for audit latencies.
+  std::chrono::steady_clock::time_point _dispatchStart{};
+  // Authenticated by the load test mode's fake authenticator, which makes
+  // no token.
+  bool _loadTestUser = false;
+  // The client's logon session, once looked up.
+  std::optional<uint64_t> _logonId;
+  // When the handler started waiting for a client, if traced.
+  uint64_t _connectStart = 0;
+  // True between a client connecting and the pipe being reset.
+  bool _connected = false;
 
   void createResponse(const char *header,
                       std::string_view message = std::string_view{});
+  void createBusyResponse(std::chrono::milliseconds retryAfter);
 
   Callback beginConnect();
   Callback endConnect();
   Callback read();
   Callback respond();
   Callback resetConnection();
+  // Count the client as connected and start reading.
+  Callback connected();
 
   // Returns true to read another message, false to reset the connection.
   bool dispatchMessage();
-  bool tryToLogonUser(char *username, char *password);
-  bool bless(HANDLE remoteHandle);
+  // True once a credential or ticket has been accepted on this connection.
+  bool authenticated() const;
+  // Returns false if the client was turned away.
+  bool admit();
+  // Give back the admission slot of a request whose reply was written.
+  void endRequest();
+  // The password is in secure memory; the request no longer holds it.
+  bool tryToLogonUser(const std::string &username, std::string_view password);
+  // Authorize the client with a resumption ticket instead of credentials.
+  bool resumeSession(std::string_view ticket);
+  // Create the token used to elevate the client's processes.
+  bool createUserToken();
+  // Remember who the client authenticated as.
+  void setUser(std::string username);
+  // Check whether the policy allows the user to elevate each process, which
+  // needs PROCESS_QUERY_LIMITED_INFORMATION access. Null processes are
+  // denied. Returns false, deciding nothing, if the user's groups can't be
+  // resolved.
+  bool permitted(const HANDLE *processes, size_t count,
+                 Permission *permissions);
+  // Policy decision for one command, with its program's digest if known.
+  bool decide(const ActivePolicy &active, const ProcessCommand &command,
+              const policy::Digest *digest);
+  // Token of the connected client, opened by impersonating it.
+  HObject clientToken();
+  // Hash of the connected client's user SID, or nothing if it can't be
+  // determined.
+  std::optional<uint64_t> peerKey();
+  // The connected client's logon session ID. Looked up once per connection.
+  std::optional<uint64_t> clientLogonId();
+  // Add an entry for the current message to the audit log.
+  void recordAudit(audit::Event event, audit::Outcome outcome,
+                   std::string_view username,
+                   const Permission *permission = nullptr);
+  // Assign the user token to each of the client's processes, writing a
+  // msg::BlessStatus for each. Returns false, with an error response, if the
+  // client process can't be opened or the user's groups can't be resolved.
+  bool bless(const HANDLE *remoteHandles, size_t count, uint32_t *statuses);
+  // Create an elevated process as a child of the client and respond with a
+  // handle to it.
+  bool spawn(const SpawnRequest &request);
+};
+
+// Serves the admin pipe on its own thread, one request at a time, so
+// answering never waits on the event loop or holds it up. Only SYSTEM and
+// Administrators can connect.
+class AdminPipe final {
+public:
+  // Flight recorder dumps requested through the pipe go to `dumpDirectory`.
+  explicit AdminPipe(metrics::Registry &registry, std::wstring dumpDirectory);
+  // Stops the thread.
+  ~AdminPipe();
+
+  AdminPipe(const AdminPipe &) = delete;
+  AdminPipe &operator=(const AdminPipe &) = delete;
+
+private:
+  metrics::Registry &_registry;
+  std::wstring _dumpDirectory;
+  HObject _pipe;
+  HObject _ioEvent;
+  HObject _stopEvent;
+  std::thread _thread;
+
+  void run();
+  // Wait for overlapped IO on the pipe. Returns false if it failed, timed
+  // out or the pipe is stopping; the IO is cancelled then.
+  bool wait(OVERLAPPED &overlapped, DWORD &bytes, DWORD timeout = INFINITE);
+  // Read a request, answer it and wait for the client to hang up.
+  void serve();
+  std::string answer(std::string_view request);
 };
 
 // Server configuration.
@@ -110,6 +302,19 @@ struct Config {
   // Server status return value.
   Status status = StatusUnset;
 
+  // Log writer whose numbers the admin pipe reports, if any.
+  std::shared_ptr<log::AsyncLogWriter> logWriter;
+
+  // Where flight recorder dumps requested through the admin pipe go.
+  std::wstring dumpDirectory;
+
+  // Load test mode: accept LoadTestPassword for any user without logging
+  // them on, bless processes without touching them, and refuse spawns. Ticket
+  // keys only live in memory and nothing is audited; pipeName should be
+  // LoadTestPipeFullPath. For measuring the server's capacity only; never
+  // run it this way otherwise.
+  bool loadTest = false;
+
   explicit Config(std::wstring pipeName, HANDLE *quitEvent)
     : pipeName(std::move(pipeName)), quitEvent(quitEvent)
   {}
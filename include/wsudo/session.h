@@ -2,8 +2,10 @@
 #define WSUDO_SESSION_H
 
 #include "wsudo.h"
+#include "groupresolver.h"
 
 #include <unordered_map>
+#include <optional>
 #include <string>
 #include <string_view>
 #include <memory>
@@ -32,6 +34,31 @@ public:
     return _defaultTtlSeconds;
   }
 
+  // This machine's account domain, which is its name.
+  std::wstring_view localDomain() const {
+    return _localDomain;
+  }
+
+  // The canonical name of the account `token` belongs to, however the user
+  // typed it: the account's own name for a local account and DOMAIN\name
+  // otherwise. None if it can't be looked up.
+  std::optional<std::string> accountName(HANDLE token) const;
+
+  // The user's local groups, from the group cache, or null if they can't be
+  // looked up.
+  std::shared_ptr<const GroupSet> groups(std::string_view username) {
+    return _groupResolver.resolve(username);
+  }
+
+  GroupResolver &groupResolver() {
+    return _groupResolver;
+  }
+
+  // Number of sessions kept.
+  size_t count() const {
+    return _sessions.size();
+  }
+
 private:
   std::shared_ptr<Session> store(Session &&session);
 
@@ -39,19 +66,20 @@ private:
   HObject _timer;
   std::wstring _localDomain;
   std::unordered_map<std::wstring_view, std::shared_ptr<Session>> _sessions;
+  GroupResolver _groupResolver;
 };
 
 class Session {
   friend class SessionManager;
 
-  // Password is a move reference in the hopes that we will get the only copy
-  // and erase it after we're done with it.
+  // The password is only used for the logon and isn't kept; callers should
+  // pass it from secure memory.
   Session(const SessionManager &manager, std::wstring_view username,
-          std::wstring_view domain, std::wstring &&password,
+          std::wstring_view domain, const wchar_t *password,
           unsigned ttlSeconds) noexcept;
 
   Session(const SessionManager &manager, std::wstring_view username,
-          std::wstring_view domain, std::wstring &&password) noexcept;
+          std::wstring_view domain, const wchar_t *password) noexcept;
 
 public:
   Session(const Session &) = delete;
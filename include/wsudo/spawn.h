@@ -0,0 +1,54 @@
+#ifndef WSUDO_SPAWN_H
+#define WSUDO_SPAWN_H
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Spawn requests ask the server to create an elevated process itself rather
+ * than replacing the token of a process the client created. The server
+ * creates it as a child of the client, so it inherits the client's console
+ * and the standard handles named in the request, and returns a handle to it
+ * that the client can wait on.
+ *
+ * This file only deals with the message encoding, which doesn't depend on
+ * Windows.
+ */
+
+namespace wsudo {
+
+// Longest command line, directory or environment block accepted, in UTF-16
+// code units.
+constexpr size_t MaxSpawnStringLength = 32767;
+
+struct SpawnRequest {
+  // Standard handles, as handle values in the client process. They must be
+  // inheritable there. Zero leaves a handle unset.
+  uint64_t input = 0;
+  uint64_t output = 0;
+  uint64_t error = 0;
+  std::wstring commandLine;
+  // Empty to start in the server's directory.
+  std::wstring currentDirectory;
+  // NUL-separated "name=value" strings, ending with an empty string. Empty
+  // to use the server's environment.
+  std::wstring environment;
+};
+
+// Encode a request as the body of a spawn message (without the header).
+//
+// Layout: u64 input, output and error handles; u32 lengths of the command
+// line, directory and environment; then the three strings as UTF-16 code
+// units, without terminators.
+std::vector<char> encodeSpawnRequest(const SpawnRequest &request);
+
+// Decode a spawn message body. Returns nothing if it is malformed.
+std::optional<SpawnRequest> decodeSpawnRequest(std::string_view body);
+
+} // namespace wsudo
+
+#endif // WSUDO_SPAWN_H
@@ -0,0 +1,19 @@
+#ifndef WSUDO_THREADSTACK_H
+#define WSUDO_THREADSTACK_H
+
+#include "wsudo.h"
+
+#include <string>
+
+namespace wsudo {
+
+// Briefly suspend `thread` and describe its stack, one "module+0xoffset"
+// frame per line, innermost first. The thread must be in this process, and
+// the handle needs THREAD_SUSPEND_RESUME, THREAD_GET_CONTEXT and
+// THREAD_QUERY_INFORMATION access. Only x64 stacks can be walked; elsewhere
+// this returns an empty string.
+std::string sampleThreadStack(HANDLE thread, size_t maxFrames = 32);
+
+} // namespace wsudo
+
+#endif // WSUDO_THREADSTACK_H
@@ -0,0 +1,152 @@
+#ifndef WSUDO_THROTTLE_H
+#define WSUDO_THROTTLE_H
+
+#include "wsudo.h"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace wsudo::server {
+
+using ThrottleClock = std::chrono::steady_clock;
+
+// Fixed size token bucket table. Each key (a 64-bit hash) gets a bucket that
+// holds up to `burst` tokens and gains one token every `refillInterval`.
+// The table is set associative, so lookups and updates touch at most `Ways`
+// slots and never allocate. When a set is full, the least recently updated
+// slot is recycled; a bucket that has refilled completely carries no
+// information, so recycling it is the same as forgetting a key that was never
+// limited.
+class TokenBucketTable {
+public:
+  constexpr static size_t Sets = 256;
+  constexpr static size_t Ways = 4;
+
+  explicit TokenBucketTable(unsigned burst,
+                            std::chrono::milliseconds refillInterval) noexcept;
+
+  // Returns true if the key has at least one token available.
+  bool allowed(uint64_t key, ThrottleClock::time_point now) const;
+
+  // Take one token from the key's bucket, creating a full bucket if there
+  // isn't one yet. Returns false if the bucket was already empty.
+  bool consume(uint64_t key, ThrottleClock::time_point now);
+
+private:
+  struct Slot {
+    uint64_t key;
+    // Time of the last update, in milliseconds since the clock's epoch.
+    int64_t updatedMs;
+    // Tokens available at updatedMs, in thousandths of a token.
+    uint32_t milliTokens;
+  };
+
+  uint32_t capacity() const { return _burst * 1000; }
+  uint32_t refilled(const Slot &slot, int64_t nowMs) const;
+
+  unsigned _burst;
+  int64_t _refillMs;
+  std::array<Slot, Sets * Ways> _slots{};
+};
+
+// Fixed size cache of recently seen keys that expire after a TTL. Like
+// TokenBucketTable, this is set associative and evicts the entry closest to
+// expiring when a set is full.
+class NegativeCache {
+public:
+  constexpr static size_t Sets = 256;
+  constexpr static size_t Ways = 4;
+
+  explicit NegativeCache(std::chrono::milliseconds ttl) noexcept;
+
+  // Returns true if the key was inserted less than one TTL ago.
+  bool contains(uint64_t key, ThrottleClock::time_point now) const;
+
+  // Add the key or refresh its expiration time.
+  void insert(uint64_t key, ThrottleClock::time_point now);
+
+private:
+  struct Slot {
+    uint64_t key;
+    int64_t expiresMs;
+  };
+
+  int64_t _ttlMs;
+  std::array<Slot, Sets * Ways> _slots{};
+};
+
+// A username as a client typed it, in the form the throttle counts it.
+// Windows compares account names without regard to case, and takes a local
+// account as "name", ".\name", "HOST\name" or "name@HOST", where HOST is
+// `localDomain`; all of these become "name". Other domains are kept. Only
+// ASCII letters are folded.
+std::string normalizeUsername(std::string_view username,
+                              std::string_view localDomain);
+
+// Rejects login attempts before any expensive verification happens. Failed
+// attempts are charged to the connecting user, both overall and for the
+// username it asked for, and the failed credential itself is remembered for a
+// short time so that replaying it is denied immediately. Successful logins
+// are never charged. Nothing is charged to a username alone, which any
+// client could otherwise use to lock its owner out.
+class LoginThrottle {
+public:
+  // Reasons for rejecting an attempt.
+  enum Verdict {
+    Allowed,
+    UserThrottled,
+    PeerThrottled,
+    RecentlyFailed,
+  };
+
+  // Requires sodium_init to have been called.
+  explicit LoginThrottle() noexcept;
+
+  // Keyed hash of a connecting user's identity (e.g. a SID). The key is
+  // random per server instance, so clients can't choose values that collide
+  // in the tables.
+  uint64_t hashPeer(const void *identity, size_t length) const;
+
+  // Keyed hash of a username as requested by one peer. Pass the name
+  // through normalizeUsername first, so spelling it differently doesn't
+  // reset the count.
+  uint64_t hashUser(uint64_t peerKey, std::string_view username) const;
+
+  // Keyed hash of a username/password pair, with the username normalized
+  // the same way. Only the hash is stored.
+  uint64_t hashCredential(std::string_view username,
+                          std::string_view password) const;
+
+  Verdict check(uint64_t userKey, uint64_t peerKey, uint64_t credentialKey,
+                ThrottleClock::time_point now = ThrottleClock::now()) const;
+
+  void recordFailure(uint64_t userKey, uint64_t peerKey, uint64_t credentialKey,
+                     ThrottleClock::time_point now = ThrottleClock::now());
+
+private:
+  constexpr static size_t KeySize = 32;
+
+  uint64_t hash(const void *data, size_t length, uint8_t domain) const;
+
+  std::array<unsigned char, KeySize> _key;
+  TokenBucketTable _users;
+  TokenBucketTable _peers;
+  NegativeCache _failures;
+};
+
+inline const char *verdictToString(LoginThrottle::Verdict verdict) {
+  switch (verdict) {
+    default: return "unknown";
+    case LoginThrottle::Allowed: return "allowed";
+    case LoginThrottle::UserThrottled: return "user throttled";
+    case LoginThrottle::PeerThrottled: return "peer throttled";
+    case LoginThrottle::RecentlyFailed: return "credential recently failed";
+  }
+}
+
+} // namespace wsudo::server
+
+#endif // WSUDO_THROTTLE_H
@@ -0,0 +1,101 @@
+#ifndef WSUDO_TICKET_H
+#define WSUDO_TICKET_H
+
+#include "wsudo.h"
+
+#include <array>
+#include <chrono>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Resumption tickets let a client that authenticated recently skip the
+ * credential exchange. After a successful CRED, the server seals the user
+ * name, the client's logon session and an expiration time with a secret key
+ * and hands the result to the client. Presenting it later is verified with a
+ * single authenticated decryption - no session lookup and no logon call. The
+ * keys are persisted, so tickets survive a server restart.
+ */
+
+namespace wsudo::server {
+
+// How long a ticket is valid after it is issued.
+constexpr std::chrono::seconds TicketLifetime{60 * 10};
+
+// How often a new ticket key is generated. Must be longer than
+// TicketLifetime, since only the current and previous keys are kept.
+constexpr std::chrono::seconds TicketKeyRotation{60 * 60};
+
+// What a ticket vouches for.
+struct TicketClaims {
+  std::string username;
+  // The client's logon session (TOKEN_STATISTICS::AuthenticationId).
+  uint64_t logonId;
+  // Unix time in seconds.
+  int64_t expiresAt;
+};
+
+// The current and previous ticket keys.
+class TicketKeyRing {
+public:
+  constexpr static size_t KeySize = 32;
+
+  struct Key {
+    uint32_t id;
+    // Unix time in seconds.
+    int64_t createdAt;
+    std::array<unsigned char, KeySize> bytes;
+  };
+
+  TicketKeyRing() = default;
+  TicketKeyRing(const TicketKeyRing &) = delete;
+  TicketKeyRing &operator=(const TicketKeyRing &) = delete;
+  ~TicketKeyRing();
+
+  // Generate a new key if there is none or the current one is older than
+  // TicketKeyRotation. Returns true if the ring changed.
+  bool rotate(int64_t now);
+
+  // The key to issue new tickets with, or null if there are no keys.
+  const Key *current() const;
+
+  // Find a key to verify a ticket with.
+  const Key *find(uint32_t id) const;
+
+  // Load keys from a file protected with DPAPI. Returns false if the file
+  // doesn't exist or can't be decrypted, leaving the ring empty.
+  bool load(const std::wstring &path);
+
+  // Save keys to a file readable only by SYSTEM and Administrators.
+  bool save(const std::wstring &path) const;
+
+private:
+  // Index 0 is the current key.
+  std::array<Key, 2> _keys{};
+  size_t _count = 0;
+};
+
+// Seal claims into a ticket with the ring's current key.
+std::vector<char> issueTicket(const TicketKeyRing &keys,
+                              const TicketClaims &claims);
+
+// Verify and decrypt a ticket. Returns nothing if the ticket was forged,
+// tampered with, sealed with a retired key, or has expired.
+std::optional<TicketClaims> openTicket(const TicketKeyRing &keys,
+                                       std::string_view ticket, int64_t now);
+
+// Current Unix time in seconds.
+inline int64_t unixNow() {
+  return std::chrono::duration_cast<std::chrono::seconds>(
+    std::chrono::system_clock::now().time_since_epoch()
+  ).count();
+}
+
+// Default location of the ticket key file, under ProgramData.
+std::wstring defaultTicketKeyPath();
+
+} // namespace wsudo::server
+
+#endif // WSUDO_TICKET_H
@@ -0,0 +1,84 @@
+#ifndef WSUDO_TRACE_H
+#define WSUDO_TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/**
+ * Span tracing for finding where a request spends its time.
+ *
+ * A span is a name, a track and a start and end time. Each thread records
+ * spans into its own fixed-size ring, overwriting the oldest, and
+ * exportJson() collects them all as Chrome trace events (load the file in
+ * chrome://tracing or Perfetto). Tracks show up as separate rows; the server
+ * uses one per client slot, so requests handled on the same thread don't
+ * overlap.
+ *
+ * Tracing is off by default. When it's off, a span is one relaxed load and a
+ * branch that is always taken the same way.
+ */
+
+namespace wsudo::trace {
+
+namespace detail {
+  inline std::atomic<bool> g_enabled{false};
+}
+
+inline bool enabled() {
+  return detail::g_enabled.load(std::memory_order_relaxed);
+}
+
+// Start recording, with room for `eventsPerThread` spans per thread.
+void enable(size_t eventsPerThread = 64 * 1024);
+// Stop recording. Recorded spans are kept.
+void disable();
+// Forget every recorded span.
+void clear();
+
+// Monotonic time in nanoseconds.
+uint64_t now();
+
+// Record a finished span. `name` must outlive the trace; use a literal.
+void record(const char *name, uint32_t track, uint64_t start, uint64_t end);
+
+// Give a track a name in the exported trace.
+void nameTrack(uint32_t track, std::string name);
+
+struct Stats {
+  uint64_t recorded = 0;
+  // Spans lost to full rings.
+  uint64_t overwritten = 0;
+};
+
+Stats stats();
+
+// Every recorded span as a Chrome trace event file, oldest first.
+std::string exportJson(uint32_t processId = 0);
+
+// Records the time from construction to destruction, if tracing was enabled
+// at construction.
+class Span {
+public:
+  Span(const char *name, uint32_t track) noexcept
+    : _name{name}, _track{track}, _start{enabled() ? now() : 0}
+  {}
+
+  ~Span() {
+    if (_start) {
+      record(_name, _track, _start, now());
+    }
+  }
+
+  Span(const Span &) = delete;
+  Span &operator=(const Span &) = delete;
+
+private:
+  const char *_name;
+  uint32_t _track;
+  uint64_t _start;
+};
+
+} // namespace wsudo::trace
+
+#endif // WSUDO_TRACE_H
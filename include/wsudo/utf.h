@@ -0,0 +1,39 @@
+#ifndef WSUDO_UTF_H
+#define WSUDO_UTF_H
+
+#include <cstddef>
+#include <optional>
+#include <string_view>
+
+namespace wsudo::utf {
+
+// What to do with invalid input: ill-formed UTF-8 (including overlong forms,
+// encoded surrogates and code points past U+10FFFF) or unpaired UTF-16
+// surrogates.
+enum class Errors {
+  // Fail the conversion.
+  Fail,
+  // Write U+FFFD in place of each maximal invalid subsequence, like
+  // MultiByteToWideChar does.
+  Replace,
+};
+
+// Convert between UTF-8 and UTF-16 into a caller's buffer, in the style of
+// MultiByteToWideChar: with a null `out`, nothing is written and the return
+// value is the exact length of the output, so a buffer can be sized once.
+// Otherwise returns the number of code units written. Returns nullopt if the
+// input is invalid and `errors` is Fail, or if the output doesn't fit in
+// `capacity` units.
+//
+// Runs of ASCII are converted 16 or 32 bytes at a time with SSE2 or AVX2
+// when those are available at compile time.
+std::optional<size_t> utf8ToUtf16(std::string_view in, char16_t *out,
+                                  size_t capacity,
+                                  Errors errors = Errors::Fail);
+std::optional<size_t> utf16ToUtf8(std::u16string_view in, char *out,
+                                  size_t capacity,
+                                  Errors errors = Errors::Fail);
+
+} // namespace wsudo::utf
+
+#endif // WSUDO_UTF_H
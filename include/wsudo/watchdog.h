@@ -0,0 +1,131 @@
+#ifndef WSUDO_WATCHDOG_H
+#define WSUDO_WATCHDOG_H
+
+#include "metrics.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+
+/**
+ * Event loop stall detection.
+ *
+ * The event loop marks the start and end of each handler call on a
+ * Heartbeat, which costs a few relaxed stores. A Watchdog thread polls it,
+ * and when one call has run longer than a threshold, it reports which
+ * handler it was, what state the handler was in and how long it has run,
+ * with a sample of the loop thread's stack if it can take one. Each stall is
+ * reported once, and logging is rate limited so a loop that keeps stalling
+ * doesn't flood the log.
+ */
+
+namespace wsudo::watchdog {
+
+using Clock = std::chrono::steady_clock;
+
+// Written by one loop thread, read by the watchdog.
+class Heartbeat {
+public:
+  struct Beat {
+    // Distinguishes handler calls; a stall is reported once per call.
+    uint64_t sequence;
+    Clock::time_point start;
+    size_t handler;
+    // From EventHandler::stateName; a static string.
+    const char *state;
+  };
+
+  // A handler call is starting. `state` must be a static string.
+  void begin(size_t handler, const char *state,
+             Clock::time_point now = Clock::now()) noexcept;
+  // The call returned.
+  void end() noexcept;
+
+  // The call in progress, or nothing if the loop is between calls.
+  std::optional<Beat> current() const noexcept;
+
+private:
+  // Odd while a call is in progress.
+  std::atomic<uint64_t> _sequence{0};
+  std::atomic<Clock::rep> _start{0};
+  std::atomic<size_t> _handler{0};
+  std::atomic<const char *> _state{nullptr};
+};
+
+struct Stall {
+  size_t handler;
+  const char *state;
+  // How long the call had run when it was noticed.
+  Clock::duration elapsed;
+  // The loop thread's stack, if sampled.
+  std::string stack;
+};
+
+struct Options {
+  // A handler call running this long is a stall.
+  Clock::duration threshold = std::chrono::milliseconds{500};
+  // At most one stall is logged per interval; the rest are counted.
+  Clock::duration logInterval = std::chrono::seconds{10};
+  // Samples the loop thread's stack, if set. Runs on the watchdog thread
+  // while the loop is stalled.
+  std::function<std::string()> sampleStack;
+  // Logs a stall, if set. Called at most once per logInterval, with the
+  // number of stalls that weren't logged since the last call.
+  std::function<void(const Stall &, uint64_t suppressed)> log;
+  // Counts stalls, if set.
+  metrics::Counter *stalls = nullptr;
+};
+
+class Watchdog {
+public:
+  struct Stats {
+    uint64_t stalls = 0;
+    // Stalls that weren't logged because of the rate limit.
+    uint64_t suppressed = 0;
+  };
+
+  // Call start() to poll on a thread, or check() directly.
+  explicit Watchdog(const Heartbeat &heartbeat, Options options = {});
+  // Calls stop().
+  ~Watchdog();
+
+  Watchdog(const Watchdog &) = delete;
+  Watchdog &operator=(const Watchdog &) = delete;
+
+  // Poll on a thread, a few times per threshold.
+  void start();
+  void stop();
+
+  // Look at the heartbeat once. Returns a new stall, after passing it to
+  // Options::log if the rate limit allows.
+  std::optional<Stall> check(Clock::time_point now = Clock::now());
+
+  Stats stats() const;
+
+private:
+  const Heartbeat &_heartbeat;
+  Options _options;
+  // The last call reported, so each is only reported once.
+  uint64_t _reported = 0;
+  std::optional<Clock::time_point> _lastLog;
+  std::atomic<uint64_t> _stalls{0};
+  std::atomic<uint64_t> _suppressed{0};
+  uint64_t _suppressedSinceLog = 0;
+
+  std::mutex _mutex;
+  std::condition_variable _wake;
+  bool _stopping = false;
+  std::thread _thread;
+
+  void run();
+};
+
+} // namespace wsudo::watchdog
+
+#endif // WSUDO_WATCHDOG_H
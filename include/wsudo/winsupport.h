@@ -3,13 +3,16 @@
 #else
 #define WSUDO_WINSUPPORT_H
 
+#include <cstdint>
 #include <exception>
+#include <optional>
 #include <string>
 #include <string_view>
 #include <type_traits>
 
 namespace wsudo {
 
+// Invalid input (unpaired surrogates or ill-formed UTF-8) becomes U+FFFD.
 std::string to_utf8(std::wstring_view utf16str);
 std::wstring to_utf16(std::string_view utf8str);
 
@@ -17,6 +20,40 @@ std::wstring to_utf16(std::string_view utf8str);
 // Returns false if the API was not found or failed.
 bool setThreadName(const wchar_t *name);
 
+// Pack a LUID into an integer.
+inline uint64_t luidToInt(const LUID &luid) {
+  return (static_cast<uint64_t>(static_cast<uint32_t>(luid.HighPart)) << 32) |
+         luid.LowPart;
+}
+
+// Logon session ID of a token.
+std::optional<uint64_t> tokenLogonId(HANDLE token);
+
+// Logon session ID of a process. The handle needs
+// PROCESS_QUERY_LIMITED_INFORMATION access.
+std::optional<uint64_t> processLogonId(HANDLE process);
+
+// Security descriptor, as SDDL, for files and directories only SYSTEM and
+// Administrators can use. Administrators own it, and the DACL is protected so
+// nothing is inherited from the parent.
+extern const wchar_t *const AdminOnlySddl;
+
+// Create a directory with AdminOnlySddl. If it already exists, it is taken
+// over the same way, since whoever created it may have left it writable by
+// other users. Returns false if it can't be created or secured.
+bool createAdminDirectory(const std::wstring &path);
+
+// createAdminDirectory for `path`'s parent, then for `path`. For directories
+// under wsudo's own directory in ProgramData, which holds the policy, so it
+// must be secured before anything is created in it. Never pass a top level
+// directory, or its parent (ProgramData itself) will be taken over.
+bool createAdminDirectoryTree(const std::wstring &path);
+
+// True if a file or directory is owned by SYSTEM or Administrators and no
+// one else may write, delete or take it over. The handle needs READ_CONTROL
+// access.
+bool isAdminOnly(HANDLE file);
+
 // Convert a "GetLastError" code to string.
 std::string lastErrorString(DWORD status);
 
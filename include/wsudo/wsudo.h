@@ -8,6 +8,7 @@
 #undef min
 #undef max
 #include "winsupport.h"
+#include "callback.h"
 
 // Winternl.h and NTSecAPI.h both define some of the same types so
 // we can't include both in the same file. Thanks Microsoft.
@@ -20,6 +21,16 @@
 #include <spdlog/spdlog.h>
 #include <spdlog/logger.h>
 
+// Log calls below this level are compiled out. Release builds keep info and
+// up unless told otherwise.
+#ifndef WSUDO_LOG_LEVEL
+#  ifdef NDEBUG
+#    define WSUDO_LOG_LEVEL SPDLOG_LEVEL_INFO
+#  else
+#    define WSUDO_LOG_LEVEL SPDLOG_LEVEL_TRACE
+#  endif
+#endif
+
 #include <cstdint>
 #include <cassert>
 #include <cstdio>
@@ -29,12 +40,18 @@ namespace wsudo {
 /// File path to the client-server communication pipe.
 extern const wchar_t *const PipeFullPath;
 
+/// File path to the server's admin pipe, which only SYSTEM and
+/// Administrators can open.
+extern const wchar_t *const AdminPipeFullPath;
+
 /// Pipe's buffer size in bytes.
 constexpr size_t PipeBufferSize = 1024;
 
 // Maximum concurrent server connections. Being sudo, it's unlikely to have to
 // process many things concurrently, but we have to give Windows a number.
-constexpr int MaxPipeConnections = 3;
+// When the server is overloaded, clients that get an instance are told to
+// retry (see AdmissionController) instead of waiting in line.
+constexpr int MaxPipeConnections = 8;
 
 // Pipe timeout, again for Windows.
 constexpr int PipeDefaultTimeout = 0;
@@ -44,18 +61,27 @@ constexpr int PipeDefaultTimeout = 0;
 namespace msg {
   /// Client->Server message headers
   namespace client {
-    /// Query session - server should tell how, if possible, to create the
-    /// session.
+    /// Query session - answered with Success if this connection is already
+    /// authenticated, or AccessDenied if it needs credentials or a ticket
     extern const char *const QuerySession;
     /// User credentials message
     extern const char *const Credential;
-    /// Bless (elevate process) request message
+    /// Bless (elevate process) request message; followed by up to
+    /// MaxBlessTargets process handles
     extern const char *const Bless;
+    /// Resume a session with a ticket from a previous credential message
+    extern const char *const Resume;
+    /// Spawn (create an elevated process) request message; followed by an
+    /// encoded SpawnRequest
+    extern const char *const Spawn;
   }
 
   /// Server->Client message headers
   namespace server {
-    /// Success
+    /// Success; a response to a credential message is followed by a
+    /// resumption ticket, a response to a bless message by a BlessStatus
+    /// for each handle, and a response to a spawn message by the new
+    /// process's 64-bit handle value (in the client) and 32-bit ID
     extern const char *const Success;
     /// Invalid message
     extern const char *const InvalidMessage;
@@ -63,6 +89,43 @@ namespace msg {
     extern const char *const InternalError;
     /// Access denied
     extern const char *const AccessDenied;
+    /// Server is overloaded; followed by a 32-bit retry delay hint in
+    /// milliseconds.
+    extern const char *const Busy;
+  }
+
+  /// Admin->Server message headers, on the admin pipe. The server answers
+  /// with a Success message followed by the result, or an error message.
+  namespace admin {
+    /// Runtime metrics; answered with Prometheus text
+    extern const char *const Metrics;
+    /// Write a flight recorder dump; answered with the dump's UTF-8 path
+    extern const char *const FlightDump;
+  }
+
+  /// Maximum number of processes in one bless message.
+  constexpr size_t MaxBlessTargets = 64;
+
+  /// Result for each process in a bless response, sent as 32 bits.
+  enum BlessStatus : uint32_t {
+    BlessOk = 0,
+    /// The server couldn't duplicate the handle from the client.
+    BlessBadHandle = 1,
+    /// The server couldn't assign the token.
+    BlessTokenFailed = 2,
+    /// The server's policy doesn't allow the user to elevate the program.
+    BlessDenied = 3,
+  };
+
+  /// Returns a description of a BlessStatus.
+  inline const char *blessStatusToString(BlessStatus status) {
+    switch (status) {
+      default: return "unknown error";
+      case BlessOk: return "ok";
+      case BlessBadHandle: return "invalid process handle";
+      case BlessTokenFailed: return "token substitution failed";
+      case BlessDenied: return "denied by policy";
+    }
   }
 } // namespace msg
 
@@ -74,6 +137,19 @@ extern std::shared_ptr<spdlog::logger> g_outLogger;
 // Logger that prints to stderr.
 extern std::shared_ptr<spdlog::logger> g_errLogger;
 
+class AsyncLogWriter;
+
+// Point g_outLogger and g_errLogger at stdout and stderr through an
+// AsyncLogWriter (asynclog.h), so logging never waits on the console. With
+// `colors`, the console is switched to VT mode for level colors. Call stop()
+// on the result before exiting to write what is left.
+std::shared_ptr<AsyncLogWriter> startAsyncLogging(bool colors);
+
+// Whether calls at a level are compiled in.
+constexpr bool enabled(spdlog::level::level_enum level) {
+  return level >= WSUDO_LOG_LEVEL;
+}
+
 /// Print to stdout with no prefix.
 template<typename... Args>
 static inline void print(const char *fmt, Args &&...args)
@@ -86,33 +162,51 @@ static inline void eprint(const char *fmt, Args &&...args)
 
 /// Trace logger.
 template<typename... Args>
-static inline void trace(const char *fmt, Args &&...args)
-{ g_outLogger->trace(fmt, std::forward<Args>(args)...); }
+static inline void trace(const char *fmt, Args &&...args) {
+  if constexpr (enabled(spdlog::level::trace)) {
+    g_outLogger->trace(fmt, std::forward<Args>(args)...);
+  }
+}
 
 /// Debug logger.
 template<typename... Args>
-static inline void debug(const char *fmt, Args &&...args)
-{ g_outLogger->debug(fmt, std::forward<Args>(args)...); }
+static inline void debug(const char *fmt, Args &&...args) {
+  if constexpr (enabled(spdlog::level::debug)) {
+    g_outLogger->debug(fmt, std::forward<Args>(args)...);
+  }
+}
 
 /// Info logger.
 template<typename... Args>
-static inline void info(const char *fmt, Args &&...args)
-{ g_outLogger->info(fmt, std::forward<Args>(args)...); }
+static inline void info(const char *fmt, Args &&...args) {
+  if constexpr (enabled(spdlog::level::info)) {
+    g_outLogger->info(fmt, std::forward<Args>(args)...);
+  }
+}
 
 /// Warning logger.
 template<typename... Args>
-static inline void warn(const char *fmt, Args &&...args)
-{ g_errLogger->warn(fmt, std::forward<Args>(args)...); }
+static inline void warn(const char *fmt, Args &&...args) {
+  if constexpr (enabled(spdlog::level::warn)) {
+    g_errLogger->warn(fmt, std::forward<Args>(args)...);
+  }
+}
 
 /// Error logger.
 template<typename... Args>
-static inline void error(const char *fmt, Args &&...args)
-{ g_errLogger->error(fmt, std::forward<Args>(args)...); }
+static inline void error(const char *fmt, Args &&...args) {
+  if constexpr (enabled(spdlog::level::err)) {
+    g_errLogger->error(fmt, std::forward<Args>(args)...);
+  }
+}
 
 /// Critical logger.
 template<typename... Args>
-static inline void critical(const char *fmt, Args &&...args)
-{ g_errLogger->critical(fmt, std::forward<Args>(args)...); }
+static inline void critical(const char *fmt, Args &&...args) {
+  if constexpr (enabled(spdlog::level::critical)) {
+    g_errLogger->critical(fmt, std::forward<Args>(args)...);
+  }
+}
 
 // wchar_t loggers (not currently working).
 #ifndef WSUDO_WCHAR_T_LOGGING
@@ -129,117 +223,56 @@ static inline void eprint(const wchar_t *fmt, Args &&...args)
 
 /// Trace logger (wchar_t version).
 template<typename... Args>
-static inline void trace(const wchar_t *fmt, Args &&...args)
-{ g_outLogger->trace(fmt, std::forward<Args>(args)...); }
+static inline void trace(const wchar_t *fmt, Args &&...args) {
+  if constexpr (enabled(spdlog::level::trace)) {
+    g_outLogger->trace(fmt, std::forward<Args>(args)...);
+  }
+}
 
 /// Debug logger (wchar_t version).
 template<typename... Args>
-static inline void debug(const wchar_t *fmt, Args &&...args)
-{ g_outLogger->debug(fmt, std::forward<Args>(args)...); }
+static inline void debug(const wchar_t *fmt, Args &&...args) {
+  if constexpr (enabled(spdlog::level::debug)) {
+    g_outLogger->debug(fmt, std::forward<Args>(args)...);
+  }
+}
 
 /// Info logger (wchar_t version).
 template<typename... Args>
-static inline void info(const wchar_t *fmt, Args &&...args)
-{ g_outLogger->info(fmt, std::forward<Args>(args)...); }
+static inline void info(const wchar_t *fmt, Args &&...args) {
+  if constexpr (enabled(spdlog::level::info)) {
+    g_outLogger->info(fmt, std::forward<Args>(args)...);
+  }
+}
 
 /// Warning logger (wchar_t version).
 template<typename... Args>
-static inline void warn(const wchar_t *fmt, Args &&...args)
-{ g_errLogger->warn(fmt, std::forward<Args>(args)...); }
+static inline void warn(const wchar_t *fmt, Args &&...args) {
+  if constexpr (enabled(spdlog::level::warn)) {
+    g_errLogger->warn(fmt, std::forward<Args>(args)...);
+  }
+}
 
 /// Error logger (wchar_t version).
 template<typename... Args>
-static inline void error(const wchar_t *fmt, Args &&...args)
-{ g_errLogger->error(fmt, std::forward<Args>(args)...); }
+static inline void error(const wchar_t *fmt, Args &&...args) {
+  if constexpr (enabled(spdlog::level::err)) {
+    g_errLogger->error(fmt, std::forward<Args>(args)...);
+  }
+}
 
 /// Critical logger (wchar_t version).
 template<typename... Args>
-static inline void critical(const wchar_t *fmt, Args &&...args)
-{ g_errLogger->critical(fmt, std::forward<Args>(args)...); }
+static inline void critical(const wchar_t *fmt, Args &&...args) {
+  if constexpr (enabled(spdlog::level::critical)) {
+    g_errLogger->critical(fmt, std::forward<Args>(args)...);
+  }
+}
 
 #endif
 
 } // namespace log
 
-// Wrapper for a function that returns a pointer of its own type, enabling
-// endless recursive callbacks.
-template<typename... Args>
-struct recursive_callback {
-  using pointer = recursive_callback (*)(Args...);
-
-  // Default (null pointer) constructor.
-  constexpr recursive_callback() noexcept
-    : function{nullptr}
-  {}
-
-  // Implicit conversion from pointer type.
-  constexpr recursive_callback(pointer function) noexcept
-    : function{function}
-  {}
-
-  // Copy
-  recursive_callback(const recursive_callback &) = default;
-
-  // Copy assign
-  recursive_callback & operator=(const recursive_callback &) = default;
-
-  // Call the function, returning the next callback.
-  constexpr inline recursive_callback operator()(Args &&...args) const {
-    return function(std::forward<Args>(args)...);
-  }
-
-  // Call the function, replacing it with the returned callback.
-  constexpr inline bool call_and_swap(Args &&...args) {
-    function = function(std::forward<Args>(args)...);
-    return !!function;
-  }
-
-  // Null check.
-  constexpr explicit operator bool() const { return !!function; }
-
-private:
-  pointer function;
-};
-
-// Wrapper for recursive member function callbacks.
-template<typename T, typename... Args>
-struct recursive_mem_callback {
-  using pointer = recursive_mem_callback (T::*)(Args...);
-
-  // Default (null pointer) constructor.
-  constexpr recursive_mem_callback() noexcept
-    : function{nullptr}
-  {}
-
-  // Implicit conversion from member pointer type.
-  constexpr recursive_mem_callback(pointer function) noexcept
-    : function{function}
-  {}
-
-  // Copy.
-  recursive_mem_callback(const recursive_mem_callback &) = default;
-
-  // Copy assign.
-  recursive_mem_callback & operator=(const recursive_mem_callback &) = default;
-
-  // Call the function, returning the next callback.
-  constexpr inline recursive_mem_callback operator()(T &self, Args &&...args) {
-    return (self.*function)(std::forward<Args>(args)...);
-  }
-
-  // Call the function, replacing it with the returned callback.
-  constexpr inline bool call_and_swap(T &self, Args &&...args) {
-    function = (self.*function)(std::forward<Args>(args)...).function;
-    return !!function;
-  }
-
-  // Null check.
-  constexpr explicit operator bool() const { return !!function; }
-
-private:
-  pointer function;
-};
-
 namespace detail {
   /// RAII wrapper to run a function when the scope exits.
   template<typename OnExit,
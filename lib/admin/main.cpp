@@ -0,0 +1,109 @@
+#include "wsudo/wsudo.h"
+
+#include <cstring>
+#include <optional>
+#include <string>
+
+using namespace wsudo;
+
+// Exit codes.
+enum : int {
+  AdminExitOk = 0,
+  AdminExitInvalidUsage = 1,
+  AdminExitRequestFailed = 2,
+  AdminExitIOError = 3,
+};
+
+// Helpers {{{
+
+namespace {
+  void usage() {
+    log::eprint(
+      "Usage: wsudo-admin <request>\n"
+      "Sends a request to the server's admin pipe. Needs an elevated\n"
+      "console.\n"
+      "  metrics  Print the server's metrics in Prometheus text format\n"
+      "  dump     Write a flight recorder dump and print its path\n"
+    );
+  }
+
+  // The whole response message, or nullopt if the exchange failed.
+  std::optional<std::string> request(const char *header) {
+    HANDLE handle = CreateFileW(AdminPipeFullPath,
+                                GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+                                OPEN_EXISTING, 0, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+      log::eprint("Couldn't connect to the server's admin pipe: {}\n",
+                  lastErrorString());
+      return std::nullopt;
+    }
+    HObject pipe{handle};
+    DWORD mode = PIPE_READMODE_MESSAGE;
+    if (!SetNamedPipeHandleState(pipe, &mode, nullptr, nullptr)) {
+      log::eprint("Couldn't set pipe mode: {}\n", lastErrorString());
+      return std::nullopt;
+    }
+
+    DWORD bytes;
+    if (!WriteFile(pipe, header, 4, &bytes, nullptr) || bytes != 4) {
+      log::eprint("Couldn't send request: {}\n", lastErrorString());
+      return std::nullopt;
+    }
+
+    // Metrics are longer than one pipe buffer; read until the message ends.
+    std::string response;
+    while (true) {
+      auto offset = response.size();
+      response.resize(offset + PipeBufferSize);
+      if (ReadFile(pipe, response.data() + offset, PipeBufferSize, &bytes,
+                   nullptr))
+      {
+        response.resize(offset + bytes);
+        return response;
+      }
+      if (GetLastError() != ERROR_MORE_DATA) {
+        log::eprint("Couldn't read response: {}\n", lastErrorString());
+        return std::nullopt;
+      }
+      response.resize(offset + bytes);
+    }
+  }
+}
+
+// }}}
+
+int wmain(int argc, wchar_t *argv[]) {
+  if (argc != 2) {
+    usage();
+    return AdminExitInvalidUsage;
+  }
+  std::wstring_view command{argv[1]};
+  const char *header;
+  if (command == L"metrics") {
+    header = msg::admin::Metrics;
+  } else if (command == L"dump") {
+    header = msg::admin::FlightDump;
+  } else {
+    usage();
+    return AdminExitInvalidUsage;
+  }
+
+  auto response = request(header);
+  if (!response) {
+    return AdminExitIOError;
+  }
+  if (response->size() < 4) {
+    log::eprint("Invalid response from the server.\n");
+    return AdminExitIOError;
+  }
+  std::string_view body{response->data() + 4, response->size() - 4};
+  if (std::memcmp(response->data(), msg::server::Success, 4)) {
+    log::eprint("Server error: {}\n", body);
+    return AdminExitRequestFailed;
+  }
+  log::print("{}", body);
+  if (header == msg::admin::FlightDump) {
+    log::print("\n");
+  }
+  return AdminExitOk;
+}
@@ -0,0 +1,314 @@
+#include "wsudo/agent.h"
+
+#include <sddl.h>
+
+using namespace wsudo;
+using namespace wsudo::agent;
+using namespace wsudo::events;
+
+// {{{ AgentContext
+
+bool AgentContext::reconnect() {
+  auto connection = std::make_unique<ClientConnection>(PipeFullPath);
+  auto ticket = loadTicket();
+  if (!*connection || ticket.empty() || !connection->resume(ticket)) {
+    server = nullptr;
+    return false;
+  }
+  server = std::move(connection);
+  return true;
+}
+
+void AgentContext::resetIdleTimer() {
+  // Negative times are relative, in 100ns units.
+  LARGE_INTEGER dueTime;
+  dueTime.QuadPart = -std::chrono::duration_cast<std::chrono::microseconds>(
+    AgentIdleTimeout
+  ).count() * 10;
+  SetWaitableTimer(idleTimer, &dueTime, 0, nullptr, nullptr, false);
+}
+
+// }}} AgentContext
+
+HObject wsudo::agent::createAgentPipe(const std::wstring &pipeName,
+                                      bool firstInstance)
+{
+  // Allow only the current user.
+  HObject token;
+  if (!OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &token)) {
+    return HObject{};
+  }
+  alignas(TOKEN_USER) char buffer[sizeof(TOKEN_USER) + SECURITY_MAX_SID_SIZE];
+  DWORD length;
+  if (!GetTokenInformation(token, TokenUser, buffer, sizeof(buffer), &length)) {
+    return HObject{};
+  }
+  HLocalPtr<LPWSTR> sidString;
+  if (!ConvertSidToStringSidW(reinterpret_cast<TOKEN_USER *>(buffer)->User.Sid,
+                              &sidString))
+  {
+    return HObject{};
+  }
+  std::wstring sddl = L"D:P(A;;GA;;;";
+  sddl.append(sidString);
+  sddl.append(L")");
+  HLocalPtr<PSECURITY_DESCRIPTOR> securityDescriptor;
+  if (!ConvertStringSecurityDescriptorToSecurityDescriptorW(
+        sddl.c_str(), SDDL_REVISION_1, &securityDescriptor, nullptr))
+  {
+    return HObject{};
+  }
+  SECURITY_ATTRIBUTES secAttr;
+  secAttr.nLength = sizeof(SECURITY_ATTRIBUTES);
+  secAttr.bInheritHandle = false;
+  secAttr.lpSecurityDescriptor = securityDescriptor;
+
+  // Claiming the first instance makes sure nobody else is squatting on the
+  // name.
+  DWORD openMode = PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED;
+  if (firstInstance) {
+    openMode |= FILE_FLAG_FIRST_PIPE_INSTANCE;
+  }
+  HANDLE pipe = CreateNamedPipeW(pipeName.c_str(), openMode,
+                                 PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE |
+                                   PIPE_REJECT_REMOTE_CLIENTS,
+                                 MaxAgentConnections, PipeBufferSize,
+                                 PipeBufferSize, PipeDefaultTimeout,
+                                 &secAttr);
+  if (pipe == INVALID_HANDLE_VALUE) {
+    return HObject{};
+  }
+  return HObject{pipe};
+}
+
+// {{{ AgentConnectionHandler
+
+AgentConnectionHandler::AgentConnectionHandler(
+  HObject pipe, int clientId, AgentContext &context
+) noexcept
+  : EventOverlappedIO{true},
+    _pipe{std::move(pipe)},
+    _clientId{clientId},
+    _context{context},
+    _callback{&Self::beginConnect}
+{
+}
+
+bool AgentConnectionHandler::reset() {
+  EventOverlappedIO::reset();
+
+  if (!DisconnectNamedPipe(_pipe) &&
+      GetLastError() != ERROR_PIPE_NOT_CONNECTED)
+  {
+    return false;
+  }
+  log::debug("Front-end {}: Resetting connection.", _clientId);
+  _callback = &Self::beginConnect;
+  SetEvent(_overlapped.hEvent);
+  return true;
+}
+
+EventStatus AgentConnectionHandler::operator()(EventListener &listener) {
+  switch (EventOverlappedIO::operator()(listener)) {
+    case EventStatus::Finished:
+      break;
+    case EventStatus::Failed:
+      return EventStatus::Failed;
+    case EventStatus::Ok:
+      return EventStatus::Ok;
+  }
+
+  if (!_callback || !_callback.call_and_swap(*this)) {
+    return EventStatus::Failed;
+  }
+  if (!_context.server) {
+    log::info("Lost the server connection; exiting.");
+    listener.stop();
+  }
+  return EventStatus::Ok;
+}
+
+void AgentConnectionHandler::createResponse(const char *header,
+                                            std::string_view message)
+{
+  assert(strlen(header) == 4);
+  _buffer.resize(4 + message.length());
+  std::memcpy(_buffer.data(), header, 4);
+  if (message.length()) {
+    std::memcpy(_buffer.data() + 4, message.data(), message.length());
+  }
+}
+
+AgentConnectionHandler::Callback
+AgentConnectionHandler::beginConnect() {
+  if (ConnectNamedPipe(_pipe, &_overlapped)) {
+    return read();
+  }
+
+  switch (GetLastError()) {
+  case ERROR_IO_PENDING:
+    return &Self::endConnect;
+  case ERROR_PIPE_CONNECTED:
+    return endConnect();
+  default:
+    log::error("Front-end {}: ConnectNamedPipe failed: {}", _clientId,
+               lastErrorString());
+    return nullptr;
+  }
+}
+
+AgentConnectionHandler::Callback
+AgentConnectionHandler::endConnect() {
+  DWORD dummyBytesTransferred;
+  if (!GetOverlappedResult(_pipe, &_overlapped,
+                           &dummyBytesTransferred, false))
+  {
+    if (GetLastError() != ERROR_BROKEN_PIPE) {
+      log::error("Front-end {}: error finalizing connection: {}", _clientId,
+                 lastErrorString());
+    }
+    return nullptr;
+  }
+  return read();
+}
+
+AgentConnectionHandler::Callback
+AgentConnectionHandler::read() {
+  switch (readToBuffer()) {
+    case EventStatus::Failed:
+      return nullptr;
+    case EventStatus::Finished:
+      return respond();
+    case EventStatus::Ok:
+      return &Self::respond;
+    default:
+      WSUDO_UNREACHABLE("Invalid EventStatus");
+  }
+}
+
+AgentConnectionHandler::Callback
+AgentConnectionHandler::respond() {
+  Callback nextCb = &Self::resetConnection;
+  if (dispatchMessage()) {
+    nextCb = &Self::read;
+  }
+
+  switch (writeFromBuffer()) {
+    case EventStatus::Ok:
+      return nextCb;
+    case EventStatus::Failed:
+      return nullptr;
+    case EventStatus::Finished:
+      return nextCb(*this);
+    default:
+      WSUDO_UNREACHABLE("Invalid EventStatus");
+  }
+}
+
+AgentConnectionHandler::Callback
+AgentConnectionHandler::resetConnection() {
+  if (!reset()) {
+    log::error("Front-end {}: Reset failed.", _clientId);
+    return nullptr;
+  }
+  return &Self::beginConnect;
+}
+
+bool AgentConnectionHandler::dispatchMessage() {
+  _context.resetIdleTimer();
+
+  if (!isSameLogonSession()) {
+    createResponse(msg::server::AccessDenied, "Wrong logon session.");
+    return false;
+  }
+
+  // The agent is already authorized, so it only handles bless requests.
+  if (_buffer.size() < 4 ||
+      std::memcmp(_buffer.data(), msg::client::Bless, 4))
+  {
+    log::warn("Front-end {}: Invalid message.", _clientId);
+    createResponse(msg::server::InvalidMessage);
+    return false;
+  }
+  auto count = (_buffer.size() - 4) / sizeof(HANDLE);
+  if ((_buffer.size() - 4) % sizeof(HANDLE) != 0 || count == 0 ||
+      count > msg::MaxBlessTargets)
+  {
+    log::warn("Front-end {}: Invalid bless message.", _clientId);
+    createResponse(msg::server::InvalidMessage);
+    return false;
+  }
+
+  HANDLE remoteHandles[msg::MaxBlessTargets];
+  std::memcpy(remoteHandles, _buffer.data() + 4, count * sizeof(HANDLE));
+  return bless(remoteHandles, count);
+}
+
+bool AgentConnectionHandler::isSameLogonSession() {
+  if (!ImpersonateNamedPipeClient(_pipe)) {
+    return false;
+  }
+  HObject token;
+  bool opened = OpenThreadToken(GetCurrentThread(), TOKEN_QUERY, true, &token);
+  RevertToSelf();
+  if (!opened) {
+    return false;
+  }
+  if (tokenLogonId(token) != _context.logonId) {
+    log::warn("Front-end {}: Not in this agent's logon session.", _clientId);
+    return false;
+  }
+  return true;
+}
+
+bool AgentConnectionHandler::bless(const HANDLE *remoteHandles,
+                                   size_t count)
+{
+  createResponse(msg::server::InternalError, "Agent couldn't forward process.");
+
+  ULONG processId;
+  if (!GetNamedPipeClientProcessId(_pipe, &processId)) {
+    return false;
+  }
+  HObject clientProcess{OpenProcess(PROCESS_DUP_HANDLE, false, processId)};
+  if (!clientProcess) {
+    log::error("Front-end {}: Couldn't open process: {}", _clientId,
+               lastErrorString());
+    return false;
+  }
+  // The server duplicates the handles again, this time from the agent. A
+  // handle that can't be duplicated is sent as null so the server reports it
+  // as bad.
+  HObject localHandles[msg::MaxBlessTargets];
+  HANDLE forwardHandles[msg::MaxBlessTargets];
+  for (size_t i = 0; i < count; ++i) {
+    if (!DuplicateHandle(clientProcess, remoteHandles[i], GetCurrentProcess(),
+                         &localHandles[i], 0, false, DUPLICATE_SAME_ACCESS))
+    {
+      log::warn("Front-end {}: Couldn't duplicate handle: {}", _clientId,
+                lastErrorString());
+    }
+    forwardHandles[i] = localHandles[i];
+  }
+
+  auto &server = _context.server;
+  std::vector<msg::BlessStatus> statuses;
+  if (!server->bless(forwardHandles, count, statuses, true) &&
+      server->response().empty())
+  {
+    // No response at all; the server may have restarted.
+    log::info("Reconnecting to server.");
+    if (!_context.reconnect() ||
+        !server->bless(forwardHandles, count, statuses, true))
+    {
+      return false;
+    }
+  }
+
+  // Pass the server's response on as is.
+  auto &response = server->response();
+  _buffer.assign(response.begin(), response.end());
+  return true;
+}
+
+// }}} AgentConnectionHandler
@@ -0,0 +1,65 @@
+#include "wsudo/agent.h"
+#include "wsudo/asynclog.h"
+
+using namespace wsudo;
+using namespace wsudo::agent;
+using namespace wsudo::events;
+
+int wmain(int argc, wchar_t *argv[]) {
+  auto logWriter = log::startAsyncLogging(true);
+  log::g_outLogger->set_level(spdlog::level::trace);
+  log::g_errLogger->set_level(spdlog::level::warn);
+  spdlog::set_pattern("%^[%l]%$ %v");
+  WSUDO_SCOPEEXIT {
+    logWriter->stop();
+    spdlog::drop_all();
+  };
+
+  if (argc != 1) {
+    log::eprint("Usage: wsudo-agent\n");
+    return ClientExitInvalidUsage;
+  }
+
+  auto logonId = processLogonId(GetCurrentProcess());
+  if (!logonId) {
+    log::critical("Can't get logon session: {}\n", lastErrorString());
+    return ClientExitSystemError;
+  }
+
+  auto pipeName = agentPipeName(*logonId);
+  auto firstPipe = createAgentPipe(pipeName, true);
+  if (!firstPipe) {
+    log::critical("Can't create agent pipe; is an agent already running?\n");
+    return ClientExitSystemError;
+  }
+
+  auto server = std::make_unique<ClientConnection>(PipeFullPath);
+  if (!*server) {
+    log::critical("Connection to server failed.\n");
+    return ClientExitServerNotFound;
+  }
+  if (auto exitCode = authenticate(*server); exitCode != ClientExitOk) {
+    return exitCode;
+  }
+
+  EventListener listener;
+  HANDLE idleTimer = CreateWaitableTimerW(nullptr, true, nullptr);
+  AgentContext context{*logonId, std::move(server), idleTimer};
+  listener.emplace(idleTimer, [](EventListener &listener) {
+    log::info("Idle timeout; exiting.");
+    listener.stop();
+    return EventStatus::Finished;
+  });
+  context.resetIdleTimer();
+
+  listener.emplace<AgentConnectionHandler>(std::move(firstPipe), 1, context);
+  for (int id = 2; id <= MaxAgentConnections; ++id) {
+    if (auto pipe = createAgentPipe(pipeName, false)) {
+      listener.emplace<AgentConnectionHandler>(std::move(pipe), id, context);
+    }
+  }
+
+  log::info("Agent ready.");
+  return listener.run() == EventStatus::Failed ? ClientExitSystemError
+                                                : ClientExitOk;
+}
@@ -0,0 +1,186 @@
+#include "wsudo/wsudo.h"
+#include "wsudo/auditstore.h"
+
+#include <algorithm>
+#include <cwchar>
+#include <ctime>
+#include <iomanip>
+#include <sstream>
+
+using namespace wsudo;
+using namespace wsudo::server;
+
+// Exit codes.
+enum : int {
+  AuditExitOk = 0,
+  AuditExitInvalidUsage = 1,
+  AuditExitIOError = 3,
+};
+
+// Helpers {{{
+
+namespace {
+  void usage() {
+    log::eprint(
+      "Usage: wsudo-audit [options]\n"
+      "Prints the server's audit log, oldest first.\n"
+      "  --dir <path>       Audit directory (default under ProgramData)\n"
+      "  --since <time>     Only entries at or after this time\n"
+      "  --until <time>     Only entries at or before this time\n"
+      "  --user <name>      Only this user's entries\n"
+      "  --event <name>     logon, resume, bless or spawn\n"
+      "  --outcome <name>   allowed, denied, throttled or failed\n"
+      "  --count            Print the number of matching entries\n"
+      "Times are UTC, as YYYY-MM-DD[THH:MM:SS] or seconds since 1970.\n"
+    );
+  }
+
+  // Microseconds since the Unix epoch.
+  std::optional<uint64_t> parseTime(const std::wstring &text, bool end) {
+    wchar_t *numberEnd;
+    auto seconds = std::wcstoull(text.c_str(), &numberEnd, 10);
+    if (numberEnd != text.c_str() && *numberEnd == 0) {
+      return seconds * 1000000 + (end ? 999999 : 0);
+    }
+
+    std::tm tm{};
+    std::wistringstream stream{text};
+    bool dateOnly = text.find(L'T') == std::wstring::npos;
+    stream >> std::get_time(&tm, dateOnly ? L"%Y-%m-%d" : L"%Y-%m-%dT%H:%M:%S");
+    if (stream.fail()) {
+      return std::nullopt;
+    }
+    auto time = _mkgmtime(&tm);
+    if (time < 0) {
+      return std::nullopt;
+    }
+    // A date by itself means the whole day.
+    auto last = dateOnly ? 86400 * 1000000ull - 1 : 999999;
+    return static_cast<uint64_t>(time) * 1000000 + (end ? last : 0);
+  }
+
+  std::string formatTime(uint64_t micros) {
+    __time64_t seconds = static_cast<__time64_t>(micros / 1000000);
+    std::tm tm;
+    if (_gmtime64_s(&tm, &seconds) != 0) {
+      return std::to_string(micros);
+    }
+    char buffer[32];
+    auto length = std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S",
+                                &tm);
+    return fmt::format("{}.{:06}", std::string_view{buffer, length},
+                       micros % 1000000);
+  }
+
+  void printRecord(const audit::Record &record) {
+    auto line = fmt::format(
+      "{} {} {} user={} pid={} session=0x{:X} client={} latency={}us",
+      formatTime(record.time), audit::eventToString(record.event),
+      audit::outcomeToString(record.outcome), record.userName(),
+      record.processId, record.logonId, record.clientId, record.latency
+    );
+    if (!record.imageName().empty()) {
+      line += fmt::format(" image={}", record.imageName());
+    }
+    auto &digest = record.digest;
+    if (std::any_of(digest.begin(), digest.end(), [](auto b) { return b; })) {
+      line += " sha256=";
+      for (auto b : digest) {
+        line += fmt::format("{:02x}", b);
+      }
+    }
+    line += '\n';
+    log::print("{}", line);
+  }
+}
+
+// }}}
+
+int wmain(int argc, wchar_t *argv[]) {
+  std::wstring directory;
+  audit::Filter filter;
+  bool countOnly = false;
+
+  for (int i = 1; i < argc; ++i) {
+    std::wstring_view arg{argv[i]};
+    if (arg == L"--count") {
+      countOnly = true;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      usage();
+      return AuditExitInvalidUsage;
+    }
+    std::wstring value{argv[++i]};
+    bool valid = true;
+    if (arg == L"--dir") {
+      directory = value;
+    } else if (arg == L"--since" || arg == L"--until") {
+      auto time = parseTime(value, arg == L"--until");
+      valid = time.has_value();
+      (arg == L"--since" ? filter.since : filter.until) = time.value_or(0);
+    } else if (arg == L"--user") {
+      filter.user = to_utf8(value);
+    } else if (arg == L"--event") {
+      filter.event = audit::eventFromString(to_utf8(value));
+      valid = filter.event.has_value();
+    } else if (arg == L"--outcome") {
+      filter.outcome = audit::outcomeFromString(to_utf8(value));
+      valid = filter.outcome.has_value();
+    } else {
+      valid = false;
+    }
+    if (!valid) {
+      log::eprint("Invalid option '{}'.\n", to_utf8(arg));
+      usage();
+      return AuditExitInvalidUsage;
+    }
+  }
+  if (directory.empty()) {
+    directory = defaultAuditDirectory();
+  }
+
+  // Only reads; the directory is left as it is.
+  AuditDirectory store{directory};
+  if (!store.exists()) {
+    log::eprint("Audit directory '{}' doesn't exist.\n", to_utf8(directory));
+    return AuditExitIOError;
+  }
+  auto sequences = store.list();
+  if (sequences.empty()) {
+    log::eprint("No audit segments in '{}'.\n", to_utf8(directory));
+    return AuditExitIOError;
+  }
+  std::sort(sequences.begin(), sequences.end());
+
+  size_t count = 0;
+  for (auto sequence : sequences) {
+    size_t size;
+    auto data = store.read(sequence, size);
+    if (!data) {
+      // Retention may have removed it since the listing.
+      continue;
+    }
+    auto segment = audit::viewSegment(data.get(), size);
+    if (!segment) {
+      log::eprint("Skipping damaged segment '{}'.\n",
+                  to_utf8(store.segmentPath(sequence)));
+      continue;
+    }
+    // The header's time range skips segments without reading records.
+    if (!filter.overlaps(*segment->header)) {
+      continue;
+    }
+    count += audit::scan(*segment, filter, [&](const audit::Record &record) {
+      if (!countOnly) {
+        printRecord(record);
+      }
+      return true;
+    });
+  }
+
+  if (countOnly) {
+    log::print("{}\n", count);
+  }
+  return AuditExitOk;
+}
@@ -0,0 +1,243 @@
+#include "wsudo/client.h"
+#include "wsudo/cmdline.h"
+
+#include <algorithm>
+#include <cwchar>
+#include <cwctype>
+
+using namespace wsudo;
+
+// Helpers {{{
+
+namespace {
+  // Batch files larger than this are rejected.
+  constexpr size_t MaxBatchSize = 16 * 1024 * 1024;
+
+  // A line of the batch file.
+  struct Job {
+    size_t line;
+    std::vector<std::wstring> arguments;
+    // Points into arguments.
+    std::vector<wchar_t *> argv;
+    std::vector<Command> commands;
+    std::vector<Process> processes;
+    std::optional<int> exitCode;
+  };
+
+  // Read a whole file, or stdin if the path is "-".
+  std::optional<std::string> readBatchFile(const wchar_t *path) {
+    HObject file;
+    HANDLE input;
+    if (!wcscmp(path, L"-")) {
+      input = GetStdHandle(STD_INPUT_HANDLE);
+    } else {
+      HANDLE rawFile = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ,
+                                   nullptr, OPEN_EXISTING,
+                                   FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+      if (rawFile == INVALID_HANDLE_VALUE) {
+        return std::nullopt;
+      }
+      file = rawFile;
+      input = file;
+    }
+
+    std::string contents;
+    char buffer[4096];
+    DWORD bytesRead;
+    while (true) {
+      if (!ReadFile(input, buffer, sizeof(buffer), &bytesRead, nullptr)) {
+        // A broken pipe is how a piped stdin ends.
+        if (GetLastError() == ERROR_BROKEN_PIPE) {
+          return contents;
+        }
+        return std::nullopt;
+      }
+      if (bytesRead == 0) {
+        return contents;
+      }
+      contents.append(buffer, bytesRead);
+      if (contents.size() > MaxBatchSize) {
+        return std::nullopt;
+      }
+    }
+  }
+
+  // Split the file into jobs, skipping blank lines and lines starting with
+  // '#'. Returns nothing if a line is malformed.
+  std::optional<std::vector<Job>> parseBatch(std::string_view contents) {
+    std::vector<Job> jobs;
+    size_t lineNumber = 0;
+    while (!contents.empty()) {
+      ++lineNumber;
+      auto end = contents.find('\n');
+      auto u8line = contents.substr(0, end);
+      contents.remove_prefix(end == std::string_view::npos ? contents.size()
+                                                           : end + 1);
+
+      auto line = to_utf16(u8line);
+      auto isSpace = [](wchar_t ch) { return !!iswspace(ch); };
+      auto first = std::find_if_not(line.begin(), line.end(), isSpace);
+      if (first == line.end() || *first == L'#') {
+        continue;
+      }
+      while (isSpace(line.back())) {
+        line.pop_back();
+      }
+
+      Job job{};
+      job.line = lineNumber;
+      job.arguments = splitCommandLine(
+        std::wstring_view{line}.substr(first - line.begin())
+      );
+      for (auto &argument : job.arguments) {
+        job.argv.push_back(argument.data());
+      }
+      auto commands = splitCommands(static_cast<int>(job.argv.size()),
+                                    job.argv.data());
+      if (!commands || commands->size() > msg::MaxBlessTargets) {
+        log::error("Line {}: Invalid command.", lineNumber);
+        return std::nullopt;
+      }
+      job.commands = std::move(*commands);
+      jobs.emplace_back(std::move(job));
+    }
+    return jobs;
+  }
+
+  void reportExit(const Job &job) {
+    log::eprint("[wsudo] line {}: exit {}\n", job.line, *job.exitCode);
+  }
+}
+
+// }}}
+
+int wsudo::runBatch(ClientConnection &conn, const wchar_t *path,
+                    unsigned maxJobs, bool ordered)
+{
+  auto contents = readBatchFile(path);
+  if (!contents) {
+    log::critical(L"Can't read batch file '{}'.\n", path);
+    return ClientExitInvalidUsage;
+  }
+  auto parsed = parseBatch(*contents);
+  if (!parsed) {
+    return ClientExitInvalidUsage;
+  }
+  auto &jobs = *parsed;
+  // Running jobs are waited on together.
+  maxJobs = std::clamp<unsigned>(maxJobs, 1, MAXIMUM_WAIT_OBJECTS);
+
+  size_t nextToStart = 0;
+  size_t nextToReport = 0;
+  std::vector<size_t> running;
+  bool connectionLost = false;
+
+  auto finish = [&](size_t index, int exitCode) {
+    jobs[index].exitCode = exitCode;
+    jobs[index].processes.clear();
+    if (!ordered) {
+      reportExit(jobs[index]);
+      return;
+    }
+    while (nextToReport < jobs.size() && jobs[nextToReport].exitCode) {
+      reportExit(jobs[nextToReport++]);
+    }
+  };
+
+  while (nextToStart < jobs.size() || !running.empty()) {
+    // Start as many jobs as there is room for, and elevate them all with one
+    // request.
+    std::vector<size_t> starting;
+    std::vector<HANDLE> handles;
+    while (!connectionLost && nextToStart < jobs.size() &&
+           running.size() + starting.size() < maxJobs &&
+           handles.size() + jobs[nextToStart].commands.size() <=
+             msg::MaxBlessTargets)
+    {
+      auto index = nextToStart++;
+      auto processes = createProcesses(jobs[index].commands);
+      if (!processes) {
+        finish(index, ClientExitCreateProcessError);
+        continue;
+      }
+      for (auto &process : *processes) {
+        handles.push_back(process.process);
+      }
+      jobs[index].processes = std::move(*processes);
+      starting.push_back(index);
+    }
+
+    if (!handles.empty()) {
+      std::vector<msg::BlessStatus> statuses;
+      bool sent = conn.bless(handles.data(), handles.size(), statuses, true);
+      if (!sent) {
+        log::error("Elevation failed: {}", conn.errorMessage());
+        connectionLost = conn.response().empty();
+      }
+      size_t status = 0;
+      for (auto index : starting) {
+        auto &job = jobs[index];
+        bool elevated = sent;
+        for (size_t i = 0; i < job.processes.size(); ++i, ++status) {
+          if (sent && statuses[status] != msg::BlessOk) {
+            log::error("Line {}: {}", job.line,
+                       msg::blessStatusToString(statuses[status]));
+            elevated = false;
+          }
+        }
+        if (!elevated) {
+          for (auto &process : job.processes) {
+            TerminateProcess(process.process, 1);
+          }
+          finish(index, ClientExitAccessDenied);
+          continue;
+        }
+        for (auto &process : job.processes) {
+          ResumeThread(process.thread);
+        }
+        running.push_back(index);
+      }
+    }
+
+    if (connectionLost) {
+      // Nothing more can be elevated; skip the rest.
+      while (nextToStart < jobs.size()) {
+        finish(nextToStart++, ClientExitSystemError);
+      }
+    }
+    if (running.empty()) {
+      continue;
+    }
+
+    // Wait for any job's last process; it has the job's exit code.
+    std::vector<HANDLE> waits;
+    for (auto index : running) {
+      waits.push_back(jobs[index].processes.back().process);
+    }
+    auto waitResult = WaitForMultipleObjects(
+      static_cast<DWORD>(waits.size()), waits.data(), false, INFINITE
+    );
+    if (waitResult >= WAIT_OBJECT_0 + waits.size()) {
+      log::critical("Waiting for processes failed: {}", lastErrorString());
+      return ClientExitSystemError;
+    }
+    auto runningIndex = waitResult - WAIT_OBJECT_0;
+    auto index = running[runningIndex];
+    running.erase(running.begin() + runningIndex);
+
+    auto &job = jobs[index];
+    for (auto &process : job.processes) {
+      WaitForSingleObject(process.process, INFINITE);
+    }
+    DWORD exitCode;
+    GetExitCodeProcess(job.processes.back().process, &exitCode);
+    finish(index, static_cast<int>(exitCode));
+  }
+
+  for (auto &job : jobs) {
+    if (*job.exitCode != 0) {
+      return *job.exitCode;
+    }
+  }
+  return ClientExitOk;
+}
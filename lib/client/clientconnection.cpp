@@ -0,0 +1,298 @@
+#include "wsudo/client.h"
+#include "wsudo/utf.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <cwchar>
+
+using namespace wsudo;
+
+ClientConnection::ClientConnection(const wchar_t *pipeName,
+                                   int connectAttempts)
+  : _pipeName{pipeName},
+    _random{std::random_device{}()}
+{
+  if (connect(connectAttempts)) {
+    _buffer.reserve(PipeBufferSize);
+  }
+}
+
+bool ClientConnection::connect(int attempts) {
+  _pipe = nullptr;
+
+  SECURITY_ATTRIBUTES secAttr;
+  secAttr.nLength = sizeof(SECURITY_ATTRIBUTES);
+  secAttr.bInheritHandle = false;
+  secAttr.lpSecurityDescriptor = nullptr;
+
+  auto delay = BackoffBase;
+  for (int attempt = 1; ; ++attempt) {
+    HANDLE pipe = CreateFileW(_pipeName.c_str(), GENERIC_READ | GENERIC_WRITE,
+                              FILE_SHARE_READ | FILE_SHARE_WRITE,
+                              &secAttr, OPEN_EXISTING, 0, nullptr);
+    if (pipe != INVALID_HANDLE_VALUE) {
+      _pipe = pipe;
+      return true;
+    }
+
+    auto error = GetLastError();
+    if (attempt >= attempts) {
+      log::debug("Couldn't connect to server: {}", lastErrorString(error));
+      return false;
+    }
+    if (error == ERROR_PIPE_BUSY) {
+      // Every pipe instance is taken; wait for one to free up.
+      if (WaitNamedPipeW(_pipeName.c_str(),
+                         static_cast<DWORD>(BackoffCap.count())))
+      {
+        continue;
+      }
+    } else if (error != ERROR_FILE_NOT_FOUND) {
+      log::error("Couldn't connect to server: {}", lastErrorString(error));
+      return false;
+    }
+    // The server is not running or is restarting.
+    backoff(delay);
+    delay = std::min(delay * 2, BackoffCap);
+  }
+}
+
+void ClientConnection::backoff(std::chrono::milliseconds delay) {
+  // Sleep for a random time between half and all of the delay.
+  auto ms = static_cast<unsigned>(delay.count());
+  std::uniform_int_distribution<unsigned> jitter{ms / 2, ms};
+  Sleep(jitter(_random));
+}
+
+std::optional<std::chrono::milliseconds>
+ClientConnection::busyRetryAfter() const {
+  if (_buffer.size() < 4 || std::memcmp(_buffer.data(), msg::server::Busy, 4)) {
+    return std::nullopt;
+  }
+  uint32_t ms = 0;
+  if (_buffer.size() >= 4 + sizeof(uint32_t)) {
+    std::memcpy(&ms, _buffer.data() + 4, sizeof(uint32_t));
+  }
+  return std::chrono::milliseconds{ms};
+}
+
+bool ClientConnection::transact(const char *messageName,
+                                std::string_view message, bool quiet)
+{
+  auto delay = BackoffBase;
+  for (int attempt = 1; ; ++attempt) {
+    DWORD bytes;
+    _buffer.clear();
+    log::trace("Writing {} message, size {}", messageName, message.size());
+    if (
+      !WriteFile(_pipe, message.data(), (DWORD)message.size(), &bytes,
+                 nullptr) ||
+      bytes != message.size()
+    )
+    {
+      log::error("Couldn't write {} message.", messageName);
+      return false;
+    }
+
+    _buffer.resize(PipeBufferSize);
+    if (!ReadFile(_pipe, _buffer.data(), PipeBufferSize, &bytes, nullptr)) {
+      _buffer.clear();
+      log::error("Couldn't read server response.");
+      return false;
+    }
+    _buffer.resize(bytes);
+
+    auto retryAfter = busyRetryAfter();
+    if (!retryAfter || attempt >= MaxBusyRetries) {
+      return readServerMessage(quiet);
+    }
+
+    // The server closes the connection after a busy response, so reconnect
+    // and send the message again.
+    log::debug("Server busy; retrying in about {} ms.",
+               std::max(*retryAfter, delay).count());
+    backoff(std::max(*retryAfter, delay));
+    delay = std::min(delay * 2, BackoffCap);
+    if (!connect()) {
+      log::error("Lost connection to server.");
+      return false;
+    }
+  }
+}
+
+bool ClientConnection::negotiate(std::wstring_view username,
+                                 std::wstring_view password, bool quiet)
+{
+  // Header, username, null, password; the password is transcoded straight
+  // into the message.
+  std::u16string_view password16{
+    reinterpret_cast<const char16_t *>(password.data()), password.size()
+  };
+  auto u8username = to_utf8(username);
+  auto passwordLength = *utf::utf16ToUtf8(password16, nullptr, 0,
+                                          utf::Errors::Replace);
+  SecureBuffer<char> message{4 + u8username.size() + 1 + passwordLength};
+  assert(strlen(msg::client::Credential) == 4);
+  message.append(msg::client::Credential, 4);
+  message.append(u8username.data(), u8username.size());
+  message.push_back(0);
+  auto passwordBegin = message.size();
+  message.resize(message.capacity());
+  utf::utf16ToUtf8(password16, message.data() + passwordBegin, passwordLength,
+                   utf::Errors::Replace);
+
+  bool result = transact("credential", message.view(), quiet);
+  if (result) {
+    _ticket.assign(_buffer.begin() + 4, _buffer.end());
+  }
+  return result;
+}
+
+bool ClientConnection::resume(const std::vector<char> &ticket) {
+  _message.resize(4 + ticket.size());
+  assert(strlen(msg::client::Resume) == 4);
+  std::memcpy(_message.data(), msg::client::Resume, 4);
+  std::memcpy(_message.data() + 4, ticket.data(), ticket.size());
+  return transact("resume", true);
+}
+
+bool ClientConnection::bless(HANDLE process, bool quiet) {
+  std::vector<msg::BlessStatus> statuses;
+  if (!bless(&process, 1, statuses, quiet)) {
+    return false;
+  }
+  if (statuses[0] != msg::BlessOk) {
+    if (!quiet) {
+      log::eprint("Couldn't elevate process: {}\n",
+                  msg::blessStatusToString(statuses[0]));
+    }
+    return false;
+  }
+  return true;
+}
+
+bool ClientConnection::bless(const HANDLE *processes, size_t count,
+                             std::vector<msg::BlessStatus> &statuses,
+                             bool quiet)
+{
+  assert(count > 0 && count <= msg::MaxBlessTargets);
+  _message.resize(4 + count * sizeof(HANDLE));
+  assert(strlen(msg::client::Bless) == 4);
+  std::memcpy(_message.data(), msg::client::Bless, 4);
+  std::memcpy(_message.data() + 4, processes, count * sizeof(HANDLE));
+  if (!transact("bless", quiet)) {
+    return false;
+  }
+
+  if (_buffer.size() != 4 + count * sizeof(uint32_t)) {
+    if (!quiet) {
+      log::eprint("Invalid bless response from server.\n");
+    }
+    return false;
+  }
+  statuses.resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    uint32_t status;
+    std::memcpy(&status, _buffer.data() + 4 + i * sizeof(uint32_t),
+                sizeof(uint32_t));
+    statuses[i] = static_cast<msg::BlessStatus>(status);
+  }
+  return true;
+}
+
+bool ClientConnection::spawn(const SpawnRequest &request, HObject &process,
+                             bool quiet)
+{
+  auto body = encodeSpawnRequest(request);
+  _message.resize(4 + body.size());
+  assert(strlen(msg::client::Spawn) == 4);
+  std::memcpy(_message.data(), msg::client::Spawn, 4);
+  std::memcpy(_message.data() + 4, body.data(), body.size());
+  if (!transact("spawn", quiet)) {
+    return false;
+  }
+
+  if (_buffer.size() != 4 + sizeof(uint64_t) + sizeof(uint32_t)) {
+    if (!quiet) {
+      log::eprint("Invalid spawn response from server.\n");
+    }
+    return false;
+  }
+  uint64_t handleValue;
+  uint32_t processId;
+  std::memcpy(&handleValue, _buffer.data() + 4, sizeof(uint64_t));
+  std::memcpy(&processId, _buffer.data() + 4 + sizeof(uint64_t),
+              sizeof(uint32_t));
+  log::debug("Server spawned process {}.", processId);
+  process = reinterpret_cast<HANDLE>(static_cast<uintptr_t>(handleValue));
+  return true;
+}
+
+std::optional<uint64_t> ClientConnection::serverLogonId() const {
+  ULONG processId;
+  if (!GetNamedPipeServerProcessId(_pipe, &processId)) {
+    return std::nullopt;
+  }
+  HObject process{OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, false,
+                              processId)};
+  if (!process) {
+    return std::nullopt;
+  }
+  return processLogonId(process);
+}
+
+std::wstring wsudo::agentPipeName(uint64_t logonId) {
+  wchar_t name[17];
+  swprintf(name, 17, L"%016llX", static_cast<unsigned long long>(logonId));
+  return std::wstring{L"\\\\.\\pipe\\wsudo_agent_"} + name;
+}
+
+bool ClientConnection::readServerMessage(bool quiet) {
+  if (_buffer.size() < 4) {
+    log::error("Unknown server response.\n");
+    return false;
+  }
+  char header[5];
+  std::memcpy(header, _buffer.data(), 4);
+  header[4] = 0;
+  log::trace("Reading response with code {}.", header);
+  if (!std::memcmp(header, msg::server::Success, 4)) {
+    // Don't print a success message - just start the process.
+    return true;
+  }
+  if (!quiet) {
+    log::eprint("{}\n", errorMessage());
+  }
+  return false;
+}
+
+std::string ClientConnection::errorMessage() const {
+  if (_buffer.empty()) {
+    return "Lost connection to server";
+  }
+  if (_buffer.size() < 4) {
+    return "Unknown server response";
+  }
+  auto header = _buffer.data();
+  if (!std::memcmp(header, msg::server::Busy, 4)) {
+    return "Server busy; try again later";
+  }
+
+  std::string message;
+  if (!std::memcmp(header, msg::server::InvalidMessage, 4)) {
+    message = "Invalid message";
+  } else if (!std::memcmp(header, msg::server::InternalError, 4)) {
+    message = "Internal server error";
+  } else if (!std::memcmp(header, msg::server::AccessDenied, 4)) {
+    message = "Access denied; this incident will be reported";
+    // TODO: Send email to police.
+  } else {
+    message = "Unknown server response";
+  }
+  if (_buffer.size() > 4) {
+    message.append(": ");
+    message.append(_buffer.begin() + 4, _buffer.end());
+  }
+  return message;
+}
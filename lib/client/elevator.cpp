@@ -0,0 +1,231 @@
+#include "wsudo/elevator.h"
+
+#include <algorithm>
+
+using namespace wsudo;
+
+Elevator::Elevator(std::wstring pipeName, bool useAgent)
+  : _pipeName{std::move(pipeName)},
+    _useAgent{useAgent},
+    _worker{&Elevator::run, this}
+{
+}
+
+Elevator::~Elevator() {
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    _stopping = true;
+  }
+  _queueChanged.notify_one();
+  _worker.join();
+}
+
+// {{{ Public operations
+
+std::future<Elevator::Result> Elevator::connect() {
+  return submit<Result>([this] { return doConnect(); });
+}
+
+void Elevator::connect(Callback<Result> callback) {
+  submit<Result>([this] { return doConnect(); }, std::move(callback));
+}
+
+std::future<Elevator::Result> Elevator::authenticate() {
+  return submit<Result>([this] { return doResume(); });
+}
+
+void Elevator::authenticate(Callback<Result> callback) {
+  submit<Result>([this] { return doResume(); }, std::move(callback));
+}
+
+// std::function must be copyable, so the password is shared.
+std::future<Elevator::Result>
+Elevator::authenticate(std::wstring username,
+                       SecureBuffer<wchar_t> password)
+{
+  return submit<Result>(
+    [this, username = std::move(username),
+     password = std::make_shared<SecureBuffer<wchar_t>>(
+       std::move(password)
+     )] {
+      return doLogon(username, *password);
+    }
+  );
+}
+
+void Elevator::authenticate(std::wstring username,
+                            SecureBuffer<wchar_t> password,
+                            Callback<Result> callback)
+{
+  submit<Result>(
+    [this, username = std::move(username),
+     password = std::make_shared<SecureBuffer<wchar_t>>(
+       std::move(password)
+     )] {
+      return doLogon(username, *password);
+    },
+    std::move(callback)
+  );
+}
+
+std::future<std::vector<Elevator::Result>>
+Elevator::elevate(std::vector<HANDLE> processes) {
+  return submit<std::vector<Result>>(
+    [this, processes = std::move(processes)] { return doElevate(processes); }
+  );
+}
+
+void Elevator::elevate(std::vector<HANDLE> processes,
+                       Callback<std::vector<Result>> callback)
+{
+  submit<std::vector<Result>>(
+    [this, processes = std::move(processes)] { return doElevate(processes); },
+    std::move(callback)
+  );
+}
+
+// }}} Public operations
+
+// {{{ Worker
+
+Elevator::Result Elevator::doConnect() {
+  if (_connection && *_connection) {
+    return Result{true, {}};
+  }
+  _viaAgent = false;
+
+  if (_useAgent) {
+    if (auto logonId = processLogonId(GetCurrentProcess())) {
+      auto agent = std::make_unique<ClientConnection>(
+        agentPipeName(*logonId).c_str(), 1
+      );
+      if (*agent && agent->serverLogonId() == logonId) {
+        _connection = std::move(agent);
+        _viaAgent = true;
+        return Result{true, {}};
+      }
+    }
+  }
+
+  _connection = std::make_unique<ClientConnection>(_pipeName.c_str());
+  if (!*_connection) {
+    return Result{false, "Connection to server failed"};
+  }
+  return Result{true, {}};
+}
+
+Elevator::Result Elevator::doResume() {
+  if (auto result = doConnect(); !result) {
+    return result;
+  }
+  if (_viaAgent) {
+    // The agent is already authorized.
+    return Result{true, {}};
+  }
+
+  auto ticket = loadTicket();
+  if (ticket.empty()) {
+    return Result{false, "No ticket stored"};
+  }
+  if (!_connection->resume(ticket)) {
+    deleteTicket();
+    return Result{false, _connection->errorMessage()};
+  }
+  return Result{true, {}};
+}
+
+Elevator::Result Elevator::doLogon(const std::wstring &username,
+                                   const SecureBuffer<wchar_t> &password)
+{
+  if (auto result = doConnect(); !result) {
+    return result;
+  }
+  if (_viaAgent) {
+    return Result{true, {}};
+  }
+
+  if (!_connection->negotiate(username, password.view(), true)) {
+    return Result{false, _connection->errorMessage()};
+  }
+  saveTicket(_connection->ticket());
+  return Result{true, {}};
+}
+
+std::vector<Elevator::Result>
+Elevator::doElevate(const std::vector<HANDLE> &processes) {
+  std::vector<Result> results;
+  results.reserve(processes.size());
+  if (auto result = doConnect(); !result) {
+    results.resize(processes.size(), result);
+    return results;
+  }
+
+  std::vector<msg::BlessStatus> statuses;
+  for (size_t first = 0; first < processes.size();
+       first += msg::MaxBlessTargets)
+  {
+    auto count = std::min(processes.size() - first, msg::MaxBlessTargets);
+    if (!_connection->bless(processes.data() + first, count, statuses, true)) {
+      results.resize(processes.size(),
+                     Result{false, _connection->errorMessage()});
+      if (_connection->response().empty()) {
+        // The connection is gone; the next operation will reconnect.
+        _connection = nullptr;
+      }
+      break;
+    }
+    for (auto status : statuses) {
+      if (status == msg::BlessOk) {
+        results.push_back(Result{true, {}});
+      } else {
+        results.push_back(Result{false, msg::blessStatusToString(status)});
+      }
+    }
+  }
+  return results;
+}
+
+template<typename T>
+std::future<T> Elevator::submit(std::function<T()> work) {
+  // std::function must be copyable, so the promise is shared.
+  auto promise = std::make_shared<std::promise<T>>();
+  auto future = promise->get_future();
+  post([promise, work = std::move(work)] {
+    promise->set_value(work());
+  });
+  return future;
+}
+
+template<typename T>
+void Elevator::submit(std::function<T()> work, Callback<T> callback) {
+  post([work = std::move(work), callback = std::move(callback)] {
+    callback(work());
+  });
+}
+
+void Elevator::post(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    _queue.emplace_back(std::move(task));
+  }
+  _queueChanged.notify_one();
+}
+
+void Elevator::run() {
+  setThreadName(L"wsudo elevator");
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock{_mutex};
+      _queueChanged.wait(lock, [this] { return _stopping || !_queue.empty(); });
+      if (_queue.empty()) {
+        return;
+      }
+      task = std::move(_queue.front());
+      _queue.pop_front();
+    }
+    task();
+  }
+}
+
+// }}} Worker
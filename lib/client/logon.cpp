@@ -0,0 +1,101 @@
+#include "wsudo/client.h"
+
+#include <cstdio>
+
+#define SECURITY_WIN32
+#include <Security.h>
+#pragma comment(lib, "Secur32.lib")
+
+using namespace wsudo;
+
+ClientExitCode wsudo::logon(ClientConnection &conn) {
+  HANDLE hStdin = GetStdHandle(STD_INPUT_HANDLE);
+  DWORD stdinMode;
+  GetConsoleMode(hStdin, &stdinMode);
+  DWORD newStdinMode = ENABLE_PROCESSED_INPUT | ENABLE_LINE_INPUT |
+                       ENABLE_ECHO_INPUT | ENABLE_EXTENDED_FLAGS |
+                       ENABLE_QUICK_EDIT_MODE;
+  SetConsoleMode(hStdin, newStdinMode);
+  WSUDO_SCOPEEXIT { SetConsoleMode(hStdin, stdinMode); };
+
+  std::wstring username{};
+  ULONG usernameLength = 0;
+  GetUserNameExW(NameSamCompatible, nullptr, &usernameLength);
+  if (GetLastError() == ERROR_MORE_DATA) {
+    username.resize(usernameLength);
+    if (!GetUserNameExW(NameSamCompatible, username.data(), &usernameLength)) {
+      log::critical("Can't get username.\n");
+      return ClientExitSystemError;
+    }
+    // It ends in a null that we don't want printed.
+    username.erase(username.cend() - 1);
+  } else {
+    log::critical("Can't get username.\n");
+    return ClientExitSystemError;
+  }
+
+  if (auto slash = username.find(L'\\'); slash != std::wstring::npos) {
+    username = username.substr(slash + 1);
+  }
+
+  SecureBuffer<wchar_t> password{MaxPasswordLength};
+  log::print(L"[wsudo] password for {}: ", username);
+  fflush(stdout);
+  // A longer password is still read to the end of the line, so the rest of
+  // it isn't left for the next program to read, and then refused; sending
+  // only part of it would be a mystery failure. This counts the characters
+  // that didn't fit.
+  size_t overflow = 0;
+  {
+    SetConsoleMode(hStdin, ENABLE_EXTENDED_FLAGS | ENABLE_QUICK_EDIT_MODE);
+    while (true) {
+      wchar_t ch;
+      DWORD chRead;
+      if (!ReadConsoleW(hStdin, &ch, 1, &chRead, nullptr)) {
+        return ClientExitSystemError;
+      }
+      if (ch == 13 || ch == 10) {
+        // Enter
+        log::print("\n");
+        break;
+      } else if (ch == 8 || ch == 0x7F) {
+        // Backspace
+        if (overflow) {
+          --overflow;
+        } else {
+          password.pop_back();
+        }
+      } else if (ch == 3) {
+        // Ctrl-C
+        log::print("\nCanceled.\n");
+        return ClientExitUserCanceled;
+      } else if (!password.push_back((wchar_t)ch)) {
+        ++overflow;
+      }
+    }
+    SetConsoleMode(hStdin, newStdinMode);
+  }
+  if (overflow) {
+    log::critical("Password too long; the limit is {} characters.",
+                  MaxPasswordLength);
+    return ClientExitInvalidUsage;
+  }
+
+  bool negotiated = conn.negotiate(username, password.view());
+  return negotiated ? ClientExitOk : ClientExitAccessDenied;
+}
+
+ClientExitCode wsudo::authenticate(ClientConnection &conn) {
+  // Skip the password prompt if we have a ticket the server still accepts.
+  if (auto ticket = loadTicket(); !ticket.empty()) {
+    if (conn.resume(ticket)) {
+      return ClientExitOk;
+    }
+    deleteTicket();
+  }
+  if (auto exitCode = logon(conn); exitCode != ClientExitOk) {
+    return exitCode;
+  }
+  saveTicket(conn.ticket());
+  return ClientExitOk;
+}
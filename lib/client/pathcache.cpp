@@ -0,0 +1,290 @@
+#include "wsudo/pathcache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cwctype>
+
+using namespace wsudo;
+
+// Helpers {{{
+
+namespace {
+  // "WSPC"
+  constexpr uint32_t CacheMagic = 0x43505357;
+  constexpr uint32_t CacheVersion = 1;
+
+  std::wstring toLower(std::wstring_view s) {
+    std::wstring lower{s};
+    for (auto &c : lower) {
+      c = static_cast<wchar_t>(std::towlower(c));
+    }
+    return lower;
+  }
+
+  bool isSeparator(wchar_t c) {
+    return c == L'\\' || c == L'/';
+  }
+
+  // Directory path without trailing separators, for use as a key.
+  std::wstring directoryKey(std::wstring_view directory) {
+    while (directory.size() > 1 && isSeparator(directory.back())) {
+      directory.remove_suffix(1);
+    }
+    return toLower(directory);
+  }
+
+  std::wstring join(std::wstring_view directory, std::wstring_view name) {
+    std::wstring path{directory};
+    if (!path.empty() && !isSeparator(path.back())) {
+      path.push_back(L'\\');
+    }
+    return path.append(name);
+  }
+
+  // Little endian, with strings stored as a length and UTF-16 code units.
+  class Writer {
+  public:
+    void u32(uint32_t value) { put(&value, sizeof(value)); }
+    void u64(uint64_t value) { put(&value, sizeof(value)); }
+    void string(std::wstring_view s) {
+      u32(static_cast<uint32_t>(s.size()));
+      for (auto c : s) {
+        auto unit = static_cast<uint16_t>(c);
+        put(&unit, sizeof(unit));
+      }
+    }
+    std::vector<char> take() { return std::move(_data); }
+
+  private:
+    void put(const void *value, size_t size) {
+      auto bytes = static_cast<const char *>(value);
+      _data.insert(_data.end(), bytes, bytes + size);
+    }
+
+    std::vector<char> _data;
+  };
+
+  class Reader {
+  public:
+    explicit Reader(const char *data, size_t size)
+      : _data{data}, _remaining{size}
+    {}
+
+    bool u32(uint32_t &value) { return get(&value, sizeof(value)); }
+    bool u64(uint64_t &value) { return get(&value, sizeof(value)); }
+    bool string(std::wstring &s) {
+      uint32_t length;
+      if (!u32(length) || length > _remaining / sizeof(uint16_t)) {
+        return false;
+      }
+      s.resize(length);
+      for (auto &c : s) {
+        uint16_t unit;
+        if (!get(&unit, sizeof(unit))) {
+          return false;
+        }
+        c = static_cast<wchar_t>(unit);
+      }
+      return true;
+    }
+    // A count of items that each take at least `itemSize` bytes.
+    bool count(uint32_t &value, size_t itemSize) {
+      return u32(value) && value <= _remaining / itemSize;
+    }
+    bool done() const { return _remaining == 0; }
+
+  private:
+    bool get(void *value, size_t size) {
+      if (_remaining < size) {
+        return false;
+      }
+      std::memcpy(value, _data, size);
+      _data += size;
+      _remaining -= size;
+      return true;
+    }
+
+    const char *_data;
+    size_t _remaining;
+  };
+}
+
+// }}}
+
+// {{{ PathCache
+
+PathCache::PathCache(FileSystem &fileSystem, std::wstring_view pathExt)
+  : _fileSystem{fileSystem},
+    _pathExt{toLower(pathExt)}
+{
+  for (auto &extension : splitPath(_pathExt)) {
+    if (extension.size() > 1 && extension[0] == L'.') {
+      _extensions.push_back(std::move(extension));
+    }
+  }
+}
+
+std::optional<std::wstring>
+PathCache::resolve(std::wstring_view name,
+                   const std::vector<std::wstring> &path)
+{
+  if (name.empty() || !isBareName(name)) {
+    return std::nullopt;
+  }
+  auto lowerName = toLower(name);
+  bool hasExtension = lowerName.find(L'.') != std::wstring::npos;
+  auto candidate = lowerName;
+  for (auto &directory : path) {
+    auto entry = listing(directory);
+    if (!entry) {
+      continue;
+    }
+    auto found = [&](const std::wstring &program) {
+      return std::binary_search(entry->names.begin(), entry->names.end(),
+                                program);
+    };
+    if (hasExtension && found(lowerName)) {
+      return join(directory, name);
+    }
+    for (auto &extension : _extensions) {
+      candidate.resize(lowerName.size());
+      candidate.append(extension);
+      if (found(candidate)) {
+        return join(directory, std::wstring{name}.append(extension));
+      }
+    }
+  }
+  return std::nullopt;
+}
+
+const PathCache::Listing *PathCache::listing(const std::wstring &directory) {
+  auto key = directoryKey(directory);
+  auto time = _fileSystem.directoryTime(directory);
+  if (!time) {
+    if (_listings.erase(key)) {
+      _dirty = true;
+    }
+    return nullptr;
+  }
+  auto it = _listings.find(key);
+  if (it != _listings.end() && it->second.time == *time) {
+    return &it->second;
+  }
+
+  auto names = _fileSystem.list(directory);
+  if (!names) {
+    return nullptr;
+  }
+  Listing entry{*time, {}};
+  for (auto &name : *names) {
+    auto lower = toLower(name);
+    if (isProgram(lower)) {
+      entry.names.push_back(std::move(lower));
+    }
+  }
+  std::sort(entry.names.begin(), entry.names.end());
+  entry.names.erase(std::unique(entry.names.begin(), entry.names.end()),
+                    entry.names.end());
+  _dirty = true;
+  return &(_listings[std::move(key)] = std::move(entry));
+}
+
+bool PathCache::isProgram(std::wstring_view lowerName) const {
+  auto dot = lowerName.rfind(L'.');
+  if (dot == std::wstring_view::npos) {
+    return false;
+  }
+  auto extension = lowerName.substr(dot);
+  return std::find(_extensions.begin(), _extensions.end(), extension) !=
+         _extensions.end();
+}
+
+std::vector<char> PathCache::save() const {
+  Writer writer;
+  writer.u32(CacheMagic);
+  writer.u32(CacheVersion);
+  writer.string(_pathExt);
+  writer.u32(static_cast<uint32_t>(_listings.size()));
+  for (auto &[directory, entry] : _listings) {
+    writer.string(directory);
+    writer.u64(entry.time);
+    writer.u32(static_cast<uint32_t>(entry.names.size()));
+    for (auto &name : entry.names) {
+      writer.string(name);
+    }
+  }
+  return writer.take();
+}
+
+bool PathCache::load(const char *data, size_t size) {
+  _listings.clear();
+  _dirty = false;
+
+  Reader reader{data, size};
+  uint32_t magic, version, directoryCount;
+  std::wstring pathExt;
+  if (!reader.u32(magic) || magic != CacheMagic ||
+      !reader.u32(version) || version != CacheVersion ||
+      !reader.string(pathExt) || pathExt != _pathExt ||
+      !reader.count(directoryCount, sizeof(uint32_t) * 2 + sizeof(uint64_t)))
+  {
+    return false;
+  }
+  for (uint32_t i = 0; i < directoryCount; ++i) {
+    std::wstring directory;
+    Listing entry;
+    uint32_t nameCount;
+    if (!reader.string(directory) || !reader.u64(entry.time) ||
+        !reader.count(nameCount, sizeof(uint32_t)))
+    {
+      _listings.clear();
+      return false;
+    }
+    entry.names.resize(nameCount);
+    for (auto &name : entry.names) {
+      if (!reader.string(name)) {
+        _listings.clear();
+        return false;
+      }
+    }
+    // Lookups binary search the names, so don't trust the order.
+    if (!std::is_sorted(entry.names.begin(), entry.names.end())) {
+      _listings.clear();
+      return false;
+    }
+    _listings[std::move(directory)] = std::move(entry);
+  }
+  if (!reader.done()) {
+    _listings.clear();
+    return false;
+  }
+  return true;
+}
+
+// }}} PathCache
+
+std::vector<std::wstring> wsudo::splitPath(std::wstring_view path) {
+  std::vector<std::wstring> entries;
+  while (!path.empty()) {
+    auto end = path.find(L';');
+    auto entry = path.substr(0, end);
+    std::wstring directory;
+    for (auto c : entry) {
+      if (c != L'"') {
+        directory.push_back(c);
+      }
+    }
+    if (!directory.empty()) {
+      entries.push_back(std::move(directory));
+    }
+    if (end == std::wstring_view::npos) {
+      break;
+    }
+    path.remove_prefix(end + 1);
+  }
+  return entries;
+}
+
+bool wsudo::isBareName(std::wstring_view name) {
+  return name.find_first_of(L"\\/:") == std::wstring_view::npos;
+}
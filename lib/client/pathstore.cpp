@@ -0,0 +1,165 @@
+#include "wsudo/client.h"
+#include "wsudo/pathcache.h"
+
+#include <ShlObj.h>
+#include <algorithm>
+
+#pragma comment(lib, "Shell32.lib")
+#pragma comment(lib, "Ole32.lib")
+
+using namespace wsudo;
+
+// Helpers {{{
+
+namespace {
+  // A saved cache larger than this is not ours.
+  constexpr LONGLONG MaxPathCacheSize = 16 * 1024 * 1024;
+
+  class WindowsFileSystem : public PathCache::FileSystem {
+  public:
+    std::optional<uint64_t>
+    directoryTime(const std::wstring &directory) override {
+      WIN32_FILE_ATTRIBUTE_DATA data;
+      if (!GetFileAttributesExW(directory.c_str(), GetFileExInfoStandard,
+                                &data) ||
+          !(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+      {
+        return std::nullopt;
+      }
+      auto &time = data.ftLastWriteTime;
+      return static_cast<uint64_t>(time.dwHighDateTime) << 32 |
+             time.dwLowDateTime;
+    }
+
+    std::optional<std::vector<std::wstring>>
+    list(const std::wstring &directory) override {
+      WIN32_FIND_DATAW data;
+      HANDLE find = FindFirstFileExW((directory + L"\\*").c_str(),
+                                     FindExInfoBasic, &data,
+                                     FindExSearchNameMatch, nullptr,
+                                     FIND_FIRST_EX_LARGE_FETCH);
+      if (find == INVALID_HANDLE_VALUE) {
+        return std::nullopt;
+      }
+      WSUDO_SCOPEEXIT { FindClose(find); };
+      std::vector<std::wstring> names;
+      do {
+        if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+          names.emplace_back(data.cFileName);
+        }
+      } while (FindNextFileW(find, &data));
+      return names;
+    }
+  };
+
+  std::wstring environmentVariable(const wchar_t *name) {
+    std::wstring value(GetEnvironmentVariableW(name, nullptr, 0), L'\0');
+    auto length = GetEnvironmentVariableW(name, value.data(),
+                                          static_cast<DWORD>(value.size()));
+    value.resize(length < value.size() ? length : 0);
+    return value;
+  }
+
+  // %LOCALAPPDATA%\wsudo\pathcache, or empty if the path can't be
+  // determined.
+  std::wstring pathCachePath(bool createDirectory) {
+    PWSTR localAppData;
+    if (!SUCCEEDED(SHGetKnownFolderPath(FOLDERID_LocalAppData, 0, nullptr,
+                                        &localAppData)))
+    {
+      return std::wstring{};
+    }
+    std::wstring path{localAppData};
+    CoTaskMemFree(localAppData);
+
+    path.append(L"\\wsudo");
+    if (createDirectory) {
+      // Fails harmlessly if the directory already exists.
+      CreateDirectoryW(path.c_str(), nullptr);
+    }
+    return path + L"\\pathcache";
+  }
+
+  void loadPathCache(PathCache &cache, const std::wstring &path) {
+    HANDLE rawFile = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                                 nullptr, OPEN_EXISTING,
+                                 FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (rawFile == INVALID_HANDLE_VALUE) {
+      return;
+    }
+    HObject file{rawFile};
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart > MaxPathCacheSize) {
+      return;
+    }
+    std::vector<char> data(static_cast<size_t>(size.QuadPart));
+    DWORD bytesRead;
+    if (!ReadFile(file, data.data(), static_cast<DWORD>(data.size()),
+                  &bytesRead, nullptr) || bytesRead != data.size() ||
+        !cache.load(data.data(), data.size()))
+    {
+      log::debug("Ignoring invalid PATH cache.");
+    }
+  }
+
+  // Write beside the cache and rename over it, so that another wsudo never
+  // reads a partly written cache.
+  void savePathCache(const PathCache &cache) {
+    auto path = pathCachePath(true);
+    if (path.empty()) {
+      return;
+    }
+    auto data = cache.save();
+    if (data.size() > static_cast<size_t>(MaxPathCacheSize)) {
+      return;
+    }
+    auto tempPath = path + L"." + std::to_wstring(GetCurrentProcessId());
+    HANDLE rawFile = CreateFileW(tempPath.c_str(), GENERIC_WRITE, 0, nullptr,
+                                 CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL,
+                                 nullptr);
+    if (rawFile == INVALID_HANDLE_VALUE) {
+      log::debug("Couldn't save PATH cache: {}", lastErrorString());
+      return;
+    }
+    HObject file{rawFile};
+    DWORD bytesWritten;
+    bool written = WriteFile(file, data.data(),
+                             static_cast<DWORD>(data.size()), &bytesWritten,
+                             nullptr);
+    file = nullptr;
+    if (!written ||
+        !MoveFileExW(tempPath.c_str(), path.c_str(),
+                     MOVEFILE_REPLACE_EXISTING))
+    {
+      log::debug("Couldn't save PATH cache: {}", lastErrorString());
+      DeleteFileW(tempPath.c_str());
+    }
+  }
+}
+
+// }}}
+
+std::vector<std::wstring>
+wsudo::resolvePrograms(const std::vector<std::wstring_view> &names) {
+  std::vector<std::wstring> programs(names.begin(), names.end());
+  if (std::none_of(names.begin(), names.end(), isBareName)) {
+    return programs;
+  }
+
+  WindowsFileSystem fileSystem;
+  PathCache cache{fileSystem, environmentVariable(L"PATHEXT")};
+  auto cachePath = pathCachePath(false);
+  if (!cachePath.empty()) {
+    loadPathCache(cache, cachePath);
+  }
+  auto path = splitPath(environmentVariable(L"PATH"));
+  for (auto &program : programs) {
+    if (auto found = cache.resolve(program, path)) {
+      program = std::move(*found);
+    }
+  }
+  if (cache.dirty()) {
+    savePathCache(cache);
+  }
+  return programs;
+}
@@ -0,0 +1,142 @@
+#include "wsudo/client.h"
+#include "wsudo/cmdline.h"
+
+#include <cwchar>
+
+using namespace wsudo;
+
+std::optional<std::vector<Command>>
+wsudo::splitCommands(int argc, wchar_t *argv[]) {
+  std::vector<Command> commands;
+  int start = 0;
+  for (int i = 0; i <= argc; ++i) {
+    bool pipe = i < argc && !wcscmp(argv[i], L"|");
+    if (i < argc && !pipe && wcscmp(argv[i], L"&")) {
+      continue;
+    }
+    if (i == start) {
+      return std::nullopt;
+    }
+    commands.push_back(Command{i - start, argv + start, pipe});
+    start = i + 1;
+  }
+  return commands;
+}
+
+std::optional<Process> wsudo::createProcess(const Command &command,
+                                            const std::wstring &program,
+                                            HANDLE input, HANDLE output)
+{
+  // Only the handles meant for this child are inheritable while it is
+  // created, so it doesn't hold other pipe ends open.
+  HObject inheritableInput, inheritableOutput;
+  auto self = GetCurrentProcess();
+  if (!DuplicateHandle(self, input, self, &inheritableInput, 0, true,
+                       DUPLICATE_SAME_ACCESS) ||
+      !DuplicateHandle(self, output, self, &inheritableOutput, 0, true,
+                       DUPLICATE_SAME_ACCESS))
+  {
+    return std::nullopt;
+  }
+
+  STARTUPINFOW si{};
+  si.cb = sizeof(STARTUPINFOW);
+  si.hStdInput = inheritableInput;
+  si.hStdOutput = inheritableOutput;
+  si.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+  si.dwFlags = STARTF_USESTDHANDLES;
+  PROCESS_INFORMATION pi;
+  auto commandLine = joinCommandLine(command.argv, command.argc);
+  if (!CreateProcessW(program.c_str(), commandLine.data(), nullptr, nullptr,
+                      true, CREATE_UNICODE_ENVIRONMENT | CREATE_SUSPENDED,
+                      nullptr, nullptr, &si, &pi))
+  {
+    return std::nullopt;
+  }
+  return Process{HObject{pi.hProcess}, HObject{pi.hThread}};
+}
+
+std::optional<std::vector<Process>>
+wsudo::createProcesses(const std::vector<Command> &commands) {
+  std::vector<std::wstring_view> names;
+  for (auto &command : commands) {
+    names.emplace_back(command.argv[0]);
+  }
+  auto programs = resolvePrograms(names);
+
+  std::vector<Process> processes;
+  processes.reserve(commands.size());
+  HObject pipeRead;
+  for (size_t i = 0; i < commands.size(); ++i) {
+    auto &command = commands[i];
+    HANDLE input = pipeRead ? (HANDLE)pipeRead
+                            : GetStdHandle(STD_INPUT_HANDLE);
+    HObject nextRead, pipeWrite;
+    if (command.pipeToNext && !CreatePipe(&nextRead, &pipeWrite, nullptr, 0)) {
+      log::critical("Error creating pipe: {}.\n", lastErrorString());
+      return std::nullopt;
+    }
+    HANDLE output = pipeWrite ? (HANDLE)pipeWrite
+                              : GetStdHandle(STD_OUTPUT_HANDLE);
+
+    auto process = createProcess(command, programs[i], input, output);
+    if (!process) {
+      log::critical(L"Error creating process '{}': {}.\n", command.argv[0],
+                    to_utf16(lastErrorString()));
+      for (auto &created : processes) {
+        TerminateProcess(created.process, 1);
+      }
+      return std::nullopt;
+    }
+    processes.emplace_back(std::move(*process));
+    pipeRead = std::move(nextRead);
+  }
+  return processes;
+}
+
+SpawnRequest wsudo::makeSpawnRequest(int argc, wchar_t *argv[],
+                                     std::vector<HObject> &inherit)
+{
+  // The server doesn't search the client's PATH, so name the program in
+  // full.
+  SpawnRequest request;
+  auto program = resolvePrograms({argv[0]})[0];
+  std::vector<wchar_t *> arguments(argv, argv + argc);
+  arguments[0] = program.data();
+  request.commandLine = joinCommandLine(arguments.data(), arguments.size());
+
+  // The server can only pass on handles that are inheritable in this process.
+  auto self = GetCurrentProcess();
+  auto inheritable = [&](DWORD which) -> uint64_t {
+    HObject handle;
+    if (!DuplicateHandle(self, GetStdHandle(which), self, &handle, 0, true,
+                         DUPLICATE_SAME_ACCESS))
+    {
+      return 0;
+    }
+    auto value = reinterpret_cast<uintptr_t>(static_cast<HANDLE>(handle));
+    inherit.emplace_back(std::move(handle));
+    return value;
+  };
+  request.input = inheritable(STD_INPUT_HANDLE);
+  request.output = inheritable(STD_OUTPUT_HANDLE);
+  request.error = inheritable(STD_ERROR_HANDLE);
+
+  request.currentDirectory.resize(GetCurrentDirectoryW(0, nullptr));
+  auto length = GetCurrentDirectoryW(
+    static_cast<DWORD>(request.currentDirectory.size()),
+    request.currentDirectory.data()
+  );
+  request.currentDirectory.resize(length);
+
+  if (auto env = GetEnvironmentStringsW()) {
+    // The block ends with an empty string.
+    auto end = env;
+    while (*end) {
+      end += wcslen(end) + 1;
+    }
+    request.environment.assign(env, end + 1);
+    FreeEnvironmentStringsW(env);
+  }
+  return request;
+}
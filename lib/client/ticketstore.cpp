@@ -0,0 +1,98 @@
+#include "wsudo/client.h"
+
+#include <ShlObj.h>
+#include <cwchar>
+
+#pragma comment(lib, "Shell32.lib")
+#pragma comment(lib, "Ole32.lib")
+
+using namespace wsudo;
+
+// Helpers {{{
+
+namespace {
+  // Tickets larger than this are not ours.
+  constexpr DWORD MaxTicketSize = 1024;
+
+  // %LOCALAPPDATA%\wsudo\tickets\<logon session ID>, or empty if the path
+  // can't be determined.
+  std::wstring ticketPath(bool createDirectory) {
+    auto logonId = processLogonId(GetCurrentProcess());
+    if (!logonId) {
+      return std::wstring{};
+    }
+
+    PWSTR localAppData;
+    if (!SUCCEEDED(SHGetKnownFolderPath(FOLDERID_LocalAppData, 0, nullptr,
+                                        &localAppData)))
+    {
+      return std::wstring{};
+    }
+    std::wstring path{localAppData};
+    CoTaskMemFree(localAppData);
+
+    path.append(L"\\wsudo");
+    if (createDirectory) {
+      // These fail harmlessly if the directories already exist.
+      CreateDirectoryW(path.c_str(), nullptr);
+      CreateDirectoryW((path + L"\\tickets").c_str(), nullptr);
+    }
+    wchar_t name[17];
+    swprintf(name, 17, L"%016llX", static_cast<unsigned long long>(*logonId));
+    return path + L"\\tickets\\" + name;
+  }
+}
+
+// }}}
+
+std::vector<char> wsudo::loadTicket() {
+  auto path = ticketPath(false);
+  if (path.empty()) {
+    return {};
+  }
+  HANDLE rawFile = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                               nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                               nullptr);
+  if (rawFile == INVALID_HANDLE_VALUE) {
+    return {};
+  }
+  HObject file{rawFile};
+
+  std::vector<char> ticket(MaxTicketSize);
+  DWORD bytesRead;
+  if (!ReadFile(file, ticket.data(), MaxTicketSize, &bytesRead, nullptr)) {
+    return {};
+  }
+  ticket.resize(bytesRead);
+  return ticket;
+}
+
+void wsudo::saveTicket(const std::vector<char> &ticket) {
+  if (ticket.empty() || ticket.size() > MaxTicketSize) {
+    return;
+  }
+  auto path = ticketPath(true);
+  if (path.empty()) {
+    return;
+  }
+  HANDLE rawFile = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr,
+                               CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (rawFile == INVALID_HANDLE_VALUE) {
+    log::debug("Couldn't save ticket: {}", lastErrorString());
+    return;
+  }
+  HObject file{rawFile};
+  DWORD bytesWritten;
+  if (!WriteFile(file, ticket.data(), static_cast<DWORD>(ticket.size()),
+                 &bytesWritten, nullptr))
+  {
+    log::debug("Couldn't save ticket: {}", lastErrorString());
+  }
+}
+
+void wsudo::deleteTicket() {
+  auto path = ticketPath(false);
+  if (!path.empty()) {
+    DeleteFileW(path.c_str());
+  }
+}
@@ -0,0 +1,351 @@
+#include "wsudo/asynclog.h"
+
+#include <spdlog/pattern_formatter.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+using namespace wsudo;
+using namespace wsudo::log;
+
+// Helpers {{{
+
+namespace {
+  // Records store their stream in the top bit of the length.
+  constexpr uint32_t StreamBit = 0x80000000;
+
+  std::atomic<uint64_t> g_nextId{1};
+
+  const char *levelColor(spdlog::level::level_enum level) {
+    switch (level) {
+      case spdlog::level::trace: return "\033[37m";
+      case spdlog::level::debug: return "\033[36m";
+      case spdlog::level::info: return "\033[32m";
+      case spdlog::level::warn: return "\033[33m\033[1m";
+      case spdlog::level::err: return "\033[31m\033[1m";
+      case spdlog::level::critical: return "\033[1m\033[41m";
+      default: return "";
+    }
+  }
+
+  constexpr std::string_view ResetColor = "\033[m";
+
+  // The formatter this thread uses for a sink, and the sink's formatter
+  // version it was cloned from.
+  struct ThreadFormatter {
+    const AsyncSink *sink;
+    uint64_t version;
+    std::unique_ptr<spdlog::formatter> formatter;
+  };
+
+  thread_local std::vector<ThreadFormatter> t_formatters;
+}
+
+// }}}
+
+// {{{ LogRing
+
+LogRing::LogRing(size_t capacity)
+  : _data{new char[capacity]},
+    _mask{capacity - 1}
+{
+  assert(capacity && (capacity & (capacity - 1)) == 0);
+}
+
+void LogRing::copyIn(size_t position, const void *data, size_t size) {
+  auto offset = position & _mask;
+  auto first = std::min(size, _mask + 1 - offset);
+  std::memcpy(_data.get() + offset, data, first);
+  std::memcpy(_data.get(), static_cast<const char *>(data) + first,
+              size - first);
+}
+
+void LogRing::copyOut(size_t position, void *data, size_t size) const {
+  auto offset = position & _mask;
+  auto first = std::min(size, _mask + 1 - offset);
+  std::memcpy(data, _data.get() + offset, first);
+  std::memcpy(static_cast<char *>(data) + first, _data.get(), size - first);
+}
+
+bool LogRing::push(unsigned stream, std::string_view text) {
+  auto head = _head.load(std::memory_order_relaxed);
+  auto tail = _tail.load(std::memory_order_acquire);
+  auto free = _mask + 1 - (head - tail);
+  if (text.size() + HeaderSize > free || text.size() >= StreamBit) {
+    return false;
+  }
+  uint32_t header = static_cast<uint32_t>(text.size()) |
+                    (stream ? StreamBit : 0);
+  copyIn(head, &header, HeaderSize);
+  copyIn(head + HeaderSize, text.data(), text.size());
+  _head.store(head + HeaderSize + text.size(), std::memory_order_release);
+  return true;
+}
+
+size_t
+LogRing::drain(const std::function<void(unsigned, std::string_view)> &sink,
+               std::string &scratch)
+{
+  auto tail = _tail.load(std::memory_order_relaxed);
+  auto head = _head.load(std::memory_order_acquire);
+  size_t records = 0;
+  while (tail != head) {
+    uint32_t header;
+    copyOut(tail, &header, HeaderSize);
+    size_t size = header & ~StreamBit;
+    auto offset = (tail + HeaderSize) & _mask;
+    if (offset + size <= _mask + 1) {
+      sink(header & StreamBit ? 1 : 0,
+           std::string_view{_data.get() + offset, size});
+    } else {
+      scratch.resize(size);
+      copyOut(tail + HeaderSize, scratch.data(), size);
+      sink(header & StreamBit ? 1 : 0, scratch);
+    }
+    tail += HeaderSize + size;
+    ++records;
+  }
+  _tail.store(tail, std::memory_order_release);
+  return records;
+}
+
+// }}} LogRing
+
+// {{{ AsyncLogWriter
+
+// The rings this thread writes to, one per writer. They are retired when
+// the thread exits.
+struct AsyncLogWriter::ThreadRings {
+  std::vector<std::pair<uint64_t, std::shared_ptr<LogRing>>> rings;
+
+  ~ThreadRings() {
+    for (auto &[id, ring] : rings) {
+      ring->retired.store(true, std::memory_order_release);
+    }
+  }
+};
+
+AsyncLogWriter::AsyncLogWriter(Output out, Output err, size_t ringSize,
+                               std::chrono::milliseconds interval)
+  : _outputs{std::move(out), std::move(err)},
+    _ringSize{ringSize},
+    _interval{interval},
+    _id{g_nextId.fetch_add(1, std::memory_order_relaxed)},
+    _thread{&AsyncLogWriter::run, this}
+{
+}
+
+AsyncLogWriter::~AsyncLogWriter() {
+  stop();
+}
+
+LogRing &AsyncLogWriter::threadRing() {
+  thread_local ThreadRings threadRings;
+  for (auto &[id, ring] : threadRings.rings) {
+    if (id == _id) {
+      return *ring;
+    }
+  }
+  auto ring = std::make_shared<LogRing>(_ringSize);
+  {
+    std::lock_guard<std::mutex> lock{_ringsMutex};
+    _rings.push_back(ring);
+  }
+  threadRings.rings.emplace_back(_id, ring);
+  return *ring;
+}
+
+bool AsyncLogWriter::write(Stream stream, std::string_view text) {
+  if (_stopped.load(std::memory_order_acquire)) {
+    std::lock_guard<std::mutex> lock{_syncMutex};
+    _outputs[stream](text);
+    _records.fetch_add(1, std::memory_order_relaxed);
+    _writes.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+  if (!threadRing().push(stream, text)) {
+    _dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  // stop() may have drained for the last time between the check above and
+  // the push. Both sides store, fence, then load, so either its drain saw
+  // this record or this sees _stopped and drains it.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (_stopped.load(std::memory_order_relaxed)) {
+    std::lock_guard<std::mutex> lock{_syncMutex};
+    writeBatches();
+  }
+  return true;
+}
+
+void AsyncLogWriter::flush() {
+  std::unique_lock<std::mutex> lock{_mutex};
+  if (_stopping) {
+    return;
+  }
+  auto ticket = ++_flushRequested;
+  _wake.notify_one();
+  _flushed.wait(lock, [&] { return _flushCompleted >= ticket || _stopping; });
+}
+
+void AsyncLogWriter::stop() {
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    if (_stopping) {
+      return;
+    }
+    _stopping = true;
+  }
+  _wake.notify_one();
+  _flushed.notify_all();
+  _thread.join();
+  // Anything logged while the thread was finishing. A record pushed after
+  // this drain is written by the thread that pushed it; see write().
+  std::lock_guard<std::mutex> lock{_syncMutex};
+  _stopped.store(true, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  writeBatches();
+}
+
+AsyncLogWriter::Stats AsyncLogWriter::stats() const {
+  Stats stats;
+  stats.records = _records.load(std::memory_order_relaxed);
+  stats.dropped = _dropped.load(std::memory_order_relaxed);
+  stats.writes = _writes.load(std::memory_order_relaxed);
+  return stats;
+}
+
+void AsyncLogWriter::run() {
+  std::unique_lock<std::mutex> lock{_mutex};
+  while (!_stopping) {
+    _wake.wait_for(lock, _interval, [this] {
+      return _stopping || _flushRequested > _flushCompleted;
+    });
+    auto ticket = _flushRequested;
+    lock.unlock();
+    writeBatches();
+    lock.lock();
+    _flushCompleted = ticket;
+    _flushed.notify_all();
+  }
+}
+
+void AsyncLogWriter::writeBatches() {
+  std::vector<std::shared_ptr<LogRing>> rings;
+  {
+    std::lock_guard<std::mutex> lock{_ringsMutex};
+    // Rings of exited threads only need one more drain.
+    rings = _rings;
+    _rings.erase(
+      std::remove_if(_rings.begin(), _rings.end(), [](auto &ring) {
+        return ring->retired.load(std::memory_order_acquire);
+      }),
+      _rings.end()
+    );
+  }
+
+  uint64_t records = 0;
+  for (auto &ring : rings) {
+    records += ring->drain(
+      [this](unsigned stream, std::string_view text) {
+        _batches[stream].append(text);
+      },
+      _scratch
+    );
+  }
+  _records.fetch_add(records, std::memory_order_relaxed);
+
+  auto dropped = _dropped.load(std::memory_order_relaxed);
+  if (dropped != _droppedReported) {
+    _batches[Err].append("[wsudo] ")
+                 .append(std::to_string(dropped - _droppedReported))
+                 .append(" log messages dropped.\n");
+    _droppedReported = dropped;
+  }
+
+  for (unsigned stream = 0; stream < _batches.size(); ++stream) {
+    auto &batch = _batches[stream];
+    if (!batch.empty()) {
+      _outputs[stream](batch);
+      _writes.fetch_add(1, std::memory_order_relaxed);
+      batch.clear();
+    }
+  }
+}
+
+// }}} AsyncLogWriter
+
+// {{{ AsyncSink
+
+AsyncSink::AsyncSink(std::shared_ptr<AsyncLogWriter> writer,
+                     AsyncLogWriter::Stream stream, bool colors)
+  : _writer{std::move(writer)},
+    _stream{stream},
+    _colors{colors},
+    _formatter{std::make_unique<spdlog::pattern_formatter>()},
+    _formatterVersion{g_nextId.fetch_add(1, std::memory_order_relaxed)}
+{
+}
+
+spdlog::formatter &AsyncSink::threadFormatter() {
+  auto version = _formatterVersion.load(std::memory_order_acquire);
+  auto it = std::find_if(t_formatters.begin(), t_formatters.end(),
+                         [this](auto &entry) { return entry.sink == this; });
+  if (it != t_formatters.end() && it->version == version) {
+    return *it->formatter;
+  }
+
+  std::unique_ptr<spdlog::formatter> formatter;
+  {
+    std::lock_guard<std::mutex> lock{_formatterMutex};
+    formatter = _formatter->clone();
+    version = _formatterVersion.load(std::memory_order_relaxed);
+  }
+  if (it == t_formatters.end()) {
+    t_formatters.push_back(ThreadFormatter{this, version, nullptr});
+    it = t_formatters.end() - 1;
+  }
+  it->version = version;
+  it->formatter = std::move(formatter);
+  return *it->formatter;
+}
+
+void AsyncSink::log(const spdlog::details::log_msg &msg) {
+  thread_local spdlog::memory_buf_t formatted;
+  formatted.clear();
+  threadFormatter().format(msg, formatted);
+  std::string_view line{formatted.data(), formatted.size()};
+
+  if (!_colors || msg.color_range_end <= msg.color_range_start) {
+    _writer->write(_stream, line);
+    return;
+  }
+  thread_local std::string colored;
+  colored.assign(line.substr(0, msg.color_range_start))
+         .append(levelColor(msg.level))
+         .append(line.substr(msg.color_range_start,
+                             msg.color_range_end - msg.color_range_start))
+         .append(ResetColor)
+         .append(line.substr(msg.color_range_end));
+  _writer->write(_stream, colored);
+}
+
+void AsyncSink::flush() {
+  _writer->flush();
+}
+
+void AsyncSink::set_pattern(const std::string &pattern) {
+  set_formatter(std::make_unique<spdlog::pattern_formatter>(pattern));
+}
+
+void AsyncSink::set_formatter(std::unique_ptr<spdlog::formatter> formatter) {
+  std::lock_guard<std::mutex> lock{_formatterMutex};
+  _formatter = std::move(formatter);
+  // Versions are unique across sinks, so a thread's copy for a destroyed
+  // sink at the same address is never mistaken for current.
+  _formatterVersion.store(g_nextId.fetch_add(1, std::memory_order_relaxed),
+                          std::memory_order_release);
+}
+
+// }}} AsyncSink
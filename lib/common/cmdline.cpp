@@ -0,0 +1,294 @@
+#include "wsudo/cmdline.h"
+
+#include <algorithm>
+
+// WSUDO_NO_SIMD builds only the scalar scan, so it can be tested alone.
+#if !defined(WSUDO_NO_SIMD) && \
+    (defined(__SSE2__) || defined(_M_X64) || \
+     (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+# define WSUDO_CMDLINE_SSE2 1
+# include <emmintrin.h>
+#endif
+
+using namespace wsudo;
+
+// Helpers {{{
+
+namespace {
+  bool isSeparator(wchar_t c) {
+    return c == L' ' || c == L'\t';
+  }
+
+  // Arguments without spaces or quotes are used as is.
+  bool needsQuotes(std::wstring_view argument, unsigned scan) {
+    return argument.empty() ||
+           (scan & (detail::ScanSpace | detail::ScanQuote));
+  }
+
+  // Length of an argument once quoted and escaped.
+  size_t escapedLength(std::wstring_view argument, unsigned scan) {
+    if (!needsQuotes(argument, scan)) {
+      return argument.size();
+    }
+    size_t length = argument.size() + 2;
+    if (!(scan & (detail::ScanQuote | detail::ScanBackslash))) {
+      return length;
+    }
+    // Backslashes are doubled before a quote and before the closing quote;
+    // quotes get one more.
+    size_t backslashes = 0;
+    for (auto c : argument) {
+      if (c == L'\\') {
+        ++backslashes;
+        continue;
+      }
+      if (c == L'"') {
+        length += backslashes + 1;
+      }
+      backslashes = 0;
+    }
+    return length + backslashes;
+  }
+
+  void appendEscaped(std::wstring &out, std::wstring_view argument,
+                     unsigned scan)
+  {
+    if (!needsQuotes(argument, scan)) {
+      out.append(argument);
+      return;
+    }
+    out.push_back(L'"');
+    if (!(scan & (detail::ScanQuote | detail::ScanBackslash))) {
+      out.append(argument);
+      out.push_back(L'"');
+      return;
+    }
+    size_t backslashes = 0;
+    for (auto c : argument) {
+      if (c == L'\\') {
+        ++backslashes;
+      } else if (c == L'"') {
+        out.append(backslashes + 1, L'\\');
+        backslashes = 0;
+      } else {
+        backslashes = 0;
+      }
+      out.push_back(c);
+    }
+    out.append(backslashes, L'\\');
+    out.push_back(L'"');
+  }
+
+  bool programNeedsQuotes(std::wstring_view program) {
+    return program.empty() ||
+           program.find_first_of(L" \t") != std::wstring_view::npos;
+  }
+
+  size_t programLength(std::wstring_view program) {
+    size_t quotes = 0;
+    for (auto c : program) {
+      quotes += c == L'"';
+    }
+    return program.size() - quotes + (programNeedsQuotes(program) ? 2 : 0);
+  }
+
+  void appendProgram(std::wstring &out, std::wstring_view program) {
+    bool quoted = programNeedsQuotes(program);
+    if (quoted) {
+      out.push_back(L'"');
+    }
+    for (auto c : program) {
+      if (c != L'"') {
+        out.push_back(c);
+      }
+    }
+    if (quoted) {
+      out.push_back(L'"');
+    }
+  }
+
+#ifdef WSUDO_CMDLINE_SSE2
+  // wchar_t is 2 bytes on Windows and 4 elsewhere.
+  __m128i splat(wchar_t c) {
+    if constexpr (sizeof(wchar_t) == 2) {
+      return _mm_set1_epi16(static_cast<short>(c));
+    } else {
+      return _mm_set1_epi32(static_cast<int>(c));
+    }
+  }
+
+  __m128i equal(__m128i a, __m128i b) {
+    if constexpr (sizeof(wchar_t) == 2) {
+      return _mm_cmpeq_epi16(a, b);
+    } else {
+      return _mm_cmpeq_epi32(a, b);
+    }
+  }
+#endif
+}
+
+// }}}
+
+unsigned wsudo::detail::scanArgumentScalar(std::wstring_view argument) {
+  unsigned scan = 0;
+  for (auto c : argument) {
+    switch (c) {
+      case L' ':
+      case L'\t':
+      case L'\n':
+      case L'\v':
+        scan |= ScanSpace;
+        break;
+      case L'"':
+        scan |= ScanQuote;
+        break;
+      case L'\\':
+        scan |= ScanBackslash;
+        break;
+    }
+  }
+  return scan;
+}
+
+unsigned wsudo::detail::scanArgument(std::wstring_view argument) {
+#ifdef WSUDO_CMDLINE_SSE2
+  constexpr size_t Lanes = sizeof(__m128i) / sizeof(wchar_t);
+  const auto space = splat(L' ');
+  const auto tab = splat(L'\t');
+  const auto newline = splat(L'\n');
+  const auto verticalTab = splat(L'\v');
+  const auto quote = splat(L'"');
+  const auto backslash = splat(L'\\');
+
+  auto spaces = _mm_setzero_si128();
+  auto quotes = _mm_setzero_si128();
+  auto backslashes = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + Lanes <= argument.size(); i += Lanes) {
+    auto chunk = _mm_loadu_si128(
+      reinterpret_cast<const __m128i *>(argument.data() + i)
+    );
+    spaces = _mm_or_si128(
+      spaces,
+      _mm_or_si128(_mm_or_si128(equal(chunk, space), equal(chunk, tab)),
+                   _mm_or_si128(equal(chunk, newline),
+                                equal(chunk, verticalTab)))
+    );
+    quotes = _mm_or_si128(quotes, equal(chunk, quote));
+    backslashes = _mm_or_si128(backslashes, equal(chunk, backslash));
+  }
+  unsigned scan = 0;
+  if (_mm_movemask_epi8(spaces)) {
+    scan |= ScanSpace;
+  }
+  if (_mm_movemask_epi8(quotes)) {
+    scan |= ScanQuote;
+  }
+  if (_mm_movemask_epi8(backslashes)) {
+    scan |= ScanBackslash;
+  }
+  return scan | scanArgumentScalar(argument.substr(i));
+#else
+  return scanArgumentScalar(argument);
+#endif
+}
+
+std::wstring wsudo::joinCommandLine(const wchar_t *const *argv,
+                                    size_t argc)
+{
+  if (argc == 0) {
+    return std::wstring{};
+  }
+
+  // Size everything first so the result is allocated once.
+  size_t length = programLength(argv[0]);
+  for (size_t i = 1; i < argc; ++i) {
+    std::wstring_view argument{argv[i]};
+    length += 1 + escapedLength(argument, detail::scanArgument(argument));
+  }
+
+  std::wstring commandLine;
+  commandLine.reserve(length);
+  appendProgram(commandLine, argv[0]);
+  for (size_t i = 1; i < argc; ++i) {
+    std::wstring_view argument{argv[i]};
+    commandLine.push_back(L' ');
+    appendEscaped(commandLine, argument, detail::scanArgument(argument));
+  }
+  return commandLine;
+}
+
+std::vector<std::wstring>
+wsudo::splitCommandLine(std::wstring_view commandLine) {
+  std::vector<std::wstring> arguments;
+  if (commandLine.empty()) {
+    return arguments;
+  }
+
+  // The program name.
+  size_t i = 0;
+  if (commandLine[0] == L'"') {
+    auto end = commandLine.find(L'"', 1);
+    arguments.emplace_back(commandLine.substr(1, end - 1));
+    i = end == std::wstring_view::npos ? commandLine.size() : end + 1;
+  } else {
+    auto end = std::min(commandLine.find_first_of(L" \t"),
+                        commandLine.size());
+    arguments.emplace_back(commandLine.substr(0, end));
+    i = end;
+  }
+
+  std::wstring argument;
+  bool inArgument = false;
+  // 0 outside quotes, 1 inside, and counts up through a run of quotes.
+  unsigned quotes = 0;
+  size_t backslashes = 0;
+  for (; i < commandLine.size(); ++i) {
+    auto c = commandLine[i];
+    if (isSeparator(c) && quotes == 0) {
+      argument.append(backslashes, L'\\');
+      backslashes = 0;
+      if (inArgument) {
+        arguments.emplace_back(std::move(argument));
+        argument.clear();
+        inArgument = false;
+      }
+      continue;
+    }
+    inArgument = true;
+    if (c == L'\\') {
+      ++backslashes;
+      continue;
+    }
+    if (c != L'"') {
+      argument.append(backslashes, L'\\');
+      backslashes = 0;
+      argument.push_back(c);
+      continue;
+    }
+
+    argument.append(backslashes / 2, L'\\');
+    if (backslashes % 2) {
+      argument.push_back(L'"');
+      backslashes = 0;
+      continue;
+    }
+    backslashes = 0;
+    ++quotes;
+    while (i + 1 < commandLine.size() && commandLine[i + 1] == L'"') {
+      ++i;
+      if (++quotes == 3) {
+        argument.push_back(L'"');
+        quotes = 0;
+      }
+    }
+    if (quotes == 2) {
+      quotes = 0;
+    }
+  }
+  argument.append(backslashes, L'\\');
+  if (inArgument) {
+    arguments.emplace_back(std::move(argument));
+  }
+  return arguments;
+}
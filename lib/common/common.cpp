@@ -1,19 +1,62 @@
 #include "wsudo/wsudo.h"
+#include "wsudo/asynclog.h"
 
 namespace wsudo {
 
 namespace log {
   std::shared_ptr<spdlog::logger> g_outLogger;
   std::shared_ptr<spdlog::logger> g_errLogger;
+
+  std::shared_ptr<AsyncLogWriter> startAsyncLogging(bool colors) {
+    auto output = [](DWORD which) {
+      return [handle = GetStdHandle(which)](std::string_view text) {
+        DWORD written;
+        WriteFile(handle, text.data(), static_cast<DWORD>(text.size()),
+                  &written, nullptr);
+      };
+    };
+    // Only a console in VT mode understands the color sequences.
+    auto useColors = [colors](DWORD which) {
+      auto handle = GetStdHandle(which);
+      DWORD mode;
+      return colors && GetConsoleMode(handle, &mode) &&
+             SetConsoleMode(handle,
+                            mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+    };
+
+    auto writer = std::make_shared<AsyncLogWriter>(
+      output(STD_OUTPUT_HANDLE), output(STD_ERROR_HANDLE)
+    );
+    g_outLogger = std::make_shared<spdlog::logger>(
+      "wsudo.out",
+      std::make_shared<AsyncSink>(writer, AsyncLogWriter::Out,
+                                  useColors(STD_OUTPUT_HANDLE))
+    );
+    g_errLogger = std::make_shared<spdlog::logger>(
+      "wsudo.err",
+      std::make_shared<AsyncSink>(writer, AsyncLogWriter::Err,
+                                  useColors(STD_ERROR_HANDLE))
+    );
+    // Critical errors usually come right before an exit; don't leave them
+    // queued.
+    g_errLogger->flush_on(spdlog::level::critical);
+    // Registered so spdlog::set_pattern reaches them.
+    spdlog::register_logger(g_outLogger);
+    spdlog::register_logger(g_errLogger);
+    return writer;
+  }
 }
 
 const wchar_t *const PipeFullPath = L"\\\\.\\pipe\\wsudo_token_server";
+const wchar_t *const AdminPipeFullPath = L"\\\\.\\pipe\\wsudo_admin";
 
 namespace msg {
   namespace client {
     const char *const QuerySession = "QSES";
     const char *const Credential = "CRED";
     const char *const Bless = "BLES";
+    const char *const Resume = "RSUM";
+    const char *const Spawn = "SPWN";
   }
 
   namespace server {
@@ -21,6 +64,12 @@ namespace msg {
     const char *const InvalidMessage = "MESG";
     const char *const InternalError = "INTE";
     const char *const AccessDenied = "DENY";
+    const char *const Busy = "BUSY";
+  }
+
+  namespace admin {
+    const char *const Metrics = "MTRC";
+    const char *const FlightDump = "FLDR";
   }
 } // namespace msg
 
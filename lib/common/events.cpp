@@ -1,6 +1,8 @@
 #include "wsudo/events.h"
 #include "wsudo/wsudo.h"
 
+#include <algorithm>
+
 using namespace wsudo;
 using namespace wsudo::events;
 
@@ -15,6 +17,10 @@ bool EventHandler::reset() {
   return false;
 }
 
+const char *EventHandler::stateName() const {
+  return "handler";
+}
+
 // }}} EventHandler
 
 // {{{ EventListener
@@ -26,9 +32,24 @@ EventStatus EventListener::next(DWORD timeout) {
     return EventStatus::Finished;
   }
 
+  // Poll first; if nothing is ready, the loop has caught up and an event
+  // that arrives while blocking hasn't waited for anything.
   auto waitResult = WaitForMultipleObjects(
-    static_cast<DWORD>(_events.size()), &_events[0], false, timeout
+    static_cast<DWORD>(_events.size()), &_events[0], false, 0
   );
+  bool blocked = waitResult == WAIT_TIMEOUT;
+  if (blocked) {
+    if (timeout != 0) {
+      waitResult = WaitForMultipleObjects(
+        static_cast<DWORD>(_events.size()), &_events[0], false, timeout
+      );
+    }
+    _backlog = 0;
+  }
+  auto now = std::chrono::steady_clock::now();
+  if (_metrics.iterations) {
+    _metrics.iterations->add();
+  }
 
   if (waitResult == WAIT_TIMEOUT) {
     log::error("WaitForMultipleObjects timed out.");
@@ -38,8 +59,25 @@ EventStatus EventListener::next(DWORD timeout) {
   {
     size_t index = static_cast<size_t>(waitResult - WAIT_OBJECT_0);
     log::trace("Event #{} signaled.", index);
-
-    switch ((*_handlers[index])(*this)) {
+    // Events before this one weren't signaled. If the loop blocked, this one
+    // wasn't either until the wait returned.
+    auto unsignaled = _readyAfter.begin() + index + (blocked ? 1 : 0);
+    std::fill(_readyAfter.begin(), unsignaled, now);
+    _queueDelay = now - _readyAfter[index];
+    recordDispatch();
+
+    if (_heartbeat) {
+      _heartbeat->begin(index, _handlers[index]->stateName());
+    }
+    auto status = (*_handlers[index])(*this);
+    if (_heartbeat) {
+      _heartbeat->end();
+    }
+    // Whatever the handler started can't have finished before it returned.
+    _readyAfter[index] = std::chrono::steady_clock::now();
+    recorder::record(recorder::Kind::Result, static_cast<uint32_t>(index),
+                     "handler", static_cast<uint32_t>(status));
+    switch (status) {
     case EventStatus::Ok:
       log::trace("Event #{} returned Ok.", index);
       break;
@@ -68,8 +106,10 @@ EventStatus EventListener::next(DWORD timeout) {
     log::error("Mutex abandoned state signaled for handler #{}.", index);
     remove(index);
   } else if (waitResult == WAIT_FAILED) {
+    auto error = GetLastError();
+    recorder::record(recorder::Kind::Error, 0, "wait", error);
     log::critical("WaitForMultipleObjects failed: {}",
-                  lastErrorString());
+                  lastErrorString(error));
     return EventStatus::Failed;
   } else {
     log::critical("WaitForMultipleObjects returned 0x{:X}: {}", waitResult,
@@ -77,9 +117,25 @@ EventStatus EventListener::next(DWORD timeout) {
     return EventStatus::Failed;
   }
 
+  if (_metrics.handlers) {
+    _metrics.handlers->set(static_cast<int64_t>(_events.size()));
+  }
   return _events.size() > 0 ? EventStatus::Ok : EventStatus::Finished;
 }
 
+void EventListener::recordDispatch() {
+  ++_backlog;
+  if (_metrics.backlog) {
+    _metrics.backlog->set(_backlog);
+  }
+  if (_metrics.queueDelay) {
+    _metrics.queueDelay->record(static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(queueDelay())
+        .count()
+    ));
+  }
+}
+
 EventStatus EventListener::run(DWORD timeout) {
   _running = true;
 
@@ -104,6 +160,7 @@ void EventListener::remove(size_t index) {
 
   _events.erase(_events.cbegin() + index);
   _handlers.erase(_handlers.cbegin() + index);
+  _readyAfter.erase(_readyAfter.cbegin() + index);
 }
 
 // }}} EventListener
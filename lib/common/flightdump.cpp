@@ -0,0 +1,103 @@
+#include "wsudo/flightdump.h"
+
+#include <ShlObj.h>
+
+#include <chrono>
+#include <ctime>
+#include <cwchar>
+
+#pragma comment(lib, "Shell32.lib")
+#pragma comment(lib, "Ole32.lib")
+
+using namespace wsudo;
+using namespace wsudo::recorder;
+
+// Helpers {{{
+
+namespace {
+  bool writeToFile(void *context, const void *data, size_t size) {
+    DWORD written;
+    return WriteFile(static_cast<HANDLE>(context), data,
+                     static_cast<DWORD>(size), &written, nullptr) &&
+           written == size;
+  }
+
+  uint64_t wallTime() noexcept {
+    using namespace std::chrono;
+    return static_cast<uint64_t>(
+      duration_cast<microseconds>(system_clock::now().time_since_epoch())
+        .count()
+    );
+  }
+
+  // Filled in by installCrashHandler; the handler only reads it.
+  wchar_t gs_crashPath[MAX_PATH];
+
+  LONG WINAPI crashFilter(EXCEPTION_POINTERS *exception) {
+    auto code = exception->ExceptionRecord->ExceptionCode;
+    record(Kind::Error, 0, "crash", static_cast<uint32_t>(code));
+    writeDump(gs_crashPath);
+    // Let Windows Error Reporting or a debugger have it too.
+    return EXCEPTION_CONTINUE_SEARCH;
+  }
+}
+
+// }}}
+
+bool recorder::writeDump(const wchar_t *path) noexcept {
+  HANDLE handle = CreateFileW(path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (handle == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  HObject file{handle};
+  return dump(writeToFile, static_cast<HANDLE>(file), GetCurrentProcessId(),
+              wallTime()) &&
+         FlushFileBuffers(file);
+}
+
+std::wstring recorder::newDumpPath(const std::wstring &directory) {
+  // Dumps hold request details, so only admins may read or plant them.
+  if (!createAdminDirectoryTree(directory)) {
+    log::error(L"Couldn't secure dump directory '{}': {}", directory,
+               to_utf16(lastErrorString()));
+    return std::wstring{};
+  }
+  auto time = std::time(nullptr);
+  std::tm utc;
+  gmtime_s(&utc, &time);
+  wchar_t stamp[16];
+  std::wcsftime(stamp, std::size(stamp), L"%Y%m%dT%H%M%S", &utc);
+  return directory + L"\\flight-" + std::to_wstring(GetCurrentProcessId()) +
+         L"-" + stamp + L".bin";
+}
+
+void recorder::installCrashHandler(const std::wstring &directory) {
+  auto path = directory + L"\\flight-" +
+              std::to_wstring(GetCurrentProcessId()) + L"-crash.bin";
+  if (path.size() >= std::size(gs_crashPath)) {
+    log::warn(L"Dump path '{}' is too long; crashes won't be recorded.",
+              path);
+    return;
+  }
+  // Now rather than in the handler.
+  if (!createAdminDirectoryTree(directory)) {
+    log::warn(L"Couldn't secure dump directory '{}'; crashes won't be "
+              L"recorded.", directory);
+    return;
+  }
+  wcscpy_s(gs_crashPath, path.c_str());
+  SetUnhandledExceptionFilter(crashFilter);
+}
+
+std::wstring recorder::defaultDumpDirectory() {
+  PWSTR programData;
+  if (!SUCCEEDED(SHGetKnownFolderPath(FOLDERID_ProgramData, 0, nullptr,
+                                      &programData)))
+  {
+    return std::wstring{};
+  }
+  std::wstring path{programData};
+  CoTaskMemFree(programData);
+  return path + L"\\wsudo\\dumps";
+}
@@ -0,0 +1,300 @@
+#include "wsudo/flightrecorder.h"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+
+using namespace wsudo;
+using namespace wsudo::recorder;
+
+// Helpers {{{
+
+namespace {
+  constexpr char DumpMagic[4] = {'W', 'S', 'F', 'R'};
+  constexpr uint32_t DumpVersion = 1;
+
+  struct DumpHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t entrySize;
+    uint32_t processId;
+    uint64_t wallTime;
+    uint64_t steadyTime;
+  };
+
+  // Precedes each thread's entries; a zero thread ends the dump.
+  struct RingHeader {
+    uint32_t thread;
+    uint32_t count;
+  };
+
+  constexpr size_t EntryWords = sizeof(Entry) / sizeof(uint64_t);
+
+  // A slot is a small seqlock: `sequence` is zero while the entry is being
+  // written, then the entry's index plus one. A reader that sees the same
+  // nonzero sequence before and after copying has a whole entry.
+  struct Slot {
+    std::atomic<uint64_t> sequence;
+    std::atomic<uint64_t> words[EntryWords];
+  };
+
+  struct Ring {
+    explicit Ring(uint32_t thread) : thread{thread} {}
+
+    const uint32_t thread;
+    // Cleared when the owning thread exits so another can take the ring.
+    std::atomic<bool> owned{true};
+    std::atomic<uint64_t> head{0};
+    Slot slots[RingCapacity]{};
+  };
+
+  // Rings are never freed, so a dump can always walk them.
+  std::atomic<Ring *> g_rings[MaxThreads]{};
+  std::mutex g_claimMutex;
+
+  struct ThreadRing {
+    Ring *ring = nullptr;
+    bool claimed = false;
+
+    ~ThreadRing() {
+      if (ring) {
+        ring->owned.store(false, std::memory_order_release);
+      }
+    }
+  };
+
+  thread_local ThreadRing t_ring;
+
+  Ring *claimRing() {
+    std::lock_guard<std::mutex> lock{g_claimMutex};
+    // A dead thread's entries may be what explains a crash, so its ring is
+    // only reused once every ring is in use.
+    for (size_t i = 0; i < MaxThreads; ++i) {
+      if (!g_rings[i].load(std::memory_order_acquire)) {
+        auto ring = new Ring{static_cast<uint32_t>(i + 1)};
+        g_rings[i].store(ring, std::memory_order_release);
+        return ring;
+      }
+    }
+    for (auto &slot : g_rings) {
+      auto ring = slot.load(std::memory_order_acquire);
+      bool owned = false;
+      if (ring->owned.compare_exchange_strong(owned, true)) {
+        return ring;
+      }
+    }
+    return nullptr;
+  }
+
+  // Copy the ring's whole entries, oldest first. Returns how many.
+  size_t copyRing(const Ring &ring, Entry *out) {
+    auto head = ring.head.load(std::memory_order_acquire);
+    auto first = head > RingCapacity ? head - RingCapacity : 0;
+    size_t count = 0;
+    for (auto index = first; index < head; ++index) {
+      auto &slot = ring.slots[index % RingCapacity];
+      auto sequence = slot.sequence.load(std::memory_order_acquire);
+      uint64_t words[EntryWords];
+      for (size_t w = 0; w < EntryWords; ++w) {
+        words[w] = slot.words[w].load(std::memory_order_relaxed);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (sequence != index + 1 ||
+          slot.sequence.load(std::memory_order_relaxed) != sequence)
+      {
+        // Overwritten while we looked.
+        continue;
+      }
+      std::memcpy(&out[count++], words, sizeof(Entry));
+    }
+    return count;
+  }
+
+  // Only one dump at a time uses the scratch space.
+  std::atomic_flag g_dumping = ATOMIC_FLAG_INIT;
+  Entry g_scratch[RingCapacity];
+
+  template<typename T>
+  bool readValue(std::string_view &data, T &value) {
+    if (data.size() < sizeof(T)) {
+      return false;
+    }
+    std::memcpy(&value, data.data(), sizeof(T));
+    data.remove_prefix(sizeof(T));
+    return true;
+  }
+
+  // Names for EventStatus, in declaration order.
+  constexpr const char *StatusNames[] = {"ok", "finished", "failed"};
+}
+
+// }}}
+
+const char *recorder::kindToString(Kind kind) {
+  switch (kind) {
+    case Kind::State: return "state";
+    case Kind::IO: return "io";
+    case Kind::Result: return "result";
+    case Kind::Error: return "error";
+    case Kind::Note: return "note";
+  }
+  return "?";
+}
+
+std::string_view Entry::tagName() const {
+  auto end = std::find(tag, tag + sizeof(tag), '\0');
+  return std::string_view{tag, static_cast<size_t>(end - tag)};
+}
+
+uint64_t recorder::now() noexcept {
+  using namespace std::chrono;
+  return static_cast<uint64_t>(
+    duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count()
+  );
+}
+
+void recorder::record(Kind kind, uint32_t track, const char *tag,
+                      uint32_t code, uint32_t value) noexcept
+{
+  auto &local = t_ring;
+  if (!local.ring) {
+    // Only try once; if every ring is taken, this thread goes unrecorded.
+    if (local.claimed) {
+      return;
+    }
+    local.claimed = true;
+    if (!(local.ring = claimRing())) {
+      return;
+    }
+  }
+  auto &ring = *local.ring;
+
+  Entry entry{now(), ring.thread, kind, static_cast<uint16_t>(track), code,
+              value, {}};
+  for (size_t i = 0; i < sizeof(entry.tag) && tag[i]; ++i) {
+    entry.tag[i] = tag[i];
+  }
+  uint64_t words[EntryWords];
+  std::memcpy(words, &entry, sizeof(Entry));
+
+  auto index = ring.head.load(std::memory_order_relaxed);
+  auto &slot = ring.slots[index % RingCapacity];
+  slot.sequence.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  for (size_t w = 0; w < EntryWords; ++w) {
+    slot.words[w].store(words[w], std::memory_order_relaxed);
+  }
+  slot.sequence.store(index + 1, std::memory_order_release);
+  ring.head.store(index + 1, std::memory_order_release);
+}
+
+bool recorder::dump(DumpWriter write, void *context, uint32_t processId,
+                    uint64_t wallTime) noexcept
+{
+  if (g_dumping.test_and_set(std::memory_order_acquire)) {
+    return false;
+  }
+  bool ok = [&] {
+    DumpHeader header{};
+    std::memcpy(header.magic, DumpMagic, sizeof(DumpMagic));
+    header.version = DumpVersion;
+    header.entrySize = sizeof(Entry);
+    header.processId = processId;
+    header.wallTime = wallTime;
+    header.steadyTime = now();
+    if (!write(context, &header, sizeof(header))) {
+      return false;
+    }
+    for (auto &slot : g_rings) {
+      auto ring = slot.load(std::memory_order_acquire);
+      if (!ring) {
+        continue;
+      }
+      RingHeader ringHeader{ring->thread,
+                            static_cast<uint32_t>(copyRing(*ring, g_scratch))};
+      if (!ringHeader.count) {
+        continue;
+      }
+      if (!write(context, &ringHeader, sizeof(ringHeader)) ||
+          !write(context, g_scratch, ringHeader.count * sizeof(Entry)))
+      {
+        return false;
+      }
+    }
+    RingHeader end{0, 0};
+    return write(context, &end, sizeof(end));
+  }();
+  g_dumping.clear(std::memory_order_release);
+  return ok;
+}
+
+std::optional<Dump> recorder::parseDump(std::string_view data) {
+  DumpHeader header;
+  if (!readValue(data, header) ||
+      std::memcmp(header.magic, DumpMagic, sizeof(DumpMagic)) != 0 ||
+      header.version != DumpVersion || header.entrySize != sizeof(Entry))
+  {
+    return std::nullopt;
+  }
+  Dump dump;
+  dump.processId = header.processId;
+  dump.wallTime = header.wallTime;
+  dump.steadyTime = header.steadyTime;
+  while (true) {
+    RingHeader ringHeader;
+    if (!readValue(data, ringHeader)) {
+      return std::nullopt;
+    }
+    if (ringHeader.thread == 0) {
+      break;
+    }
+    if (ringHeader.count > RingCapacity ||
+        data.size() < ringHeader.count * sizeof(Entry))
+    {
+      return std::nullopt;
+    }
+    auto first = dump.entries.size();
+    dump.entries.resize(first + ringHeader.count);
+    std::memcpy(&dump.entries[first], data.data(),
+                ringHeader.count * sizeof(Entry));
+    data.remove_prefix(ringHeader.count * sizeof(Entry));
+  }
+  std::stable_sort(dump.entries.begin(), dump.entries.end(),
+                   [](auto &a, auto &b) { return a.time < b.time; });
+  return dump;
+}
+
+std::string recorder::formatEntry(const Entry &entry, uint64_t steadyTime) {
+  auto offset = static_cast<int64_t>(entry.time - steadyTime);
+  auto line = fmt::format("{:+14.6f} ms  T{:<2} #{:<3} {:<6} {}",
+                          static_cast<double>(offset) / 1e6, entry.thread,
+                          entry.track, kindToString(entry.kind),
+                          entry.tagName());
+  switch (entry.kind) {
+    case Kind::IO:
+      line += fmt::format(" {} bytes", entry.value);
+      break;
+    case Kind::Result:
+      line += ' ';
+      line += entry.code < std::size(StatusNames)
+        ? StatusNames[entry.code]
+        : "?";
+      break;
+    case Kind::Error:
+      line += fmt::format(" {} (0x{:X})", entry.code, entry.code);
+      break;
+    default:
+      if (entry.code) {
+        line += fmt::format(" code={}", entry.code);
+      }
+      if (entry.value) {
+        line += fmt::format(" value={}", entry.value);
+      }
+      break;
+  }
+  return line;
+}
@@ -0,0 +1,300 @@
+#include "wsudo/metrics.h"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+#ifdef _MSC_VER
+# include <intrin.h>
+#endif
+
+using namespace wsudo;
+using namespace wsudo::metrics;
+
+// Helpers {{{
+
+namespace {
+  // Index of the highest set bit; `value` must not be zero.
+  unsigned highestBit(uint64_t value) noexcept {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return static_cast<unsigned>(index);
+#else
+    return 63 - static_cast<unsigned>(__builtin_clzll(value));
+#endif
+  }
+
+  void appendEscaped(std::string &out, std::string_view text) {
+    for (auto c : text) {
+      switch (c) {
+      case '\\': out += "\\\\"; break;
+      case '"': out += "\\\""; break;
+      case '\n': out += "\\n"; break;
+      default: out += c; break;
+      }
+    }
+  }
+
+  // {a="b",...}, with `extra` as one more label if given.
+  std::string formatLabels(const Labels &labels,
+                           std::string_view extraName = {},
+                           std::string_view extraValue = {})
+  {
+    if (labels.empty() && extraName.empty()) {
+      return std::string{};
+    }
+    std::string out{"{"};
+    for (auto &[name, value] : labels) {
+      if (out.size() > 1) {
+        out += ',';
+      }
+      out += name;
+      out += "=\"";
+      appendEscaped(out, value);
+      out += '"';
+    }
+    if (!extraName.empty()) {
+      if (out.size() > 1) {
+        out += ',';
+      }
+      out += extraName;
+      out += "=\"";
+      out += extraValue;
+      out += '"';
+    }
+    out += '}';
+    return out;
+  }
+
+  constexpr double Quantiles[] = {0.5, 0.9, 0.99, 0.999};
+  constexpr const char *QuantileNames[] = {"0.5", "0.9", "0.99", "0.999"};
+}
+
+// }}}
+
+// {{{ Counter
+
+uint64_t Counter::value() const noexcept {
+  uint64_t total = 0;
+  for (auto &cell : _cells) {
+    total += cell.value.load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+// }}} Counter
+
+// {{{ Histogram
+
+struct Histogram::Shard {
+  alignas(64) std::atomic<uint64_t> sum{0};
+  std::atomic<uint64_t> buckets[Buckets]{};
+};
+
+Histogram::Histogram() : _shards{std::make_unique<Shard[]>(Shards)} {}
+
+Histogram::~Histogram() = default;
+
+size_t Histogram::bucketIndex(uint64_t value) noexcept {
+  if (value < SubBuckets) {
+    return static_cast<size_t>(value);
+  }
+  auto bit = highestBit(value);
+  auto sub = (value >> (bit - SubBucketBits)) & (SubBuckets - 1);
+  return (bit - SubBucketBits + 1) * SubBuckets + static_cast<size_t>(sub);
+}
+
+uint64_t Histogram::bucketLowerBound(size_t index) noexcept {
+  if (index < SubBuckets) {
+    return index;
+  }
+  auto bit = index / SubBuckets + SubBucketBits - 1;
+  auto sub = index % SubBuckets;
+  return static_cast<uint64_t>(SubBuckets + sub) << (bit - SubBucketBits);
+}
+
+uint64_t Histogram::bucketUpperBound(size_t index) noexcept {
+  if (index + 1 >= Buckets) {
+    return std::numeric_limits<uint64_t>::max();
+  }
+  return bucketLowerBound(index + 1) - 1;
+}
+
+void Histogram::record(uint64_t nanoseconds) noexcept {
+  auto &shard = _shards[detail::shard()];
+  shard.buckets[bucketIndex(nanoseconds)]
+    .fetch_add(1, std::memory_order_relaxed);
+  shard.sum.fetch_add(nanoseconds, std::memory_order_relaxed);
+}
+
+Histogram::Snapshot Histogram::snapshot() const {
+  Snapshot snapshot;
+  snapshot.buckets.resize(Buckets);
+  for (size_t s = 0; s < Shards; ++s) {
+    auto &shard = _shards[s];
+    snapshot.sum += shard.sum.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < Buckets; ++i) {
+      auto count = shard.buckets[i].load(std::memory_order_relaxed);
+      snapshot.buckets[i] += count;
+      snapshot.count += count;
+    }
+  }
+  return snapshot;
+}
+
+uint64_t Histogram::Snapshot::quantile(double q) const {
+  if (!count) {
+    return 0;
+  }
+  auto rank = static_cast<uint64_t>(std::ceil(q * static_cast<double>(count)));
+  rank = std::clamp<uint64_t>(rank, 1, count);
+  uint64_t seen = 0;
+  for (size_t i = 0; i < buckets.size(); ++i) {
+    seen += buckets[i];
+    if (seen >= rank) {
+      return bucketUpperBound(i);
+    }
+  }
+  return bucketUpperBound(buckets.size() - 1);
+}
+
+// }}} Histogram
+
+// {{{ Registry
+
+struct Registry::Family {
+  struct Metric {
+    Labels labels;
+    std::unique_ptr<Counter> counter;
+    std::unique_ptr<Gauge> gauge;
+    std::unique_ptr<Histogram> histogram;
+  };
+
+  std::string name;
+  std::string help;
+  Type type;
+  std::vector<Metric> metrics;
+};
+
+Registry::Registry() = default;
+
+Registry::~Registry() = default;
+
+Registry::Family &Registry::family(std::string_view name,
+                                   std::string_view help, Type type)
+{
+  auto it = std::find_if(_families.begin(), _families.end(),
+                         [&](auto &family) { return family->name == name; });
+  if (it != _families.end()) {
+    assert((*it)->type == type && "Metric registered with another type");
+    return **it;
+  }
+  auto &family = *_families.emplace_back(std::make_unique<Family>());
+  family.name = name;
+  family.help = help;
+  family.type = type;
+  return family;
+}
+
+Counter &Registry::counter(std::string_view name, std::string_view help,
+                           Labels labels)
+{
+  std::lock_guard<std::mutex> lock{_mutex};
+  auto &metric = family(name, help, Type::Counter).metrics.emplace_back();
+  metric.labels = std::move(labels);
+  metric.counter = std::make_unique<Counter>();
+  return *metric.counter;
+}
+
+Gauge &Registry::gauge(std::string_view name, std::string_view help,
+                       Labels labels)
+{
+  std::lock_guard<std::mutex> lock{_mutex};
+  auto &metric = family(name, help, Type::Gauge).metrics.emplace_back();
+  metric.labels = std::move(labels);
+  metric.gauge = std::make_unique<Gauge>();
+  return *metric.gauge;
+}
+
+Gauge &Registry::counterGauge(std::string_view name, std::string_view help,
+                              Labels labels)
+{
+  std::lock_guard<std::mutex> lock{_mutex};
+  auto &metric = family(name, help, Type::CounterGauge).metrics.emplace_back();
+  metric.labels = std::move(labels);
+  metric.gauge = std::make_unique<Gauge>();
+  return *metric.gauge;
+}
+
+Histogram &Registry::histogram(std::string_view name, std::string_view help,
+                               Labels labels)
+{
+  std::lock_guard<std::mutex> lock{_mutex};
+  auto &metric = family(name, help, Type::Histogram).metrics.emplace_back();
+  metric.labels = std::move(labels);
+  metric.histogram = std::make_unique<Histogram>();
+  return *metric.histogram;
+}
+
+void Registry::onSnapshot(std::function<void()> update) {
+  std::lock_guard<std::mutex> lock{_mutex};
+  _updates.emplace_back(std::move(update));
+}
+
+std::string Registry::snapshot() {
+  std::lock_guard<std::mutex> lock{_mutex};
+  for (auto &update : _updates) {
+    update();
+  }
+
+  std::string out;
+  for (auto &family : _families) {
+    const char *type;
+    switch (family->type) {
+    case Type::Counter:
+    case Type::CounterGauge:
+      type = "counter";
+      break;
+    case Type::Gauge:
+      type = "gauge";
+      break;
+    default:
+      type = "summary";
+      break;
+    }
+    out += fmt::format("# HELP {} {}\n# TYPE {} {}\n", family->name,
+                       family->help, family->name, type);
+
+    for (auto &metric : family->metrics) {
+      if (metric.counter) {
+        out += fmt::format("{}{} {}\n", family->name,
+                           formatLabels(metric.labels),
+                           metric.counter->value());
+      } else if (metric.gauge) {
+        out += fmt::format("{}{} {}\n", family->name,
+                           formatLabels(metric.labels),
+                           metric.gauge->value());
+      } else {
+        auto snapshot = metric.histogram->snapshot();
+        for (size_t i = 0; i < std::size(Quantiles); ++i) {
+          out += fmt::format(
+            "{}{} {}\n", family->name,
+            formatLabels(metric.labels, "quantile", QuantileNames[i]),
+            static_cast<double>(snapshot.quantile(Quantiles[i])) / 1e9
+          );
+        }
+        auto labels = formatLabels(metric.labels);
+        out += fmt::format("{}_sum{} {}\n{}_count{} {}\n", family->name,
+                           labels, static_cast<double>(snapshot.sum) / 1e9,
+                           family->name, labels, snapshot.count);
+      }
+    }
+  }
+  return out;
+}
+
+// }}} Registry
@@ -22,6 +22,13 @@ EventOverlappedIO::~EventOverlappedIO() {
   CloseHandle(_overlapped.hEvent);
 }
 
+void EventOverlappedIO::traceIO(const char *name) {
+  if (_ioStart) {
+    trace::record(name, _traceTrack, _ioStart, trace::now());
+    _ioStart = 0;
+  }
+}
+
 EventStatus EventOverlappedIO::beginRead() {
   _ioState = IOState::Reading;
   setOverlappedOffset(&_overlapped, _offset);
@@ -39,6 +46,7 @@ EventStatus EventOverlappedIO::beginRead() {
     return EventStatus::Ok;
   } else {
     log::error("ReadFile failed: {}", lastErrorString(error));
+    recorder::record(recorder::Kind::Error, _traceTrack, "ReadFile", error);
     _ioState = IOState::Inactive;
     return EventStatus::Failed;
   }
@@ -50,6 +58,9 @@ EventStatus EventOverlappedIO::endRead() {
   {
     _offset += bytesTransferred;
     log::debug("Read finished: {} bytes.", _offset);
+    recorder::record(recorder::Kind::IO, _traceTrack, "read", 0,
+                     static_cast<uint32_t>(_offset));
+    traceIO("read");
     _buffer.resize(_offset);
     _ioState = IOState::Inactive;
     return EventStatus::Finished;
@@ -65,6 +76,7 @@ EventStatus EventOverlappedIO::endRead() {
     return EventStatus::Failed;
   }
   log::error("Read failed: {}", lastErrorString(error));
+  recorder::record(recorder::Kind::Error, _traceTrack, "read", error);
   _ioState = IOState::Failed;
   return EventStatus::Failed;
 }
@@ -78,11 +90,14 @@ EventStatus EventOverlappedIO::beginWrite() {
   {
     // Interpret the results.
     return endWrite();
-  } else if (GetLastError() == ERROR_IO_PENDING) {
+  }
+  auto error = GetLastError();
+  if (error == ERROR_IO_PENDING) {
     log::trace("Write in progress.");
     return EventStatus::Ok;
   } else {
-    log::error("WriteFile failed: {}", lastErrorString());
+    log::error("WriteFile failed: {}", lastErrorString(error));
+    recorder::record(recorder::Kind::Error, _traceTrack, "WriteFile", error);
     _ioState = IOState::Failed;
     return EventStatus::Failed;
   }
@@ -95,6 +110,9 @@ EventStatus EventOverlappedIO::endWrite() {
     _offset += bytesTransferred;
     if (_offset == _buffer.size()) {
       log::debug("Write finished: {} bytes.", _offset);
+      recorder::record(recorder::Kind::IO, _traceTrack, "write", 0,
+                       static_cast<uint32_t>(_offset));
+      traceIO("write");
       _ioState = IOState::Inactive;
       return EventStatus::Finished;
     } else if (_offset > _buffer.size()) {
@@ -116,13 +134,33 @@ EventStatus EventOverlappedIO::endWrite() {
     return EventStatus::Failed;
   }
   log::error("Write failed: {}", lastErrorString(error));
+  recorder::record(recorder::Kind::Error, _traceTrack, "write", error);
   _ioState = IOState::Failed;
   return EventStatus::Failed;
 }
 
+const char *EventOverlappedIO::ioStateName() const {
+  switch (_ioState) {
+  case IOState::Reading:
+    return "read";
+  case IOState::Writing:
+    return "write";
+  case IOState::Failed:
+    return "failed";
+  default:
+    return nullptr;
+  }
+}
+
+const char *EventOverlappedIO::stateName() const {
+  auto name = ioStateName();
+  return name ? name : "idle";
+}
+
 bool EventOverlappedIO::reset() {
   _ioState = IOState::Inactive;
   _offset = 0;
+  _ioStart = 0;
   return false;
 }
 
@@ -0,0 +1,118 @@
+#include "wsudo/securememory.h"
+
+#include <sodium.h>
+#include <new>
+
+using namespace wsudo;
+
+// Helpers {{{
+
+namespace {
+  // Fallback regions are rounded up so the block sodium_malloc returns,
+  // which ends where the guard page starts, stays aligned.
+  constexpr size_t FallbackAlignment = alignof(std::max_align_t);
+
+  size_t fallbackSize(size_t bytes) {
+    return (bytes + FallbackAlignment - 1) & ~(FallbackAlignment - 1);
+  }
+
+  void *secureMalloc(size_t bytes) {
+    auto block = sodium_malloc(bytes);
+    if (!block) {
+      throw std::bad_alloc{};
+    }
+    return block;
+  }
+}
+
+// }}}
+
+void wsudo::secureWipe(void *data, size_t size) noexcept {
+  sodium_memzero(data, size);
+}
+
+// {{{ SecureArena
+
+SecureArena::SecureArena(size_t size)
+  // Whole blocks of the largest class, which also keeps the region aligned
+  // to MinBlockSize.
+  : _size{(size + MaxBlockSize - 1) / MaxBlockSize * MaxBlockSize}
+{
+  if (sodium_init() < 0) {
+    throw std::bad_alloc{};
+  }
+  _base = static_cast<unsigned char *>(secureMalloc(_size));
+}
+
+SecureArena::~SecureArena() {
+  sodium_free(_base);
+}
+
+SecureArena &SecureArena::global() {
+  static SecureArena arena;
+  return arena;
+}
+
+size_t SecureArena::classOf(size_t bytes) {
+  size_t sizeClass = 0;
+  while (sizeClass < Classes && (MinBlockSize << sizeClass) < bytes) {
+    ++sizeClass;
+  }
+  return sizeClass;
+}
+
+bool SecureArena::owns(const void *block) const {
+  auto p = static_cast<const unsigned char *>(block);
+  return p >= _base && p < _base + _size;
+}
+
+void *SecureArena::allocate(size_t bytes) {
+  auto sizeClass = classOf(bytes ? bytes : 1);
+  if (sizeClass < Classes) {
+    auto blockSize = MinBlockSize << sizeClass;
+    std::lock_guard<std::mutex> lock{_mutex};
+    void *block = nullptr;
+    if (auto &head = _free[sizeClass]) {
+      block = head;
+      head = *static_cast<void **>(block);
+      *static_cast<void **>(block) = nullptr;
+    } else if (_size - _next >= blockSize) {
+      block = _base + _next;
+      _next += blockSize;
+    }
+    if (block) {
+      _stats.bytesInUse += blockSize;
+      return block;
+    }
+    ++_stats.fallbacks;
+  } else {
+    std::lock_guard<std::mutex> lock{_mutex};
+    ++_stats.fallbacks;
+  }
+  return secureMalloc(fallbackSize(bytes));
+}
+
+void SecureArena::deallocate(void *block, size_t bytes) noexcept {
+  if (!block) {
+    return;
+  }
+  if (!owns(block)) {
+    // sodium_free wipes it.
+    sodium_free(block);
+    return;
+  }
+  auto sizeClass = classOf(bytes ? bytes : 1);
+  auto blockSize = MinBlockSize << sizeClass;
+  sodium_memzero(block, blockSize);
+  std::lock_guard<std::mutex> lock{_mutex};
+  *static_cast<void **>(block) = _free[sizeClass];
+  _free[sizeClass] = block;
+  _stats.bytesInUse -= blockSize;
+}
+
+SecureArena::Stats SecureArena::stats() const {
+  std::lock_guard<std::mutex> lock{_mutex};
+  return _stats;
+}
+
+// }}} SecureArena
@@ -0,0 +1,108 @@
+#include "wsudo/spawn.h"
+
+#include <cstring>
+
+using namespace wsudo;
+
+// Helpers {{{
+
+namespace {
+  constexpr size_t HeaderSize = 3 * sizeof(uint64_t) + 3 * sizeof(uint32_t);
+
+  template<typename T>
+  void put(std::vector<char> &out, T value) {
+    auto offset = out.size();
+    out.resize(offset + sizeof(T));
+    std::memcpy(out.data() + offset, &value, sizeof(T));
+  }
+
+  template<typename T>
+  T get(const char *in) {
+    T value;
+    std::memcpy(&value, in, sizeof(T));
+    return value;
+  }
+
+  void putString(std::vector<char> &out, const std::wstring &str) {
+    for (auto ch : str) {
+      put(out, static_cast<uint16_t>(ch));
+    }
+  }
+
+  std::wstring getString(const char *in, size_t length) {
+    std::wstring str(length, L'\0');
+    for (size_t i = 0; i < length; ++i) {
+      str[i] = static_cast<wchar_t>(get<uint16_t>(in + i * sizeof(uint16_t)));
+    }
+    return str;
+  }
+}
+
+// }}}
+
+std::vector<char> wsudo::encodeSpawnRequest(const SpawnRequest &request) {
+  std::vector<char> body;
+  body.reserve(HeaderSize + sizeof(uint16_t) * (
+    request.commandLine.length() + request.currentDirectory.length() +
+    request.environment.length()
+  ));
+  put(body, request.input);
+  put(body, request.output);
+  put(body, request.error);
+  put(body, static_cast<uint32_t>(request.commandLine.length()));
+  put(body, static_cast<uint32_t>(request.currentDirectory.length()));
+  put(body, static_cast<uint32_t>(request.environment.length()));
+  putString(body, request.commandLine);
+  putString(body, request.currentDirectory);
+  putString(body, request.environment);
+  return body;
+}
+
+std::optional<SpawnRequest> wsudo::decodeSpawnRequest(std::string_view body) {
+  if (body.size() < HeaderSize) {
+    return std::nullopt;
+  }
+
+  SpawnRequest request;
+  auto data = body.data();
+  request.input = get<uint64_t>(data);
+  request.output = get<uint64_t>(data + sizeof(uint64_t));
+  request.error = get<uint64_t>(data + 2 * sizeof(uint64_t));
+  data += 3 * sizeof(uint64_t);
+  size_t lengths[3];
+  for (auto &length : lengths) {
+    length = get<uint32_t>(data);
+    data += sizeof(uint32_t);
+    if (length > MaxSpawnStringLength) {
+      return std::nullopt;
+    }
+  }
+  if (lengths[0] == 0 ||
+      body.size() !=
+        HeaderSize + sizeof(uint16_t) * (lengths[0] + lengths[1] + lengths[2]))
+  {
+    return std::nullopt;
+  }
+
+  request.commandLine = getString(data, lengths[0]);
+  data += lengths[0] * sizeof(uint16_t);
+  request.currentDirectory = getString(data, lengths[1]);
+  data += lengths[1] * sizeof(uint16_t);
+  request.environment = getString(data, lengths[2]);
+
+  // Embedded NULs would silently cut these short.
+  if (request.commandLine.find(L'\0') != std::wstring::npos ||
+      request.currentDirectory.find(L'\0') != std::wstring::npos)
+  {
+    return std::nullopt;
+  }
+  // An environment block must end with an empty string.
+  auto &env = request.environment;
+  if (!env.empty() &&
+      (env.length() < 2 || env[env.length() - 1] != L'\0' ||
+       env[env.length() - 2] != L'\0'))
+  {
+    return std::nullopt;
+  }
+  return request;
+}
@@ -0,0 +1,129 @@
+#include "wsudo/threadstack.h"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+
+using namespace wsudo;
+
+// Helpers {{{
+
+namespace {
+  constexpr size_t MaxFrames = 64;
+
+  // The thread environment block of `thread`, which must be in this
+  // process, or null if it can't be found.
+  const NT_TIB *threadTib(HANDLE thread) {
+    static const auto NtQueryInformationThread = LinkedModule{L"ntdll.dll"}
+      .get<nt::NtQueryInformationThread_t>("NtQueryInformationThread");
+
+    nt::THREAD_BASIC_INFORMATION info{};
+    if (!NT_SUCCESS(NtQueryInformationThread(thread,
+                                             nt::ThreadBasicInformation,
+                                             &info, sizeof(info), nullptr)))
+    {
+      return nullptr;
+    }
+    return static_cast<const NT_TIB *>(info.TebBaseAddress);
+  }
+
+  // Walk the stack from `context` into `frames`. Runs while the thread is
+  // suspended, so it must not allocate or take a lock the thread might
+  // hold; the unwind tables are only read. The thread may be anywhere, even
+  // in a prologue, so the walk stops at the first frame outside its stack,
+  // and a fault reading one ends it with the frames found so far.
+  size_t walkStack(CONTEXT &context, const NT_TIB *tib, DWORD64 *frames,
+                   size_t maxFrames)
+  {
+    size_t count = 0;
+#ifdef _M_X64
+    __try {
+      auto limit = reinterpret_cast<DWORD64>(tib->StackLimit);
+      auto base = reinterpret_cast<DWORD64>(tib->StackBase);
+      while (count < maxFrames && context.Rip) {
+        if (context.Rsp < limit || context.Rsp + sizeof(DWORD64) > base) {
+          break;
+        }
+        frames[count++] = context.Rip;
+        auto rsp = context.Rsp;
+        DWORD64 imageBase;
+        auto function = RtlLookupFunctionEntry(context.Rip, &imageBase,
+                                               nullptr);
+        if (!function) {
+          // A leaf function: the return address is on top of the stack.
+          context.Rip = *reinterpret_cast<DWORD64 *>(context.Rsp);
+          context.Rsp += sizeof(DWORD64);
+          continue;
+        }
+        PVOID handlerData;
+        DWORD64 establisherFrame;
+        RtlVirtualUnwind(UNW_FLAG_NHANDLER, imageBase, context.Rip, function,
+                         &context, &handlerData, &establisherFrame, nullptr);
+        // Each caller's frame is above its callee's; anything else is a
+        // corrupt stack that could loop.
+        if (context.Rsp <= rsp) {
+          break;
+        }
+      }
+    } __except (EXCEPTION_EXECUTE_HANDLER) {
+      // Keep the frames found so far.
+    }
+#else
+    (void)context;
+    (void)tib;
+    (void)frames;
+    (void)maxFrames;
+#endif
+    return count;
+  }
+
+  std::string describeAddress(DWORD64 address) {
+    HMODULE module;
+    if (!GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS |
+                              GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                            reinterpret_cast<LPCWSTR>(address), &module))
+    {
+      return fmt::format("0x{:X}", address);
+    }
+    wchar_t path[MAX_PATH];
+    auto length = GetModuleFileNameW(module, path, MAX_PATH);
+    std::wstring_view name{path, length};
+    if (auto slash = name.rfind(L'\\'); slash != std::wstring_view::npos) {
+      name.remove_prefix(slash + 1);
+    }
+    return fmt::format("{}+0x{:X}", to_utf8(name),
+                       address - reinterpret_cast<DWORD64>(module));
+  }
+}
+
+// }}}
+
+std::string wsudo::sampleThreadStack(HANDLE thread, size_t maxFrames) {
+  DWORD64 frames[MaxFrames];
+  size_t count;
+  // Look this up first; while the thread is suspended, it may hold the
+  // loader lock.
+  auto tib = threadTib(thread);
+  if (!tib) {
+    return std::string{};
+  }
+  {
+    if (SuspendThread(thread) == static_cast<DWORD>(-1)) {
+      return std::string{};
+    }
+    WSUDO_SCOPEEXIT { ResumeThread(thread); };
+    CONTEXT context{};
+    context.ContextFlags = CONTEXT_FULL;
+    if (!GetThreadContext(thread, &context)) {
+      return std::string{};
+    }
+    count = walkStack(context, tib, frames, std::min(maxFrames, MaxFrames));
+  }
+
+  std::string stack;
+  for (size_t i = 0; i < count; ++i) {
+    stack += describeAddress(frames[i]);
+    stack += '\n';
+  }
+  return stack;
+}
@@ -0,0 +1,171 @@
+#include "wsudo/trace.h"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace wsudo;
+using namespace wsudo::trace;
+
+// Helpers {{{
+
+namespace {
+  struct Event {
+    const char *name;
+    uint32_t track;
+    uint64_t start;
+    uint64_t end;
+  };
+
+  // One thread's spans. The lock is only contended while exporting.
+  struct ThreadBuffer {
+    std::mutex mutex;
+    std::vector<Event> events;
+    // Total recorded; the ring holds the last events.size() of them.
+    uint64_t written = 0;
+  };
+
+  std::atomic<size_t> g_capacity{64 * 1024};
+
+  // Buffers outlive their threads so their spans can still be exported.
+  std::mutex g_buffersMutex;
+  std::vector<std::shared_ptr<ThreadBuffer>> g_buffers;
+  std::map<uint32_t, std::string> g_trackNames;
+
+  thread_local std::shared_ptr<ThreadBuffer> t_buffer;
+
+  ThreadBuffer &threadBuffer() {
+    if (!t_buffer) {
+      t_buffer = std::make_shared<ThreadBuffer>();
+      t_buffer->events.resize(g_capacity.load(std::memory_order_relaxed));
+      std::lock_guard<std::mutex> lock{g_buffersMutex};
+      g_buffers.push_back(t_buffer);
+    }
+    return *t_buffer;
+  }
+
+  void appendString(std::string &out, std::string_view s) {
+    out += '"';
+    for (char c : s) {
+      if (c == '"' || c == '\\') {
+        out += '\\';
+        out += c;
+      } else if (static_cast<unsigned char>(c) < 0x20) {
+        out += fmt::format("\\u{:04x}", c);
+      } else {
+        out += c;
+      }
+    }
+    out += '"';
+  }
+}
+
+// }}}
+
+void trace::enable(size_t eventsPerThread) {
+  g_capacity.store(std::max<size_t>(eventsPerThread, 1),
+                   std::memory_order_relaxed);
+  detail::g_enabled.store(true, std::memory_order_relaxed);
+}
+
+void trace::disable() {
+  detail::g_enabled.store(false, std::memory_order_relaxed);
+}
+
+void trace::clear() {
+  std::lock_guard<std::mutex> lock{g_buffersMutex};
+  for (auto &buffer : g_buffers) {
+    std::lock_guard<std::mutex> bufferLock{buffer->mutex};
+    buffer->written = 0;
+  }
+}
+
+uint64_t trace::now() {
+  using namespace std::chrono;
+  return static_cast<uint64_t>(
+    duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count()
+  );
+}
+
+void trace::record(const char *name, uint32_t track, uint64_t start,
+                   uint64_t end)
+{
+  auto &buffer = threadBuffer();
+  std::lock_guard<std::mutex> lock{buffer.mutex};
+  buffer.events[buffer.written % buffer.events.size()] =
+    Event{name, track, start, end};
+  ++buffer.written;
+}
+
+void trace::nameTrack(uint32_t track, std::string name) {
+  std::lock_guard<std::mutex> lock{g_buffersMutex};
+  g_trackNames[track] = std::move(name);
+}
+
+Stats trace::stats() {
+  Stats stats;
+  std::lock_guard<std::mutex> lock{g_buffersMutex};
+  for (auto &buffer : g_buffers) {
+    std::lock_guard<std::mutex> bufferLock{buffer->mutex};
+    stats.recorded += buffer->written;
+    if (buffer->written > buffer->events.size()) {
+      stats.overwritten += buffer->written - buffer->events.size();
+    }
+  }
+  return stats;
+}
+
+std::string trace::exportJson(uint32_t processId) {
+  std::vector<Event> events;
+  std::map<uint32_t, std::string> trackNames;
+  {
+    std::lock_guard<std::mutex> lock{g_buffersMutex};
+    trackNames = g_trackNames;
+    for (auto &buffer : g_buffers) {
+      std::lock_guard<std::mutex> bufferLock{buffer->mutex};
+      auto capacity = buffer->events.size();
+      auto count = std::min<uint64_t>(buffer->written, capacity);
+      for (auto i = buffer->written - count; i < buffer->written; ++i) {
+        events.push_back(buffer->events[i % capacity]);
+      }
+    }
+  }
+  std::sort(events.begin(), events.end(), [](auto &a, auto &b) {
+    return a.start < b.start;
+  });
+
+  std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+  bool first = true;
+  auto separate = [&] {
+    if (!first) {
+      out += ",\n";
+    }
+    first = false;
+  };
+  for (auto &[track, name] : trackNames) {
+    separate();
+    out += fmt::format("{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":{},"
+                       "\"tid\":{},\"args\":{{\"name\":",
+                       processId, track);
+    appendString(out, name);
+    out += "}}";
+  }
+  // Chrome wants microseconds; keep nanosecond precision as a fraction.
+  for (auto &event : events) {
+    separate();
+    out += "{\"name\":";
+    appendString(out, event.name);
+    auto duration = event.end > event.start ? event.end - event.start : 0;
+    out += fmt::format(",\"cat\":\"wsudo\",\"ph\":\"X\",\"pid\":{},"
+                       "\"tid\":{},\"ts\":{}.{:03},\"dur\":{}.{:03}}}",
+                       processId, event.track, event.start / 1000,
+                       event.start % 1000, duration / 1000, duration % 1000);
+  }
+  out += "\n]}\n";
+  return out;
+}
@@ -0,0 +1,288 @@
+#include "wsudo/utf.h"
+
+#include <algorithm>
+
+// WSUDO_NO_SIMD builds only the scalar paths, so they can be tested alone.
+#if !defined(WSUDO_NO_SIMD) && defined(__AVX2__)
+# define WSUDO_UTF_AVX2 1
+#endif
+#if !defined(WSUDO_NO_SIMD) && \
+    (defined(__SSE2__) || defined(_M_X64) || \
+     (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(WSUDO_UTF_AVX2))
+# define WSUDO_UTF_SSE2 1
+#endif
+#if defined(WSUDO_UTF_AVX2)
+# include <immintrin.h>
+#elif defined(WSUDO_UTF_SSE2)
+# include <emmintrin.h>
+#endif
+
+using namespace wsudo;
+using namespace wsudo::utf;
+
+// Helpers {{{
+
+namespace {
+  constexpr char32_t Invalid = 0xFFFFFFFF;
+  constexpr char32_t Replacement = 0xFFFD;
+
+  struct Decoded {
+    char32_t codePoint;
+    // Units consumed. For invalid input, the length of the maximal invalid
+    // subsequence.
+    size_t length;
+  };
+
+  Decoded decodeUtf8(const unsigned char *s, size_t n) {
+    auto lead = s[0];
+    if (lead < 0x80) {
+      return {lead, 1};
+    }
+    size_t trail;
+    char32_t codePoint;
+    // Allowed range of the first trailing byte, which rules out overlong
+    // forms, surrogates and code points past U+10FFFF.
+    unsigned char low = 0x80;
+    unsigned char high = 0xBF;
+    if (lead >= 0xC2 && lead <= 0xDF) {
+      trail = 1;
+      codePoint = lead & 0x1F;
+    } else if (lead >= 0xE0 && lead <= 0xEF) {
+      trail = 2;
+      codePoint = lead & 0x0F;
+      low = lead == 0xE0 ? 0xA0 : low;
+      high = lead == 0xED ? 0x9F : high;
+    } else if (lead >= 0xF0 && lead <= 0xF4) {
+      trail = 3;
+      codePoint = lead & 0x07;
+      low = lead == 0xF0 ? 0x90 : low;
+      high = lead == 0xF4 ? 0x8F : high;
+    } else {
+      return {Invalid, 1};
+    }
+    for (size_t i = 1; i <= trail; ++i) {
+      if (i >= n || s[i] < low || s[i] > high) {
+        return {Invalid, i};
+      }
+      codePoint = codePoint << 6 | (s[i] & 0x3F);
+      low = 0x80;
+      high = 0xBF;
+    }
+    return {codePoint, trail + 1};
+  }
+
+  Decoded decodeUtf16(const char16_t *s, size_t n) {
+    char32_t unit = s[0];
+    if (unit < 0xD800 || unit > 0xDFFF) {
+      return {unit, 1};
+    }
+    if (unit <= 0xDBFF && n > 1 && s[1] >= 0xDC00 && s[1] <= 0xDFFF) {
+      return {0x10000 + ((unit - 0xD800) << 10) + (s[1] - 0xDC00), 2};
+    }
+    return {Invalid, 1};
+  }
+
+  size_t utf8Length(char32_t codePoint) {
+    return codePoint < 0x80 ? 1
+         : codePoint < 0x800 ? 2
+         : codePoint < 0x10000 ? 3
+         : 4;
+  }
+
+  void encodeUtf8(char32_t codePoint, char *out) {
+    auto put = [&](char32_t byte) { *out++ = static_cast<char>(byte); };
+    switch (utf8Length(codePoint)) {
+      case 1:
+        put(codePoint);
+        break;
+      case 2:
+        put(0xC0 | codePoint >> 6);
+        put(0x80 | (codePoint & 0x3F));
+        break;
+      case 3:
+        put(0xE0 | codePoint >> 12);
+        put(0x80 | (codePoint >> 6 & 0x3F));
+        put(0x80 | (codePoint & 0x3F));
+        break;
+      default:
+        put(0xF0 | codePoint >> 18);
+        put(0x80 | (codePoint >> 12 & 0x3F));
+        put(0x80 | (codePoint >> 6 & 0x3F));
+        put(0x80 | (codePoint & 0x3F));
+        break;
+    }
+  }
+
+  void encodeUtf16(char32_t codePoint, char16_t *out) {
+    if (codePoint < 0x10000) {
+      out[0] = static_cast<char16_t>(codePoint);
+      return;
+    }
+    codePoint -= 0x10000;
+    out[0] = static_cast<char16_t>(0xD800 + (codePoint >> 10));
+    out[1] = static_cast<char16_t>(0xDC00 + (codePoint & 0x3FF));
+  }
+
+  // Widen the ASCII prefix of `in`, up to `n` bytes, into `out` if it isn't
+  // null. Returns the length of the prefix.
+  size_t widenAscii(const unsigned char *in, size_t n, char16_t *out) {
+    size_t i = 0;
+#ifdef WSUDO_UTF_AVX2
+    for (; i + 32 <= n; i += 32) {
+      auto bytes =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i));
+      if (_mm256_movemask_epi8(bytes)) {
+        break;
+      }
+      if (out) {
+        auto low = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(bytes));
+        auto high = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(bytes, 1));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), low);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i + 16), high);
+      }
+    }
+#endif
+#ifdef WSUDO_UTF_SSE2
+    const auto zero = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+      auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+      if (_mm_movemask_epi8(bytes)) {
+        break;
+      }
+      if (out) {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                         _mm_unpacklo_epi8(bytes, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i + 8),
+                         _mm_unpackhi_epi8(bytes, zero));
+      }
+    }
+#endif
+    for (; i < n && in[i] < 0x80; ++i) {
+      if (out) {
+        out[i] = in[i];
+      }
+    }
+    return i;
+  }
+
+  // Narrow the ASCII prefix of `in`, up to `n` units, into `out` if it isn't
+  // null. Returns the length of the prefix.
+  size_t narrowAscii(const char16_t *in, size_t n, char *out) {
+    size_t i = 0;
+#ifdef WSUDO_UTF_AVX2
+    const auto notAscii256 = _mm256_set1_epi16(static_cast<short>(0xFF80));
+    for (; i + 32 <= n; i += 32) {
+      auto a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i));
+      auto b =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i + 16));
+      if (!_mm256_testz_si256(_mm256_or_si256(a, b), notAscii256)) {
+        break;
+      }
+      if (out) {
+        // Packing works within 128-bit lanes; put the lanes back in order.
+        auto packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b),
+                                               0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), packed);
+      }
+    }
+#endif
+#ifdef WSUDO_UTF_SSE2
+    const auto notAscii = _mm_set1_epi16(static_cast<short>(0xFF80));
+    const auto zero = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+      auto a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+      auto b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i + 8));
+      auto high = _mm_and_si128(_mm_or_si128(a, b), notAscii);
+      if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, zero)) != 0xFFFF) {
+        break;
+      }
+      if (out) {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                         _mm_packus_epi16(a, b));
+      }
+    }
+#endif
+    for (; i < n && in[i] < 0x80; ++i) {
+      if (out) {
+        out[i] = static_cast<char>(in[i]);
+      }
+    }
+    return i;
+  }
+}
+
+// }}}
+
+std::optional<size_t> wsudo::utf::utf8ToUtf16(std::string_view in,
+                                              char16_t *out, size_t capacity,
+                                              Errors errors)
+{
+  auto s = reinterpret_cast<const unsigned char *>(in.data());
+  size_t n = in.size();
+  size_t i = 0;
+  size_t written = 0;
+  while (i < n) {
+    auto limit = out ? std::min(n - i, capacity - written) : n - i;
+    auto ascii = widenAscii(s + i, limit, out ? out + written : nullptr);
+    i += ascii;
+    written += ascii;
+    if (i == n) {
+      break;
+    }
+
+    auto [codePoint, length] = decodeUtf8(s + i, n - i);
+    i += length;
+    if (codePoint == Invalid) {
+      if (errors == Errors::Fail) {
+        return std::nullopt;
+      }
+      codePoint = Replacement;
+    }
+    size_t units = codePoint < 0x10000 ? 1 : 2;
+    if (out) {
+      if (capacity - written < units) {
+        return std::nullopt;
+      }
+      encodeUtf16(codePoint, out + written);
+    }
+    written += units;
+  }
+  return written;
+}
+
+std::optional<size_t> wsudo::utf::utf16ToUtf8(std::u16string_view in,
+                                              char *out, size_t capacity,
+                                              Errors errors)
+{
+  auto s = in.data();
+  size_t n = in.size();
+  size_t i = 0;
+  size_t written = 0;
+  while (i < n) {
+    auto limit = out ? std::min(n - i, capacity - written) : n - i;
+    auto ascii = narrowAscii(s + i, limit, out ? out + written : nullptr);
+    i += ascii;
+    written += ascii;
+    if (i == n) {
+      break;
+    }
+
+    auto [codePoint, length] = decodeUtf16(s + i, n - i);
+    i += length;
+    if (codePoint == Invalid) {
+      if (errors == Errors::Fail) {
+        return std::nullopt;
+      }
+      codePoint = Replacement;
+    }
+    auto bytes = utf8Length(codePoint);
+    if (out) {
+      if (capacity - written < bytes) {
+        return std::nullopt;
+      }
+      encodeUtf8(codePoint, out + written);
+    }
+    written += bytes;
+  }
+  return written;
+}
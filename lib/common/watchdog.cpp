@@ -0,0 +1,125 @@
+#include "wsudo/watchdog.h"
+
+#include <algorithm>
+
+using namespace wsudo;
+using namespace wsudo::watchdog;
+
+// {{{ Heartbeat
+
+void Heartbeat::begin(size_t handler, const char *state,
+                      Clock::time_point now) noexcept
+{
+  _start.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+  _handler.store(handler, std::memory_order_relaxed);
+  _state.store(state, std::memory_order_relaxed);
+  // Odd: publishes the fields above.
+  _sequence.fetch_add(1, std::memory_order_release);
+}
+
+void Heartbeat::end() noexcept {
+  _sequence.fetch_add(1, std::memory_order_release);
+}
+
+std::optional<Heartbeat::Beat> Heartbeat::current() const noexcept {
+  auto sequence = _sequence.load(std::memory_order_acquire);
+  if (sequence % 2 == 0) {
+    return std::nullopt;
+  }
+  Beat beat{
+    sequence,
+    Clock::time_point{Clock::duration{
+      _start.load(std::memory_order_relaxed)
+    }},
+    _handler.load(std::memory_order_relaxed),
+    _state.load(std::memory_order_relaxed),
+  };
+  // If the call ended meanwhile, the fields may belong to the next one.
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (_sequence.load(std::memory_order_relaxed) != sequence) {
+    return std::nullopt;
+  }
+  return beat;
+}
+
+// }}} Heartbeat
+
+// {{{ Watchdog
+
+Watchdog::Watchdog(const Heartbeat &heartbeat, Options options)
+  : _heartbeat{heartbeat}, _options{std::move(options)}
+{}
+
+Watchdog::~Watchdog() {
+  stop();
+}
+
+void Watchdog::start() {
+  if (!_thread.joinable()) {
+    _thread = std::thread{&Watchdog::run, this};
+  }
+}
+
+void Watchdog::stop() {
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    _stopping = true;
+  }
+  _wake.notify_all();
+  if (_thread.joinable()) {
+    _thread.join();
+  }
+}
+
+std::optional<Stall> Watchdog::check(Clock::time_point now) {
+  auto beat = _heartbeat.current();
+  if (!beat || beat->sequence == _reported ||
+      now - beat->start < _options.threshold)
+  {
+    return std::nullopt;
+  }
+  _reported = beat->sequence;
+
+  Stall stall{beat->handler, beat->state, now - beat->start, {}};
+  if (_options.sampleStack) {
+    stall.stack = _options.sampleStack();
+  }
+  _stalls.fetch_add(1, std::memory_order_relaxed);
+  if (_options.stalls) {
+    _options.stalls->add();
+  }
+
+  if (_lastLog && now - *_lastLog < _options.logInterval) {
+    ++_suppressedSinceLog;
+    _suppressed.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    _lastLog = now;
+    if (_options.log) {
+      _options.log(stall, _suppressedSinceLog);
+    }
+    _suppressedSinceLog = 0;
+  }
+  return stall;
+}
+
+Watchdog::Stats Watchdog::stats() const {
+  Stats stats;
+  stats.stalls = _stalls.load(std::memory_order_relaxed);
+  stats.suppressed = _suppressed.load(std::memory_order_relaxed);
+  return stats;
+}
+
+void Watchdog::run() {
+  // Polling a few times per threshold notices a stall at most a quarter
+  // threshold late.
+  auto interval = std::max<Clock::duration>(_options.threshold / 4,
+                                            std::chrono::milliseconds{1});
+  std::unique_lock<std::mutex> lock{_mutex};
+  while (!_wake.wait_for(lock, interval, [this] { return _stopping; })) {
+    lock.unlock();
+    check();
+    lock.lock();
+  }
+}
+
+// }}} Watchdog
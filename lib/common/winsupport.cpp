@@ -1,31 +1,54 @@
 #include "wsudo/wsudo.h"
 
-#include <codecvt>
+#include "wsudo/utf.h"
 
-namespace wsudo {
+#include <AclAPI.h>
+#include <sddl.h>
 
-#pragma warning(push)
-#pragma warning(disable: 4996) // codecvt deprecation warning
+#pragma comment(lib, "Advapi32.lib")
 
-std::string to_utf8(std::wstring_view utf16str) {
-  if (utf16str.empty()) {
-    return std::string{};
-  }
+// Helpers {{{
 
-  return std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>, wchar_t>{}
-          .to_bytes(&utf16str.front(), &utf16str.back() + 1);
-}
+namespace {
+  // Rights that let someone change a file or directory, or its contents.
+  constexpr ACCESS_MASK WriteAccess =
+    FILE_WRITE_DATA | FILE_APPEND_DATA | FILE_DELETE_CHILD | DELETE |
+    WRITE_DAC | WRITE_OWNER | GENERIC_WRITE | GENERIC_ALL;
 
-std::wstring to_utf16(std::string_view utf8str) {
-  if (utf8str.empty()) {
-    return std::wstring{};
+  bool isAdminSid(PSID sid) {
+    return IsWellKnownSid(sid, WinLocalSystemSid) ||
+           IsWellKnownSid(sid, WinBuiltinAdministratorsSid);
   }
+}
 
-  return std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>, wchar_t>{}
-            .from_bytes(&utf8str.front(), &utf8str.back() + 1);
+// }}}
+
+namespace wsudo {
+
+const wchar_t *const AdminOnlySddl =
+  L"O:BAD:P(A;OICI;FA;;;SY)(A;OICI;FA;;;BA)";
+
+// Size the result exactly, then convert into it. Replacing invalid input
+// can't fail, and the capacity is exact, so the second pass always succeeds.
+std::string to_utf8(std::wstring_view utf16str) {
+  static_assert(sizeof(wchar_t) == sizeof(char16_t));
+  std::u16string_view input{
+    reinterpret_cast<const char16_t *>(utf16str.data()), utf16str.size()
+  };
+  auto length = utf::utf16ToUtf8(input, nullptr, 0, utf::Errors::Replace);
+  std::string result(*length, '\0');
+  utf::utf16ToUtf8(input, result.data(), result.size(),
+                   utf::Errors::Replace);
+  return result;
 }
 
-#pragma warning(pop)
+std::wstring to_utf16(std::string_view utf8str) {
+  auto length = utf::utf8ToUtf16(utf8str, nullptr, 0, utf::Errors::Replace);
+  std::wstring result(*length, L'\0');
+  utf::utf8ToUtf16(utf8str, reinterpret_cast<char16_t *>(result.data()),
+                   result.size(), utf::Errors::Replace);
+  return result;
+}
 
 bool setThreadName(const wchar_t *name) {
   try {
@@ -38,6 +61,116 @@ bool setThreadName(const wchar_t *name) {
   }
 }
 
+std::optional<uint64_t> tokenLogonId(HANDLE token) {
+  TOKEN_STATISTICS statistics;
+  DWORD length;
+  if (!GetTokenInformation(token, TokenStatistics, &statistics,
+                           sizeof(statistics), &length))
+  {
+    return std::nullopt;
+  }
+  return luidToInt(statistics.AuthenticationId);
+}
+
+std::optional<uint64_t> processLogonId(HANDLE process) {
+  HObject token;
+  if (!OpenProcessToken(process, TOKEN_QUERY, &token)) {
+    return std::nullopt;
+  }
+  return tokenLogonId(token);
+}
+
+bool createAdminDirectory(const std::wstring &path) {
+  HLocalPtr<PSECURITY_DESCRIPTOR> securityDescriptor;
+  if (!ConvertStringSecurityDescriptorToSecurityDescriptorW(
+        AdminOnlySddl, SDDL_REVISION_1, &securityDescriptor, nullptr))
+  {
+    return false;
+  }
+  SECURITY_ATTRIBUTES secAttr;
+  secAttr.nLength = sizeof(SECURITY_ATTRIBUTES);
+  secAttr.bInheritHandle = false;
+  secAttr.lpSecurityDescriptor = securityDescriptor;
+  if (CreateDirectoryW(path.c_str(), &secAttr)) {
+    return true;
+  }
+  if (GetLastError() != ERROR_ALREADY_EXISTS) {
+    return false;
+  }
+
+  PSID owner;
+  PACL dacl;
+  BOOL present;
+  BOOL defaulted;
+  if (!GetSecurityDescriptorOwner(securityDescriptor, &owner, &defaulted) ||
+      !GetSecurityDescriptorDacl(securityDescriptor, &present, &dacl,
+                                 &defaulted))
+  {
+    return false;
+  }
+  // Children that inherit their permissions get the new ones too.
+  auto error = SetNamedSecurityInfoW(
+    const_cast<LPWSTR>(path.c_str()), SE_FILE_OBJECT,
+    OWNER_SECURITY_INFORMATION | DACL_SECURITY_INFORMATION |
+      PROTECTED_DACL_SECURITY_INFORMATION,
+    owner, nullptr, dacl, nullptr
+  );
+  if (error != ERROR_SUCCESS) {
+    SetLastError(error);
+    return false;
+  }
+  return true;
+}
+
+bool isAdminOnly(HANDLE file) {
+  PSID owner;
+  PACL dacl;
+  HLocalPtr<PSECURITY_DESCRIPTOR> securityDescriptor;
+  auto error = GetSecurityInfo(
+    file, SE_FILE_OBJECT,
+    OWNER_SECURITY_INFORMATION | DACL_SECURITY_INFORMATION, &owner, nullptr,
+    &dacl, nullptr, &securityDescriptor
+  );
+  if (error != ERROR_SUCCESS) {
+    SetLastError(error);
+    return false;
+  }
+  // A null DACL lets everyone in.
+  if (!isAdminSid(owner) || !dacl) {
+    return false;
+  }
+  for (DWORD i = 0; i < dacl->AceCount; ++i) {
+    void *ace;
+    if (!GetAce(dacl, i, &ace)) {
+      return false;
+    }
+    auto header = static_cast<ACE_HEADER *>(ace);
+    if ((header->AceFlags & INHERIT_ONLY_ACE) ||
+        header->AceType == ACCESS_DENIED_ACE_TYPE)
+    {
+      continue;
+    }
+    // Other kinds of allow entries are too rare to be worth understanding.
+    if (header->AceType != ACCESS_ALLOWED_ACE_TYPE) {
+      return false;
+    }
+    auto allowed = static_cast<ACCESS_ALLOWED_ACE *>(ace);
+    if ((allowed->Mask & WriteAccess) && !isAdminSid(&allowed->SidStart)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool createAdminDirectoryTree(const std::wstring &path) {
+  if (auto slash = path.rfind(L'\\'); slash != std::wstring::npos) {
+    if (!createAdminDirectory(path.substr(0, slash))) {
+      return false;
+    }
+  }
+  return createAdminDirectory(path);
+}
+
 std::string lastErrorString(DWORD status) {
   constexpr DWORD bufferSize = 1024;
   char buffer[bufferSize];
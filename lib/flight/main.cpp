@@ -0,0 +1,80 @@
+#include "wsudo/wsudo.h"
+#include "wsudo/flightrecorder.h"
+
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+using namespace wsudo;
+
+// Exit codes.
+enum : int {
+  FlightExitOk = 0,
+  FlightExitInvalidUsage = 1,
+  FlightExitInvalidDump = 2,
+  FlightExitIOError = 3,
+};
+
+// Helpers {{{
+
+namespace {
+  void usage() {
+    log::eprint(
+      "Usage: wsudo-flight <dump>\n"
+      "Prints a flight recorder dump as a timeline, oldest first. Times are\n"
+      "relative to when the dump was taken.\n"
+    );
+  }
+
+  std::string formatTime(uint64_t micros) {
+    __time64_t seconds = static_cast<__time64_t>(micros / 1000000);
+    std::tm tm;
+    if (_gmtime64_s(&tm, &seconds) != 0) {
+      return std::to_string(micros);
+    }
+    char buffer[32];
+    auto length = std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S",
+                                &tm);
+    return fmt::format("{}.{:06} UTC", std::string_view{buffer, length},
+                       micros % 1000000);
+  }
+}
+
+// }}}
+
+int wmain(int argc, wchar_t *argv[]) {
+  if (argc != 2) {
+    usage();
+    return FlightExitInvalidUsage;
+  }
+
+  std::ifstream in{std::filesystem::path{argv[1]}, std::ios::binary};
+  if (!in) {
+    log::eprint("Couldn't open '{}'.\n", to_utf8(argv[1]));
+    return FlightExitIOError;
+  }
+  std::string data{std::istreambuf_iterator<char>{in},
+                   std::istreambuf_iterator<char>{}};
+
+  auto dump = recorder::parseDump(data);
+  if (!dump) {
+    log::eprint("'{}' isn't a flight recorder dump, or is cut short.\n",
+                to_utf8(argv[1]));
+    return FlightExitInvalidDump;
+  }
+
+  log::print("Process {}, dumped at {}; {} entries.\n", dump->processId,
+             formatTime(dump->wallTime), dump->entries.size());
+  for (auto &entry : dump->entries) {
+    auto line = recorder::formatEntry(entry, dump->steadyTime);
+    // NTSTATUS and exception codes have the high bit set and no message.
+    if (entry.kind == recorder::Kind::Error && entry.code < 0x80000000) {
+      line += ": ";
+      line += lastErrorString(entry.code);
+    }
+    line += '\n';
+    log::print("{}", line);
+  }
+  return FlightExitOk;
+}
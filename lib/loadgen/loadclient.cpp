@@ -0,0 +1,326 @@
+#include "wsudo/loadclient.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace wsudo;
+using namespace wsudo::loadgen;
+using namespace wsudo::events;
+
+// {{{ Worker
+
+Worker::Worker(const Options &options, Results &results, size_t clients,
+               size_t index, Clock::time_point start,
+               Clock::time_point end)
+  : _options{options},
+    _results{results},
+    _clients{clients},
+    _end{end},
+    _random{static_cast<std::minstd_rand::result_type>(index + 1)}
+{
+  if (options.rate > 0) {
+    // Each worker sends in proportion to its clients, offset so the workers
+    // don't all send at once.
+    auto rate = options.rate * static_cast<double>(clients) /
+                static_cast<double>(options.clients);
+    auto offset = std::chrono::duration<double>{
+      static_cast<double>(index) / options.rate
+    };
+    _schedule.emplace(rate,
+                      start + std::chrono::duration_cast<Clock::duration>(
+                        offset
+                      ));
+  }
+}
+
+bool Worker::run() {
+  EventListener listener;
+  HANDLE timer = CreateWaitableTimerExW(nullptr, nullptr,
+                                        CREATE_WAITABLE_TIMER_HIGH_RESOLUTION,
+                                        TIMER_ALL_ACCESS);
+  if (!timer) {
+    // High resolution timers need Windows 10 1803. Latency is measured from
+    // when each request was due, so a coarser tick only adds to it.
+    timer = CreateWaitableTimerW(nullptr, false, nullptr);
+  }
+  if (!timer) {
+    log::error("Couldn't create a timer: {}", lastErrorString());
+    return false;
+  }
+  // Negative times are relative, in 100ns units.
+  LARGE_INTEGER dueTime;
+  dueTime.QuadPart = -10000;
+  SetWaitableTimer(timer, &dueTime, 1, nullptr, nullptr, false);
+
+  // First, so a busy client can't keep the ticks from being handled.
+  listener.emplace(timer, [this](EventListener &listener) {
+    if (!tick(Clock::now())) {
+      listener.stop();
+    }
+    return EventStatus::Ok;
+  });
+  for (size_t i = 0; i < _clients; ++i) {
+    listener.emplace<LoadClient>(*this);
+  }
+  return listener.run() != EventStatus::Failed;
+}
+
+std::optional<Clock::time_point> Worker::nextRequest(Clock::time_point now) {
+  if (now >= _end) {
+    return std::nullopt;
+  }
+  if (!_schedule) {
+    return now;
+  }
+  if (_sent >= _schedule->due(now)) {
+    return std::nullopt;
+  }
+  return _schedule->at(_sent++);
+}
+
+Request Worker::pickRequest() {
+  return _options.mix.pick(static_cast<uint32_t>(_random()));
+}
+
+void Worker::waitForRequest(LoadClient &client) {
+  _idle.push_back(&client);
+}
+
+void Worker::retryLater(LoadClient &client) {
+  _retry.push_back(&client);
+}
+
+bool Worker::tick(Clock::time_point now) {
+  if (now >= _end) {
+    if (_schedule) {
+      auto due = _schedule->due(_end);
+      _unsent = due > _sent ? due - _sent : 0;
+    }
+    return false;
+  }
+
+  for (auto client : _retry) {
+    client->wake();
+  }
+  _retry.clear();
+
+  if (_schedule) {
+    // A client that wakes for a request another has taken waits again.
+    auto due = _schedule->due(now);
+    auto ready = std::min<uint64_t>(due > _sent ? due - _sent : 0,
+                                    _idle.size());
+    for (uint64_t i = 0; i < ready; ++i) {
+      _idle.back()->wake();
+      _idle.pop_back();
+    }
+  }
+  return true;
+}
+
+// }}} Worker
+
+// {{{ LoadClient
+
+LoadClient::LoadClient(Worker &worker) noexcept
+  : EventOverlappedIO{true},
+    _worker{worker},
+    _callback{&Self::start}
+{
+}
+
+LoadClient::~LoadClient() {
+  if (_pipe) {
+    // The system may still write to the OVERLAPPED until the IO is done.
+    DWORD bytes;
+    CancelIoEx(_pipe, &_overlapped);
+    GetOverlappedResult(_pipe, &_overlapped, &bytes, true);
+  }
+}
+
+EventStatus LoadClient::operator()(EventListener &listener) {
+  switch (EventOverlappedIO::operator()(listener)) {
+    case EventStatus::Finished:
+      break;
+    case EventStatus::Failed:
+      // The server hung up or the pipe broke.
+      EventOverlappedIO::reset();
+      _callback = finish(Outcome::Error);
+      return EventStatus::Ok;
+    case EventStatus::Ok:
+      return EventStatus::Ok;
+  }
+
+  // Steps never return null; a client stays in the loop until the run ends.
+  _callback.call_and_swap(*this);
+  return EventStatus::Ok;
+}
+
+void LoadClient::wake() {
+  SetEvent(_overlapped.hEvent);
+}
+
+void LoadClient::createRequest(const char *header, std::string_view message) {
+  assert(strlen(header) == 4);
+  _buffer.resize(4 + message.length());
+  std::memcpy(_buffer.data(), header, 4);
+  if (message.length()) {
+    std::memcpy(_buffer.data() + 4, message.data(), message.length());
+  }
+}
+
+void LoadClient::disconnect() {
+  _pipe = nullptr;
+  _sent = 0;
+  _authenticated = false;
+}
+
+LoadClient::Callback LoadClient::start() {
+  auto due = _worker.nextRequest(Clock::now());
+  if (!due) {
+    _worker.waitForRequest(*this);
+    return &Self::start;
+  }
+  _due = *due;
+  _request = _worker.pickRequest();
+  return connect();
+}
+
+LoadClient::Callback LoadClient::connect() {
+  if (_pipe) {
+    return send();
+  }
+
+  HANDLE pipe = CreateFileW(_worker.options().pipeName.c_str(),
+                            GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+                            OPEN_EXISTING, FILE_FLAG_OVERLAPPED, nullptr);
+  if (pipe == INVALID_HANDLE_VALUE) {
+    if (GetLastError() == ERROR_PIPE_BUSY) {
+      // Every pipe instance is taken; the wait counts toward latency.
+      _worker.retryLater(*this);
+      return &Self::connect;
+    }
+    return finish(Outcome::Error);
+  }
+  _pipe = HObject{pipe};
+
+  DWORD mode = PIPE_READMODE_MESSAGE;
+  if (!SetNamedPipeHandleState(_pipe, &mode, nullptr, nullptr)) {
+    log::error("Couldn't set pipe mode: {}", lastErrorString());
+    return finish(Outcome::Error);
+  }
+  return send();
+}
+
+LoadClient::Callback LoadClient::send() {
+  auto &options = _worker.options();
+  _authenticating = _request == Request::Bless && !_authenticated;
+  if (_request == Request::Query) {
+    createRequest(msg::client::QuerySession);
+  } else if (_request == Request::Credential || _authenticating) {
+    std::string credentials;
+    credentials.reserve(options.username.length() + 1 +
+                        options.password.length());
+    credentials.append(options.username);
+    credentials.push_back('\0');
+    credentials.append(options.password);
+    createRequest(msg::client::Credential, credentials);
+  } else {
+    // A server in load test mode doesn't look at the handle. Any other
+    // server would try to elevate this process.
+    HANDLE process = GetCurrentProcess();
+    createRequest(msg::client::Bless, std::string_view{
+      reinterpret_cast<const char *>(&process), sizeof(HANDLE)
+    });
+  }
+
+  switch (writeFromBuffer()) {
+    case EventStatus::Ok:
+      return &Self::receive;
+    case EventStatus::Failed:
+      return finish(Outcome::Error);
+    case EventStatus::Finished:
+      return receive();
+    default:
+      WSUDO_UNREACHABLE("Invalid EventStatus");
+  }
+}
+
+LoadClient::Callback LoadClient::receive() {
+  switch (readToBuffer()) {
+    case EventStatus::Ok:
+      return &Self::received;
+    case EventStatus::Failed:
+      return finish(Outcome::Error);
+    case EventStatus::Finished:
+      return received();
+    default:
+      WSUDO_UNREACHABLE("Invalid EventStatus");
+  }
+}
+
+LoadClient::Callback LoadClient::received() {
+  if (_buffer.size() < 4) {
+    return finish(Outcome::Error);
+  }
+  auto header = reinterpret_cast<const char *>(_buffer.data());
+  if (!std::memcmp(header, msg::server::Busy, 4)) {
+    return finish(Outcome::Busy);
+  }
+  bool success = !std::memcmp(header, msg::server::Success, 4);
+  if (!success && std::memcmp(header, msg::server::AccessDenied, 4)) {
+    return finish(Outcome::Error);
+  }
+
+  if (_authenticating) {
+    _authenticating = false;
+    if (!success) {
+      return finish(Outcome::Denied);
+    }
+    _authenticated = true;
+    return send();
+  }
+
+  switch (_request) {
+    case Request::Query:
+      // Either answer is right; it depends on whether this connection has
+      // authenticated yet.
+      return finish(Outcome::Success);
+    case Request::Credential:
+      _authenticated = success;
+      return finish(success ? Outcome::Success : Outcome::Denied);
+    case Request::Bless: {
+      uint32_t status;
+      if (!success) {
+        return finish(Outcome::Denied);
+      } else if (_buffer.size() != 4 + sizeof(status)) {
+        return finish(Outcome::Error);
+      }
+      std::memcpy(&status, _buffer.data() + 4, sizeof(status));
+      return finish(status == msg::BlessOk ? Outcome::Success
+                                           : Outcome::Denied);
+    }
+    default:
+      WSUDO_UNREACHABLE("Invalid request type");
+  }
+}
+
+LoadClient::Callback LoadClient::finish(Outcome outcome) {
+  _worker.results().record(_request, outcome, Clock::now() - _due);
+  // The server hangs up after most failures; start over on a new connection.
+  if (outcome != Outcome::Success ||
+      ++_sent >= _worker.options().perConnection)
+  {
+    disconnect();
+  }
+
+  if (outcome == Outcome::Busy || outcome == Outcome::Error) {
+    // Don't spin on a server that is full or gone.
+    _worker.retryLater(*this);
+  } else {
+    // Let the loop run the other clients before this one's next request.
+    wake();
+  }
+  return &Self::start;
+}
+
+// }}} LoadClient
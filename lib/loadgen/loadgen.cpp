@@ -0,0 +1,222 @@
+#include "wsudo/loadgen.h"
+
+#include <fmt/format.h>
+
+#include <cassert>
+#include <charconv>
+#include <cmath>
+
+using namespace wsudo;
+using namespace wsudo::loadgen;
+
+// Helpers {{{
+
+namespace {
+  constexpr const char *RequestNames[] = {"QSES", "CRED", "BLES"};
+  static_assert(std::size(RequestNames) == RequestTypes);
+
+  constexpr const char *OutcomeNames[] = {
+    "success", "denied", "busy", "error",
+  };
+  static_assert(std::size(OutcomeNames) == Outcomes);
+
+  std::optional<Request> parseRequest(std::string_view name) {
+    if (name == "qses") {
+      return Request::Query;
+    } else if (name == "cred") {
+      return Request::Credential;
+    } else if (name == "bles") {
+      return Request::Bless;
+    }
+    return std::nullopt;
+  }
+
+  // Nanoseconds as milliseconds, for the report.
+  double toMilliseconds(uint64_t nanoseconds) {
+    return static_cast<double>(nanoseconds) / 1e6;
+  }
+
+  void appendRow(std::string &out, std::string_view name,
+                 const metrics::Histogram::Snapshot &latency,
+                 const uint64_t (&outcomes)[Outcomes], double seconds)
+  {
+    auto rate = seconds > 0 ? static_cast<double>(latency.count) / seconds
+                            : 0.0;
+    out += fmt::format(
+      "{:<6}{:>10}{:>12.1f}{:>10.3f}{:>10.3f}{:>10.3f}{:>9}{:>9}{:>9}\n",
+      name, latency.count, rate, toMilliseconds(latency.quantile(0.5)),
+      toMilliseconds(latency.quantile(0.99)),
+      toMilliseconds(latency.quantile(0.999)),
+      outcomes[static_cast<size_t>(Outcome::Denied)],
+      outcomes[static_cast<size_t>(Outcome::Busy)],
+      outcomes[static_cast<size_t>(Outcome::Error)]
+    );
+  }
+}
+
+// }}}
+
+const char *wsudo::loadgen::requestName(Request request) {
+  return RequestNames[static_cast<size_t>(request)];
+}
+
+const char *wsudo::loadgen::outcomeName(Outcome outcome) {
+  return OutcomeNames[static_cast<size_t>(outcome)];
+}
+
+// {{{ Mix
+
+std::optional<Mix> Mix::parse(std::string_view text) {
+  Mix mix;
+  while (true) {
+    auto comma = text.find(',');
+    auto item = text.substr(0, comma);
+    auto equals = item.find('=');
+    if (equals == std::string_view::npos) {
+      return std::nullopt;
+    }
+    auto request = parseRequest(item.substr(0, equals));
+    if (!request) {
+      return std::nullopt;
+    }
+    auto value = item.substr(equals + 1);
+    uint32_t weight;
+    auto [end, error] = std::from_chars(value.data(),
+                                        value.data() + value.size(), weight);
+    if (error != std::errc{} || end != value.data() + value.size()) {
+      return std::nullopt;
+    }
+    mix._weights[static_cast<size_t>(*request)] = weight;
+    if (comma == std::string_view::npos) {
+      break;
+    }
+    text.remove_prefix(comma + 1);
+  }
+  uint64_t total = 0;
+  for (auto weight : mix._weights) {
+    total += weight;
+  }
+  if (total == 0 || total > UINT32_MAX) {
+    return std::nullopt;
+  }
+  return mix;
+}
+
+uint32_t Mix::weight(Request request) const {
+  return _weights[static_cast<size_t>(request)];
+}
+
+uint32_t Mix::total() const {
+  uint32_t total = 0;
+  for (auto weight : _weights) {
+    total += weight;
+  }
+  return total;
+}
+
+Request Mix::pick(uint32_t random) const {
+  auto value = random % total();
+  for (size_t i = 0; i < RequestTypes; ++i) {
+    if (value < _weights[i]) {
+      return static_cast<Request>(i);
+    }
+    value -= _weights[i];
+  }
+  assert(0 && "Weights don't add up to the total");
+  return static_cast<Request>(RequestTypes - 1);
+}
+
+// }}} Mix
+
+// {{{ Schedule
+
+Schedule::Schedule(double ratePerSecond, Clock::time_point start)
+  : _rate{ratePerSecond}, _start{start}
+{
+  assert(ratePerSecond > 0 && "Open-loop tests need a positive rate");
+}
+
+Clock::time_point Schedule::at(uint64_t n) const {
+  return _start + std::chrono::duration_cast<Clock::duration>(
+    std::chrono::duration<double>{static_cast<double>(n) / _rate}
+  );
+}
+
+uint64_t Schedule::due(Clock::time_point now) const {
+  if (now < _start) {
+    return 0;
+  }
+  std::chrono::duration<double> elapsed = now - _start;
+  auto n = static_cast<uint64_t>(std::floor(elapsed.count() * _rate)) + 1;
+  // Agree with at() where rounding doesn't.
+  while (n > 0 && at(n - 1) > now) {
+    --n;
+  }
+  while (at(n) <= now) {
+    ++n;
+  }
+  return n;
+}
+
+// }}} Schedule
+
+// {{{ Results
+
+void Results::record(Request request, Outcome outcome,
+                     Clock::duration latency) noexcept
+{
+  auto index = static_cast<size_t>(request);
+  _outcomes[index][static_cast<size_t>(outcome)].add();
+  if (outcome == Outcome::Success || outcome == Outcome::Denied) {
+    _latency[index].record(static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count()
+    ));
+  }
+}
+
+uint64_t Results::count(Request request, Outcome outcome) const {
+  return _outcomes[static_cast<size_t>(request)][static_cast<size_t>(outcome)]
+    .value();
+}
+
+metrics::Histogram::Snapshot Results::latency(Request request) const {
+  return _latency[static_cast<size_t>(request)].snapshot();
+}
+
+std::string Results::report(Clock::duration elapsed) const {
+  auto seconds = std::chrono::duration<double>{elapsed}.count();
+  std::string out = fmt::format(
+    "{:<6}{:>10}{:>12}{:>10}{:>10}{:>10}{:>9}{:>9}{:>9}\n", "", "answered",
+    "per second", "p50 ms", "p99 ms", "p99.9 ms", "denied", "busy", "errors"
+  );
+
+  metrics::Histogram::Snapshot all;
+  all.buckets.resize(metrics::Histogram::Buckets);
+  uint64_t allOutcomes[Outcomes]{};
+  for (size_t i = 0; i < RequestTypes; ++i) {
+    auto request = static_cast<Request>(i);
+    auto latency = this->latency(request);
+    uint64_t outcomes[Outcomes];
+    for (size_t o = 0; o < Outcomes; ++o) {
+      outcomes[o] = count(request, static_cast<Outcome>(o));
+      allOutcomes[o] += outcomes[o];
+    }
+    if (!latency.count && !outcomes[static_cast<size_t>(Outcome::Busy)] &&
+        !outcomes[static_cast<size_t>(Outcome::Error)])
+    {
+      // Not in the mix.
+      continue;
+    }
+    appendRow(out, requestName(request), latency, outcomes, seconds);
+
+    all.count += latency.count;
+    all.sum += latency.sum;
+    for (size_t b = 0; b < latency.buckets.size(); ++b) {
+      all.buckets[b] += latency.buckets[b];
+    }
+  }
+  appendRow(out, "all", all, allOutcomes, seconds);
+  return out;
+}
+
+// }}} Results
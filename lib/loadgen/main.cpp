@@ -0,0 +1,260 @@
+#include "wsudo/loadclient.h"
+#include "wsudo/asynclog.h"
+
+#include <Psapi.h>
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cwchar>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#pragma comment(lib, "Psapi.lib")
+
+using namespace wsudo;
+using namespace wsudo::loadgen;
+
+// Exit codes.
+enum : int {
+  LoadgenExitOk = 0,
+  LoadgenExitInvalidUsage = 1,
+  LoadgenExitServerNotFound = 2,
+  LoadgenExitSystemError = 3,
+};
+
+// Helpers {{{
+
+namespace {
+  constexpr const char *DefaultMix = "qses=1,cred=1,bles=8";
+
+  void usage() {
+    log::eprint(
+      "Usage: wsudo-loadgen [options]\n"
+      "Drives the token server with simulated clients and reports throughput,\n"
+      "latency and memory use. Start the server with --load-test, or give\n"
+      "--pipe the real server's pipe and --user and --password a real\n"
+      "account.\n"
+      "  --clients <n>         Simulated clients (default 64)\n"
+      "  --rate <n>            Open loop: send n requests per second and time\n"
+      "                        each from when it was due. Without it, each\n"
+      "                        client sends its next request as soon as the\n"
+      "                        last is answered.\n"
+      "  --duration <seconds>  How long to run (default 10)\n"
+      "  --mix <weights>       Request mix (default {})\n"
+      "  --per-connection <n>  Requests per connection (default 1)\n"
+      "  --pipe <name>         Server pipe (default the load test server's)\n"
+      "  --user <name>         User to log on as (default loadtest)\n"
+      "  --password <text>     Password (default: the load test password)\n",
+      DefaultMix
+    );
+  }
+
+  std::optional<uint64_t> parseCount(const wchar_t *text) {
+    wchar_t *end;
+    auto value = std::wcstoull(text, &end, 10);
+    if (end == text || *end || value == 0) {
+      return std::nullopt;
+    }
+    return value;
+  }
+
+  std::optional<double> parseRate(const wchar_t *text) {
+    wchar_t *end;
+    auto value = std::wcstod(text, &end);
+    if (end == text || *end || !(value > 0)) {
+      return std::nullopt;
+    }
+    return value;
+  }
+
+  // Returns false if the arguments don't make sense.
+  bool parseOptions(int argc, wchar_t *argv[], Options &options) {
+    auto mix = Mix::parse(DefaultMix);
+    for (int i = 1; i < argc; ++i) {
+      std::wstring_view name{argv[i]};
+      if (i + 1 == argc) {
+        return false;
+      }
+      auto value = argv[++i];
+      if (name == L"--clients") {
+        auto clients = parseCount(value);
+        if (!clients) {
+          return false;
+        }
+        options.clients = static_cast<size_t>(*clients);
+      } else if (name == L"--rate") {
+        auto rate = parseRate(value);
+        if (!rate) {
+          return false;
+        }
+        options.rate = *rate;
+      } else if (name == L"--duration") {
+        auto seconds = parseCount(value);
+        if (!seconds) {
+          return false;
+        }
+        options.duration = std::chrono::seconds{*seconds};
+      } else if (name == L"--mix") {
+        if (!(mix = Mix::parse(to_utf8(value)))) {
+          return false;
+        }
+      } else if (name == L"--per-connection") {
+        auto count = parseCount(value);
+        if (!count || *count > UINT_MAX) {
+          return false;
+        }
+        options.perConnection = static_cast<unsigned>(*count);
+      } else if (name == L"--pipe") {
+        options.pipeName = value;
+      } else if (name == L"--user") {
+        options.username = to_utf8(value);
+      } else if (name == L"--password") {
+        options.password = to_utf8(value);
+      } else {
+        return false;
+      }
+    }
+    options.mix = *mix;
+    return true;
+  }
+
+  size_t workingSet(HANDLE process) {
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(process, &counters, sizeof(counters))) {
+      return 0;
+    }
+    return counters.WorkingSetSize;
+  }
+
+  // Connect once to find the server's process. Returns false if there is no
+  // server; `process` stays null if this user can't query it.
+  bool findServer(const std::wstring &pipeName, HObject &process) {
+    HANDLE handle = CreateFileW(pipeName.c_str(), GENERIC_READ | GENERIC_WRITE,
+                                0, nullptr, OPEN_EXISTING, 0, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+      return GetLastError() == ERROR_PIPE_BUSY;
+    }
+    HObject pipe{handle};
+    ULONG processId;
+    if (GetNamedPipeServerProcessId(pipe, &processId)) {
+      process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, false,
+                            processId);
+    }
+    return true;
+  }
+
+  double toMiB(size_t bytes) {
+    return static_cast<double>(bytes) / (1024 * 1024);
+  }
+
+  // Growth from `before` to `peak` shared over `count`, in KiB.
+  double growthPer(size_t before, size_t peak, size_t count) {
+    auto growth = peak > before ? peak - before : 0;
+    return static_cast<double>(growth) / static_cast<double>(count) / 1024;
+  }
+}
+
+// }}}
+
+int wmain(int argc, wchar_t *argv[]) {
+  Options options;
+  if (!parseOptions(argc, argv, options)) {
+    usage();
+    return LoadgenExitInvalidUsage;
+  }
+
+  auto logWriter = log::startAsyncLogging(true);
+  log::g_outLogger->set_level(spdlog::level::warn);
+  log::g_errLogger->set_level(spdlog::level::warn);
+  spdlog::set_pattern("%^[%l]%$ %v");
+  WSUDO_SCOPEEXIT {
+    logWriter->stop();
+    spdlog::drop_all();
+  };
+
+  HObject server;
+  if (!findServer(options.pipeName, server)) {
+    log::critical("Couldn't connect to the server: {}", lastErrorString());
+    return LoadgenExitServerNotFound;
+  }
+  if (!server) {
+    log::warn("Can't read the server's memory use; run elevated to see it.");
+  }
+
+  auto self = GetCurrentProcess();
+  auto selfBefore = workingSet(self);
+  auto serverBefore = server ? workingSet(server) : 0;
+  auto selfPeak = selfBefore;
+  auto serverPeak = serverBefore;
+
+  // Spread the clients evenly over as few threads as the handle limit allows.
+  auto workerCount = (options.clients + MaxClientsPerWorker - 1) /
+                     MaxClientsPerWorker;
+  Results results;
+  auto start = Clock::now();
+  auto end = start + options.duration;
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::vector<std::thread> threads;
+  std::atomic<bool> failed{false};
+  for (size_t i = 0; i < workerCount; ++i) {
+    auto clients = options.clients / workerCount +
+                   (i < options.clients % workerCount ? 1 : 0);
+    auto &worker = *workers.emplace_back(
+      std::make_unique<Worker>(options, results, clients, i, start, end)
+    );
+    threads.emplace_back([&worker, &failed] {
+      if (!worker.run()) {
+        failed = true;
+      }
+    });
+  }
+
+  log::print("Running {} clients on {} threads for {} s, {}.\n",
+             options.clients, workerCount, options.duration.count(),
+             options.rate > 0
+               ? fmt::format("open loop at {} requests per second",
+                             options.rate)
+               : std::string{"closed loop"});
+
+  while (Clock::now() < end) {
+    std::this_thread::sleep_for(std::chrono::milliseconds{100});
+    selfPeak = std::max(selfPeak, workingSet(self));
+    if (server) {
+      serverPeak = std::max(serverPeak, workingSet(server));
+    }
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  if (failed) {
+    return LoadgenExitSystemError;
+  }
+
+  log::print("\n{}\n", results.report(end - start));
+  if (options.rate > 0) {
+    uint64_t unsent = 0;
+    for (auto &worker : workers) {
+      unsent += worker->unsent();
+    }
+    if (unsent) {
+      log::print("{} requests came due but no client was free to send them; "
+                 "the server can't keep up with this rate.\n", unsent);
+    }
+  }
+
+  log::print("Load generator working set: {:.1f} MiB peak, {:.1f} KiB per "
+             "client.\n", toMiB(selfPeak),
+             growthPer(selfBefore, selfPeak, options.clients));
+  if (server) {
+    // The server has at most MaxPipeConnections clients connected at once.
+    auto connections = std::min<size_t>(options.clients, MaxPipeConnections);
+    log::print("Server working set: {:.1f} MiB before, {:.1f} MiB peak, "
+               "{:.1f} KiB per connection.\n", toMiB(serverBefore),
+               toMiB(serverPeak),
+               growthPer(serverBefore, serverPeak, connections));
+  }
+  return LoadgenExitOk;
+}
@@ -0,0 +1,82 @@
+#include "wsudo/wsudo.h"
+#include "wsudo/policy.h"
+
+#include <cwchar>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+using namespace wsudo;
+
+// Exit codes.
+enum : int {
+  PolicyExitOk = 0,
+  PolicyExitInvalidUsage = 1,
+  PolicyExitInvalidPolicy = 2,
+  PolicyExitIOError = 3,
+};
+
+int wmain(int argc, wchar_t *argv[]) {
+  bool checkOnly = argc == 3 && !std::wcscmp(argv[1], L"--check");
+  if (argc < 2 || argc > 3 || (!checkOnly && argv[1][0] == L'-')) {
+    log::eprint(
+      "Usage: wsudo-policy <source> [<image>]\n"
+      "       wsudo-policy --check <source>\n"
+      "Compiles a policy into the image the server loads. The image defaults\n"
+      "to the source path with '.bin' appended.\n"
+    );
+    return PolicyExitInvalidUsage;
+  }
+  std::wstring sourcePath{argv[checkOnly ? 2 : 1]};
+  std::wstring imagePath{argc == 3 && !checkOnly ? argv[2] : L""};
+  if (imagePath.empty()) {
+    imagePath = sourcePath + L".bin";
+  }
+
+  std::ifstream source{std::filesystem::path{sourcePath}, std::ios::binary};
+  if (!source) {
+    log::eprint("Can't open '{}'.\n", to_utf8(sourcePath));
+    return PolicyExitIOError;
+  }
+  std::string text{std::istreambuf_iterator<char>{source},
+                   std::istreambuf_iterator<char>{}};
+
+  policy::CompileError error;
+  auto image = policy::Policy::compileImage(text, &error);
+  if (!image) {
+    log::eprint("{}:{}: {}\n", to_utf8(sourcePath), error.line,
+                error.message);
+    return PolicyExitInvalidPolicy;
+  }
+  if (checkOnly) {
+    log::print("{}: OK.\n", to_utf8(sourcePath));
+    return PolicyExitOk;
+  }
+
+  // Write the image beside the target and rename it into place, so the
+  // server never maps a partly written image.
+  auto tempPath = imagePath + L".tmp";
+  {
+    std::ofstream out{std::filesystem::path{tempPath},
+                      std::ios::binary | std::ios::trunc};
+    out.write(image->data(), static_cast<std::streamsize>(image->size()));
+    if (!out.flush()) {
+      log::eprint("Can't write '{}'.\n", to_utf8(tempPath));
+      out.close();
+      DeleteFileW(tempPath.c_str());
+      return PolicyExitIOError;
+    }
+  }
+  if (!MoveFileExW(tempPath.c_str(), imagePath.c_str(),
+                   MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+  {
+    log::eprint("Can't replace '{}': {}\n", to_utf8(imagePath),
+                lastErrorString());
+    DeleteFileW(tempPath.c_str());
+    return PolicyExitIOError;
+  }
+
+  log::print("Compiled '{}' ({} bytes).\n", to_utf8(imagePath),
+             image->size());
+  return PolicyExitOk;
+}
@@ -0,0 +1,161 @@
+#include "wsudo/server.h"
+#include "wsudo/flightdump.h"
+
+#include <sddl.h>
+
+#include <cstring>
+
+using namespace wsudo;
+using namespace wsudo::server;
+
+// Helpers {{{
+
+namespace {
+  // How long a client has to read its answer and hang up.
+  constexpr DWORD HangUpTimeout = 5000;
+
+  std::string response(const char *header, std::string_view body = {}) {
+    std::string message{header, 4};
+    message += body;
+    return message;
+  }
+}
+
+// }}}
+
+AdminPipe::AdminPipe(metrics::Registry &registry, std::wstring dumpDirectory)
+  : _registry{registry},
+    _dumpDirectory{std::move(dumpDirectory)},
+    _ioEvent{CreateEventW(nullptr, true, false, nullptr)},
+    _stopEvent{CreateEventW(nullptr, true, false, nullptr)}
+{
+  HLocalPtr<PSECURITY_DESCRIPTOR> securityDescriptor;
+  if (!ConvertStringSecurityDescriptorToSecurityDescriptorW(
+        L"D:P(A;;GA;;;SY)(A;;GA;;;BA)", SDDL_REVISION_1, &securityDescriptor,
+        nullptr))
+  {
+    log::error("Couldn't create admin pipe security descriptor: {}",
+               lastErrorString());
+    return;
+  }
+  SECURITY_ATTRIBUTES secAttr;
+  secAttr.nLength = sizeof(SECURITY_ATTRIBUTES);
+  secAttr.bInheritHandle = false;
+  secAttr.lpSecurityDescriptor = securityDescriptor;
+
+  HANDLE pipe = CreateNamedPipeW(
+    AdminPipeFullPath,
+    PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE,
+    PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_REJECT_REMOTE_CLIENTS,
+    1, PipeBufferSize, PipeBufferSize, PipeDefaultTimeout, &secAttr
+  );
+  if (pipe == INVALID_HANDLE_VALUE) {
+    log::error("Failed to create admin pipe: {}", lastErrorString());
+    return;
+  }
+  _pipe = pipe;
+  log::info(L"Admin requests on '{}'.", AdminPipeFullPath);
+  _thread = std::thread{&AdminPipe::run, this};
+}
+
+AdminPipe::~AdminPipe() {
+  if (_thread.joinable()) {
+    SetEvent(_stopEvent);
+    _thread.join();
+  }
+}
+
+void AdminPipe::run() {
+  while (WaitForSingleObject(_stopEvent, 0) != WAIT_OBJECT_0) {
+    OVERLAPPED overlapped{};
+    overlapped.hEvent = _ioEvent;
+    DWORD bytes;
+    if (!ConnectNamedPipe(_pipe, &overlapped)) {
+      auto error = GetLastError();
+      if (error == ERROR_IO_PENDING) {
+        if (!wait(overlapped, bytes)) {
+          DisconnectNamedPipe(_pipe);
+          continue;
+        }
+      } else if (error != ERROR_PIPE_CONNECTED) {
+        log::error("Admin pipe: ConnectNamedPipe failed: {}",
+                   lastErrorString(error));
+        return;
+      }
+    }
+    serve();
+    DisconnectNamedPipe(_pipe);
+  }
+}
+
+bool AdminPipe::wait(OVERLAPPED &overlapped, DWORD &bytes, DWORD timeout) {
+  HANDLE events[] = {overlapped.hEvent, _stopEvent};
+  if (WaitForMultipleObjects(2, events, false, timeout) == WAIT_OBJECT_0) {
+    return GetOverlappedResult(_pipe, &overlapped, &bytes, false);
+  }
+  CancelIoEx(_pipe, &overlapped);
+  GetOverlappedResult(_pipe, &overlapped, &bytes, true);
+  return false;
+}
+
+void AdminPipe::serve() {
+  OVERLAPPED overlapped{};
+  overlapped.hEvent = _ioEvent;
+  char request[PipeBufferSize];
+  DWORD bytes = 0;
+  if (!ReadFile(_pipe, request, sizeof(request), &bytes, &overlapped)) {
+    if (GetLastError() != ERROR_IO_PENDING ||
+        !wait(overlapped, bytes, HangUpTimeout))
+    {
+      // Requests are only a header, so ERROR_MORE_DATA is an error too.
+      log::warn("Admin pipe: couldn't read request: {}", lastErrorString());
+      return;
+    }
+  }
+
+  auto answer = this->answer(std::string_view{request, bytes});
+  overlapped = OVERLAPPED{};
+  overlapped.hEvent = _ioEvent;
+  if (!WriteFile(_pipe, answer.data(), static_cast<DWORD>(answer.size()),
+                 &bytes, &overlapped) &&
+      (GetLastError() != ERROR_IO_PENDING ||
+       !wait(overlapped, bytes, HangUpTimeout)))
+  {
+    log::warn("Admin pipe: couldn't write response: {}", lastErrorString());
+    return;
+  }
+
+  // Disconnecting discards what the client hasn't read yet, so wait for it
+  // to hang up first.
+  overlapped = OVERLAPPED{};
+  overlapped.hEvent = _ioEvent;
+  if (!ReadFile(_pipe, request, sizeof(request), &bytes, &overlapped) &&
+      GetLastError() == ERROR_IO_PENDING)
+  {
+    wait(overlapped, bytes, HangUpTimeout);
+  }
+}
+
+std::string AdminPipe::answer(std::string_view request) {
+  if (request.size() != 4) {
+    return response(msg::server::InvalidMessage, "Expected a header.");
+  }
+  recorder::record(recorder::Kind::Note, 0, "admin");
+  if (!std::memcmp(request.data(), msg::admin::Metrics, 4)) {
+    return response(msg::server::Success, _registry.snapshot());
+  } else if (!std::memcmp(request.data(), msg::admin::FlightDump, 4)) {
+    auto path = recorder::newDumpPath(_dumpDirectory);
+    if (path.empty()) {
+      return response(msg::server::InternalError,
+                      "Couldn't secure the dump directory.");
+    }
+    if (!recorder::writeDump(path.c_str())) {
+      log::error(L"Couldn't write flight recorder dump to '{}'.", path);
+      return response(msg::server::InternalError,
+                      "Couldn't write the dump.");
+    }
+    log::info(L"Wrote flight recorder dump to '{}' for an admin.", path);
+    return response(msg::server::Success, to_utf8(path));
+  }
+  return response(msg::server::InvalidMessage, "Unknown message header.");
+}
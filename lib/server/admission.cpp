@@ -0,0 +1,75 @@
+#include "wsudo/admission.h"
+
+#include <algorithm>
+
+using namespace wsudo;
+using namespace wsudo::server;
+
+namespace {
+  // Weight of each new sample in the service time average.
+  constexpr double ServiceTimeWeight = 0.125;
+  // Bounds for the retry hint sent to clients.
+  constexpr std::chrono::milliseconds MinRetryAfter{50};
+  constexpr std::chrono::milliseconds MaxRetryAfter{5000};
+}
+
+AdmissionController::AdmissionController(duration target,
+                                         duration interval) noexcept
+  : _target{target},
+    _interval{interval}
+{
+}
+
+AdmissionController::Decision
+AdmissionController::admit(AdmissionClock::duration queueDelay,
+                           AdmissionClock::time_point now)
+{
+  if (queueDelay < _target) {
+    // The backlog drained recently enough; leave the overloaded state.
+    _firstAboveTime = AdmissionClock::time_point{};
+    _overloaded = false;
+  } else if (_firstAboveTime == AdmissionClock::time_point{}) {
+    _firstAboveTime = now + _interval;
+  } else if (now >= _firstAboveTime) {
+    _overloaded = true;
+  }
+
+  if (_overloaded) {
+    return Decision{false, retryAfter(queueDelay)};
+  }
+
+  ++_inFlight;
+  return Decision{true, duration{0}};
+}
+
+void AdmissionController::acquire() {
+  ++_inFlight;
+}
+
+void AdmissionController::release() {
+  assert(_inFlight > 0);
+  if (_inFlight > 0) {
+    --_inFlight;
+  }
+}
+
+void AdmissionController::recordService(AdmissionClock::duration serviceTime) {
+  double us = static_cast<double>(
+    std::chrono::duration_cast<std::chrono::microseconds>(serviceTime).count()
+  );
+  if (_serviceUs == 0) {
+    _serviceUs = us;
+  } else {
+    _serviceUs += (us - _serviceUs) * ServiceTimeWeight;
+  }
+}
+
+AdmissionController::duration
+AdmissionController::retryAfter(AdmissionClock::duration queueDelay) const {
+  // Roughly the time for the current backlog and the clients ahead of this
+  // one to finish.
+  auto drainUs = _serviceUs * _inFlight;
+  auto hint = std::chrono::duration_cast<duration>(queueDelay) +
+              duration{static_cast<long long>(drainUs / 1000)};
+  return std::clamp(hint, MinRetryAfter, MaxRetryAfter);
+}
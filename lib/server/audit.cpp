@@ -0,0 +1,369 @@
+#include "wsudo/audit.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace wsudo;
+using namespace wsudo::audit;
+
+// Helpers {{{
+
+namespace {
+  bool isContinuation(char c) {
+    return (static_cast<unsigned char>(c) & 0xC0) == 0x80;
+  }
+
+  // Copy into a fixed field without splitting a UTF-8 sequence. With
+  // `keepEnd`, the end of a long value is kept instead of the start.
+  template<size_t N>
+  void setField(char (&field)[N], std::string_view value, bool keepEnd) {
+    if (value.length() > N) {
+      if (keepEnd) {
+        value.remove_prefix(value.length() - N);
+        while (!value.empty() && isContinuation(value.front())) {
+          value.remove_prefix(1);
+        }
+      } else {
+        auto length = N;
+        while (length > 0 && isContinuation(value[length])) {
+          --length;
+        }
+        value = value.substr(0, length);
+      }
+    }
+    std::memset(field, 0, N);
+    std::memcpy(field, value.data(), value.length());
+  }
+
+  template<size_t N>
+  std::string_view getField(const char (&field)[N]) {
+    auto end = std::find(field, field + N, '\0');
+    return std::string_view{field, static_cast<size_t>(end - field)};
+  }
+
+  constexpr const char *EventNames[] = {"logon", "resume", "bless", "spawn"};
+  constexpr const char *OutcomeNames[] = {
+    "allowed", "denied", "throttled", "failed"
+  };
+
+  template<typename E, size_t N>
+  const char *enumToString(E value, const char *const (&names)[N]) {
+    auto index = static_cast<size_t>(value) - 1;
+    return index < N ? names[index] : "unknown";
+  }
+
+  template<typename E, size_t N>
+  std::optional<E> enumFromString(std::string_view name,
+                                  const char *const (&names)[N])
+  {
+    for (size_t i = 0; i < N; ++i) {
+      if (name == names[i]) {
+        return static_cast<E>(i + 1);
+      }
+    }
+    return std::nullopt;
+  }
+}
+
+// }}}
+
+const char *audit::eventToString(Event event) {
+  return enumToString(event, EventNames);
+}
+
+const char *audit::outcomeToString(Outcome outcome) {
+  return enumToString(outcome, OutcomeNames);
+}
+
+std::optional<Event> audit::eventFromString(std::string_view name) {
+  return enumFromString<Event>(name, EventNames);
+}
+
+std::optional<Outcome> audit::outcomeFromString(std::string_view name) {
+  return enumFromString<Outcome>(name, OutcomeNames);
+}
+
+// {{{ Record
+
+void Record::setUser(std::string_view value) {
+  setField(user, value, false);
+}
+
+void Record::setImage(std::string_view value) {
+  setField(image, value, true);
+}
+
+std::string_view Record::userName() const {
+  return getField(user);
+}
+
+std::string_view Record::imageName() const {
+  return getField(image);
+}
+
+// }}} Record
+
+// {{{ AuditLog
+
+AuditLog::AuditLog(std::unique_ptr<Storage> storage)
+  : AuditLog{std::move(storage), Options{}}
+{
+}
+
+AuditLog::AuditLog(std::unique_ptr<Storage> storage, Options options)
+  : _storage{std::move(storage)},
+    _options{options}
+{
+  _options.segmentRecords = std::max<size_t>(_options.segmentRecords, 1);
+  _options.maxSegments = std::max<size_t>(_options.maxSegments, 1);
+  _options.batchRecords = std::max<size_t>(_options.batchRecords, 1);
+  if (!_storage) {
+    return;
+  }
+  if (openSegment()) {
+    // Keep times increasing across restarts too.
+    _lastTime = _header->lastTime;
+  } else {
+    ++_stats.failures;
+  }
+  _thread = std::thread{&AuditLog::run, this};
+}
+
+AuditLog::~AuditLog() {
+  if (!_thread.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    _stopping = true;
+  }
+  _wake.notify_one();
+  _thread.join();
+}
+
+void AuditLog::append(Record record) {
+  std::unique_lock<std::mutex> lock{_mutex};
+  if (!_storage || _pending.size() >= _options.maxPending) {
+    ++_stats.dropped;
+    return;
+  }
+  record.time = std::max(record.time, _lastTime);
+  _lastTime = record.time;
+  _pending.push_back(record);
+  ++_appended;
+  if (_pending.size() == 1) {
+    _oldestPending = std::chrono::steady_clock::now();
+    _wake.notify_one();
+  } else if (_pending.size() == _options.batchRecords) {
+    _wake.notify_one();
+  }
+}
+
+void AuditLog::flush() {
+  std::unique_lock<std::mutex> lock{_mutex};
+  auto target = _appended;
+  if (!_thread.joinable() || _written >= target) {
+    return;
+  }
+  _flushTarget = std::max(_flushTarget, target);
+  _wake.notify_one();
+  _committed.wait(lock, [&] { return _written >= target; });
+}
+
+AuditLog::Stats AuditLog::stats() const {
+  std::lock_guard<std::mutex> lock{_mutex};
+  return _stats;
+}
+
+uint64_t AuditLog::now() {
+  using namespace std::chrono;
+  return static_cast<uint64_t>(
+    duration_cast<microseconds>(system_clock::now().time_since_epoch())
+      .count()
+  );
+}
+
+void AuditLog::run() {
+  std::vector<Record> batch;
+  std::unique_lock<std::mutex> lock{_mutex};
+  while (true) {
+    _wake.wait(lock, [this] { return _stopping || !_pending.empty(); });
+    if (_pending.empty()) {
+      break;
+    }
+    _wake.wait_until(lock, _oldestPending + _options.commitInterval, [this] {
+      return _stopping || _pending.size() >= _options.batchRecords ||
+             _flushTarget > _written;
+    });
+
+    batch.swap(_pending);
+    auto target = _appended;
+    lock.unlock();
+    auto written = commit(batch);
+    lock.lock();
+
+    _stats.records += written;
+    _stats.failures += batch.size() - written;
+    ++_stats.commits;
+    batch.clear();
+    _written = target;
+    _committed.notify_all();
+  }
+}
+
+size_t AuditLog::commit(const std::vector<Record> &batch) {
+  size_t index = 0;
+  while (index < batch.size()) {
+    if (!_header || _header->count >= _header->capacity) {
+      if (!startSegment(_nextSequence)) {
+        break;
+      }
+    }
+    auto count = static_cast<size_t>(_header->count);
+    auto n = std::min(batch.size() - index,
+                      static_cast<size_t>(_header->capacity) - count);
+    std::memcpy(_records + count, batch.data() + index, n * sizeof(Record));
+    auto header = *_header;
+    if (count == 0) {
+      _header->firstTime = batch[index].time;
+    }
+    _header->lastTime = batch[index + n - 1].time;
+    _header->count = count + n;
+    // One sync for the new records and the header together. If it fails,
+    // they're reported as failed, so the segment mustn't count them either.
+    if (!_segment->sync(0, segmentSize(count + n))) {
+      *_header = header;
+      std::memset(_records + count, 0, n * sizeof(Record));
+      break;
+    }
+    index += n;
+  }
+  return index;
+}
+
+bool AuditLog::openSegment() {
+  auto sequences = _storage->list();
+  if (sequences.empty()) {
+    return startSegment(1);
+  }
+  auto newest = *std::max_element(sequences.begin(), sequences.end());
+  _nextSequence = newest + 1;
+  auto segment = _storage->open(newest, segmentSize(_options.segmentRecords));
+  if (segment) {
+    auto view = viewSegment(segment->data(), segment->size());
+    if (view && view->header->sequence == newest &&
+        view->count < view->header->capacity)
+    {
+      _segment = std::move(segment);
+      _header = reinterpret_cast<SegmentHeader *>(_segment->data());
+      _records = reinterpret_cast<Record *>(_header + 1);
+      return true;
+    }
+  }
+  // Full or damaged; leave it for the reader and start after it.
+  return startSegment(_nextSequence);
+}
+
+bool AuditLog::startSegment(uint64_t sequence) {
+  _segment.reset();
+  _header = nullptr;
+  _records = nullptr;
+
+  auto size = segmentSize(_options.segmentRecords);
+  auto segment = _storage->open(sequence, size);
+  if (!segment || segment->size() < size) {
+    return false;
+  }
+  auto header = reinterpret_cast<SegmentHeader *>(segment->data());
+  std::memset(header, 0, sizeof(SegmentHeader));
+  std::memcpy(header->magic, SegmentMagic, sizeof(header->magic));
+  header->version = SegmentVersion;
+  header->recordSize = sizeof(Record);
+  header->capacity = static_cast<uint32_t>(_options.segmentRecords);
+  header->sequence = sequence;
+  if (!segment->sync(0, sizeof(SegmentHeader))) {
+    return false;
+  }
+
+  _segment = std::move(segment);
+  _header = header;
+  _records = reinterpret_cast<Record *>(header + 1);
+  _nextSequence = sequence + 1;
+  removeOldSegments();
+  return true;
+}
+
+void AuditLog::removeOldSegments() {
+  auto sequences = _storage->list();
+  if (sequences.size() <= _options.maxSegments) {
+    return;
+  }
+  std::sort(sequences.begin(), sequences.end());
+  auto excess = sequences.size() - _options.maxSegments;
+  for (size_t i = 0; i < excess; ++i) {
+    if (sequences[i] != _header->sequence) {
+      _storage->remove(sequences[i]);
+    }
+  }
+}
+
+// }}} AuditLog
+
+// {{{ Reader
+
+std::optional<SegmentView> audit::viewSegment(const char *data, size_t size) {
+  if (size < sizeof(SegmentHeader)) {
+    return std::nullopt;
+  }
+  auto header = reinterpret_cast<const SegmentHeader *>(data);
+  if (std::memcmp(header->magic, SegmentMagic, sizeof(SegmentMagic)) != 0 ||
+      header->version != SegmentVersion ||
+      header->recordSize != sizeof(Record) ||
+      segmentSize(header->capacity) > size ||
+      header->count > header->capacity)
+  {
+    return std::nullopt;
+  }
+  SegmentView view;
+  view.header = header;
+  view.records = reinterpret_cast<const Record *>(header + 1);
+  view.count = static_cast<size_t>(header->count);
+  return view;
+}
+
+bool Filter::overlaps(const SegmentHeader &header) const {
+  return header.count > 0 && header.firstTime <= until &&
+         header.lastTime >= since;
+}
+
+bool Filter::matches(const Record &record) const {
+  return record.time >= since && record.time <= until &&
+         (user.empty() || record.userName() == user) &&
+         (!event || record.event == *event) &&
+         (!outcome || record.outcome == *outcome);
+}
+
+size_t audit::scan(const SegmentView &segment, const Filter &filter,
+                   const std::function<bool(const Record &)> &visit)
+{
+  if (!segment.header || !filter.overlaps(*segment.header)) {
+    return 0;
+  }
+  auto end = segment.records + segment.count;
+  auto it = std::lower_bound(
+    segment.records, end, filter.since,
+    [](const Record &record, uint64_t time) { return record.time < time; }
+  );
+  size_t visited = 0;
+  for (; it != end && it->time <= filter.until; ++it) {
+    if (filter.matches(*it)) {
+      ++visited;
+      if (!visit(*it)) {
+        break;
+      }
+    }
+  }
+  return visited;
+}
+
+// }}} Reader
@@ -0,0 +1,191 @@
+#include "wsudo/auditstore.h"
+
+#include <ShlObj.h>
+
+#include <cwchar>
+
+#pragma comment(lib, "Shell32.lib")
+#pragma comment(lib, "Ole32.lib")
+
+using namespace wsudo;
+using namespace wsudo::server;
+
+// Helpers {{{
+
+namespace {
+  constexpr const wchar_t *SegmentPrefix = L"audit-";
+  constexpr const wchar_t *SegmentSuffix = L".seg";
+
+  class FileMapping final : public audit::Storage::Mapping {
+  public:
+    FileMapping(HObject file, char *view, size_t size) noexcept
+      : _file{std::move(file)}, _view{view}, _size{size}
+    {}
+
+    ~FileMapping() {
+      UnmapViewOfFile(_view);
+    }
+
+    char *data() override { return _view; }
+    size_t size() const override { return _size; }
+
+    bool sync(size_t offset, size_t length) override {
+      // Writes the dirty pages to the file, then the file to the disk.
+      if (!FlushViewOfFile(_view + offset, length) ||
+          !FlushFileBuffers(_file))
+      {
+        log::error("Couldn't write audit log: {}", lastErrorString());
+        return false;
+      }
+      return true;
+    }
+
+  private:
+    HObject _file;
+    char *_view;
+    size_t _size;
+  };
+}
+
+// }}}
+
+// {{{ AuditDirectory
+
+AuditDirectory::AuditDirectory(std::wstring directory) noexcept
+  : _directory{std::move(directory)}
+{
+}
+
+bool AuditDirectory::create() {
+  if (!createAdminDirectoryTree(_directory)) {
+    log::error(L"Couldn't secure audit directory '{}': {}", _directory,
+               to_utf16(lastErrorString()));
+    return false;
+  }
+  return true;
+}
+
+bool AuditDirectory::exists() const {
+  auto attributes = GetFileAttributesW(_directory.c_str());
+  return attributes != INVALID_FILE_ATTRIBUTES &&
+         (attributes & FILE_ATTRIBUTE_DIRECTORY);
+}
+
+std::vector<uint64_t> AuditDirectory::list() {
+  std::vector<uint64_t> sequences;
+  auto pattern = _directory + L"\\" + SegmentPrefix + L"*" + SegmentSuffix;
+  WIN32_FIND_DATAW findData;
+  HANDLE find = FindFirstFileW(pattern.c_str(), &findData);
+  if (find == INVALID_HANDLE_VALUE) {
+    return sequences;
+  }
+  WSUDO_SCOPEEXIT { FindClose(find); };
+  do {
+    auto name = findData.cFileName + std::wcslen(SegmentPrefix);
+    wchar_t *end;
+    auto sequence = std::wcstoull(name, &end, 16);
+    if (end != name && std::wcscmp(end, SegmentSuffix) == 0) {
+      sequences.push_back(sequence);
+    }
+  } while (FindNextFileW(find, &findData));
+  return sequences;
+}
+
+std::unique_ptr<audit::Storage::Mapping>
+AuditDirectory::open(uint64_t sequence, size_t size) {
+  auto path = segmentPath(sequence);
+  // Readers may map it while it is written.
+  HANDLE rawFile = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE,
+                               FILE_SHARE_READ, nullptr, OPEN_ALWAYS,
+                               FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (rawFile == INVALID_HANDLE_VALUE) {
+    log::error(L"Couldn't open audit segment '{}'.", path);
+    return nullptr;
+  }
+  HObject file{rawFile};
+
+  // An existing segment keeps its size; a new one is extended (with zeros)
+  // by the mapping.
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(file, &fileSize)) {
+    log::error("Couldn't open audit segment: {}", lastErrorString());
+    return nullptr;
+  }
+  if (fileSize.QuadPart > 0) {
+    size = static_cast<size_t>(fileSize.QuadPart);
+  }
+  auto size64 = static_cast<uint64_t>(size);
+  HObject mapping{CreateFileMappingW(file, nullptr, PAGE_READWRITE,
+                                     static_cast<DWORD>(size64 >> 32),
+                                     static_cast<DWORD>(size64), nullptr)};
+  if (!mapping) {
+    log::error("Couldn't map audit segment: {}", lastErrorString());
+    return nullptr;
+  }
+  auto view = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size);
+  if (!view) {
+    log::error("Couldn't map audit segment: {}", lastErrorString());
+    return nullptr;
+  }
+  return std::make_unique<FileMapping>(std::move(file),
+                                       static_cast<char *>(view), size);
+}
+
+void AuditDirectory::remove(uint64_t sequence) {
+  auto path = segmentPath(sequence);
+  if (!DeleteFileW(path.c_str())) {
+    log::warn(L"Couldn't delete old audit segment '{}'.", path);
+  }
+}
+
+std::shared_ptr<const char>
+AuditDirectory::read(uint64_t sequence, size_t &size) const {
+  auto path = segmentPath(sequence);
+  HANDLE rawFile = CreateFileW(path.c_str(), GENERIC_READ,
+                               FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                               OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (rawFile == INVALID_HANDLE_VALUE) {
+    return nullptr;
+  }
+  HObject file{rawFile};
+
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+    return nullptr;
+  }
+  HObject mapping{CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0,
+                                     nullptr)};
+  if (!mapping) {
+    return nullptr;
+  }
+  // The view keeps the mapping alive after the handles are closed.
+  auto view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!view) {
+    return nullptr;
+  }
+  size = static_cast<size_t>(fileSize.QuadPart);
+  return std::shared_ptr<const char>{static_cast<const char *>(view),
+                                     [](const char *view) {
+                                       UnmapViewOfFile(view);
+                                     }};
+}
+
+std::wstring AuditDirectory::segmentPath(uint64_t sequence) const {
+  wchar_t name[17];
+  swprintf(name, 17, L"%016llx", static_cast<unsigned long long>(sequence));
+  return _directory + L"\\" + SegmentPrefix + name + SegmentSuffix;
+}
+
+// }}} AuditDirectory
+
+std::wstring wsudo::server::defaultAuditDirectory() {
+  PWSTR programData;
+  if (!SUCCEEDED(SHGetKnownFolderPath(FOLDERID_ProgramData, 0, nullptr,
+                                      &programData)))
+  {
+    return std::wstring{};
+  }
+  std::wstring path{programData};
+  CoTaskMemFree(programData);
+  return path + L"\\wsudo\\audit";
+}
@@ -1,26 +1,174 @@
 #include "wsudo/server.h"
+#include "wsudo/loadtest.h"
+#include "wsudo/securememory.h"
+#include "wsudo/utf.h"
 
 #include <AclAPI.h>
+#include <algorithm>
 
 using namespace wsudo;
 using namespace wsudo::server;
 using namespace wsudo::events;
 
+// Helpers {{{
+
+namespace {
+  // The part of a command line after the program name, which is either
+  // quoted or ends at the first space.
+  std::wstring_view commandArguments(std::wstring_view commandLine) {
+    auto start = commandLine.find_first_not_of(L" \t");
+    if (start == std::wstring_view::npos) {
+      return std::wstring_view{};
+    }
+    size_t end;
+    if (commandLine[start] == L'"') {
+      end = commandLine.find(L'"', start + 1);
+      if (end != std::wstring_view::npos) {
+        ++end;
+      }
+    } else {
+      end = commandLine.find_first_of(L" \t", start);
+    }
+    if (end == std::wstring_view::npos) {
+      return std::wstring_view{};
+    }
+    return commandLine.substr(end);
+  }
+
+  // Program and arguments of a process, which needs
+  // PROCESS_QUERY_LIMITED_INFORMATION access.
+  std::optional<ProcessCommand> processCommand(HANDLE process, int clientId) {
+    static const auto NtQueryInformationProcess = LinkedModule{L"ntdll.dll"}
+      .get<nt::NtQueryInformationProcess_t>("NtQueryInformationProcess");
+
+    std::wstring imagePath(MAX_PATH, L'\0');
+    DWORD length;
+    while (true) {
+      length = static_cast<DWORD>(imagePath.size());
+      if (QueryFullProcessImageNameW(process, 0, imagePath.data(), &length)) {
+        break;
+      }
+      if (GetLastError() != ERROR_INSUFFICIENT_BUFFER ||
+          imagePath.size() >= MaxSpawnStringLength)
+      {
+        log::error("Client {}: Couldn't get process image name: {}", clientId,
+                   lastErrorString());
+        return std::nullopt;
+      }
+      imagePath.resize(imagePath.size() * 2);
+    }
+    imagePath.resize(length);
+
+    // A UNICODE_STRING followed by its buffer.
+    ULONG size = 0;
+    NtQueryInformationProcess(process, nt::ProcessCommandLineInformation,
+                              nullptr, 0, &size);
+    std::vector<ULONG_PTR> buffer(size / sizeof(ULONG_PTR) + 1);
+    if (size < sizeof(UNICODE_STRING) ||
+        !NT_SUCCESS(NtQueryInformationProcess(
+          process, nt::ProcessCommandLineInformation, buffer.data(),
+          static_cast<ULONG>(buffer.size() * sizeof(ULONG_PTR)), &size)))
+    {
+      log::error("Client {}: Couldn't get process command line.", clientId);
+      return std::nullopt;
+    }
+    auto commandLine = reinterpret_cast<const UNICODE_STRING *>(buffer.data());
+    auto arguments = commandArguments(std::wstring_view{
+      commandLine->Buffer, commandLine->Length / sizeof(wchar_t)
+    });
+
+    auto image = policy::normalizePath(to_utf8(imagePath));
+    return ProcessCommand{std::move(imagePath), std::move(image),
+                          to_utf8(arguments)};
+  }
+
+  // The program file a process runs, held open for hashing so it can't be
+  // changed or renamed. The file at the process's path may have been
+  // replaced since it started, so it's only used if it's the file the
+  // process has mapped. Null if it can't be opened or isn't that file.
+  HObject openImageFile(HANDLE process, const std::wstring &path,
+                        int clientId)
+  {
+    static const auto NtQueryInformationProcess = LinkedModule{L"ntdll.dll"}
+      .get<nt::NtQueryInformationProcess_t>("NtQueryInformationProcess");
+
+    auto file = openProgramFile(path);
+    if (!file) {
+      log::warn("Client {}: Couldn't open '{}' to check its digest: {}",
+                clientId, to_utf8(path), lastErrorString());
+      return file;
+    }
+    HANDLE handle = file;
+    if (!NT_SUCCESS(NtQueryInformationProcess(
+          process, nt::ProcessImageFileMapping, &handle, sizeof(handle),
+          nullptr)))
+    {
+      log::warn("Client {}: '{}' isn't the file the process is running.",
+                clientId, to_utf8(path));
+      return HObject{};
+    }
+    return file;
+  }
+
+  // A null terminated UTF-16 copy of a password for LogonUserExW, converted
+  // straight into secure memory.
+  SecureBuffer<wchar_t> securePassword(std::string_view password) {
+    auto length = *utf::utf8ToUtf16(password, nullptr, 0,
+                                    utf::Errors::Replace);
+    SecureBuffer<wchar_t> password16{length + 1};
+    password16.resize(length);
+    utf::utf8ToUtf16(password,
+                     reinterpret_cast<char16_t *>(password16.data()), length,
+                     utf::Errors::Replace);
+    password16.push_back(L'\0');
+    return password16;
+  }
+
+  audit::Outcome blessOutcome(uint32_t status) {
+    switch (status) {
+      case msg::BlessOk: return audit::Outcome::Allowed;
+      case msg::BlessDenied: return audit::Outcome::Denied;
+      default: return audit::Outcome::Failed;
+    }
+  }
+}
+
+// }}}
+
 ClientConnectionHandler::ClientConnectionHandler(
-  HObject pipe, int clientId, session::SessionManager &sessionManager
+  HObject pipe, int clientId, ServerContext &context
 ) noexcept
   : EventOverlappedIO{true},
     _pipe{std::move(pipe)},
     _clientId{clientId},
-    _sessionManager{sessionManager},
+    _context{context},
     _callback{&Self::beginConnect}
 {
+  _traceTrack = static_cast<uint32_t>(clientId);
+  trace::nameTrack(_traceTrack, "Client " + std::to_string(clientId));
+}
+
+ClientConnectionHandler::~ClientConnectionHandler() {
+  endRequest();
+  if (_connected) {
+    _context.metrics.connectedClients->add(-1);
+  }
 }
 
 bool ClientConnectionHandler::reset() {
   EventOverlappedIO::reset();
 
   _userToken = nullptr;
+  _loadTestUser = false;
+  _username.clear();
+  _groups.reset();
+  _logonId.reset();
+  endRequest();
+  _admitted = false;
+  if (_connected) {
+    _context.metrics.connectedClients->add(-1);
+    _connected = false;
+  }
   if (!DisconnectNamedPipe(_pipe) &&
       GetLastError() != ERROR_PIPE_NOT_CONNECTED)
   {
@@ -32,7 +180,37 @@ bool ClientConnectionHandler::reset() {
   return true;
 }
 
+const char *ClientConnectionHandler::stateName() const {
+  if (auto name = ioStateName()) {
+    return name;
+  }
+  if (_callback == &Self::beginConnect) {
+    return "beginConnect";
+  } else if (_callback == &Self::endConnect) {
+    return "endConnect";
+  } else if (_callback == &Self::read) {
+    return "read";
+  } else if (_callback == &Self::respond) {
+    return "respond";
+  } else if (_callback == &Self::resetConnection) {
+    return "resetConnection";
+  } else if (_callback == &Self::connected) {
+    return "connected";
+  }
+  return "none";
+}
+
 EventStatus ClientConnectionHandler::operator()(EventListener &listener) {
+  _queueDelay = listener.queueDelay();
+  if (trace::enabled()) {
+    auto now = trace::now();
+    auto delay = static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(_queueDelay)
+        .count()
+    );
+    trace::record("queue", _traceTrack, now - std::min(now, delay), now);
+  }
+
   // First see if there is any overlapped IO to process.
   switch (EventOverlappedIO::operator()(listener)) {
     case EventStatus::Finished:
@@ -54,24 +232,35 @@ void ClientConnectionHandler::createResponse(const char *header,
                                              std::string_view message)
 {
   assert(strlen(header) == 4);
-  size_t totalSize = 4 + message.length();
-  if (_buffer.size() < totalSize) {
-    _buffer.resize(totalSize);
-  }
+  // The buffer still holds the request, which may be longer than this.
+  _buffer.resize(4 + message.length());
   std::memcpy(_buffer.data(), header, 4);
   if (message.length()) {
     std::memcpy(_buffer.data() + 4, message.data(), message.length());
   }
 }
 
+void ClientConnectionHandler::createBusyResponse(
+  std::chrono::milliseconds retryAfter
+)
+{
+  auto ms = static_cast<uint32_t>(retryAfter.count());
+  char message[sizeof(uint32_t)];
+  std::memcpy(message, &ms, sizeof(uint32_t));
+  createResponse(msg::server::Busy, std::string_view{message, sizeof(message)});
+}
+
 ClientConnectionHandler::Callback
 ClientConnectionHandler::beginConnect() {
+  _connectStart = trace::enabled() ? trace::now() : 0;
+  recorder::record(recorder::Kind::State, _traceTrack, "listen");
   if (ConnectNamedPipe(_pipe, &_overlapped)) {
     log::trace("Client {}: connected.", _clientId);
-    return read();
+    return connected();
   }
 
-  switch (GetLastError()) {
+  auto error = GetLastError();
+  switch (error) {
   case ERROR_IO_PENDING:
     log::trace("Client {}: waiting for connection.", _clientId);
     return &Self::endConnect;
@@ -79,8 +268,9 @@ ClientConnectionHandler::beginConnect() {
     log::trace("Client {}: already connected; reading.", _clientId);
     return endConnect();
   default:
+    recorder::record(recorder::Kind::Error, _traceTrack, "Connect", error);
     log::error("Client {}: ConnectNamedPipe failed: {}", _clientId,
-               lastErrorString());
+               lastErrorString(error));
     return nullptr;
   }
 }
@@ -91,19 +281,35 @@ ClientConnectionHandler::endConnect() {
   if (!GetOverlappedResult(_pipe, &_overlapped,
                            &dummyBytesTransferred, false))
   {
-    if (GetLastError() == ERROR_BROKEN_PIPE) {
+    auto error = GetLastError();
+    if (error == ERROR_BROKEN_PIPE) {
       log::info("Client {}: connection ended by client.", _clientId);
       return nullptr;
     }
+    recorder::record(recorder::Kind::Error, _traceTrack, "connect", error);
     log::error("Client {}: error finalizing connection: {}", _clientId,
-               lastErrorString());
+               lastErrorString(error));
     return nullptr;
   }
+  if (_connectStart) {
+    trace::record("connect", _traceTrack, _connectStart, trace::now());
+    _connectStart = 0;
+  }
+  return connected();
+}
+
+ClientConnectionHandler::Callback
+ClientConnectionHandler::connected() {
+  recorder::record(recorder::Kind::State, _traceTrack, "connect");
+  _connected = true;
+  _context.metrics.connectedClients->add(1);
   return read();
 }
 
 ClientConnectionHandler::Callback
 ClientConnectionHandler::read() {
+  // Any reply has been written by now.
+  endRequest();
   switch (readToBuffer()) {
     case EventStatus::Failed:
       return nullptr;
@@ -119,9 +325,22 @@ ClientConnectionHandler::read() {
 ClientConnectionHandler::Callback
 ClientConnectionHandler::respond() {
   Callback nextCb = &Self::resetConnection;
-  if (dispatchMessage()) {
-    nextCb = &Self::read;
+  if (admit()) {
+    auto type = ServerMetrics::messageType(std::string_view{
+      reinterpret_cast<const char *>(_buffer.data()), _buffer.size()
+    });
+    auto start = std::chrono::steady_clock::now();
+    if (dispatchMessage()) {
+      nextCb = &Self::read;
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    _context.admission.recordService(elapsed);
+    _context.metrics.messages[type]->add();
+    _context.metrics.messageLatency[type]->record(static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()
+    ));
   }
+  _context.publishStats();
 
   switch (writeFromBuffer()) {
     case EventStatus::Ok:
@@ -139,6 +358,7 @@ ClientConnectionHandler::respond() {
 
 ClientConnectionHandler::Callback
 ClientConnectionHandler::resetConnection() {
+  recorder::record(recorder::Kind::State, _traceTrack, "reset");
   if (!reset()) {
     log::error("Client {}: Reset failed.", _clientId);
     return nullptr;
@@ -146,17 +366,51 @@ ClientConnectionHandler::resetConnection() {
   return &Self::beginConnect;
 }
 
+bool ClientConnectionHandler::admit() {
+  // Only new clients are subject to admission; once in, a client is served
+  // until it disconnects. Either way, the request is counted until its reply
+  // is written.
+  if (_admitted) {
+    _context.admission.acquire();
+    _inFlight = true;
+    return true;
+  }
+  auto decision = _context.admission.admit(_queueDelay);
+  if (!decision) {
+    log::debug("Client {}: Server busy; retry in {} ms.", _clientId,
+               decision.retryAfter.count());
+    _context.metrics.busy->add();
+    // The request isn't read, but it may hold a password.
+    SecureZeroMemory(_buffer.data(), _buffer.size());
+    createBusyResponse(decision.retryAfter);
+    return false;
+  }
+  _admitted = true;
+  _inFlight = true;
+  return true;
+}
+
+void ClientConnectionHandler::endRequest() {
+  if (_inFlight) {
+    _context.admission.release();
+    _inFlight = false;
+  }
+}
+
 bool ClientConnectionHandler::dispatchMessage() {
+  trace::Span span{"dispatch", _traceTrack};
   if (_buffer.size() < 4) {
     log::warn("Client {}: No message header found.", _clientId);
     createResponse(msg::server::InvalidMessage, "No message header present");
     return false;
   }
 
+  _dispatchStart = std::chrono::steady_clock::now();
   char header[5];
   std::memcpy(header, _buffer.data(), 4);
   header[4] = 0;
   log::debug("Client {}: Dispatching message '{}'.", _clientId, header);
+  recorder::record(recorder::Kind::State, _traceTrack, header);
 
   // Check if the header is still the same on exit; that means we forgot
   // to set it.
@@ -199,24 +453,77 @@ bool ClientConnectionHandler::dispatchMessage() {
       }
       ++passwordEnd;
     }
-    _buffer.emplace_back(0);
-    return tryToLogonUser(reinterpret_cast<char *>(&*usernameBegin),
-                          reinterpret_cast<char *>(&*passwordBegin));
+    // Every response is written over the request, so move the password to
+    // secure memory and zero it here before anything can respond.
+    auto passwordOffset = static_cast<size_t>(passwordBegin - _buffer.begin());
+    auto passwordLength = static_cast<size_t>(passwordEnd - passwordBegin);
+    SecureBuffer<char> password{passwordLength};
+    password.append(
+      reinterpret_cast<const char *>(_buffer.data()) + passwordOffset,
+      passwordLength
+    );
+    SecureZeroMemory(_buffer.data() + passwordOffset, passwordLength);
+    return tryToLogonUser(std::string(usernameBegin, usernameEnd),
+                          password.view());
+  } else if (!std::memcmp(header, msg::client::Resume, 4)) {
+    return resumeSession(std::string_view{
+      reinterpret_cast<const char *>(_buffer.data()) + 4, _buffer.size() - 4
+    });
   } else if (!std::memcmp(header, msg::client::Bless, 4)) {
-    if (_buffer.size() != 4 + sizeof(HANDLE)) {
+    auto count = (_buffer.size() - 4) / sizeof(HANDLE);
+    if ((_buffer.size() - 4) % sizeof(HANDLE) != 0 || count == 0 ||
+        count > msg::MaxBlessTargets)
+    {
       log::warn("Client {}: Invalid bless message.", _clientId);
       createResponse(msg::server::InvalidMessage);
+      return false;
+    }
+    if (!authenticated()) {
+      log::error("Client {}: Not authenticated.", _clientId);
+      createResponse(msg::server::AccessDenied, "Not authenticated.");
+      return false;
+    }
+
+    HANDLE remoteHandles[msg::MaxBlessTargets];
+    std::memcpy(remoteHandles, _buffer.data() + 4, count * sizeof(HANDLE));
+    uint32_t statuses[msg::MaxBlessTargets];
+    if (!bless(remoteHandles, count, statuses)) {
+      return false;
+    }
+    createResponse(msg::server::Success, std::string_view{
+      reinterpret_cast<const char *>(statuses), count * sizeof(uint32_t)
+    });
+    // Keep the connection open; an agent may send more processes.
+    return true;
+  } else if (!std::memcmp(header, msg::client::Spawn, 4)) {
+    auto request = decodeSpawnRequest(std::string_view{
+      reinterpret_cast<const char *>(_buffer.data()) + 4, _buffer.size() - 4
+    });
+    if (!request) {
+      log::warn("Client {}: Invalid spawn message.", _clientId);
+      createResponse(msg::server::InvalidMessage);
+      return false;
+    }
+    if (!authenticated()) {
+      log::error("Client {}: Not authenticated.", _clientId);
+      createResponse(msg::server::AccessDenied, "Not authenticated.");
+      return false;
+    }
+    if (_context.loadTest) {
+      createResponse(msg::server::AccessDenied,
+                     "Spawning is disabled in load test mode.");
+      return true;
+    }
+    // Keep the connection open after a spawn, like after a bless.
+    return spawn(*request);
+  } else if (!std::memcmp(header, msg::client::QuerySession, 4)) {
+    // Tell the client whether it still needs to authenticate.
+    if (authenticated()) {
+      createResponse(msg::server::Success);
     } else {
-      HANDLE remoteHandle;
-      std::memcpy(&remoteHandle, _buffer.data() + 4, sizeof(HANDLE));
-      if (bless(remoteHandle)) {
-        createResponse(msg::server::Success);
-      } else {
-        createResponse(msg::server::InternalError,
-                       "Token substitution failed.");
-      }
+      createResponse(msg::server::AccessDenied, "Not authenticated.");
     }
-    return false;
+    return true;
   } else {
     log::warn("Client {}: Unknown message header (0x{:2X}_{:2X}_{:2X}_{:2X}).",
               _clientId, header[0], header[1], header[2], header[3]);
@@ -225,27 +532,229 @@ bool ClientConnectionHandler::dispatchMessage() {
   }
 }
 
-bool ClientConnectionHandler::tryToLogonUser(char *username, char *password) {
-  auto username_w = to_utf16(username);
-  auto password_w = to_utf16(password);
-  // Zero the password from memory.
-  while (*password) {
-    *password++ = 0;
+bool ClientConnectionHandler::authenticated() const {
+  return _userToken || _loadTestUser;
+}
+
+HObject ClientConnectionHandler::clientToken() {
+  if (!ImpersonateNamedPipeClient(_pipe)) {
+    log::warn("Client {}: Couldn't impersonate client: {}", _clientId,
+              lastErrorString());
+    return HObject{};
+  }
+  HObject token;
+  bool opened = OpenThreadToken(GetCurrentThread(), TOKEN_QUERY, true, &token);
+  auto error = GetLastError();
+  RevertToSelf();
+  if (!opened) {
+    log::warn("Client {}: Couldn't open client token: {}", _clientId,
+              lastErrorString(error));
   }
+  return token;
+}
 
-  auto session = _sessionManager.find(username_w);
-  if (!session) {
-    session = _sessionManager.create(username_w, L"", std::move(password_w));
-    if (!session) {
-      log::warn("Client {}: Access denied for user '{}'.", _clientId, username);
-      createResponse(msg::server::AccessDenied);
-      return false;
+std::optional<uint64_t> ClientConnectionHandler::peerKey() {
+  auto token = clientToken();
+  if (!token) {
+    return std::nullopt;
+  }
+
+  // TOKEN_USER is followed by the SID it points to.
+  alignas(TOKEN_USER) char buffer[sizeof(TOKEN_USER) + SECURITY_MAX_SID_SIZE];
+  DWORD length;
+  if (!GetTokenInformation(token, TokenUser, buffer, sizeof(buffer), &length)) {
+    log::warn("Client {}: Couldn't query client user: {}", _clientId,
+              lastErrorString());
+    return std::nullopt;
+  }
+  PSID sid = reinterpret_cast<TOKEN_USER *>(buffer)->User.Sid;
+  return _context.loginThrottle.hashPeer(sid, GetLengthSid(sid));
+}
+
+std::optional<uint64_t> ClientConnectionHandler::clientLogonId() {
+  if (_logonId) {
+    return _logonId;
+  }
+  auto token = clientToken();
+  if (!token) {
+    return std::nullopt;
+  }
+  _logonId = tokenLogonId(token);
+  if (!_logonId) {
+    log::warn("Client {}: Couldn't query client logon session: {}", _clientId,
+              lastErrorString());
+  }
+  return _logonId;
+}
+
+void ClientConnectionHandler::recordAudit(audit::Event event,
+                                          audit::Outcome outcome,
+                                          std::string_view username,
+                                          const Permission *permission)
+{
+  _context.metrics.decisions[static_cast<size_t>(event) - 1]
+                            [static_cast<size_t>(outcome) - 1]->add();
+
+  using namespace std::chrono;
+  audit::Record record{};
+  record.time = audit::AuditLog::now();
+  auto latency = duration_cast<microseconds>(steady_clock::now() -
+                                             _dispatchStart).count();
+  record.latency = static_cast<uint32_t>(
+    std::min<decltype(latency)>(latency, UINT32_MAX)
+  );
+  record.event = event;
+  record.outcome = outcome;
+  record.clientId = static_cast<uint32_t>(_clientId);
+  ULONG processId;
+  if (GetNamedPipeClientProcessId(_pipe, &processId)) {
+    record.processId = processId;
+  }
+  record.logonId = clientLogonId().value_or(0);
+  record.setUser(username);
+  if (permission) {
+    record.setImage(permission->image);
+    if (permission->digest) {
+      record.digest = *permission->digest;
     }
   }
+  _context.auditLog.append(record);
+}
+
+bool ClientConnectionHandler::tryToLogonUser(const std::string &username,
+                                             std::string_view password)
+{
+  // Failures are charged to the client's own identity, so one that can't be
+  // identified can't be throttled either.
+  auto peer = peerKey();
+  if (!peer) {
+    log::warn("Client {}: Login for user '{}' rejected: can't identify the "
+              "client.", _clientId, username);
+    recordAudit(audit::Event::Logon, audit::Outcome::Denied, username);
+    createResponse(msg::server::AccessDenied, "Couldn't identify client.");
+    return false;
+  }
+
+  // Reject without verifying anything if this client, this client's
+  // attempts at this user, or this exact credential has failed too many
+  // times recently. The same account spelled another way counts the same.
+  auto &throttle = _context.loginThrottle;
+  auto throttleName = normalizeUsername(
+    username, to_utf8(_context.sessionManager.localDomain())
+  );
+  auto userKey = throttle.hashUser(*peer, throttleName);
+  auto credentialKey = throttle.hashCredential(throttleName, password);
+  auto verdict = throttle.check(userKey, *peer, credentialKey);
+  if (verdict != LoginThrottle::Allowed) {
+    log::warn("Client {}: Login for user '{}' rejected: {}.", _clientId,
+              username, verdictToString(verdict));
+    recordAudit(audit::Event::Logon, audit::Outcome::Throttled, username);
+    createResponse(msg::server::AccessDenied,
+                   "Too many failed attempts; try again later.");
+    return false;
+  }
+
+  bool loggedOn;
+  // The account's own name, used for the policy, tickets and the audit log.
+  std::optional<std::string> account;
+  if (_context.loadTest) {
+    // The fake authenticator; it knows one password and no accounts.
+    loggedOn = password == LoadTestPassword;
+    account = throttleName;
+  } else {
+    // Always check the password, even if the user has a session already;
+    // this is what earns the client a ticket.
+    trace::Span span{"LogonUser", _traceTrack};
+    auto session = _context.sessionManager.create(
+      to_utf16(username), L"", securePassword(password).data()
+    );
+    loggedOn = !!session;
+    if (session) {
+      account = _context.sessionManager.accountName(session->token());
+    }
+  }
+  if (!loggedOn) {
+    recorder::record(recorder::Kind::Note, _traceTrack, "denied");
+    throttle.recordFailure(userKey, *peer, credentialKey);
+    log::warn("Client {}: Access denied for user '{}'.", _clientId, username);
+    recordAudit(audit::Event::Logon, audit::Outcome::Denied, username);
+    createResponse(msg::server::AccessDenied);
+    return false;
+  }
 
   // This response will be sent if there are any failures here.
   createResponse(msg::server::InternalError);
+  if (!account) {
+    log::error("Client {}: Couldn't get the account name for user '{}'.",
+               _clientId, username);
+    recordAudit(audit::Event::Logon, audit::Outcome::Failed, username);
+    return false;
+  }
+  if (!createUserToken()) {
+    recordAudit(audit::Event::Logon, audit::Outcome::Failed, *account);
+    return false;
+  }
+  setUser(std::move(*account));
+  recordAudit(audit::Event::Logon, audit::Outcome::Allowed, _username);
+
+  // Give the client a ticket so it can skip this step next time.
+  std::vector<char> ticket;
+  if (auto logonId = clientLogonId()) {
+    auto now = unixNow();
+    if (_context.ticketKeys.rotate(now) && !_context.ticketKeyPath.empty()) {
+      _context.ticketKeys.save(_context.ticketKeyPath);
+    }
+    ticket = issueTicket(
+      _context.ticketKeys,
+      TicketClaims{_username, *logonId, now + TicketLifetime.count()}
+    );
+  }
+
+  createResponse(msg::server::Success,
+                 std::string_view{ticket.data(), ticket.size()});
+  return true;
+}
+
+bool ClientConnectionHandler::resumeSession(std::string_view ticket) {
+  // On failure the client can still send credentials on this connection.
+  auto claims = openTicket(_context.ticketKeys, ticket, unixNow());
+  if (!claims) {
+    log::info("Client {}: Invalid or expired ticket.", _clientId);
+    recordAudit(audit::Event::Resume, audit::Outcome::Denied, {});
+    createResponse(msg::server::AccessDenied, "Invalid ticket.");
+    return true;
+  }
+  auto logonId = clientLogonId();
+  if (!logonId || *logonId != claims->logonId) {
+    log::warn("Client {}: Ticket for user '{}' presented from another logon "
+              "session.", _clientId, claims->username);
+    recordAudit(audit::Event::Resume, audit::Outcome::Denied,
+                claims->username);
+    createResponse(msg::server::AccessDenied, "Invalid ticket.");
+    return true;
+  }
+
+  createResponse(msg::server::InternalError);
+  if (!createUserToken()) {
+    recordAudit(audit::Event::Resume, audit::Outcome::Failed,
+                claims->username);
+    return false;
+  }
+  setUser(claims->username);
+  recordAudit(audit::Event::Resume, audit::Outcome::Allowed, _username);
+  log::info("Client {}: Resumed session for user '{}'.", _clientId,
+            claims->username);
+  createResponse(msg::server::Success);
+  return true;
+}
 
+bool ClientConnectionHandler::createUserToken() {
+  trace::Span span{"createUserToken", _traceTrack};
+  if (_context.loadTest) {
+    _loadTestUser = true;
+    log::info("Client {}: Authorized for load testing.", _clientId);
+    return true;
+  }
   HObject clientProcess;
   ULONG processId;
   if (!GetNamedPipeClientProcessId(_pipe, &processId)) {
@@ -256,6 +765,8 @@ bool ClientConnectionHandler::tryToLogonUser(char *username, char *password) {
   auto const access =
     PROCESS_DUP_HANDLE | PROCESS_VM_READ | PROCESS_QUERY_INFORMATION;
   if (!(clientProcess = OpenProcess(access, false, processId))) {
+    recorder::record(recorder::Kind::Error, _traceTrack, "OpenProc",
+                     GetLastError());
     log::error("Client {}: Couldn't open client process: {}", _clientId,
                lastErrorString());
     return false;
@@ -308,58 +819,382 @@ bool ClientConnectionHandler::tryToLogonUser(char *username, char *password) {
 
   _userToken = std::move(newToken);
   log::info("Client {}: Authorized; stored new token.", _clientId);
+  return true;
+}
 
-  createResponse(msg::server::Success);
+void ClientConnectionHandler::setUser(std::string username) {
+  // Groups are looked up when a policy first needs them, so a policy loaded
+  // after logon still sees them.
+  _groups.reset();
+  _username = std::move(username);
+}
+
+bool ClientConnectionHandler::permitted(const HANDLE *processes, size_t count,
+                                        Permission *permissions)
+{
+  trace::Span span{"policy", _traceTrack};
+  // Hold on to this policy even if it's replaced while we use it.
+  auto active = _context.policy.current();
+
+  std::vector<std::optional<ProcessCommand>> commands(count);
+  for (size_t i = 0; i < count; ++i) {
+    if (processes[i]) {
+      commands[i] = processCommand(processes[i], _clientId);
+    }
+    if (commands[i]) {
+      permissions[i].image = commands[i]->image;
+    }
+  }
+  if (!active) {
+    for (size_t i = 0; i < count; ++i) {
+      permissions[i].allowed = true;
+    }
+    return true;
+  }
+
+  // Without the user's groups, rules for a group, including ones that deny
+  // it, would be skipped. A failed lookup isn't kept on the connection, so
+  // the next request tries again once the resolver forgets it.
+  if (!_groups && !(_groups = _context.sessionManager.groups(_username))) {
+    log::error("Client {}: Couldn't resolve groups for user '{}'.",
+               _clientId, _username);
+    return false;
+  }
+
+  // Only hash programs when a rule needs their digest, and then hash them
+  // all together. Each is hashed through a handle to the file the process
+  // has mapped, not whatever is at its path now.
+  if (active->policy.usesDigests()) {
+    trace::Span digestSpan{"digest", _traceTrack};
+    std::vector<HObject> files;
+    std::vector<size_t> indexes;
+    for (size_t i = 0; i < count; ++i) {
+      if (commands[i]) {
+        files.push_back(openImageFile(processes[i], commands[i]->path,
+                                      _clientId));
+        indexes.push_back(i);
+      }
+    }
+    std::vector<HANDLE> handles(files.begin(), files.end());
+    auto computed = _context.digestCache.digests(handles);
+    for (size_t i = 0; i < indexes.size(); ++i) {
+      permissions[indexes[i]].digest = computed[i];
+    }
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    auto &digest = permissions[i].digest;
+    permissions[i].allowed =
+      commands[i] && decide(*active, *commands[i], digest ? &*digest : nullptr);
+  }
   return true;
 }
 
-bool ClientConnectionHandler::bless(HANDLE remoteHandle) {
+bool ClientConnectionHandler::decide(const ActivePolicy &active,
+                                     const ProcessCommand &command,
+                                     const policy::Digest *digest)
+{
+  // The same user tends to run the same commands over and over.
+  auto &cache = _context.decisionCache;
+  auto &groups = _groups->names();
+  auto key = cache.hash(_username, groups, command.image, command.arguments,
+                        digest);
+  policy::Decision decision{false, 0};
+  if (auto cached = cache.find(active.generation, key)) {
+    decision = *cached;
+  } else {
+    decision = active.policy.evaluate(_username, groups, command.image,
+                                      command.arguments, digest);
+    cache.insert(active.generation, key, decision);
+  }
+  if (decision) {
+    log::info("Client {}: Policy line {} allows '{}' for user '{}'.",
+              _clientId, decision.line, command.image, _username);
+  } else if (decision.line) {
+    log::warn("Client {}: Policy line {} denies '{}' for user '{}'.",
+              _clientId, decision.line, command.image, _username);
+  } else {
+    log::warn("Client {}: No policy rule allows '{}' for user '{}'.",
+              _clientId, command.image, _username);
+  }
+  return decision.allowed;
+}
+
+bool ClientConnectionHandler::bless(const HANDLE *remoteHandles, size_t count,
+                                    uint32_t *statuses)
+{
+  // Looked up once; ntdll stays loaded for the life of the process.
+  static const auto NtSetInformationProcess = LinkedModule{L"ntdll.dll"}
+    .get<nt::NtSetInformationProcess_t>("NtSetInformationProcess");
+
+  if (_context.loadTest) {
+    // The fake elevator: report success without opening anything.
+    for (size_t i = 0; i < count; ++i) {
+      statuses[i] = msg::BlessOk;
+      recordAudit(audit::Event::Bless, audit::Outcome::Allowed, _username);
+    }
+    return true;
+  }
+
+  // Every handle in the batch comes from the same client process.
   HObject clientProcess;
-  HObject localHandle;
   ULONG processId;
-  if (!_userToken) {
-    log::error("Client {}: Not authenticated.", _clientId);
+  {
+    trace::Span span{"OpenProcess", _traceTrack};
+    if (!GetNamedPipeClientProcessId(_pipe, &processId)) {
+      log::error("Client {}: Couldn't get client process ID: {}", _clientId,
+                 lastErrorString());
+      createResponse(msg::server::InternalError,
+                     "Couldn't open client process.");
+      return false;
+    }
+    auto const access = PROCESS_DUP_HANDLE | PROCESS_VM_READ;
+    if (!(clientProcess = OpenProcess(access, false, processId))) {
+      recorder::record(recorder::Kind::Error, _traceTrack, "OpenProc",
+                       GetLastError());
+      log::error("Client {}: Couldn't open client process: {}", _clientId,
+                 lastErrorString());
+      createResponse(msg::server::InternalError,
+                     "Couldn't open client process.");
+      return false;
+    }
+  }
+
+  // Check the whole batch against the policy first, so any digests it needs
+  // are computed together.
+  std::vector<HObject> localHandles(count);
+  for (size_t i = 0; i < count; ++i) {
+    trace::Span span{"DuplicateHandle", _traceTrack};
+    log::debug("Trying to duplicate remote handle 0x{:X}.",
+               reinterpret_cast<size_t>(remoteHandles[i]));
+    if (!DuplicateHandle(clientProcess, remoteHandles[i], GetCurrentProcess(),
+                         &localHandles[i],
+                         PROCESS_SET_INFORMATION |
+                           PROCESS_QUERY_LIMITED_INFORMATION,
+                         false, 0))
+    {
+      recorder::record(recorder::Kind::Error, _traceTrack, "DupHndl",
+                       GetLastError());
+      log::error("Client {}: Couldn't duplicate remote handle: {}", _clientId,
+                 lastErrorString());
+    }
+  }
+  std::vector<HANDLE> processes(localHandles.begin(), localHandles.end());
+  std::vector<Permission> permissions(count);
+  if (!permitted(processes.data(), count, permissions.data())) {
+    for (size_t i = 0; i < count; ++i) {
+      recordAudit(audit::Event::Bless, audit::Outcome::Failed, _username);
+    }
+    createResponse(msg::server::InternalError,
+                   "Couldn't resolve the user's groups.");
     return false;
   }
 
+  nt::PROCESS_ACCESS_TOKEN processAccessToken{_userToken, nullptr};
+  for (size_t i = 0; i < count; ++i) {
+    WSUDO_SCOPEEXIT_THIS {
+      recordAudit(audit::Event::Bless, blessOutcome(statuses[i]), _username,
+                  &permissions[i]);
+    };
+
+    if (!localHandles[i]) {
+      statuses[i] = msg::BlessBadHandle;
+      continue;
+    }
+
+    if (!permissions[i].allowed) {
+      statuses[i] = msg::BlessDenied;
+      continue;
+    }
+
+    trace::Span span{"NtSetInformationProcess", _traceTrack};
+    auto status = NtSetInformationProcess(localHandles[i],
+                                          nt::ProcessAccessToken,
+                                          &processAccessToken,
+                                          sizeof(nt::PROCESS_ACCESS_TOKEN));
+    if (!NT_SUCCESS(status)) {
+      recorder::record(recorder::Kind::Error, _traceTrack, "NtSetInf",
+                       static_cast<uint32_t>(status));
+      log::error("Client {}: Couldn't assign access token: {}", _clientId,
+                 lastErrorString());
+      statuses[i] = msg::BlessTokenFailed;
+      continue;
+    }
+    statuses[i] = msg::BlessOk;
+  }
+
+  log::info("Client {}: Adjusted {} remote process token(s).", _clientId,
+            std::count(statuses, statuses + count, msg::BlessOk));
+  return true;
+}
+
+bool ClientConnectionHandler::spawn(const SpawnRequest &request) {
+  createResponse(msg::server::InternalError, "Couldn't create process.");
+  auto outcome = audit::Outcome::Failed;
+  Permission permission;
+  WSUDO_SCOPEEXIT_THIS {
+    recordAudit(audit::Event::Spawn, outcome, _username, &permission);
+  };
+
+  ULONG processId;
   if (!GetNamedPipeClientProcessId(_pipe, &processId)) {
     log::error("Client {}: Couldn't get client process ID: {}", _clientId,
                lastErrorString());
     return false;
   }
-  auto const access = PROCESS_DUP_HANDLE | PROCESS_VM_READ;
-  if (!(clientProcess = OpenProcess(access, false, processId))) {
+  HObject clientProcess{OpenProcess(PROCESS_CREATE_PROCESS |
+                                      PROCESS_DUP_HANDLE,
+                                    false, processId)};
+  if (!clientProcess) {
+    recorder::record(recorder::Kind::Error, _traceTrack, "OpenProc",
+                     GetLastError());
     log::error("Client {}: Couldn't open client process: {}", _clientId,
                lastErrorString());
     return false;
   }
-  log::debug("Trying to duplicate remote handle 0x{:X}.",
-             reinterpret_cast<size_t>(remoteHandle));
-  if (!DuplicateHandle(clientProcess, remoteHandle, GetCurrentProcess(),
-                       &localHandle, PROCESS_SET_INFORMATION, false, 0))
+
+  // Put the process in the client's session so it can use its console. This
+  // needs SeTcbPrivilege, which the server has when run as a service.
+  HObject token;
+  if (!DuplicateTokenEx(_userToken, MAXIMUM_ALLOWED, nullptr,
+                        SecurityImpersonation, TokenPrimary, &token))
   {
-    log::error("Client {}: Couldn't duplicate remote handle: {}", _clientId,
+    log::error("Client {}: Couldn't duplicate token: {}", _clientId,
                lastErrorString());
     return false;
   }
+  DWORD sessionId;
+  if (ProcessIdToSessionId(processId, &sessionId) &&
+      !SetTokenInformation(token, TokenSessionId, &sessionId,
+                           sizeof(sessionId)))
+  {
+    log::warn("Client {}: Couldn't set token session: {}", _clientId,
+              lastErrorString());
+  }
 
-  auto ntdll = LinkedModule{L"ntdll.dll"};
-  auto NtSetInformationProcess =
-    ntdll.get<nt::NtSetInformationProcess_t>("NtSetInformationProcess");
+  // With a parent process attribute, inherited handles come from the parent,
+  // so the client's handle values are used as is. Only those are inherited.
+  HANDLE inherit[3];
+  size_t inheritCount = 0;
+  for (auto value : {request.input, request.output, request.error}) {
+    auto handle = reinterpret_cast<HANDLE>(static_cast<uintptr_t>(value));
+    if (handle && std::find(inherit, inherit + inheritCount, handle) ==
+                    inherit + inheritCount)
+    {
+      inherit[inheritCount++] = handle;
+    }
+  }
 
-  nt::PROCESS_ACCESS_TOKEN processAccessToken{_userToken, nullptr};
-  if (!NT_SUCCESS(NtSetInformationProcess(localHandle,
-                                          nt::ProcessAccessToken,
-                                          &processAccessToken,
-                                          sizeof(nt::PROCESS_ACCESS_TOKEN))))
+  SIZE_T attributeSize = 0;
+  InitializeProcThreadAttributeList(nullptr, 2, 0, &attributeSize);
+  std::vector<char> attributeBuffer(attributeSize);
+  auto attributes =
+    reinterpret_cast<LPPROC_THREAD_ATTRIBUTE_LIST>(attributeBuffer.data());
+  if (!InitializeProcThreadAttributeList(attributes, 2, 0, &attributeSize)) {
+    log::error("Client {}: Couldn't create attribute list: {}", _clientId,
+               lastErrorString());
+    return false;
+  }
+  WSUDO_SCOPEEXIT { DeleteProcThreadAttributeList(attributes); };
+  HANDLE parent = clientProcess;
+  if (!UpdateProcThreadAttribute(attributes, 0,
+                                 PROC_THREAD_ATTRIBUTE_PARENT_PROCESS,
+                                 &parent, sizeof(HANDLE), nullptr, nullptr) ||
+      (inheritCount > 0 &&
+       !UpdateProcThreadAttribute(attributes, 0,
+                                  PROC_THREAD_ATTRIBUTE_HANDLE_LIST, inherit,
+                                  inheritCount * sizeof(HANDLE), nullptr,
+                                  nullptr)))
   {
-    log::error("Client {}: Couldn't assign access token: {}", _clientId,
+    log::error("Client {}: Couldn't set process attributes: {}", _clientId,
                lastErrorString());
     return false;
   }
 
-  log::info("Client {}: Successfully adjusted remote process token.",
-            _clientId);
+  STARTUPINFOEXW si{};
+  si.StartupInfo.cb = sizeof(STARTUPINFOEXW);
+  si.StartupInfo.dwFlags = STARTF_USESTDHANDLES;
+  si.StartupInfo.hStdInput =
+    reinterpret_cast<HANDLE>(static_cast<uintptr_t>(request.input));
+  si.StartupInfo.hStdOutput =
+    reinterpret_cast<HANDLE>(static_cast<uintptr_t>(request.output));
+  si.StartupInfo.hStdError =
+    reinterpret_cast<HANDLE>(static_cast<uintptr_t>(request.error));
+  si.lpAttributeList = attributes;
+
+  // CreateProcessAsUser may modify the command line.
+  std::wstring commandLine{request.commandLine};
+  PROCESS_INFORMATION pi;
+  BOOL created;
+  {
+    trace::Span span{"CreateProcessAsUser", _traceTrack};
+    created = CreateProcessAsUserW(
+      token, nullptr, commandLine.data(), nullptr, nullptr, inheritCount > 0,
+      EXTENDED_STARTUPINFO_PRESENT | CREATE_UNICODE_ENVIRONMENT |
+        CREATE_SUSPENDED,
+      request.environment.empty()
+        ? nullptr
+        : const_cast<wchar_t *>(request.environment.data()),
+      request.currentDirectory.empty()
+        ? nullptr
+        : request.currentDirectory.c_str(),
+      &si.StartupInfo, &pi
+    );
+  }
+  if (!created) {
+    recorder::record(recorder::Kind::Error, _traceTrack, "CreatePr",
+                     GetLastError());
+    log::error("Client {}: Couldn't create process: {}", _clientId,
+               lastErrorString());
+    return false;
+  }
+  HObject process{pi.hProcess};
+  HObject thread{pi.hThread};
+
+  // The process is suspended, so it hasn't run yet if the policy says no.
+  // Checking the created process instead of the request means the path is
+  // the one Windows actually resolved, and any digest is of the file it
+  // mapped, which can't be written while it's mapped.
+  HANDLE processHandle = process;
+  if (!permitted(&processHandle, 1, &permission)) {
+    TerminateProcess(process, 1);
+    createResponse(msg::server::InternalError,
+                   "Couldn't resolve the user's groups.");
+    return false;
+  }
+  if (!permission.allowed) {
+    TerminateProcess(process, 1);
+    outcome = audit::Outcome::Denied;
+    createResponse(msg::server::AccessDenied, "Denied by policy.");
+    return true;
+  }
+
+  // The client only needs to wait on the process and get its exit code.
+  HANDLE clientHandle;
+  if (!DuplicateHandle(GetCurrentProcess(), process, clientProcess,
+                       &clientHandle,
+                       SYNCHRONIZE | PROCESS_QUERY_LIMITED_INFORMATION, false,
+                       0))
+  {
+    recorder::record(recorder::Kind::Error, _traceTrack, "DupHndl",
+                     GetLastError());
+    log::error("Client {}: Couldn't give process handle to client: {}",
+               _clientId, lastErrorString());
+    TerminateProcess(process, 1);
+    return false;
+  }
+  ResumeThread(thread);
+  outcome = audit::Outcome::Allowed;
+  recorder::record(recorder::Kind::Note, _traceTrack, "spawned", 0,
+                   pi.dwProcessId);
 
+  log::info("Client {}: Spawned process {}.", _clientId, pi.dwProcessId);
+  char response[sizeof(uint64_t) + sizeof(uint32_t)];
+  uint64_t handleValue = reinterpret_cast<uintptr_t>(clientHandle);
+  uint32_t pid = pi.dwProcessId;
+  std::memcpy(response, &handleValue, sizeof(uint64_t));
+  std::memcpy(response + sizeof(uint64_t), &pid, sizeof(uint32_t));
+  createResponse(msg::server::Success,
+                 std::string_view{response, sizeof(response)});
   return true;
 }
@@ -0,0 +1,104 @@
+#include "wsudo/decisioncache.h"
+
+#include <sodium.h>
+#include <cstring>
+
+using namespace wsudo;
+using namespace wsudo::server;
+
+// Helpers {{{
+
+namespace {
+  // Hash a field with its length, so fields can't run into each other.
+  void hashField(crypto_generichash_state &state, std::string_view field) {
+    auto length = static_cast<uint32_t>(field.length());
+    crypto_generichash_update(
+      &state, reinterpret_cast<const unsigned char *>(&length), sizeof(length)
+    );
+    crypto_generichash_update(
+      &state, reinterpret_cast<const unsigned char *>(field.data()),
+      field.length()
+    );
+  }
+}
+
+// }}}
+
+// {{{ DecisionCache
+
+DecisionCache::DecisionCache() noexcept {
+  static_assert(KeySize == crypto_generichash_KEYBYTES);
+  randombytes_buf(_key.data(), _key.size());
+}
+
+uint64_t DecisionCache::hash(std::string_view user,
+                             const std::vector<std::string> &groups,
+                             std::string_view command,
+                             std::string_view arguments,
+                             const policy::Digest *digest) const
+{
+  unsigned char out[crypto_generichash_BYTES_MIN];
+  crypto_generichash_state state;
+  crypto_generichash_init(&state, _key.data(), _key.size(), sizeof(out));
+  hashField(state, user);
+  auto groupCount = static_cast<uint32_t>(groups.size());
+  crypto_generichash_update(
+    &state, reinterpret_cast<const unsigned char *>(&groupCount),
+    sizeof(groupCount)
+  );
+  for (auto &group : groups) {
+    hashField(state, group);
+  }
+  hashField(state, command);
+  hashField(state, arguments);
+  if (digest) {
+    crypto_generichash_update(&state, digest->data(), digest->size());
+  }
+  crypto_generichash_final(&state, out, sizeof(out));
+  uint64_t result;
+  std::memcpy(&result, out, sizeof(result));
+  return result;
+}
+
+std::optional<policy::Decision>
+DecisionCache::find(uint64_t generation, uint64_t key) {
+  auto set = &_slots[(key & (Sets - 1)) * Ways];
+  for (size_t i = 0; i < Ways; ++i) {
+    if (set[i].generation == generation && set[i].key == key) {
+      set[i].referenced = true;
+      ++_stats.hits;
+      return policy::Decision{set[i].allowed, set[i].line};
+    }
+  }
+  ++_stats.misses;
+  return std::nullopt;
+}
+
+void DecisionCache::insert(uint64_t generation, uint64_t key,
+                           policy::Decision decision)
+{
+  auto setIndex = key & (Sets - 1);
+  auto set = &_slots[setIndex * Ways];
+
+  // Entries from an old generation are as good as empty.
+  Slot *victim = nullptr;
+  for (size_t i = 0; i < Ways; ++i) {
+    if (set[i].generation != generation || set[i].key == key) {
+      victim = &set[i];
+      break;
+    }
+  }
+  if (!victim) {
+    auto &hand = _hands[setIndex];
+    while (set[hand].referenced) {
+      set[hand].referenced = false;
+      hand = (hand + 1) % Ways;
+    }
+    victim = &set[hand];
+    hand = (hand + 1) % Ways;
+    ++_stats.evictions;
+  }
+  *victim = Slot{key, generation, decision.line, decision.allowed, false};
+}
+
+// }}} DecisionCache
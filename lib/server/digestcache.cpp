@@ -0,0 +1,207 @@
+#include "wsudo/digestcache.h"
+
+#include <bcrypt.h>
+#include <algorithm>
+#include <atomic>
+#include <system_error>
+#include <thread>
+
+#pragma comment(lib, "Bcrypt.lib")
+
+using namespace wsudo;
+using namespace wsudo::server;
+
+// Helpers {{{
+
+namespace {
+  // Largest view of a file mapped at once while hashing it.
+  constexpr uint64_t HashWindowSize = 64 * 1024 * 1024;
+
+  std::optional<FileIdentity> fileIdentity(HANDLE file) {
+    BY_HANDLE_FILE_INFORMATION info;
+    if (!GetFileInformationByHandle(file, &info)) {
+      return std::nullopt;
+    }
+    return FileIdentity{
+      static_cast<uint32_t>(info.dwVolumeSerialNumber),
+      static_cast<uint64_t>(info.nFileIndexHigh) << 32 | info.nFileIndexLow,
+      static_cast<uint64_t>(info.nFileSizeHigh) << 32 | info.nFileSizeLow,
+      static_cast<uint64_t>(info.ftLastWriteTime.dwHighDateTime) << 32 |
+        info.ftLastWriteTime.dwLowDateTime,
+    };
+  }
+
+  size_t setIndex(const FileIdentity &identity) {
+    auto mixed = (identity.fileIndex ^ identity.volumeSerial) *
+                 0x9E3779B97F4A7C15ull;
+    return static_cast<size_t>(mixed >> 32) & (DigestCache::Sets - 1);
+  }
+
+  BCRYPT_ALG_HANDLE sha256Algorithm() {
+    // Opened once and shared; algorithm handles are safe to use from any
+    // thread.
+    static const BCRYPT_ALG_HANDLE algorithm = [] {
+      BCRYPT_ALG_HANDLE handle;
+      if (!NT_SUCCESS(BCryptOpenAlgorithmProvider(
+            &handle, BCRYPT_SHA256_ALGORITHM, nullptr, 0)))
+      {
+        return BCRYPT_ALG_HANDLE{nullptr};
+      }
+      return handle;
+    }();
+    return algorithm;
+  }
+
+  // A file to hash.
+  struct ColdFile {
+    size_t index;
+    HANDLE file;
+    FileIdentity identity;
+    std::optional<policy::Digest> digest;
+  };
+}
+
+// }}}
+
+// {{{ DigestCache
+
+std::vector<std::optional<policy::Digest>>
+DigestCache::digests(const std::vector<HANDLE> &files) {
+  std::vector<std::optional<policy::Digest>> results(files.size());
+  std::vector<ColdFile> cold;
+
+  for (size_t i = 0; i < files.size(); ++i) {
+    if (!files[i]) {
+      ++_stats.failures;
+      continue;
+    }
+    auto identity = fileIdentity(files[i]);
+    if (!identity) {
+      ++_stats.failures;
+      continue;
+    }
+    if (auto slot = find(*identity)) {
+      ++_stats.hits;
+      slot->used = ++_clock;
+      results[i] = slot->digest;
+      continue;
+    }
+    ++_stats.misses;
+    cold.push_back(ColdFile{i, files[i], *identity, std::nullopt});
+  }
+
+  // Hashing is bound by reading the files, so hash them all at once and let
+  // the I/O overlap.
+  std::atomic<size_t> next{0};
+  auto work = [&] {
+    for (size_t i; (i = next.fetch_add(1)) < cold.size(); ) {
+      cold[i].digest = sha256File(cold[i].file, cold[i].identity.size);
+    }
+  };
+  auto threadCount = std::min<size_t>(
+    cold.size(), std::max(1u, std::thread::hardware_concurrency())
+  );
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < threadCount; ++i) {
+    try {
+      threads.emplace_back(work);
+    } catch (const std::system_error &) {
+      // The threads that did start, and this one, will do the rest.
+      break;
+    }
+  }
+  work();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  for (auto &file : cold) {
+    if (!file.digest) {
+      log::warn("Couldn't compute a program's digest.");
+      ++_stats.failures;
+      continue;
+    }
+    insert(file.identity, *file.digest);
+    results[file.index] = file.digest;
+  }
+  return results;
+}
+
+DigestCache::Slot *DigestCache::find(const FileIdentity &identity) {
+  auto set = &_slots[setIndex(identity) * Ways];
+  for (size_t i = 0; i < Ways; ++i) {
+    if (set[i].used && set[i].identity == identity) {
+      return &set[i];
+    }
+  }
+  return nullptr;
+}
+
+void DigestCache::insert(const FileIdentity &identity,
+                         const policy::Digest &digest)
+{
+  auto set = &_slots[setIndex(identity) * Ways];
+  auto victim = std::min_element(
+    set, set + Ways,
+    [](const Slot &a, const Slot &b) { return a.used < b.used; }
+  );
+  *victim = Slot{identity, digest, ++_clock};
+}
+
+// }}} DigestCache
+
+HObject wsudo::server::openProgramFile(const std::wstring &path) {
+  HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN,
+                            nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    return HObject{};
+  }
+  return HObject{file};
+}
+
+std::optional<policy::Digest>
+wsudo::server::sha256File(HANDLE file, uint64_t size) {
+  auto algorithm = sha256Algorithm();
+  BCRYPT_HASH_HANDLE hash;
+  if (!algorithm ||
+      !NT_SUCCESS(BCryptCreateHash(algorithm, &hash, nullptr, 0, nullptr, 0,
+                                   0)))
+  {
+    return std::nullopt;
+  }
+  WSUDO_SCOPEEXIT { BCryptDestroyHash(hash); };
+
+  // Empty files can't be mapped, and their digest is the empty digest.
+  if (size > 0) {
+    HObject mapping{CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0,
+                                       nullptr)};
+    if (!mapping) {
+      return std::nullopt;
+    }
+    for (uint64_t offset = 0; offset < size; offset += HashWindowSize) {
+      auto length = std::min(size - offset, HashWindowSize);
+      auto view = MapViewOfFile(mapping, FILE_MAP_READ,
+                                static_cast<DWORD>(offset >> 32),
+                                static_cast<DWORD>(offset),
+                                static_cast<SIZE_T>(length));
+      if (!view) {
+        return std::nullopt;
+      }
+      auto status = BCryptHashData(hash, static_cast<PUCHAR>(view),
+                                   static_cast<ULONG>(length), 0);
+      UnmapViewOfFile(view);
+      if (!NT_SUCCESS(status)) {
+        return std::nullopt;
+      }
+    }
+  }
+
+  policy::Digest digest;
+  if (!NT_SUCCESS(BCryptFinishHash(hash, digest.data(),
+                                   static_cast<ULONG>(digest.size()), 0)))
+  {
+    return std::nullopt;
+  }
+  return digest;
+}
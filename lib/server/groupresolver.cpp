@@ -0,0 +1,130 @@
+#include "wsudo/groupresolver.h"
+
+#include <algorithm>
+
+using namespace wsudo::session;
+
+// Helpers {{{
+
+namespace {
+  // Expired entries are swept when the cache grows past this many users.
+  constexpr size_t SweepThreshold = 1024;
+
+  std::string toLower(std::string_view s) {
+    std::string lower{s};
+    for (auto &c : lower) {
+      if (c >= 'A' && c <= 'Z') {
+        c = c - 'A' + 'a';
+      }
+    }
+    return lower;
+  }
+}
+
+// }}}
+
+// {{{ GroupSet
+
+GroupSet::GroupSet(std::vector<std::string> names)
+  : _names{std::move(names)}
+{
+  for (auto &name : _names) {
+    name = toLower(name);
+  }
+  std::sort(_names.begin(), _names.end());
+  _names.erase(std::unique(_names.begin(), _names.end()), _names.end());
+}
+
+bool GroupSet::contains(std::string_view name) const {
+  auto lower = toLower(name);
+  return std::binary_search(_names.begin(), _names.end(), lower);
+}
+
+bool GroupSet::intersects(const GroupSet &other) const {
+  auto a = _names.begin();
+  auto b = other._names.begin();
+  while (a != _names.end() && b != other._names.end()) {
+    if (*a < *b) {
+      ++a;
+    } else if (*b < *a) {
+      ++b;
+    } else {
+      return true;
+    }
+  }
+  return false;
+}
+
+// }}} GroupSet
+
+// {{{ GroupResolver
+
+GroupResolver::GroupResolver(Lookup lookup, GroupClock::duration ttl,
+                             GroupClock::duration negativeTtl) noexcept
+  : _lookup{std::move(lookup)},
+    _ttl{ttl},
+    _negativeTtl{negativeTtl}
+{
+}
+
+std::shared_ptr<const GroupSet>
+GroupResolver::resolve(std::string_view username, GroupClock::time_point now)
+{
+  auto key = toLower(username);
+  std::promise<Result> promise;
+  std::unique_lock<std::mutex> lock{_mutex};
+  auto entry = _entries.find(key);
+  if (entry != _entries.end() && now < entry->second.expires) {
+    ++_stats.hits;
+    return entry->second.groups;
+  }
+  auto flight = _inFlight.find(key);
+  if (flight != _inFlight.end()) {
+    // Someone else is already looking; wait for their answer.
+    ++_stats.hits;
+    auto future = flight->second;
+    lock.unlock();
+    return future.get();
+  }
+  ++_stats.misses;
+  _inFlight.emplace(key, promise.get_future().share());
+  lock.unlock();
+
+  std::optional<std::vector<std::string>> names;
+  try {
+    names = _lookup(std::string{username});
+  } catch (...) {
+    // Treated like any other failed lookup, so waiters aren't stranded.
+  }
+  Result groups;
+  if (names) {
+    groups = std::make_shared<const GroupSet>(std::move(*names));
+  }
+
+  lock.lock();
+  if (!names) {
+    ++_stats.failures;
+  }
+  if (_entries.size() >= SweepThreshold) {
+    for (auto it = _entries.begin(); it != _entries.end(); ) {
+      it = now < it->second.expires ? std::next(it) : _entries.erase(it);
+    }
+  }
+  _entries[key] = Entry{groups, now + (names ? _ttl : _negativeTtl)};
+  _inFlight.erase(key);
+  lock.unlock();
+  promise.set_value(groups);
+  return groups;
+}
+
+void GroupResolver::clear() {
+  std::lock_guard<std::mutex> lock{_mutex};
+  _entries.clear();
+}
+
+GroupResolver::Stats GroupResolver::stats() const {
+  std::lock_guard<std::mutex> lock{_mutex};
+  return _stats;
+}
+
+// }}} GroupResolver
@@ -1,9 +1,15 @@
 #include "wsudo/server.h"
+#include "wsudo/loadtest.h"
+#include "wsudo/asynclog.h"
+#include "wsudo/trace.h"
+#include "wsudo/flightdump.h"
 
-#include <spdlog/sinks/stdout_color_sinks.h>
 #include <fmt/format.h>
 #include <Psapi.h>
 #include <cstring>
+#include <cwchar>
+#include <filesystem>
+#include <fstream>
 #include <string>
 #include <iostream>
 #include <system_error>
@@ -12,15 +18,51 @@
 using namespace wsudo;
 
 static HANDLE gs_quitEventHandle = nullptr;
+static std::wstring gs_tracePath;
+static std::wstring gs_dumpDirectory;
+
+static void writeTrace() {
+  auto json = trace::exportJson(GetCurrentProcessId());
+  std::ofstream out{std::filesystem::path{gs_tracePath},
+                    std::ios::binary | std::ios::trunc};
+  out.write(json.data(), static_cast<std::streamsize>(json.size()));
+  if (!out.flush()) {
+    log::error(L"Couldn't write trace to '{}'.", gs_tracePath);
+    return;
+  }
+  auto stats = trace::stats();
+  log::info(L"Wrote trace to '{}' ({} spans, {} overwritten).", gs_tracePath,
+            stats.recorded - stats.overwritten, stats.overwritten);
+}
+
+static void writeFlightDump() {
+  auto path = recorder::newDumpPath(gs_dumpDirectory);
+  if (path.empty()) {
+    return;
+  }
+  if (!recorder::writeDump(path.c_str())) {
+    log::error(L"Couldn't write flight recorder dump to '{}'.", path);
+    return;
+  }
+  log::info(L"Wrote flight recorder dump to '{}'.", path);
+}
+
 BOOL WINAPI consoleControlHandler(DWORD event) {
+  // Ctrl-Break takes a flight recorder dump, and writes the trace if tracing
+  // is on, instead of quitting.
+  if (event == CTRL_BREAK_EVENT) {
+    writeFlightDump();
+    if (trace::enabled()) {
+      writeTrace();
+    }
+    return true;
+  }
+
   const char *eventName;
   switch (event) {
   case CTRL_C_EVENT:
     eventName = "Ctrl-C";
     break;
-  case CTRL_BREAK_EVENT:
-    eventName = "Ctrl-Break";
-    break;
   case CTRL_CLOSE_EVENT:
     eventName = "close";
     break;
@@ -46,9 +88,33 @@ BOOL WINAPI consoleControlHandler(DWORD event) {
 }
 
 int wmain(int argc, wchar_t *argv[]) {
-  log::g_outLogger = spdlog::stdout_color_mt("wsudo.out");
+  bool loadTest = false;
+  bool usage = false;
+  for (int i = 1; i < argc; ++i) {
+    if (!std::wcscmp(argv[i], L"--trace") && i + 1 < argc) {
+      gs_tracePath = argv[++i];
+    } else if (!std::wcscmp(argv[i], L"--load-test")) {
+      loadTest = true;
+    } else {
+      usage = true;
+    }
+  }
+  if (usage) {
+    log::eprint(
+      "Usage: TokenServer [--trace <file>] [--load-test]\n"
+      "  --trace <file>  Record request spans and write them to <file> as\n"
+      "                  Chrome trace events on Ctrl-Break and at exit.\n"
+      "  --load-test     Fake logons and elevation for wsudo-loadgen, on a\n"
+      "                  pipe of its own. Any user can log on with the load\n"
+      "                  test password.\n"
+      "Ctrl-Break also writes a flight recorder dump; read it with\n"
+      "wsudo-flight.\n"
+    );
+    return 1;
+  }
+
+  auto logWriter = log::startAsyncLogging(true);
   log::g_outLogger->set_level(spdlog::level::trace);
-  log::g_errLogger = spdlog::stderr_color_mt("wsudo.err");
   log::g_errLogger->set_level(spdlog::level::warn);
 #ifndef NDEBUG
   // Set a more compact, readable log format for debugging.
@@ -59,7 +125,10 @@ int wmain(int argc, wchar_t *argv[]) {
 #endif
 
   // VC++ deadlock bug
-  WSUDO_SCOPEEXIT { spdlog::drop_all(); };
+  WSUDO_SCOPEEXIT {
+    logWriter->stop();
+    spdlog::drop_all();
+  };
 
   HANDLE hStdin = GetStdHandle(STD_INPUT_HANDLE);
   HANDLE hStdout = GetStdHandle(STD_OUTPUT_HANDLE);
@@ -89,9 +158,27 @@ int wmain(int argc, wchar_t *argv[]) {
     SetConsoleMode(hStdout, stdoutMode);
   };
 
-  server::Config config{ PipeFullPath, &gs_quitEventHandle };
+  gs_dumpDirectory = recorder::defaultDumpDirectory();
+  recorder::installCrashHandler(gs_dumpDirectory);
+  log::info(L"Flight recorder dumps go to '{}'; press Ctrl-Break for one.",
+            gs_dumpDirectory);
+
+  if (!gs_tracePath.empty()) {
+    trace::enable();
+    log::info("Tracing requests; press Ctrl-Break to write the trace.");
+  }
+
+  server::Config config{ loadTest ? LoadTestPipeFullPath : PipeFullPath,
+                         &gs_quitEventHandle };
+  config.logWriter = logWriter;
+  config.dumpDirectory = gs_dumpDirectory;
+  config.loadTest = loadTest;
   std::thread serverThread{&server::serverMain, std::ref(config)};
   serverThread.join();
   log::info("Event loop returned {}.", server::statusToString(config.status));
+  if (trace::enabled()) {
+    trace::disable();
+    writeTrace();
+  }
   return 0;
 }
@@ -0,0 +1,698 @@
+#include "wsudo/policy.h"
+
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+#include <unordered_map>
+
+using namespace wsudo;
+using namespace wsudo::policy;
+
+// Helpers {{{
+
+namespace {
+  constexpr std::string_view Whitespace = " \t\r";
+
+  uint64_t fnv1a(std::string_view s) {
+    uint64_t hash = 0xCBF29CE484222325;
+    for (unsigned char c : s) {
+      hash ^= c;
+      hash *= 0x100000001B3;
+    }
+    return hash;
+  }
+
+  char toLower(char c) {
+    return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+  }
+
+  std::string_view trim(std::string_view s) {
+    auto begin = s.find_first_not_of(Whitespace);
+    if (begin == std::string_view::npos) {
+      return std::string_view{};
+    }
+    auto end = s.find_last_not_of(Whitespace);
+    return s.substr(begin, end - begin + 1);
+  }
+
+  bool isGlob(std::string_view segment) {
+    return segment.find_first_of("*?") != std::string_view::npos;
+  }
+
+  // Expects a normalized path.
+  bool isAbsolute(std::string_view path) {
+    if (path.size() >= 3 && path[0] >= 'a' && path[0] <= 'z' &&
+        path[1] == ':' && path[2] == '\\')
+    {
+      return true;
+    }
+    return path.size() > 2 && path[0] == '\\' && path[1] == '\\';
+  }
+
+  // Key in the principal table: "u:name", "g:name" or "*" for ALL.
+  std::string principalKey(char kind, std::string_view name) {
+    if (kind == '*') {
+      return std::string{"*"};
+    }
+    std::string key{kind};
+    key.push_back(':');
+    for (auto c : name) {
+      key.push_back(toLower(c));
+    }
+    return key;
+  }
+
+  struct ParsedRule {
+    std::vector<std::string> principals;
+    bool deny = false;
+    // Normalized path, or empty for ALL.
+    std::string command;
+    // False if the rule had an argument pattern or "".
+    bool anyArguments = true;
+    std::string arguments;
+    // Empty or a raw SHA-256 digest.
+    std::string digest;
+  };
+
+  int hexValue(char c) {
+    c = toLower(c);
+    if (c >= '0' && c <= '9') {
+      return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+      return c - 'a' + 10;
+    }
+    return -1;
+  }
+
+  std::optional<ParsedRule> parseRule(std::string_view line,
+                                      std::string &error)
+  {
+    auto equals = line.find('=');
+    if (equals == std::string_view::npos) {
+      error = "Expected '='.";
+      return std::nullopt;
+    }
+
+    ParsedRule rule;
+    auto who = line.substr(0, equals);
+    while (true) {
+      auto comma = who.find(',');
+      auto name = trim(who.substr(0, comma));
+      if (name.empty()) {
+        error = "Expected a user or group name.";
+        return std::nullopt;
+      }
+      if (name == "ALL") {
+        rule.principals.push_back(principalKey('*', name));
+      } else if (name[0] == '%') {
+        name = trim(name.substr(1));
+        if (name.empty()) {
+          error = "Expected a group name after '%'.";
+          return std::nullopt;
+        }
+        rule.principals.push_back(principalKey('g', name));
+      } else {
+        rule.principals.push_back(principalKey('u', name));
+      }
+      if (comma == std::string_view::npos) {
+        break;
+      }
+      who = who.substr(comma + 1);
+    }
+
+    auto rest = trim(line.substr(equals + 1));
+    constexpr std::string_view DigestPrefix = "sha256:";
+    if (rest.substr(0, DigestPrefix.size()) == DigestPrefix) {
+      auto space = rest.find_first_of(Whitespace);
+      auto hex = rest.substr(DigestPrefix.size(),
+                             space - DigestPrefix.size());
+      if (hex.size() != 2 * std::tuple_size_v<Digest>) {
+        error = "A SHA-256 digest must be 64 hex digits.";
+        return std::nullopt;
+      }
+      for (size_t i = 0; i < hex.size(); i += 2) {
+        auto high = hexValue(hex[i]);
+        auto low = hexValue(hex[i + 1]);
+        if (high < 0 || low < 0) {
+          error = "A SHA-256 digest must be 64 hex digits.";
+          return std::nullopt;
+        }
+        rule.digest.push_back(static_cast<char>(high << 4 | low));
+      }
+      rest = space == std::string_view::npos
+        ? std::string_view{}
+        : trim(rest.substr(space));
+    }
+    if (!rest.empty() && rest[0] == '!') {
+      rule.deny = true;
+      rest = trim(rest.substr(1));
+    }
+
+    std::string_view command;
+    if (!rest.empty() && rest[0] == '"') {
+      auto quote = rest.find('"', 1);
+      if (quote == std::string_view::npos) {
+        error = "Unterminated quote.";
+        return std::nullopt;
+      }
+      command = rest.substr(1, quote - 1);
+      rest = rest.substr(quote + 1);
+      if (!rest.empty() && Whitespace.find(rest[0]) == std::string_view::npos)
+      {
+        error = "Expected a space after the command.";
+        return std::nullopt;
+      }
+    } else {
+      auto space = rest.find_first_of(Whitespace);
+      command = rest.substr(0, space);
+      rest = space == std::string_view::npos
+        ? std::string_view{}
+        : rest.substr(space);
+    }
+    if (command.empty()) {
+      error = "Expected a command.";
+      return std::nullopt;
+    }
+
+    auto arguments = trim(rest);
+    if (command == "ALL") {
+      if (!arguments.empty()) {
+        error = "ALL doesn't take arguments.";
+        return std::nullopt;
+      }
+      return rule;
+    }
+
+    rule.command = normalizePath(command);
+    if (!isAbsolute(rule.command)) {
+      error = "Command must be an absolute path or ALL.";
+      return std::nullopt;
+    }
+    if (rule.command.back() == '\\') {
+      error = "Command must name a file.";
+      return std::nullopt;
+    }
+    if (auto globstar = rule.command.find("**");
+        globstar != std::string::npos &&
+        (globstar + 2 != rule.command.size() ||
+         rule.command[globstar - 1] != '\\'))
+    {
+      error = "'**' is only allowed as the last path segment.";
+      return std::nullopt;
+    }
+
+    if (arguments == "\"\"") {
+      rule.anyArguments = false;
+    } else if (!arguments.empty()) {
+      rule.anyArguments = false;
+      rule.arguments = arguments;
+    }
+    return rule;
+  }
+
+  // "WSPL"
+  constexpr uint32_t ImageMagic = 0x4C505357;
+
+  struct TableRef {
+    // Byte offset from the start of the image.
+    uint32_t offset;
+    // Number of entries.
+    uint32_t count;
+  };
+
+  // Image flags.
+  enum : uint32_t {
+    ImageUsesDigests = 1,
+  };
+
+  struct ImageHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t flags;
+    uint32_t reserved;
+    TableRef strings;
+    TableRef principals;
+    TableRef principalSlots;
+    TableRef nodes;
+    TableRef edges;
+    TableRef globs;
+    TableRef nodeRules;
+    TableRef rules;
+  };
+
+  template<typename T>
+  TableRef appendTable(std::vector<char> &image, const T *data,
+                       size_t count)
+  {
+    image.resize((image.size() + 7) & ~size_t{7});
+    TableRef ref{static_cast<uint32_t>(image.size()),
+                 static_cast<uint32_t>(count)};
+    image.insert(image.end(), reinterpret_cast<const char *>(data),
+                 reinterpret_cast<const char *>(data + count));
+    return ref;
+  }
+
+  template<typename Table>
+  bool getTable(const char *base, size_t size, TableRef ref, Table &table) {
+    using T = std::remove_cv_t<
+      std::remove_pointer_t<decltype(table.data)>
+    >;
+    if (ref.offset % alignof(T) != 0 || ref.offset > size ||
+        ref.count > (size - ref.offset) / sizeof(T))
+    {
+      return false;
+    }
+    table.data = reinterpret_cast<const T *>(base + ref.offset);
+    table.count = ref.count;
+    return true;
+  }
+
+  // Trie node used while compiling.
+  struct BuildNode {
+    std::unordered_map<std::string, uint32_t> literals;
+    std::vector<std::pair<std::string, uint32_t>> globs;
+    std::vector<uint32_t> rules;
+    std::vector<uint32_t> subtreeRules;
+  };
+}
+
+// }}}
+
+// {{{ Policy
+
+std::optional<Policy> Policy::compile(std::string_view text,
+                                      CompileError *error)
+{
+  auto image = compileImage(text, error);
+  if (!image) {
+    return std::nullopt;
+  }
+  auto owner = std::make_shared<std::vector<char>>(std::move(*image));
+  return load(std::shared_ptr<const void>{owner, owner->data()},
+              owner->size());
+}
+
+std::optional<std::vector<char>>
+Policy::compileImage(std::string_view text, CompileError *error) {
+  // The image is used as is on any compiler we build with.
+  static_assert(sizeof(ImageHeader) == 80 && sizeof(Principal) == 24 &&
+                sizeof(Node) == 32 && sizeof(Edge) == 24 &&
+                sizeof(Rule) == 24);
+
+  std::vector<BuildNode> nodes;
+  std::unordered_map<std::string, uint32_t> roots;
+  std::string strings;
+  std::unordered_map<std::string, StringRef> interned;
+  auto intern = [&](std::string_view s) {
+    auto [it, inserted] = interned.try_emplace(std::string{s});
+    if (inserted) {
+      it->second = StringRef{static_cast<uint32_t>(strings.size()),
+                             static_cast<uint32_t>(s.size())};
+      strings.append(s);
+    }
+    return it->second;
+  };
+  std::vector<Rule> rules;
+  uint32_t flags = 0;
+
+  uint32_t lineNumber = 0;
+  size_t lineStart = 0;
+  while (lineStart <= text.size()) {
+    auto lineEnd = text.find('\n', lineStart);
+    if (lineEnd == std::string_view::npos) {
+      lineEnd = text.size();
+    }
+    auto line = trim(text.substr(lineStart, lineEnd - lineStart));
+    lineStart = lineEnd + 1;
+    ++lineNumber;
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+
+    std::string message;
+    auto parsed = parseRule(line, message);
+    if (!parsed) {
+      if (error) {
+        *error = CompileError{lineNumber, std::move(message)};
+      }
+      return std::nullopt;
+    }
+
+    auto ruleIndex = static_cast<uint32_t>(rules.size());
+    Rule rule{lineNumber, parsed->deny, Arguments::Any, 0, StringRef{0, 0},
+              StringRef{0, 0}};
+    if (!parsed->anyArguments) {
+      rule.arguments =
+        parsed->arguments.empty() ? Arguments::None : Arguments::Pattern;
+      rule.pattern = intern(parsed->arguments);
+    }
+    if (!parsed->digest.empty()) {
+      rule.digest = intern(parsed->digest);
+      flags |= ImageUsesDigests;
+    }
+    rules.push_back(rule);
+
+    std::vector<std::string_view> segments;
+    std::string_view command{parsed->command};
+    while (!command.empty()) {
+      auto slash = command.find('\\');
+      segments.push_back(command.substr(0, slash));
+      command = slash == std::string_view::npos
+        ? std::string_view{}
+        : command.substr(slash + 1);
+    }
+    bool subtree = segments.empty() || segments.back() == "**";
+    if (subtree && !segments.empty()) {
+      segments.pop_back();
+    }
+
+    for (auto &key : parsed->principals) {
+      auto [root, inserted] =
+        roots.try_emplace(key, static_cast<uint32_t>(nodes.size()));
+      if (inserted) {
+        nodes.emplace_back();
+      }
+      auto node = root->second;
+      for (auto segment : segments) {
+        auto child = static_cast<uint32_t>(nodes.size());
+        if (isGlob(segment)) {
+          auto &globs = nodes[node].globs;
+          auto glob = std::find_if(globs.begin(), globs.end(),
+                                   [&](auto &g) { return g.first == segment; });
+          if (glob != globs.end()) {
+            node = glob->second;
+            continue;
+          }
+          globs.emplace_back(std::string{segment}, child);
+        } else {
+          auto [literal, added] =
+            nodes[node].literals.try_emplace(std::string{segment}, child);
+          if (!added) {
+            node = literal->second;
+            continue;
+          }
+        }
+        nodes.emplace_back();
+        node = child;
+      }
+      (subtree ? nodes[node].subtreeRules : nodes[node].rules)
+        .push_back(ruleIndex);
+    }
+  }
+
+  // Flatten the trie so each node's edges and rules are contiguous.
+  std::vector<Node> flatNodes(nodes.size());
+  std::vector<Edge> edges;
+  std::vector<Edge> globs;
+  std::vector<uint32_t> nodeRules;
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    auto &in = nodes[i];
+    auto &out = flatNodes[i];
+
+    out.firstEdge = static_cast<uint32_t>(edges.size());
+    for (auto &[segment, child] : in.literals) {
+      edges.push_back(Edge{fnv1a(segment), intern(segment), child, 0});
+    }
+    out.edgeCount = static_cast<uint32_t>(in.literals.size());
+    std::sort(edges.begin() + out.firstEdge, edges.end(),
+              [](const Edge &a, const Edge &b) { return a.hash < b.hash; });
+
+    out.firstGlob = static_cast<uint32_t>(globs.size());
+    for (auto &[segment, child] : in.globs) {
+      globs.push_back(Edge{fnv1a(segment), intern(segment), child, 0});
+    }
+    out.globCount = static_cast<uint32_t>(in.globs.size());
+
+    out.firstRule = static_cast<uint32_t>(nodeRules.size());
+    out.ruleCount = static_cast<uint32_t>(in.rules.size());
+    nodeRules.insert(nodeRules.end(), in.rules.begin(), in.rules.end());
+    out.firstSubtreeRule = static_cast<uint32_t>(nodeRules.size());
+    out.subtreeRuleCount = static_cast<uint32_t>(in.subtreeRules.size());
+    nodeRules.insert(nodeRules.end(), in.subtreeRules.begin(),
+                     in.subtreeRules.end());
+  }
+
+  // Keep the principal table at most half full.
+  size_t slotCount = 8;
+  while (slotCount < roots.size() * 2) {
+    slotCount *= 2;
+  }
+  std::vector<Principal> principals;
+  std::vector<uint32_t> principalSlots(slotCount, 0);
+  for (auto &[key, root] : roots) {
+    auto hash = fnv1a(key);
+    principals.push_back(Principal{hash, intern(key), root, 0});
+    auto slot = hash & (slotCount - 1);
+    while (principalSlots[slot]) {
+      slot = (slot + 1) & (slotCount - 1);
+    }
+    principalSlots[slot] = static_cast<uint32_t>(principals.size());
+  }
+
+  std::vector<char> image(sizeof(ImageHeader));
+  ImageHeader header{};
+  header.magic = ImageMagic;
+  header.version = ImageVersion;
+  header.flags = flags;
+  header.strings = appendTable(image, strings.data(), strings.size());
+  header.principals = appendTable(image, principals.data(), principals.size());
+  header.principalSlots =
+    appendTable(image, principalSlots.data(), principalSlots.size());
+  header.nodes = appendTable(image, flatNodes.data(), flatNodes.size());
+  header.edges = appendTable(image, edges.data(), edges.size());
+  header.globs = appendTable(image, globs.data(), globs.size());
+  header.nodeRules = appendTable(image, nodeRules.data(), nodeRules.size());
+  header.rules = appendTable(image, rules.data(), rules.size());
+  std::memcpy(image.data(), &header, sizeof(ImageHeader));
+  return image;
+}
+
+std::optional<Policy> Policy::load(std::shared_ptr<const void> image,
+                                   size_t size)
+{
+  if (size < sizeof(ImageHeader) || size > UINT32_MAX) {
+    return std::nullopt;
+  }
+  auto base = static_cast<const char *>(image.get());
+  ImageHeader header;
+  std::memcpy(&header, base, sizeof(ImageHeader));
+  if (header.magic != ImageMagic || header.version != ImageVersion) {
+    return std::nullopt;
+  }
+
+  Policy policy;
+  if (!getTable(base, size, header.strings, policy._strings) ||
+      !getTable(base, size, header.principals, policy._principals) ||
+      !getTable(base, size, header.principalSlots, policy._principalSlots) ||
+      !getTable(base, size, header.nodes, policy._nodes) ||
+      !getTable(base, size, header.edges, policy._edges) ||
+      !getTable(base, size, header.globs, policy._globs) ||
+      !getTable(base, size, header.nodeRules, policy._nodeRules) ||
+      !getTable(base, size, header.rules, policy._rules))
+  {
+    return std::nullopt;
+  }
+  auto slots = policy._principalSlots.count;
+  if (slots == 0 || (slots & (slots - 1)) != 0) {
+    return std::nullopt;
+  }
+  policy._usesDigests = (header.flags & ImageUsesDigests) != 0;
+  policy._image = std::move(image);
+  return policy;
+}
+
+Decision Policy::evaluate(std::string_view user,
+                          const std::vector<std::string> &groups,
+                          std::string_view command,
+                          std::string_view arguments,
+                          const Digest *digest) const
+{
+  Decision best{false, 0};
+  if (_principals.count == 0) {
+    return best;
+  }
+
+  auto path = normalizePath(command);
+  arguments = trim(arguments);
+  auto check = [&](char kind, std::string_view name) {
+    if (auto principal = findPrincipal(principalKey(kind, name))) {
+      walk(principal->root, path, arguments, digest, best);
+    }
+  };
+  check('*', std::string_view{});
+  check('u', user);
+  for (auto &group : groups) {
+    check('g', group);
+  }
+  return best;
+}
+
+const Policy::Principal *Policy::findPrincipal(std::string_view key) const {
+  auto hash = fnv1a(key);
+  auto mask = _principalSlots.count - 1;
+  auto slot = hash & mask;
+  for (uint32_t probes = 0; probes < _principalSlots.count; ++probes) {
+    auto index = _principalSlots.data[slot];
+    if (index == 0) {
+      break;
+    }
+    auto principal = _principals.at(index - 1);
+    if (principal && principal->hash == hash && str(principal->key) == key) {
+      return principal;
+    }
+    slot = (slot + 1) & mask;
+  }
+  return nullptr;
+}
+
+void Policy::walk(uint32_t root, std::string_view path,
+                  std::string_view arguments, const Digest *digest,
+                  Decision &best) const
+{
+  // Nodes reached by the segments so far. Globs can match alongside a
+  // literal, so there may be more than one.
+  std::vector<uint32_t> active{root};
+  std::vector<uint32_t> next;
+  size_t segmentStart = 0;
+  while (!active.empty()) {
+    auto segmentEnd = path.find('\\', segmentStart);
+    bool last = segmentEnd == std::string_view::npos;
+    auto segment = path.substr(segmentStart, segmentEnd - segmentStart);
+    auto hash = fnv1a(segment);
+
+    next.clear();
+    for (auto index : active) {
+      auto node = _nodes.at(index);
+      if (!node) {
+        continue;
+      }
+      // There is at least one more segment, so '**' rules here match.
+      consider(node->firstSubtreeRule, node->subtreeRuleCount, arguments,
+               digest, best);
+
+      if (node->firstEdge <= _edges.count &&
+          node->edgeCount <= _edges.count - node->firstEdge)
+      {
+        auto edgesBegin = _edges.data + node->firstEdge;
+        auto edgesEnd = edgesBegin + node->edgeCount;
+        auto edge = std::lower_bound(
+          edgesBegin, edgesEnd, hash,
+          [](const Edge &e, uint64_t h) { return e.hash < h; }
+        );
+        for (; edge != edgesEnd && edge->hash == hash; ++edge) {
+          if (str(edge->segment) == segment) {
+            next.push_back(edge->child);
+          }
+        }
+      }
+
+      if (node->firstGlob <= _globs.count &&
+          node->globCount <= _globs.count - node->firstGlob)
+      {
+        for (uint32_t i = 0; i < node->globCount; ++i) {
+          auto &glob = _globs.data[node->firstGlob + i];
+          if (globMatch(str(glob.segment), segment)) {
+            next.push_back(glob.child);
+          }
+        }
+      }
+    }
+
+    // A compiled trie never reaches a node twice, but a corrupt image could.
+    std::sort(next.begin(), next.end());
+    next.erase(std::unique(next.begin(), next.end()), next.end());
+
+    if (last) {
+      for (auto index : next) {
+        if (auto node = _nodes.at(index)) {
+          consider(node->firstRule, node->ruleCount, arguments, digest,
+                   best);
+        }
+      }
+      break;
+    }
+    active.swap(next);
+    segmentStart = segmentEnd + 1;
+  }
+}
+
+void Policy::consider(uint32_t firstRule, uint32_t count,
+                      std::string_view arguments, const Digest *digest,
+                      Decision &best) const
+{
+  if (firstRule > _nodeRules.count || count > _nodeRules.count - firstRule) {
+    return;
+  }
+  for (uint32_t i = firstRule; i < firstRule + count; ++i) {
+    auto rule = _rules.at(_nodeRules.data[i]);
+    // The last matching rule wins.
+    if (!rule || rule->line <= best.line) {
+      continue;
+    }
+    switch (rule->arguments) {
+      case Arguments::Any:
+        break;
+      case Arguments::None:
+        if (!arguments.empty()) {
+          continue;
+        }
+        break;
+      case Arguments::Pattern:
+        if (!globMatch(str(rule->pattern), arguments)) {
+          continue;
+        }
+        break;
+      default:
+        continue;
+    }
+    if (rule->digest.length != 0) {
+      auto expected = str(rule->digest);
+      if (!digest || expected.size() != digest->size() ||
+          std::memcmp(expected.data(), digest->data(), digest->size()) != 0)
+      {
+        continue;
+      }
+    }
+    best = Decision{!rule->deny, rule->line};
+  }
+}
+
+// }}} Policy
+
+bool wsudo::policy::globMatch(std::string_view pattern, std::string_view text)
+{
+  // Backtrack to the most recent '*' on a mismatch; earlier stars never need
+  // to be revisited, so this is O(pattern * text) at worst.
+  size_t p = 0;
+  size_t t = 0;
+  size_t starP = std::string_view::npos;
+  size_t starT = 0;
+  while (t < text.size()) {
+    if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == text[t])) {
+      ++p;
+      ++t;
+    } else if (p < pattern.size() && pattern[p] == '*') {
+      starP = p++;
+      starT = t;
+    } else if (starP != std::string_view::npos) {
+      p = starP + 1;
+      t = ++starT;
+    } else {
+      return false;
+    }
+  }
+  while (p < pattern.size() && pattern[p] == '*') {
+    ++p;
+  }
+  return p == pattern.size();
+}
+
+std::string wsudo::policy::normalizePath(std::string_view path) {
+  std::string normalized;
+  normalized.reserve(path.size());
+  for (auto c : path) {
+    normalized.push_back(c == '/' ? '\\' : toLower(c));
+  }
+  return normalized;
+}
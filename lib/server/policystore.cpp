@@ -0,0 +1,208 @@
+#include "wsudo/policystore.h"
+
+#include <ShlObj.h>
+
+#pragma comment(lib, "Shell32.lib")
+#pragma comment(lib, "Ole32.lib")
+
+using namespace wsudo;
+using namespace wsudo::server;
+using namespace wsudo::events;
+
+// Helpers {{{
+
+namespace {
+  // Largest policy source the server will compile.
+  constexpr LONGLONG MaxPolicySourceSize = 16 * 1024 * 1024;
+
+  bool fileExists(const std::wstring &path) {
+    return GetFileAttributesW(path.c_str()) != INVALID_FILE_ATTRIBUTES;
+  }
+
+  // Anyone who can change the policy can elevate anything, so it only counts
+  // if no one but SYSTEM and Administrators can.
+  bool checkAdminOnly(HANDLE file, const std::wstring &path) {
+    if (isAdminOnly(file)) {
+      return true;
+    }
+    log::error(L"'{}' must be owned by and only writable by SYSTEM or "
+               L"Administrators.", path);
+    return false;
+  }
+
+  bool checkAdminOnlyDirectory(const std::wstring &path) {
+    HANDLE directory = CreateFileW(path.c_str(), READ_CONTROL,
+                                   FILE_SHARE_READ | FILE_SHARE_WRITE |
+                                     FILE_SHARE_DELETE,
+                                   nullptr, OPEN_EXISTING,
+                                   FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+    if (directory == INVALID_HANDLE_VALUE) {
+      log::error(L"Couldn't open '{}': {}", path,
+                 to_utf16(lastErrorString()));
+      return false;
+    }
+    return checkAdminOnly(HObject{directory}, path);
+  }
+}
+
+// }}}
+
+// {{{ PolicyStore
+
+PolicyStore::PolicyStore(std::wstring directory) noexcept
+  : _directory{std::move(directory)}
+{
+}
+
+void PolicyStore::reload() {
+  auto imagePath = _directory + L"\\" + PolicyImageName;
+  auto sourcePath = _directory + L"\\" + PolicySourceName;
+  std::optional<policy::Policy> policy;
+  if (fileExists(_directory) && !checkAdminOnlyDirectory(_directory)) {
+    // Someone else could have replaced or removed the policy files.
+  } else if (fileExists(imagePath)) {
+    policy = loadImage(imagePath);
+  } else if (fileExists(sourcePath)) {
+    log::warn("No compiled policy; compiling the source. Use wsudo-policy to "
+              "compile it ahead of time.");
+    policy = loadSource(sourcePath);
+  } else {
+    log::warn("No policy file; any authenticated user may elevate any "
+              "program.");
+    std::atomic_store(&_policy, std::shared_ptr<const ActivePolicy>{});
+    return;
+  }
+
+  if (!policy) {
+    // Keep a working policy rather than replace it with a broken one, but
+    // never fall back to allowing everything.
+    if (current()) {
+      log::error("Keeping the previous policy.");
+      return;
+    }
+    log::error("Denying everything until the policy is fixed.");
+    policy.emplace();
+  }
+  auto active = std::make_shared<const ActivePolicy>(
+    ActivePolicy{std::move(*policy), ++_generation}
+  );
+  log::debug("Policy generation {} is active.", active->generation);
+  std::atomic_store(&_policy, std::move(active));
+}
+
+std::optional<policy::Policy>
+PolicyStore::loadImage(const std::wstring &path) {
+  // Share delete access so wsudo-policy can rename a new image over this one
+  // while it is mapped.
+  HANDLE rawFile = CreateFileW(path.c_str(), GENERIC_READ,
+                               FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+                               OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (rawFile == INVALID_HANDLE_VALUE) {
+    log::error("Couldn't open policy image: {}", lastErrorString());
+    return std::nullopt;
+  }
+  HObject file{rawFile};
+  if (!checkAdminOnly(file, path)) {
+    return std::nullopt;
+  }
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size) || size.QuadPart == 0 ||
+      size.QuadPart > UINT32_MAX)
+  {
+    log::error("Policy image is invalid.");
+    return std::nullopt;
+  }
+  HObject mapping{CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0,
+                                     nullptr)};
+  if (!mapping) {
+    log::error("Couldn't map policy image: {}", lastErrorString());
+    return std::nullopt;
+  }
+  // The view keeps the mapping alive after the handles are closed.
+  auto view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!view) {
+    log::error("Couldn't map policy image: {}", lastErrorString());
+    return std::nullopt;
+  }
+  std::shared_ptr<const void> image{view, [](const void *view) {
+    UnmapViewOfFile(view);
+  }};
+
+  auto policy = policy::Policy::load(std::move(image),
+                                     static_cast<size_t>(size.QuadPart));
+  if (!policy) {
+    log::error("Policy image is invalid or from another version; recompile "
+               "it with wsudo-policy.");
+    return std::nullopt;
+  }
+  log::info("Loaded policy image with {} rule(s).", policy->ruleCount());
+  return policy;
+}
+
+std::optional<policy::Policy>
+PolicyStore::loadSource(const std::wstring &path) {
+  HANDLE rawFile = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                               nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                               nullptr);
+  if (rawFile == INVALID_HANDLE_VALUE) {
+    log::error("Couldn't open policy file: {}", lastErrorString());
+    return std::nullopt;
+  }
+  HObject file{rawFile};
+  if (!checkAdminOnly(file, path)) {
+    return std::nullopt;
+  }
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size) || size.QuadPart > MaxPolicySourceSize) {
+    log::error("Policy file is too large.");
+    return std::nullopt;
+  }
+  std::string text(static_cast<size_t>(size.QuadPart), '\0');
+  DWORD bytesRead;
+  if (!ReadFile(file, text.data(), static_cast<DWORD>(text.size()),
+                &bytesRead, nullptr) || bytesRead != text.size())
+  {
+    log::error("Couldn't read policy file: {}", lastErrorString());
+    return std::nullopt;
+  }
+
+  policy::CompileError error;
+  auto policy = policy::Policy::compile(text, &error);
+  if (!policy) {
+    log::error("Policy line {}: {}", error.line, error.message);
+    return std::nullopt;
+  }
+  log::info("Loaded policy with {} rule(s).", policy->ruleCount());
+  return policy;
+}
+
+// }}} PolicyStore
+
+// {{{ PolicyWatcher
+
+EventStatus PolicyWatcher::operator()(EventListener &) {
+  log::info("Policy directory changed; reloading.");
+  _store.reload();
+  if (!FindNextChangeNotification(_notification)) {
+    log::error("Can't keep watching the policy directory: {}",
+               lastErrorString());
+    return EventStatus::Finished;
+  }
+  return EventStatus::Ok;
+}
+
+// }}} PolicyWatcher
+
+std::wstring wsudo::server::defaultPolicyDirectory() {
+  PWSTR programData;
+  if (!SUCCEEDED(SHGetKnownFolderPath(FOLDERID_ProgramData, 0, nullptr,
+                                      &programData)))
+  {
+    return std::wstring{};
+  }
+  std::wstring path{programData};
+  CoTaskMemFree(programData);
+  return path + L"\\wsudo";
+}
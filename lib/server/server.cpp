@@ -1,5 +1,11 @@
 #include "wsudo/server.h"
 #include "wsudo/session.h"
+#include "wsudo/auditstore.h"
+#include "wsudo/asynclog.h"
+#include "wsudo/securememory.h"
+#include "wsudo/threadstack.h"
+
+#include <sodium.h>
 
 #pragma comment(lib, "Advapi32.lib")
 
@@ -9,7 +15,98 @@ using namespace wsudo::server;
 void wsudo::server::serverMain(Config &config) {
   using namespace events;
 
-  session::SessionManager sessionManager{60 * 10};
+  if (sodium_init() < 0) {
+    log::critical("Couldn't initialize libsodium.");
+    config.status = StatusCryptoInitFailed;
+    return;
+  }
+
+  // A load test server shares nothing with a real one. Its ticket keys only
+  // live in memory, so its tickets are worthless to any other server, and
+  // nothing is audited.
+  std::unique_ptr<audit::Storage> auditStorage;
+  std::wstring ticketKeyPath;
+  if (config.loadTest) {
+    log::warn(L"Load test mode: any user can log on with the load test "
+              L"password on '{}', and nothing is elevated or audited. Don't "
+              L"use this server for anything else.", config.pipeName);
+  } else {
+    auto auditDirectory = defaultAuditDirectory();
+    if (auditDirectory.empty()) {
+      log::error("Can't find the audit directory; requests won't be "
+                 "audited.");
+    } else if (auto store = std::make_unique<AuditDirectory>(
+                 std::move(auditDirectory));
+               store->create())
+    {
+      auditStorage = std::move(store);
+    } else {
+      log::error("Requests won't be audited.");
+    }
+    ticketKeyPath = defaultTicketKeyPath();
+  }
+
+  // This is fairly large, so keep it off the stack.
+  auto context = std::make_unique<ServerContext>(60 * 10,
+                                                 std::move(ticketKeyPath),
+                                                 defaultPolicyDirectory(),
+                                                 std::move(auditStorage));
+  context->loadTest = config.loadTest;
+
+  // Reuse the ticket keys from the last run so clients' tickets stay valid.
+  if (!context->ticketKeyPath.empty()) {
+    context->ticketKeys.load(context->ticketKeyPath);
+  }
+  if (context->ticketKeys.rotate(unixNow()) &&
+      !context->ticketKeyPath.empty())
+  {
+    context->ticketKeys.save(context->ticketKeyPath);
+  }
+  context->policy.reload();
+
+  // Numbers from objects that are safe to read from the admin thread are
+  // taken when a snapshot is; the rest are published by the event loop.
+  auto &registry = context->metrics.registry;
+  auto &groupHits = registry.counterGauge("wsudo_group_cache_hits_total",
+                                          "Group membership cache hits.");
+  auto &groupMisses = registry.counterGauge(
+    "wsudo_group_cache_misses_total", "Group membership cache misses."
+  );
+  auto &secureBytes = registry.gauge(
+    "wsudo_secure_arena_bytes", "Bytes of the locked password arena in use."
+  );
+  auto &secureFallbacks = registry.counterGauge(
+    "wsudo_secure_arena_fallbacks_total",
+    "Secure allocations too large for the arena."
+  );
+  auto &auditRecords = registry.counterGauge("wsudo_audit_records_total",
+                                             "Audit records written.");
+  auto &auditDropped = registry.counterGauge(
+    "wsudo_audit_dropped_total", "Audit records dropped while backed up."
+  );
+  auto &traceSpans = registry.counterGauge("wsudo_trace_spans_total",
+                                           "Trace spans recorded.");
+  auto &logRecords = registry.counterGauge("wsudo_log_records_total",
+                                           "Log records queued.");
+  auto &logDropped = registry.counterGauge("wsudo_log_dropped_total",
+                                           "Log records dropped.");
+  registry.onSnapshot([&, logWriter = config.logWriter] {
+    auto groupStats = context->sessionManager.groupResolver().stats();
+    groupHits.set(static_cast<int64_t>(groupStats.hits));
+    groupMisses.set(static_cast<int64_t>(groupStats.misses));
+    auto arenaStats = SecureArena::global().stats();
+    secureBytes.set(static_cast<int64_t>(arenaStats.bytesInUse));
+    secureFallbacks.set(static_cast<int64_t>(arenaStats.fallbacks));
+    auto auditStats = context->auditLog.stats();
+    auditRecords.set(static_cast<int64_t>(auditStats.records));
+    auditDropped.set(static_cast<int64_t>(auditStats.dropped));
+    traceSpans.set(static_cast<int64_t>(trace::stats().recorded));
+    if (logWriter) {
+      auto logStats = logWriter->stats();
+      logRecords.set(static_cast<int64_t>(logStats.records));
+      logDropped.set(static_cast<int64_t>(logStats.dropped));
+    }
+  });
 
   NamedPipeHandleFactory pipeHandleFactory{config.pipeName.c_str()};
   if (!pipeHandleFactory) {
@@ -18,18 +115,77 @@ void wsudo::server::serverMain(Config &config) {
   }
 
   EventListener listener;
+  listener.setMetrics(context->metrics.loop);
+
+  // Report handlers that block the loop, with the loop thread's stack.
+  watchdog::Heartbeat heartbeat;
+  listener.setHeartbeat(&heartbeat);
+  watchdog::Options watchdogOptions;
+  watchdogOptions.stalls = context->metrics.stalls;
+  HObject loopThread;
+  if (DuplicateHandle(GetCurrentProcess(), GetCurrentThread(),
+                      GetCurrentProcess(), &loopThread,
+                      THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT |
+                        THREAD_QUERY_INFORMATION,
+                      false, 0))
+  {
+    watchdogOptions.sampleStack = [thread = static_cast<HANDLE>(loopThread)] {
+      return sampleThreadStack(thread);
+    };
+  }
+  watchdogOptions.log = [](const watchdog::Stall &stall, uint64_t suppressed) {
+    using namespace std::chrono;
+    auto ms = duration_cast<milliseconds>(stall.elapsed).count();
+    recorder::record(recorder::Kind::Note, static_cast<uint32_t>(stall.handler),
+                     "stall", 0, static_cast<uint32_t>(ms));
+    log::warn("Event loop stalled for {} ms in handler #{} ({}).{}{}", ms,
+              stall.handler, stall.state,
+              suppressed
+                ? fmt::format(" {} earlier stalls weren't logged.", suppressed)
+                : std::string{},
+              stall.stack.empty() ? std::string{} : "\n" + stall.stack);
+  };
+  watchdog::Watchdog watchdog{heartbeat, std::move(watchdogOptions)};
+
   *config.quitEvent = CreateEventW(nullptr, true, false, nullptr);
   listener.emplace(*config.quitEvent, [](EventListener &listener) {
     listener.stop();
     return EventStatus::Finished;
   });
 
+  // Pick up policy changes without a restart.
+  HANDLE policyNotification = FindFirstChangeNotificationW(
+    context->policy.directory().c_str(), false,
+    FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE
+  );
+  if (policyNotification != INVALID_HANDLE_VALUE) {
+    listener.emplace<PolicyWatcher>(context->policy, policyNotification);
+  } else {
+    log::warn("Can't watch the policy directory; changes need a restart: {}",
+              lastErrorString());
+  }
+
   for (int id = 1; id <= MaxPipeConnections; ++id) {
     listener.emplace<ClientConnectionHandler>(pipeHandleFactory(), id,
-                                              sessionManager);
+                                              *context);
+  }
+  context->metrics.pipeInstances->set(MaxPipeConnections);
+
+  EventStatus status;
+  {
+    AdminPipe adminPipe{registry, config.dumpDirectory};
+    watchdog.start();
+    status = listener.run();
+    watchdog.stop();
   }
 
-  EventStatus status = listener.run();
+  auto &cacheStats = context->decisionCache.stats();
+  log::info("Policy decision cache: {} hits, {} misses, {} evictions "
+            "({:.1f}% hit rate).", cacheStats.hits, cacheStats.misses,
+            cacheStats.evictions, cacheStats.hitRate() * 100);
+  auto &digestStats = context->digestCache.stats();
+  log::info("Digest cache: {} hits, {} misses, {} failures.",
+            digestStats.hits, digestStats.misses, digestStats.failures);
 
   if (status == EventStatus::Failed) {
     config.status = StatusEventFailed;
@@ -0,0 +1,124 @@
+#include "wsudo/server.h"
+
+#include <cstring>
+
+using namespace wsudo;
+using namespace wsudo::server;
+
+// Helpers {{{
+
+namespace {
+  constexpr const char *MessageNames[] = {
+    "credential", "resume", "bless", "spawn", "query", "invalid",
+  };
+  static_assert(std::size(MessageNames) == ServerMetrics::MessageTypes);
+}
+
+// }}}
+
+ServerMetrics::ServerMetrics() {
+  for (size_t i = 0; i < MessageTypes; ++i) {
+    metrics::Labels labels{{"type", MessageNames[i]}};
+    messages[i] = &registry.counter("wsudo_messages_total",
+                                    "Client messages received.", labels);
+    messageLatency[i] = &registry.histogram(
+      "wsudo_message_seconds", "Time to handle a client message.", labels
+    );
+  }
+  for (uint8_t e = 0; e < 4; ++e) {
+    for (uint8_t o = 0; o < 4; ++o) {
+      auto event = static_cast<audit::Event>(e + 1);
+      auto outcome = static_cast<audit::Outcome>(o + 1);
+      decisions[e][o] = &registry.counter(
+        "wsudo_decisions_total", "Audited requests, by event and outcome.",
+        {{"event", audit::eventToString(event)},
+         {"outcome", audit::outcomeToString(outcome)}}
+      );
+    }
+  }
+  busy = &registry.counter("wsudo_busy_total",
+                           "Clients turned away while overloaded.");
+  stalls = &registry.counter("wsudo_event_loop_stalls_total",
+                             "Handler calls that blocked the event loop.");
+
+  pipeInstances = &registry.gauge("wsudo_pipe_instances",
+                                  "Pipe instances waiting for clients.");
+  connectedClients = &registry.gauge("wsudo_connected_clients",
+                                     "Clients connected to the pipe.");
+  inFlight = &registry.gauge("wsudo_in_flight_requests",
+                             "Requests admitted and being served.");
+  sessions = &registry.gauge("wsudo_sessions", "Logon sessions kept.");
+
+  decisionCacheHits = &registry.counterGauge(
+    "wsudo_decision_cache_hits_total", "Policy decision cache hits."
+  );
+  decisionCacheMisses = &registry.counterGauge(
+    "wsudo_decision_cache_misses_total", "Policy decision cache misses."
+  );
+  decisionCacheEvictions = &registry.counterGauge(
+    "wsudo_decision_cache_evictions_total",
+    "Policy decisions evicted from the cache."
+  );
+  digestCacheHits = &registry.counterGauge(
+    "wsudo_digest_cache_hits_total", "Program digest cache hits."
+  );
+  digestCacheMisses = &registry.counterGauge(
+    "wsudo_digest_cache_misses_total", "Program digest cache misses."
+  );
+  digestCacheFailures = &registry.counterGauge(
+    "wsudo_digest_cache_failures_total", "Programs that couldn't be hashed."
+  );
+
+  loop.iterations = &registry.counter("wsudo_event_loop_iterations_total",
+                                      "Event loop iterations.");
+  loop.queueDelay = &registry.histogram(
+    "wsudo_event_queue_delay_seconds",
+    "How long signaled events waited to be handled."
+  );
+  loop.backlog = &registry.gauge(
+    "wsudo_event_backlog",
+    "Events handled since the event loop last found none ready."
+  );
+  loop.handlers = &registry.gauge("wsudo_event_handlers",
+                                  "Handlers in the event loop.");
+}
+
+ServerMetrics::Message ServerMetrics::messageType(std::string_view header) {
+  if (header.size() < 4) {
+    return Invalid;
+  }
+  auto data = header.data();
+  if (!std::memcmp(data, msg::client::Credential, 4)) {
+    return Credential;
+  } else if (!std::memcmp(data, msg::client::Resume, 4)) {
+    return Resume;
+  } else if (!std::memcmp(data, msg::client::Bless, 4)) {
+    return Bless;
+  } else if (!std::memcmp(data, msg::client::Spawn, 4)) {
+    return Spawn;
+  } else if (!std::memcmp(data, msg::client::QuerySession, 4)) {
+    return Query;
+  }
+  return Invalid;
+}
+
+void ServerContext::publishStats() {
+  metrics.inFlight->set(admission.inFlight());
+  metrics.sessions->set(static_cast<int64_t>(sessionManager.count()));
+
+  auto &decisionStats = decisionCache.stats();
+  metrics.decisionCacheHits->set(static_cast<int64_t>(decisionStats.hits));
+  metrics.decisionCacheMisses->set(
+    static_cast<int64_t>(decisionStats.misses)
+  );
+  metrics.decisionCacheEvictions->set(
+    static_cast<int64_t>(decisionStats.evictions)
+  );
+
+  auto &digestStats = digestCache.stats();
+  metrics.digestCacheHits->set(static_cast<int64_t>(digestStats.hits));
+  metrics.digestCacheMisses->set(static_cast<int64_t>(digestStats.misses));
+  metrics.digestCacheFailures->set(
+    static_cast<int64_t>(digestStats.failures)
+  );
+}
@@ -1,16 +1,50 @@
 #define WSUDO_NO_NT_API
 #include "wsudo/session.h"
 #include <NTSecAPI.h>
+#include <LM.h>
 #include <cstdlib>
 
+#pragma comment(lib, "Netapi32.lib")
+
 #define NT_SUCCESS(status) ((long)(status) >= 0)
 
 using namespace wsudo;
 using namespace wsudo::session;
 
+// Helpers {{{
+
+namespace {
+  // Local groups the user belongs to, directly or through a global group.
+  std::optional<std::vector<std::string>>
+  localGroups(const std::string &username) {
+    LOCALGROUP_USERS_INFO_0 *info;
+    DWORD entriesRead;
+    DWORD totalEntries;
+    auto status = NetUserGetLocalGroups(
+      nullptr, to_utf16(username).c_str(), 0, LG_INCLUDE_INDIRECT,
+      reinterpret_cast<LPBYTE *>(&info), MAX_PREFERRED_LENGTH, &entriesRead,
+      &totalEntries
+    );
+    if (status != NERR_Success) {
+      log::warn("Couldn't get groups for user '{}': {}", username,
+                lastErrorString(status));
+      return std::nullopt;
+    }
+    WSUDO_SCOPEEXIT { NetApiBufferFree(info); };
+    std::vector<std::string> groups;
+    for (DWORD i = 0; i < entriesRead; ++i) {
+      groups.push_back(to_utf8(info[i].lgrui0_name));
+    }
+    return groups;
+  }
+}
+
+// }}}
+
 SessionManager::SessionManager(unsigned defaultTtlSeconds) noexcept
   : _defaultTtlSeconds{defaultTtlSeconds},
-    _timer{CreateWaitableTimerW(nullptr, false, nullptr)}
+    _timer{CreateWaitableTimerW(nullptr, false, nullptr)},
+    _groupResolver{localGroups}
 {
   NTSTATUS status;
   LSA_OBJECT_ATTRIBUTES attr{{}};
@@ -41,6 +75,39 @@ SessionManager::SessionManager(unsigned defaultTtlSeconds) noexcept
             _localDomain);
 }
 
+std::optional<std::string> SessionManager::accountName(HANDLE token) const {
+  // TOKEN_USER is followed by the SID it points to.
+  alignas(TOKEN_USER) char buffer[sizeof(TOKEN_USER) + SECURITY_MAX_SID_SIZE];
+  DWORD length;
+  if (!GetTokenInformation(token, TokenUser, buffer, sizeof(buffer), &length)) {
+    log::warn("Couldn't query token user: {}", lastErrorString());
+    return std::nullopt;
+  }
+  wchar_t name[UNLEN + 1];
+  DWORD nameLength = UNLEN + 1;
+  wchar_t domain[MAX_PATH];
+  DWORD domainLength = MAX_PATH;
+  PSID sid = reinterpret_cast<TOKEN_USER *>(buffer)->User.Sid;
+  SID_NAME_USE use;
+  if (!LookupAccountSidW(nullptr, sid, name, &nameLength, domain,
+                         &domainLength, &use))
+  {
+    log::warn("Couldn't look up token user: {}", lastErrorString());
+    return std::nullopt;
+  }
+  if (CompareStringOrdinal(domain, static_cast<int>(domainLength),
+                           _localDomain.c_str(),
+                           static_cast<int>(_localDomain.length()),
+                           true) == CSTR_EQUAL)
+  {
+    return to_utf8(std::wstring_view{name, nameLength});
+  }
+  std::wstring account{domain, domainLength};
+  account.push_back(L'\\');
+  account.append(name, nameLength);
+  return to_utf8(account);
+}
+
 std::shared_ptr<Session> SessionManager::find(std::wstring_view username,
                                               std::wstring_view domain)
 {
@@ -61,13 +128,12 @@ std::shared_ptr<Session> SessionManager::store(Session &&session) {
     return std::shared_ptr<Session>{};
   }
   log::debug(L"Session username: {}.", name);
-  auto [it, inserted] = _sessions.try_emplace(
-    name, std::make_shared<Session>(std::move(session))
-  );
-  if (!inserted) {
-    log::warn(L"Session already exists for '{}'.", name);
-  }
-  return it->second;
+  // A new logon replaces the user's old session. Each key points into its
+  // session's own name, so the old entry goes before the new one is added.
+  auto stored = std::make_shared<Session>(std::move(session));
+  _sessions.erase(stored->username());
+  _sessions.emplace(stored->username(), stored);
+  return stored;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -75,7 +141,7 @@ std::shared_ptr<Session> SessionManager::store(Session &&session) {
 ////////////////////////////////////////////////////////////////////////////////
 
 Session::Session(const SessionManager &, std::wstring_view username,
-                 std::wstring_view domain, std::wstring &&password,
+                 std::wstring_view domain, const wchar_t *password,
                  unsigned ttlSeconds) noexcept
   : _username{username},
     _domain{domain},
@@ -85,7 +151,7 @@ Session::Session(const SessionManager &, std::wstring_view username,
   PVOID pProfileBuffer;
   DWORD profileLength;
   QUOTA_LIMITS quotaLimits;
-  if (!LogonUserExW(_username.c_str(), _domain.c_str(), password.c_str(),
+  if (!LogonUserExW(_username.c_str(), _domain.c_str(), password,
                     LOGON32_LOGON_NETWORK, LOGON32_PROVIDER_DEFAULT,
                     &_token, &_pSid, &pProfileBuffer, &profileLength,
                     &quotaLimits))
@@ -97,8 +163,8 @@ Session::Session(const SessionManager &, std::wstring_view username,
 }
 
 Session::Session(const SessionManager &manager, std::wstring_view username,
-                 std::wstring_view domain, std::wstring &&password) noexcept
-  : Session(manager, username, domain, std::move(password),
+                 std::wstring_view domain, const wchar_t *password) noexcept
+  : Session(manager, username, domain, password,
             manager.defaultTtlSeconds())
 {
 }
@@ -0,0 +1,294 @@
+#include "wsudo/throttle.h"
+
+#include <sodium.h>
+#include <algorithm>
+#include <cstring>
+
+using namespace wsudo;
+using namespace wsudo::server;
+
+// Helpers {{{
+
+static inline int64_t toMs(ThrottleClock::time_point time) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+    time.time_since_epoch()
+  ).count();
+}
+
+// Zero marks an empty slot, so keys are never allowed to be zero.
+static inline uint64_t nonzeroKey(uint64_t key) {
+  return key ? key : 1;
+}
+
+static inline char asciiLower(char c) {
+  return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+static bool equalsIgnoreCase(std::string_view a, std::string_view b) {
+  return a.length() == b.length() &&
+         std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+           return asciiLower(x) == asciiLower(y);
+         });
+}
+
+template<typename Slot, size_t Sets, size_t Ways>
+static inline Slot *setFor(std::array<Slot, Sets * Ways> &slots, uint64_t key) {
+  return &slots[(key & (Sets - 1)) * Ways];
+}
+
+template<typename Slot, size_t Sets, size_t Ways>
+static inline const Slot *setFor(const std::array<Slot, Sets * Ways> &slots,
+                                 uint64_t key)
+{
+  return &slots[(key & (Sets - 1)) * Ways];
+}
+
+// }}}
+
+std::string wsudo::server::normalizeUsername(std::string_view username,
+                                             std::string_view localDomain)
+{
+  if (auto slash = username.find('\\'); slash != std::string_view::npos) {
+    auto domain = username.substr(0, slash);
+    if (domain == "." || equalsIgnoreCase(domain, localDomain)) {
+      username.remove_prefix(slash + 1);
+    }
+  } else if (auto at = username.rfind('@'); at != std::string_view::npos) {
+    if (equalsIgnoreCase(username.substr(at + 1), localDomain)) {
+      username.remove_suffix(username.length() - at);
+    }
+  }
+  std::string name{username};
+  std::transform(name.begin(), name.end(), name.begin(), asciiLower);
+  return name;
+}
+
+// {{{ TokenBucketTable
+
+TokenBucketTable::TokenBucketTable(unsigned burst,
+                                   std::chrono::milliseconds refillInterval)
+                                   noexcept
+  : _burst{std::max(burst, 1u)},
+    _refillMs{std::max<int64_t>(refillInterval.count(), 1)}
+{
+}
+
+uint32_t TokenBucketTable::refilled(const Slot &slot, int64_t nowMs) const {
+  int64_t elapsed = std::max<int64_t>(nowMs - slot.updatedMs, 0);
+  int64_t tokens = slot.milliTokens + elapsed * 1000 / _refillMs;
+  return static_cast<uint32_t>(std::min<int64_t>(tokens, capacity()));
+}
+
+bool TokenBucketTable::allowed(uint64_t key,
+                               ThrottleClock::time_point now) const
+{
+  key = nonzeroKey(key);
+  auto set = setFor<Slot, Sets, Ways>(_slots, key);
+  for (size_t i = 0; i < Ways; ++i) {
+    if (set[i].key == key) {
+      return refilled(set[i], toMs(now)) >= 1000;
+    }
+  }
+  // No bucket means a full bucket.
+  return true;
+}
+
+bool TokenBucketTable::consume(uint64_t key, ThrottleClock::time_point now) {
+  key = nonzeroKey(key);
+  auto nowMs = toMs(now);
+  auto set = setFor<Slot, Sets, Ways>(_slots, key);
+
+  Slot *slot = nullptr;
+  Slot *victim = &set[0];
+  for (size_t i = 0; i < Ways; ++i) {
+    if (set[i].key == key) {
+      slot = &set[i];
+      break;
+    }
+    if (!set[i].key) {
+      victim = &set[i];
+    } else if (victim->key && set[i].updatedMs < victim->updatedMs) {
+      victim = &set[i];
+    }
+  }
+
+  if (!slot) {
+    slot = victim;
+    slot->key = key;
+    slot->milliTokens = capacity();
+    slot->updatedMs = nowMs;
+  }
+
+  auto tokens = refilled(*slot, nowMs);
+  slot->updatedMs = nowMs;
+  if (tokens < 1000) {
+    slot->milliTokens = tokens;
+    return false;
+  }
+  slot->milliTokens = tokens - 1000;
+  return true;
+}
+
+// }}} TokenBucketTable
+
+// {{{ NegativeCache
+
+NegativeCache::NegativeCache(std::chrono::milliseconds ttl) noexcept
+  : _ttlMs{ttl.count()}
+{
+}
+
+bool NegativeCache::contains(uint64_t key,
+                             ThrottleClock::time_point now) const
+{
+  key = nonzeroKey(key);
+  auto nowMs = toMs(now);
+  auto set = setFor<Slot, Sets, Ways>(_slots, key);
+  for (size_t i = 0; i < Ways; ++i) {
+    if (set[i].key == key) {
+      return set[i].expiresMs > nowMs;
+    }
+  }
+  return false;
+}
+
+void NegativeCache::insert(uint64_t key, ThrottleClock::time_point now) {
+  key = nonzeroKey(key);
+  auto set = setFor<Slot, Sets, Ways>(_slots, key);
+  Slot *victim = &set[0];
+  for (size_t i = 0; i < Ways; ++i) {
+    if (set[i].key == key) {
+      victim = &set[i];
+      break;
+    }
+    if (set[i].expiresMs < victim->expiresMs) {
+      victim = &set[i];
+    }
+  }
+  victim->key = key;
+  victim->expiresMs = toMs(now) + _ttlMs;
+}
+
+// }}} NegativeCache
+
+// {{{ LoginThrottle
+
+namespace {
+  // Failed attempts allowed in a burst before throttling kicks in.
+  constexpr unsigned UserBurst = 5;
+  constexpr unsigned PeerBurst = 10;
+  // Time to regain one attempt after the burst is used up.
+  constexpr std::chrono::seconds UserRefill{6};
+  constexpr std::chrono::seconds PeerRefill{3};
+  // How long a failed credential is rejected without being checked again.
+  constexpr std::chrono::seconds FailureTtl{30};
+
+  // Hash domains, so the same bytes hash differently for each key type.
+  enum : uint8_t {
+    DomainUser = 1,
+    DomainPeer,
+    DomainCredential,
+  };
+}
+
+LoginThrottle::LoginThrottle() noexcept
+  : _users{UserBurst, UserRefill},
+    _peers{PeerBurst, PeerRefill},
+    _failures{FailureTtl}
+{
+  static_assert(KeySize == crypto_generichash_KEYBYTES);
+  randombytes_buf(_key.data(), _key.size());
+}
+
+uint64_t LoginThrottle::hash(const void *data, size_t length,
+                             uint8_t domain) const
+{
+  unsigned char out[crypto_generichash_BYTES_MIN];
+  crypto_generichash_state state;
+  crypto_generichash_init(&state, _key.data(), _key.size(), sizeof(out));
+  crypto_generichash_update(&state, &domain, 1);
+  crypto_generichash_update(&state,
+                            static_cast<const unsigned char *>(data), length);
+  crypto_generichash_final(&state, out, sizeof(out));
+  uint64_t result;
+  std::memcpy(&result, out, sizeof(result));
+  return result;
+}
+
+uint64_t LoginThrottle::hashPeer(const void *identity, size_t length) const {
+  return hash(identity, length, DomainPeer);
+}
+
+uint64_t LoginThrottle::hashUser(uint64_t peerKey,
+                                 std::string_view username) const
+{
+  unsigned char out[crypto_generichash_BYTES_MIN];
+  const uint8_t domain = DomainUser;
+  crypto_generichash_state state;
+  crypto_generichash_init(&state, _key.data(), _key.size(), sizeof(out));
+  crypto_generichash_update(&state, &domain, 1);
+  crypto_generichash_update(
+    &state, reinterpret_cast<const unsigned char *>(&peerKey), sizeof(peerKey)
+  );
+  crypto_generichash_update(
+    &state, reinterpret_cast<const unsigned char *>(username.data()),
+    username.length()
+  );
+  crypto_generichash_final(&state, out, sizeof(out));
+  uint64_t result;
+  std::memcpy(&result, out, sizeof(result));
+  return result;
+}
+
+uint64_t LoginThrottle::hashCredential(std::string_view username,
+                                       std::string_view password) const
+{
+  unsigned char out[crypto_generichash_BYTES_MIN];
+  const uint8_t domain = DomainCredential;
+  const unsigned char separator = 0;
+  crypto_generichash_state state;
+  crypto_generichash_init(&state, _key.data(), _key.size(), sizeof(out));
+  crypto_generichash_update(&state, &domain, 1);
+  crypto_generichash_update(
+    &state, reinterpret_cast<const unsigned char *>(username.data()),
+    username.length()
+  );
+  crypto_generichash_update(&state, &separator, 1);
+  crypto_generichash_update(
+    &state, reinterpret_cast<const unsigned char *>(password.data()),
+    password.length()
+  );
+  crypto_generichash_final(&state, out, sizeof(out));
+  // The state has seen the password.
+  sodium_memzero(&state, sizeof(state));
+  uint64_t result;
+  std::memcpy(&result, out, sizeof(result));
+  return result;
+}
+
+LoginThrottle::Verdict
+LoginThrottle::check(uint64_t userKey, uint64_t peerKey, uint64_t credentialKey,
+                     ThrottleClock::time_point now) const
+{
+  if (_failures.contains(credentialKey, now)) {
+    return RecentlyFailed;
+  }
+  if (!_users.allowed(userKey, now)) {
+    return UserThrottled;
+  }
+  if (!_peers.allowed(peerKey, now)) {
+    return PeerThrottled;
+  }
+  return Allowed;
+}
+
+void LoginThrottle::recordFailure(uint64_t userKey, uint64_t peerKey,
+                                  uint64_t credentialKey,
+                                  ThrottleClock::time_point now)
+{
+  _failures.insert(credentialKey, now);
+  _users.consume(userKey, now);
+  _peers.consume(peerKey, now);
+}
+
+// }}} LoginThrottle
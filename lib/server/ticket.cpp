@@ -0,0 +1,287 @@
+#include "wsudo/ticket.h"
+
+#include <sodium.h>
+#include <ShlObj.h>
+#include <sddl.h>
+#include <algorithm>
+#include <cstring>
+
+#pragma comment(lib, "Crypt32.lib")
+#pragma comment(lib, "Shell32.lib")
+#pragma comment(lib, "Ole32.lib")
+
+using namespace wsudo;
+using namespace wsudo::server;
+
+// Helpers {{{
+
+namespace {
+  constexpr uint8_t TicketVersion = 1;
+  constexpr size_t TicketHeaderSize =
+    1 + sizeof(uint32_t) + crypto_secretbox_NONCEBYTES;
+  constexpr size_t ClaimsHeaderSize = sizeof(int64_t) + sizeof(uint64_t);
+
+  // "WSTK"
+  constexpr uint32_t KeyFileMagic = 0x4B545357;
+
+  template<typename T>
+  void put(std::vector<char> &out, T value) {
+    auto offset = out.size();
+    out.resize(offset + sizeof(T));
+    std::memcpy(out.data() + offset, &value, sizeof(T));
+  }
+
+  template<typename T>
+  T get(const char *in) {
+    T value;
+    std::memcpy(&value, in, sizeof(T));
+    return value;
+  }
+}
+
+// }}}
+
+// {{{ TicketKeyRing
+
+TicketKeyRing::~TicketKeyRing() {
+  sodium_memzero(_keys.data(), sizeof(_keys));
+}
+
+bool TicketKeyRing::rotate(int64_t now) {
+  if (_count > 0 && now - _keys[0].createdAt < TicketKeyRotation.count()) {
+    return false;
+  }
+
+  _keys[1] = _keys[0];
+  _keys[0].id = _count > 0 ? _keys[1].id + 1 : randombytes_random();
+  _keys[0].createdAt = now;
+  crypto_secretbox_keygen(_keys[0].bytes.data());
+  _count = std::min(_count + 1, _keys.size());
+  log::info("Generated ticket key {:08X}.", _keys[0].id);
+  return true;
+}
+
+const TicketKeyRing::Key *TicketKeyRing::current() const {
+  return _count > 0 ? &_keys[0] : nullptr;
+}
+
+const TicketKeyRing::Key *TicketKeyRing::find(uint32_t id) const {
+  for (size_t i = 0; i < _count; ++i) {
+    if (_keys[i].id == id) {
+      return &_keys[i];
+    }
+  }
+  return nullptr;
+}
+
+bool TicketKeyRing::load(const std::wstring &path) {
+  HANDLE rawFile = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                               nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                               nullptr);
+  if (rawFile == INVALID_HANDLE_VALUE) {
+    if (GetLastError() != ERROR_FILE_NOT_FOUND) {
+      log::warn(L"Couldn't open ticket key file '{}'.", path);
+    }
+    return false;
+  }
+  HObject file{rawFile};
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size) || size.QuadPart > 4096) {
+    log::warn("Ticket key file is invalid.");
+    return false;
+  }
+  std::vector<BYTE> sealed(static_cast<size_t>(size.QuadPart));
+  DWORD bytesRead;
+  if (!ReadFile(file, sealed.data(), static_cast<DWORD>(sealed.size()),
+                &bytesRead, nullptr) || bytesRead != sealed.size())
+  {
+    log::warn("Couldn't read ticket key file: {}", lastErrorString());
+    return false;
+  }
+
+  DATA_BLOB in{static_cast<DWORD>(sealed.size()), sealed.data()};
+  DATA_BLOB out{};
+  if (!CryptUnprotectData(&in, nullptr, nullptr, nullptr, nullptr,
+                          CRYPTPROTECT_UI_FORBIDDEN, &out))
+  {
+    log::warn("Couldn't decrypt ticket key file: {}", lastErrorString());
+    return false;
+  }
+  WSUDO_SCOPEEXIT {
+    SecureZeroMemory(out.pbData, out.cbData);
+    LocalFree(out.pbData);
+  };
+
+  auto data = reinterpret_cast<const char *>(out.pbData);
+  constexpr size_t KeyRecordSize = sizeof(uint32_t) + sizeof(int64_t) + KeySize;
+  if (out.cbData < 2 * sizeof(uint32_t) ||
+      get<uint32_t>(data) != KeyFileMagic)
+  {
+    log::warn("Ticket key file is invalid.");
+    return false;
+  }
+  auto count = get<uint32_t>(data + sizeof(uint32_t));
+  if (count > _keys.size() ||
+      out.cbData != 2 * sizeof(uint32_t) + count * KeyRecordSize)
+  {
+    log::warn("Ticket key file is invalid.");
+    return false;
+  }
+
+  data += 2 * sizeof(uint32_t);
+  for (uint32_t i = 0; i < count; ++i) {
+    _keys[i].id = get<uint32_t>(data);
+    _keys[i].createdAt = get<int64_t>(data + sizeof(uint32_t));
+    std::memcpy(_keys[i].bytes.data(),
+                data + sizeof(uint32_t) + sizeof(int64_t), KeySize);
+    data += KeyRecordSize;
+  }
+  _count = count;
+  log::info("Loaded {} ticket key(s).", _count);
+  return true;
+}
+
+bool TicketKeyRing::save(const std::wstring &path) const {
+  std::vector<char> plain;
+  put(plain, KeyFileMagic);
+  put(plain, static_cast<uint32_t>(_count));
+  for (size_t i = 0; i < _count; ++i) {
+    put(plain, _keys[i].id);
+    put(plain, _keys[i].createdAt);
+    plain.insert(plain.end(), _keys[i].bytes.begin(), _keys[i].bytes.end());
+  }
+
+  DATA_BLOB in{static_cast<DWORD>(plain.size()),
+               reinterpret_cast<BYTE *>(plain.data())};
+  DATA_BLOB out{};
+  bool protectedOk = CryptProtectData(&in, L"wsudo ticket keys", nullptr,
+                                      nullptr, nullptr,
+                                      CRYPTPROTECT_UI_FORBIDDEN, &out);
+  sodium_memzero(plain.data(), plain.size());
+  if (!protectedOk) {
+    log::error("Couldn't encrypt ticket keys: {}", lastErrorString());
+    return false;
+  }
+  WSUDO_SCOPEEXIT { LocalFree(out.pbData); };
+
+  // Only SYSTEM and Administrators may touch the key file or its directory,
+  // which is wsudo's own directory in ProgramData.
+  if (auto slash = path.rfind(L'\\'); slash != std::wstring::npos &&
+      !createAdminDirectory(path.substr(0, slash)))
+  {
+    log::error(L"Couldn't secure the directory of '{}': {}", path,
+               to_utf16(lastErrorString()));
+    return false;
+  }
+  HLocalPtr<PSECURITY_DESCRIPTOR> securityDescriptor;
+  if (!ConvertStringSecurityDescriptorToSecurityDescriptorW(
+        AdminOnlySddl, SDDL_REVISION_1, &securityDescriptor, nullptr))
+  {
+    log::error("Couldn't create key file security descriptor: {}",
+               lastErrorString());
+    return false;
+  }
+  SECURITY_ATTRIBUTES secAttr;
+  secAttr.nLength = sizeof(SECURITY_ATTRIBUTES);
+  secAttr.bInheritHandle = false;
+  secAttr.lpSecurityDescriptor = securityDescriptor;
+
+  HANDLE rawFile = CreateFileW(path.c_str(), GENERIC_WRITE, 0, &secAttr,
+                               CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (rawFile == INVALID_HANDLE_VALUE) {
+    log::error(L"Couldn't create ticket key file '{}'.", path);
+    return false;
+  }
+  HObject file{rawFile};
+  DWORD bytesWritten;
+  if (!WriteFile(file, out.pbData, out.cbData, &bytesWritten, nullptr) ||
+      bytesWritten != out.cbData)
+  {
+    log::error("Couldn't write ticket key file: {}", lastErrorString());
+    return false;
+  }
+  return true;
+}
+
+// }}} TicketKeyRing
+
+std::vector<char> wsudo::server::issueTicket(const TicketKeyRing &keys,
+                                             const TicketClaims &claims)
+{
+  auto key = keys.current();
+  if (!key) {
+    return {};
+  }
+
+  std::vector<char> plain;
+  plain.reserve(ClaimsHeaderSize + claims.username.length());
+  put(plain, claims.expiresAt);
+  put(plain, claims.logonId);
+  plain.insert(plain.end(), claims.username.begin(), claims.username.end());
+
+  std::vector<char> ticket;
+  ticket.reserve(TicketHeaderSize + crypto_secretbox_MACBYTES + plain.size());
+  put(ticket, TicketVersion);
+  put(ticket, key->id);
+  auto nonceOffset = ticket.size();
+  ticket.resize(TicketHeaderSize + crypto_secretbox_MACBYTES + plain.size());
+  auto nonce = reinterpret_cast<unsigned char *>(ticket.data() + nonceOffset);
+  randombytes_buf(nonce, crypto_secretbox_NONCEBYTES);
+  crypto_secretbox_easy(
+    reinterpret_cast<unsigned char *>(ticket.data() + TicketHeaderSize),
+    reinterpret_cast<const unsigned char *>(plain.data()), plain.size(),
+    nonce, key->bytes.data()
+  );
+  return ticket;
+}
+
+std::optional<TicketClaims>
+wsudo::server::openTicket(const TicketKeyRing &keys, std::string_view ticket,
+                          int64_t now)
+{
+  if (ticket.size() <
+        TicketHeaderSize + crypto_secretbox_MACBYTES + ClaimsHeaderSize ||
+      static_cast<uint8_t>(ticket[0]) != TicketVersion)
+  {
+    return std::nullopt;
+  }
+  auto key = keys.find(get<uint32_t>(ticket.data() + 1));
+  if (!key) {
+    return std::nullopt;
+  }
+
+  auto nonce = reinterpret_cast<const unsigned char *>(
+    ticket.data() + 1 + sizeof(uint32_t)
+  );
+  auto box = ticket.substr(TicketHeaderSize);
+  std::vector<char> plain(box.size() - crypto_secretbox_MACBYTES);
+  if (crypto_secretbox_open_easy(
+        reinterpret_cast<unsigned char *>(plain.data()),
+        reinterpret_cast<const unsigned char *>(box.data()), box.size(),
+        nonce, key->bytes.data()) != 0)
+  {
+    return std::nullopt;
+  }
+
+  TicketClaims claims;
+  claims.expiresAt = get<int64_t>(plain.data());
+  claims.logonId = get<uint64_t>(plain.data() + sizeof(int64_t));
+  if (claims.expiresAt <= now) {
+    return std::nullopt;
+  }
+  claims.username.assign(plain.begin() + ClaimsHeaderSize, plain.end());
+  return claims;
+}
+
+std::wstring wsudo::server::defaultTicketKeyPath() {
+  PWSTR programData;
+  if (!SUCCEEDED(SHGetKnownFolderPath(FOLDERID_ProgramData, 0, nullptr,
+                                      &programData)))
+  {
+    return std::wstring{};
+  }
+  std::wstring path{programData};
+  CoTaskMemFree(programData);
+  return path + L"\\wsudo\\ticketkeys.bin";
+}
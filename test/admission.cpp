@@ -0,0 +1,58 @@
+#include "wsudo/admission.h"
+
+#include <catch.hpp>
+
+using namespace wsudo::server;
+using namespace std::chrono_literals;
+
+TEST_CASE("Requests in flight are counted but not capped", "[admission]") {
+  AdmissionController admission;
+  auto now = AdmissionClock::time_point{} + 1h;
+
+  for (int i = 0; i < 16; ++i) {
+    REQUIRE(admission.admit(0ms, now));
+  }
+  admission.acquire();
+  REQUIRE(admission.inFlight() == 17);
+
+  // Between requests, admitted clients aren't counted.
+  for (int i = 0; i < 17; ++i) {
+    admission.release();
+  }
+  REQUIRE(admission.inFlight() == 0);
+}
+
+TEST_CASE("Admission sheds load after a standing backlog", "[admission]") {
+  AdmissionController admission{50ms, 500ms};
+  auto now = AdmissionClock::time_point{} + 1h;
+
+  // A backlog above target is tolerated for one interval.
+  REQUIRE(admission.admit(80ms, now));
+  REQUIRE(admission.admit(80ms, now + 200ms));
+  REQUIRE_FALSE(admission.overloaded());
+
+  // Then new clients are turned away.
+  REQUIRE_FALSE(admission.admit(80ms, now + 500ms));
+  REQUIRE(admission.overloaded());
+  REQUIRE_FALSE(admission.admit(80ms, now + 600ms));
+
+  // Once the backlog drains, clients are admitted again.
+  REQUIRE(admission.admit(10ms, now + 700ms));
+  REQUIRE_FALSE(admission.overloaded());
+  REQUIRE(admission.admit(80ms, now + 800ms));
+}
+
+TEST_CASE("Admission retry hint tracks the backlog", "[admission]") {
+  AdmissionController admission{50ms, 500ms};
+  auto now = AdmissionClock::time_point{} + 1h;
+
+  admission.recordService(100ms);
+  REQUIRE(admission.admit(50ms, now));
+  auto decision = admission.admit(50ms, now + 500ms);
+  REQUIRE_FALSE(decision);
+  // The backlog plus the one client ahead of this one.
+  REQUIRE(decision.retryAfter == 150ms);
+
+  decision = admission.admit(1h, now + 600ms);
+  REQUIRE(decision.retryAfter == 5000ms);
+}
@@ -0,0 +1,193 @@
+#include "wsudo/asynclog.h"
+
+#include <catch.hpp>
+#include <spdlog/logger.h>
+#include <atomic>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace wsudo::log;
+
+namespace {
+  // Output that remembers what was written and how many calls it took.
+  struct Capture {
+    std::mutex mutex;
+    std::string text;
+    size_t writes = 0;
+
+    AsyncLogWriter::Output output() {
+      return [this](std::string_view data) {
+        std::lock_guard<std::mutex> lock{mutex};
+        text.append(data);
+        ++writes;
+      };
+    }
+  };
+}
+
+TEST_CASE("Log rings wrap and refuse what doesn't fit", "[asynclog]") {
+  LogRing ring{64};
+  std::string scratch;
+  std::vector<std::pair<unsigned, std::string>> records;
+  auto collect = [&](unsigned stream, std::string_view text) {
+    records.emplace_back(stream, std::string{text});
+  };
+
+  // 4 byte header each, so 3 records of 16 fill 60 of 64 bytes.
+  REQUIRE(ring.push(0, std::string(16, 'a')));
+  REQUIRE(ring.push(1, std::string(16, 'b')));
+  REQUIRE(ring.push(0, std::string(16, 'c')));
+  REQUIRE_FALSE(ring.push(0, "too much"));
+  REQUIRE(ring.drain(collect, scratch) == 3);
+  REQUIRE(records[1] == std::pair{1u, std::string(16, 'b')});
+
+  // Now records straddle the end of the buffer.
+  records.clear();
+  for (int i = 0; i < 20; ++i) {
+    auto text = std::string(static_cast<size_t>(i % 7 + 5), 'a' + i);
+    REQUIRE(ring.push(i % 2, text));
+    REQUIRE(ring.drain(collect, scratch) == 1);
+    REQUIRE(records.back() == std::pair{unsigned(i % 2), text});
+  }
+  REQUIRE_FALSE(ring.push(0, std::string(61, 'x')));
+}
+
+TEST_CASE("Async writer batches records per stream", "[asynclog]") {
+  Capture out, err;
+  {
+    AsyncLogWriter writer{out.output(), err.output(), 4096,
+                          std::chrono::milliseconds{1000}};
+    for (int i = 0; i < 50; ++i) {
+      REQUIRE(writer.write(AsyncLogWriter::Out, "line\n"));
+    }
+    REQUIRE(writer.write(AsyncLogWriter::Err, "error\n"));
+    writer.flush();
+    REQUIRE(out.text.size() == 50 * 5);
+    REQUIRE(out.writes == 1);
+    REQUIRE(err.text == "error\n");
+    REQUIRE(writer.stats().records == 51);
+
+    // After stopping, writes go straight through.
+    writer.stop();
+    REQUIRE(writer.write(AsyncLogWriter::Out, "late\n"));
+    REQUIRE(out.text.substr(out.text.size() - 5) == "late\n");
+  }
+}
+
+TEST_CASE("Async writer drops and reports when a ring is full",
+          "[asynclog]")
+{
+  Capture out, err;
+  AsyncLogWriter writer{out.output(), err.output(), 64,
+                        std::chrono::milliseconds{1000}};
+  size_t written = 0;
+  for (int i = 0; i < 10; ++i) {
+    written += writer.write(AsyncLogWriter::Out, "0123456789\n");
+  }
+  REQUIRE(written == 4);
+  writer.flush();
+  REQUIRE(writer.stats().dropped == 6);
+  REQUIRE(err.text == "[wsudo] 6 log messages dropped.\n");
+  writer.stop();
+}
+
+TEST_CASE("Async writer keeps each thread's records in order",
+          "[asynclog]")
+{
+  Capture out, err;
+  {
+    AsyncLogWriter writer{out.output(), err.output(), 1 << 16,
+                          std::chrono::milliseconds{1}};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+      threads.emplace_back([&writer, t] {
+        for (int i = 0; i < 1000; ++i) {
+          auto line = std::to_string(t) + " " + std::to_string(i) + "\n";
+          // Retry instead of dropping so every line can be checked.
+          while (!writer.write(AsyncLogWriter::Out, line)) {
+            std::this_thread::yield();
+          }
+        }
+      });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+  }
+
+  std::map<int, int> next;
+  size_t position = 0;
+  size_t lines = 0;
+  while (position < out.text.size()) {
+    auto end = out.text.find('\n', position);
+    auto line = out.text.substr(position, end - position);
+    auto space = line.find(' ');
+    auto t = std::stoi(line.substr(0, space));
+    auto i = std::stoi(line.substr(space + 1));
+    REQUIRE(i == next[t]++);
+    position = end + 1;
+    ++lines;
+  }
+  REQUIRE(lines == 4000);
+}
+
+TEST_CASE("Async writer keeps records written while it stops",
+          "[asynclog]")
+{
+  for (int round = 0; round < 500; ++round) {
+    Capture out, err;
+    std::atomic<size_t> accepted{0};
+    {
+      AsyncLogWriter writer{out.output(), err.output(), 1 << 16,
+                            std::chrono::milliseconds{1}};
+      std::atomic<bool> go{false};
+      std::vector<std::thread> threads;
+      for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&] {
+          while (!go.load()) {
+            std::this_thread::yield();
+          }
+          for (int i = 0; i < 2000; ++i) {
+            accepted += writer.write(AsyncLogWriter::Out, "x\n");
+          }
+        });
+      }
+      go = true;
+      writer.stop();
+      for (auto &thread : threads) {
+        thread.join();
+      }
+    }
+    REQUIRE(out.text.size() == accepted * 2);
+  }
+}
+
+TEST_CASE("Async sink formats on the calling thread", "[asynclog]") {
+  Capture out, err;
+  auto writer = std::make_shared<AsyncLogWriter>(out.output(), err.output());
+  spdlog::logger plain{"plain", std::make_shared<AsyncSink>(
+    writer, AsyncLogWriter::Out, false
+  )};
+  spdlog::logger colored{"colored", std::make_shared<AsyncSink>(
+    writer, AsyncLogWriter::Err, true
+  )};
+  plain.set_pattern("%^[%l]%$ %v");
+  colored.set_pattern("%^[%l]%$ %v");
+  plain.info("hello {}", 1);
+  colored.warn("careful");
+  plain.flush();
+  REQUIRE(out.text == "[info] hello 1\n");
+  REQUIRE(err.text == "\033[33m\033[1m[warning]\033[m careful\n");
+
+  // A new pattern reaches threads that already have a formatter.
+  plain.set_pattern("%v!");
+  std::thread{[&] { plain.info("from a thread"); }}.join();
+  // Different threads aren't ordered with each other.
+  plain.flush();
+  plain.info("again");
+  plain.flush();
+  REQUIRE(out.text == "[info] hello 1\nfrom a thread!\nagain!\n");
+  writer->stop();
+}
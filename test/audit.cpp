@@ -0,0 +1,403 @@
+#include "wsudo/audit.h"
+
+#include <catch.hpp>
+#include <cstring>
+#include <map>
+#include <thread>
+
+using namespace wsudo::audit;
+
+namespace {
+  // Segments in memory, kept after the log that wrote them is gone.
+  struct Segments {
+    std::map<uint64_t, std::vector<char>> files;
+    size_t syncs = 0;
+    bool failOpen = false;
+    bool failSync = false;
+  };
+
+  class MemoryStorage final : public Storage {
+  public:
+    explicit MemoryStorage(std::shared_ptr<Segments> segments)
+      : _segments{std::move(segments)}
+    {}
+
+    std::vector<uint64_t> list() override {
+      std::vector<uint64_t> sequences;
+      for (auto &[sequence, file] : _segments->files) {
+        sequences.push_back(sequence);
+      }
+      return sequences;
+    }
+
+    std::unique_ptr<Mapping> open(uint64_t sequence, size_t size) override {
+      if (_segments->failOpen) {
+        return nullptr;
+      }
+      auto &file = _segments->files[sequence];
+      if (file.empty()) {
+        file.resize(size);
+      }
+      return std::make_unique<MemoryMapping>(file, *_segments);
+    }
+
+    void remove(uint64_t sequence) override {
+      _segments->files.erase(sequence);
+    }
+
+  private:
+    class MemoryMapping final : public Mapping {
+    public:
+      MemoryMapping(std::vector<char> &file, Segments &segments)
+        : _file{file}, _segments{segments}
+      {}
+
+      char *data() override { return _file.data(); }
+      size_t size() const override { return _file.size(); }
+      bool sync(size_t, size_t) override {
+        ++_segments.syncs;
+        return !_segments.failSync;
+      }
+
+    private:
+      std::vector<char> &_file;
+      Segments &_segments;
+    };
+
+    std::shared_ptr<Segments> _segments;
+  };
+
+  Record makeRecord(uint64_t time, const char *user,
+                    Event event = Event::Spawn,
+                    Outcome outcome = Outcome::Allowed)
+  {
+    Record record{};
+    record.time = time;
+    record.event = event;
+    record.outcome = outcome;
+    record.setUser(user);
+    return record;
+  }
+
+  std::vector<Record> allRecords(const Segments &segments) {
+    std::vector<Record> records;
+    for (auto &[sequence, file] : segments.files) {
+      auto view = viewSegment(file.data(), file.size());
+      REQUIRE(view);
+      REQUIRE(view->header->sequence == sequence);
+      records.insert(records.end(), view->records,
+                     view->records + view->count);
+    }
+    return records;
+  }
+}
+
+TEST_CASE("Audit log writes records to a segment", "[audit]") {
+  auto segments = std::make_shared<Segments>();
+  AuditLog::Options options;
+  options.segmentRecords = 16;
+  {
+    AuditLog log{std::make_unique<MemoryStorage>(segments), options};
+    auto record = makeRecord(1000, "alice", Event::Bless, Outcome::Denied);
+    record.processId = 42;
+    record.logonId = 0x1234;
+    record.setImage("c:\\windows\\system32\\windowspowershell.exe");
+    record.digest[0] = 0xAB;
+    log.append(record);
+    log.append(makeRecord(2000, "bob"));
+    log.flush();
+    REQUIRE(log.stats().records == 2);
+  }
+
+  REQUIRE(segments->files.size() == 1);
+  auto &file = segments->files.begin()->second;
+  REQUIRE(file.size() == segmentSize(16));
+  auto view = viewSegment(file.data(), file.size());
+  REQUIRE(view);
+  REQUIRE(view->count == 2);
+  REQUIRE(view->header->firstTime == 1000);
+  REQUIRE(view->header->lastTime == 2000);
+
+  auto &first = view->records[0];
+  REQUIRE(first.userName() == "alice");
+  // Cut to the last 32 bytes.
+  REQUIRE(first.imageName() == "s\\system32\\windowspowershell.exe");
+  REQUIRE(first.event == Event::Bless);
+  REQUIRE(first.outcome == Outcome::Denied);
+  REQUIRE(first.processId == 42);
+  REQUIRE(first.logonId == 0x1234);
+  REQUIRE(first.digest[0] == 0xAB);
+  REQUIRE(view->records[1].userName() == "bob");
+}
+
+TEST_CASE("Audit log commits records in groups", "[audit]") {
+  auto segments = std::make_shared<Segments>();
+  AuditLog::Options options;
+  options.batchRecords = 64;
+  options.commitInterval = std::chrono::hours{1};
+  AuditLog log{std::make_unique<MemoryStorage>(segments), options};
+  auto syncsBefore = segments->syncs;
+
+  for (uint64_t i = 0; i < 1000; ++i) {
+    log.append(makeRecord(i, "alice"));
+  }
+  log.flush();
+  auto stats = log.stats();
+  REQUIRE(stats.records == 1000);
+  REQUIRE(stats.failures == 0);
+  // One sync per commit, and far fewer commits than records.
+  REQUIRE(segments->syncs - syncsBefore == stats.commits);
+  REQUIRE(stats.commits <= 1000 / 64 + 1);
+
+  // flush() doesn't wait for the interval.
+  log.append(makeRecord(1000, "alice"));
+  log.flush();
+  REQUIRE(log.stats().records == 1001);
+}
+
+TEST_CASE("Audit log keeps times in order", "[audit]") {
+  auto segments = std::make_shared<Segments>();
+  {
+    AuditLog log{std::make_unique<MemoryStorage>(segments)};
+    log.append(makeRecord(500, "alice"));
+    // The clock went backwards.
+    log.append(makeRecord(400, "alice"));
+  }
+  {
+    AuditLog log{std::make_unique<MemoryStorage>(segments)};
+    log.append(makeRecord(300, "alice"));
+  }
+  auto records = allRecords(*segments);
+  REQUIRE(records.size() == 3);
+  REQUIRE(records[0].time == 500);
+  REQUIRE(records[1].time == 500);
+  REQUIRE(records[2].time == 500);
+}
+
+TEST_CASE("Audit log resumes its last segment", "[audit]") {
+  auto segments = std::make_shared<Segments>();
+  AuditLog::Options options;
+  options.segmentRecords = 8;
+  for (uint64_t run = 0; run < 3; ++run) {
+    AuditLog log{std::make_unique<MemoryStorage>(segments), options};
+    log.append(makeRecord(run * 10, "alice"));
+    log.append(makeRecord(run * 10 + 1, "alice"));
+  }
+  REQUIRE(segments->files.size() == 1);
+  REQUIRE(allRecords(*segments).size() == 6);
+}
+
+TEST_CASE("Audit log rotates and removes old segments", "[audit]") {
+  auto segments = std::make_shared<Segments>();
+  AuditLog::Options options;
+  options.segmentRecords = 4;
+  options.maxSegments = 2;
+  {
+    AuditLog log{std::make_unique<MemoryStorage>(segments), options};
+    for (uint64_t i = 0; i < 10; ++i) {
+      log.append(makeRecord(i, "alice"));
+    }
+  }
+  REQUIRE(segments->files.size() == 2);
+  REQUIRE(segments->files.count(2));
+  REQUIRE(segments->files.count(3));
+  auto records = allRecords(*segments);
+  REQUIRE(records.size() == 6);
+  REQUIRE(records.front().time == 4);
+  REQUIRE(records.back().time == 9);
+}
+
+TEST_CASE("Audit log starts a new segment after a damaged one", "[audit]") {
+  auto segments = std::make_shared<Segments>();
+  segments->files[5].assign(segmentSize(4), 'x');
+  {
+    AuditLog log{std::make_unique<MemoryStorage>(segments)};
+    log.append(makeRecord(1, "alice"));
+  }
+  REQUIRE(segments->files.size() == 2);
+  // The damaged segment is left alone for someone to look at.
+  REQUIRE(segments->files[5][0] == 'x');
+  auto &file = segments->files[6];
+  auto view = viewSegment(file.data(), file.size());
+  REQUIRE(view);
+  REQUIRE(view->count == 1);
+}
+
+TEST_CASE("Audit log counts what it can't write", "[audit]") {
+  SECTION("No storage") {
+    AuditLog log{nullptr};
+    log.append(makeRecord(1, "alice"));
+    log.flush();
+    REQUIRE(log.stats().dropped == 1);
+  }
+
+  SECTION("Storage fails") {
+    auto segments = std::make_shared<Segments>();
+    segments->failOpen = true;
+    AuditLog log{std::make_unique<MemoryStorage>(segments)};
+    log.append(makeRecord(1, "alice"));
+    log.flush();
+    REQUIRE(log.stats().records == 0);
+    REQUIRE(log.stats().failures >= 1);
+  }
+
+  SECTION("Writes fail") {
+    auto segments = std::make_shared<Segments>();
+    AuditLog log{std::make_unique<MemoryStorage>(segments)};
+    log.append(makeRecord(1, "alice"));
+    log.flush();
+    segments->failSync = true;
+    log.append(makeRecord(2, "bob"));
+    log.flush();
+    REQUIRE(log.stats().records == 1);
+    REQUIRE(log.stats().failures == 1);
+    // The segment doesn't count what failed, and it can be written again.
+    auto records = allRecords(*segments);
+    REQUIRE(records.size() == 1);
+    REQUIRE(records[0].userName() == "alice");
+    segments->failSync = false;
+    log.append(makeRecord(3, "carol"));
+    log.flush();
+    records = allRecords(*segments);
+    REQUIRE(records.size() == 2);
+    REQUIRE(records[1].userName() == "carol");
+  }
+
+  SECTION("Too many waiting") {
+    auto segments = std::make_shared<Segments>();
+    AuditLog::Options options;
+    options.maxPending = 0;
+    AuditLog log{std::make_unique<MemoryStorage>(segments), options};
+    log.append(makeRecord(1, "alice"));
+    REQUIRE(log.stats().dropped == 1);
+  }
+}
+
+TEST_CASE("Audit log accepts records from many threads", "[audit]") {
+  auto segments = std::make_shared<Segments>();
+  AuditLog::Options options;
+  options.segmentRecords = 1000;
+  {
+    AuditLog log{std::make_unique<MemoryStorage>(segments), options};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+      threads.emplace_back([&log] {
+        for (int i = 0; i < 1000; ++i) {
+          log.append(makeRecord(AuditLog::now(), "alice"));
+        }
+      });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    log.flush();
+    REQUIRE(log.stats().records == 4000);
+  }
+  auto records = allRecords(*segments);
+  REQUIRE(records.size() == 4000);
+  REQUIRE(std::is_sorted(records.begin(), records.end(),
+                         [](auto &a, auto &b) { return a.time < b.time; }));
+}
+
+TEST_CASE("Audit scan finds a time range", "[audit]") {
+  auto segments = std::make_shared<Segments>();
+  {
+    AuditLog log{std::make_unique<MemoryStorage>(segments)};
+    for (uint64_t i = 0; i < 1000; ++i) {
+      log.append(makeRecord(i * 10, i % 2 ? "alice" : "bob",
+                            i % 3 ? Event::Bless : Event::Logon,
+                            i % 5 ? Outcome::Allowed : Outcome::Denied));
+    }
+  }
+  auto &file = segments->files.begin()->second;
+  auto view = viewSegment(file.data(), file.size());
+  REQUIRE(view);
+
+  Filter filter;
+  filter.since = 995;
+  filter.until = 2000;
+  std::vector<uint64_t> times;
+  auto count = scan(*view, filter, [&](const Record &record) {
+    times.push_back(record.time);
+    return true;
+  });
+  REQUIRE(count == 101);
+  REQUIRE(times.front() == 1000);
+  REQUIRE(times.back() == 2000);
+
+  filter.user = "alice";
+  filter.event = Event::Logon;
+  filter.outcome = Outcome::Denied;
+  scan(*view, filter, [&](const Record &record) {
+    REQUIRE(record.time >= 1000);
+    REQUIRE(record.time <= 2000);
+    auto i = record.time / 10;
+    REQUIRE(i % 2 == 1);
+    REQUIRE(i % 3 == 0);
+    REQUIRE(i % 5 == 0);
+    return true;
+  });
+  // Only i = 105, 135, 165 and 195 match.
+  REQUIRE(scan(*view, filter, [](auto &) { return true; }) == 4);
+  // Stops when asked to.
+  REQUIRE(scan(*view, filter, [](auto &) { return false; }) == 1);
+
+  Filter later;
+  later.since = 10000;
+  REQUIRE_FALSE(later.overlaps(*view->header));
+  REQUIRE(scan(*view, later, [](auto &) { return true; }) == 0);
+}
+
+TEST_CASE("Audit segments are validated", "[audit]") {
+  std::vector<char> data(segmentSize(4));
+  REQUIRE_FALSE(viewSegment(data.data(), data.size()));
+
+  SegmentHeader header{};
+  std::memcpy(header.magic, SegmentMagic, sizeof(header.magic));
+  header.version = SegmentVersion;
+  header.recordSize = sizeof(Record);
+  header.capacity = 4;
+  header.count = 4;
+  std::memcpy(data.data(), &header, sizeof(header));
+  REQUIRE(viewSegment(data.data(), data.size()));
+  // Too short for its capacity.
+  REQUIRE_FALSE(viewSegment(data.data(), data.size() - 1));
+
+  header.count = 5;
+  std::memcpy(data.data(), &header, sizeof(header));
+  REQUIRE_FALSE(viewSegment(data.data(), data.size()));
+}
+
+TEST_CASE("Audit record fields don't split characters", "[audit]") {
+  Record record{};
+  record.setUser("alice");
+  REQUIRE(record.userName() == "alice");
+
+  // 31 ASCII bytes, then a 2 byte character that doesn't fit.
+  std::string user(31, 'u');
+  user += "\xC3\xA9";
+  record.setUser(user);
+  REQUIRE(record.userName() == std::string(31, 'u'));
+
+  // The image keeps the end of the path.
+  std::string image = "\xC3\xA9" + std::string(31, 'i');
+  record.setImage(image);
+  REQUIRE(record.imageName() == std::string(31, 'i'));
+  record.setImage("c:\\a.exe");
+  REQUIRE(record.imageName() == "c:\\a.exe");
+}
+
+TEST_CASE("Audit names round trip", "[audit]") {
+  for (auto event : {Event::Logon, Event::Resume, Event::Bless,
+                     Event::Spawn})
+  {
+    REQUIRE(eventFromString(eventToString(event)) == event);
+  }
+  for (auto outcome : {Outcome::Allowed, Outcome::Denied, Outcome::Throttled,
+                       Outcome::Failed})
+  {
+    REQUIRE(outcomeFromString(outcomeToString(outcome)) == outcome);
+  }
+  REQUIRE_FALSE(eventFromString("reboot"));
+  REQUIRE(std::string{outcomeToString(static_cast<Outcome>(9))} == "unknown");
+}
@@ -0,0 +1,114 @@
+#include "wsudo/cmdline.h"
+
+#include <catch.hpp>
+#include <algorithm>
+#include <iterator>
+#include <random>
+
+#ifdef _WIN32
+# include <Windows.h>
+# include <shellapi.h>
+# pragma comment(lib, "Shell32.lib")
+#endif
+
+using namespace wsudo;
+
+namespace {
+  using Arguments = std::vector<std::wstring>;
+
+  std::wstring join(const Arguments &arguments) {
+    std::vector<const wchar_t *> argv;
+    for (auto &argument : arguments) {
+      argv.push_back(argument.c_str());
+    }
+    return joinCommandLine(argv.data(), argv.size());
+  }
+
+  // Arguments made mostly of the characters the quoting rules care about.
+  Arguments randomArguments(std::minstd_rand &random) {
+    static const wchar_t Alphabet[] = L"ab \t\"\\\\\\\"\x3bb\n";
+    std::uniform_int_distribution<size_t> count{1, 6};
+    std::uniform_int_distribution<size_t> length{0, 24};
+    std::uniform_int_distribution<size_t> pick{0, std::size(Alphabet) - 2};
+    Arguments arguments(count(random));
+    for (auto &argument : arguments) {
+      for (auto n = length(random); n > 0; --n) {
+        argument.push_back(Alphabet[pick(random)]);
+      }
+    }
+    // Program names can't contain quotes.
+    auto &program = arguments[0];
+    program.erase(std::remove(program.begin(), program.end(), L'"'),
+                  program.end());
+    return arguments;
+  }
+}
+
+TEST_CASE("Command lines split like CommandLineToArgvW", "[cmdline]") {
+  auto check = [](std::wstring_view line, Arguments expected) {
+    INFO(std::string(line.begin(), line.end()));
+    REQUIRE(splitCommandLine(line) == expected);
+  };
+  check(L"", {});
+  check(L"p", {L"p"});
+  check(L"\"C:\\Program Files\\x.exe\" a", {L"C:\\Program Files\\x.exe",
+                                            L"a"});
+  // Backslashes are literal in the program name.
+  check(L"C:\\dir\\\"x a", {L"C:\\dir\\\"x", L"a"});
+  check(L"p \"a b c\" d e", {L"p", L"a b c", L"d", L"e"});
+  check(L"p \"ab\\\"c\" \"\\\\\" d", {L"p", L"ab\"c", L"\\", L"d"});
+  check(L"p a\\\\\\b d\"e f\"g h", {L"p", L"a\\\\\\b", L"de fg", L"h"});
+  check(L"p a\\\\\\\"b c d", {L"p", L"a\\\"b", L"c", L"d"});
+  check(L"p a\\\\\\\\\"b c\" d e", {L"p", L"a\\\\b c", L"d", L"e"});
+  check(L"p \"\" x", {L"p", L"", L"x"});
+  check(L"p  \t a  ", {L"p", L"a"});
+  // Every third quote in a run is literal.
+  check(L"p a\"b\"\" c d", {L"p", L"ab\"", L"c", L"d"});
+  check(L"p \"\"\"a\"\"\" b", {L"p", L"\"a\"", L"b"});
+}
+
+TEST_CASE("Command lines are only quoted when needed", "[cmdline]") {
+  REQUIRE(join({L"C:\\x.exe", L"a", L"C:\\dir\\"}) ==
+          L"C:\\x.exe a C:\\dir\\");
+  REQUIRE(join({L"C:\\Program Files\\x.exe", L"", L"a b"}) ==
+          L"\"C:\\Program Files\\x.exe\" \"\" \"a b\"");
+  REQUIRE(join({L"x", L"C:\\a dir\\", L"say \"hi\""}) ==
+          L"x \"C:\\a dir\\\\\" \"say \\\"hi\\\"\"");
+}
+
+TEST_CASE("The vector scan agrees with the scalar scan", "[cmdline]") {
+  std::minstd_rand random{1};
+  std::uniform_int_distribution<int> pick{0, 7};
+  const wchar_t special[] = {L' ', L'\t', L'\n', L'\v', L'"', L'\\'};
+  for (int round = 0; round < 2000; ++round) {
+    std::wstring argument(static_cast<size_t>(round % 67), L'a');
+    for (auto &c : argument) {
+      auto which = pick(random);
+      c = which < 6 && pick(random) == 0 ? special[which] : L'a' + which;
+    }
+    REQUIRE(detail::scanArgument(argument) ==
+            detail::scanArgumentScalar(argument));
+  }
+}
+
+TEST_CASE("Command lines round trip", "[cmdline]") {
+  std::minstd_rand random{42};
+  for (int round = 0; round < 20000; ++round) {
+    auto arguments = randomArguments(random);
+    auto line = join(arguments);
+    INFO("round " << round);
+    REQUIRE(splitCommandLine(line) == arguments);
+
+#ifdef _WIN32
+    // The real thing agrees, except about an empty program name.
+    if (!arguments[0].empty()) {
+      int argc;
+      auto argv = CommandLineToArgvW(line.c_str(), &argc);
+      REQUIRE(argv);
+      Arguments windows(argv, argv + argc);
+      LocalFree(argv);
+      REQUIRE(windows == arguments);
+    }
+#endif
+  }
+}
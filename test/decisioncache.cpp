@@ -0,0 +1,79 @@
+#include "wsudo/decisioncache.h"
+
+#include <sodium.h>
+#include <catch.hpp>
+
+using namespace wsudo::server;
+using wsudo::policy::Decision;
+
+TEST_CASE("Decision cache hits within a generation", "[decisioncache]") {
+  REQUIRE(sodium_init() >= 0);
+  DecisionCache cache;
+  std::vector<std::string> groups{"users"};
+  auto key = cache.hash("alice", groups, "c:\\windows\\system32\\cmd.exe", "");
+
+  REQUIRE_FALSE(cache.find(1, key));
+  cache.insert(1, key, Decision{true, 7});
+  auto decision = cache.find(1, key);
+  REQUIRE(decision);
+  REQUIRE(decision->allowed);
+  REQUIRE(decision->line == 7);
+
+  // A new policy generation invalidates everything.
+  REQUIRE_FALSE(cache.find(2, key));
+
+  REQUIRE(cache.stats().hits == 1);
+  REQUIRE(cache.stats().misses == 2);
+  REQUIRE(cache.stats().hitRate() == Approx(1.0 / 3));
+}
+
+TEST_CASE("Decision cache keys cover every field", "[decisioncache]") {
+  REQUIRE(sodium_init() >= 0);
+  DecisionCache cache;
+  std::vector<std::string> none;
+  std::vector<std::string> admins{"administrators"};
+  auto key = cache.hash("alice", none, "c:\\x.exe", "a b");
+  REQUIRE(key == cache.hash("alice", none, "c:\\x.exe", "a b"));
+  REQUIRE(key != cache.hash("bob", none, "c:\\x.exe", "a b"));
+  REQUIRE(key != cache.hash("alice", admins, "c:\\x.exe", "a b"));
+  REQUIRE(key != cache.hash("alice", none, "c:\\y.exe", "a b"));
+  REQUIRE(key != cache.hash("alice", none, "c:\\x.exe", "a c"));
+  // Moving text between fields changes the key.
+  REQUIRE(key != cache.hash("alice", none, "c:\\x.exe a", "b"));
+  wsudo::policy::Digest digest{};
+  REQUIRE(key != cache.hash("alice", none, "c:\\x.exe", "a b", &digest));
+
+  // Another cache instance uses another key.
+  DecisionCache other;
+  REQUIRE(key != other.hash("alice", none, "c:\\x.exe", "a b"));
+}
+
+TEST_CASE("Decision cache evicts unreferenced entries first",
+          "[decisioncache]")
+{
+  REQUIRE(sodium_init() >= 0);
+  DecisionCache cache;
+  constexpr auto stride = DecisionCache::Sets;
+
+  // Fill one set and touch every entry but the third.
+  for (uint64_t i = 1; i <= DecisionCache::Ways; ++i) {
+    cache.insert(1, i * stride, Decision{true, static_cast<uint32_t>(i)});
+  }
+  for (uint64_t i = 1; i <= DecisionCache::Ways; ++i) {
+    if (i != 3) {
+      REQUIRE(cache.find(1, i * stride));
+    }
+  }
+
+  cache.insert(1, 100 * stride, Decision{false, 100});
+  REQUIRE(cache.stats().evictions == 1);
+  REQUIRE_FALSE(cache.find(1, 3 * stride));
+  for (uint64_t i : {1, 2, 4, 100}) {
+    REQUIRE(cache.find(1, i * stride));
+  }
+
+  // Entries from an old generation are reused before anything is evicted.
+  cache.insert(2, 200 * stride, Decision{true, 200});
+  REQUIRE(cache.stats().evictions == 1);
+  REQUIRE(cache.find(2, 200 * stride));
+}
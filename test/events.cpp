@@ -44,3 +44,31 @@ TEST_CASE("EventListener chooses correctly.", "[events]") {
   REQUIRE(listener.next() == EventStatus::Finished);
   REQUIRE(timerNr == 1);
 }
+
+TEST_CASE("EventListener measures each event's wait.", "[events]") {
+  using namespace wsudo::events;
+  using namespace std::chrono_literals;
+
+  EventListener listener;
+  std::chrono::steady_clock::duration delays[2]{};
+  HANDLE events[2];
+  for (int i = 0; i < 2; ++i) {
+    events[i] = CreateEventW(nullptr, true, false, nullptr);
+    listener.emplace(events[i], [i, &events, &delays](EventListener &l) {
+      delays[i] = l.queueDelay();
+      ResetEvent(events[i]);
+      if (i == 0) {
+        Sleep(50);
+      }
+      return EventStatus::Finished;
+    });
+  }
+
+  // The second event waits behind the first handler, which didn't wait.
+  SetEvent(events[0]);
+  SetEvent(events[1]);
+  REQUIRE(listener.next() == EventStatus::Ok);
+  REQUIRE(listener.next() == EventStatus::Finished);
+  REQUIRE(delays[0] < 50ms);
+  REQUIRE(delays[1] >= 50ms);
+}
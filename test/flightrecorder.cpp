@@ -0,0 +1,136 @@
+#include "wsudo/flightrecorder.h"
+
+#include <catch.hpp>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace wsudo;
+using recorder::Kind;
+
+namespace {
+  std::string takeDump(uint32_t processId = 1, uint64_t wallTime = 2) {
+    std::string data;
+    auto append = [](void *context, const void *bytes, size_t size) {
+      static_cast<std::string *>(context)->append(
+        static_cast<const char *>(bytes), size
+      );
+      return true;
+    };
+    REQUIRE(recorder::dump(append, &data, processId, wallTime));
+    return data;
+  }
+
+  // Entries on `track` with `tag`, in the order they were recorded.
+  std::vector<recorder::Entry> entriesFor(const recorder::Dump &dump,
+                                          uint32_t track,
+                                          std::string_view tag)
+  {
+    std::vector<recorder::Entry> entries;
+    for (auto &entry : dump.entries) {
+      if (entry.track == track && entry.tagName() == tag) {
+        entries.push_back(entry);
+      }
+    }
+    return entries;
+  }
+}
+
+// The recorder is always on and shared by the whole test process, so each
+// test uses its own track numbers.
+
+TEST_CASE("Flight recorder dumps round trip", "[flightrecorder]") {
+  recorder::record(Kind::State, 100, "CRED");
+  recorder::record(Kind::IO, 100, "read", 0, 512);
+  recorder::record(Kind::Error, 100, "OpenProc", 5);
+  recorder::record(Kind::Note, 100, "a-long-tag-name", 1, 2);
+
+  auto dump = recorder::parseDump(takeDump(1234, 5678));
+  REQUIRE(dump);
+  REQUIRE(dump->processId == 1234);
+  REQUIRE(dump->wallTime == 5678);
+  REQUIRE(std::is_sorted(dump->entries.begin(), dump->entries.end(),
+                         [](auto &a, auto &b) { return a.time < b.time; }));
+
+  auto io = entriesFor(*dump, 100, "read");
+  REQUIRE(io.size() == 1);
+  REQUIRE(io[0].kind == Kind::IO);
+  REQUIRE(io[0].value == 512);
+  REQUIRE(io[0].time <= dump->steadyTime);
+
+  // Tags are cut to 8 characters.
+  auto note = entriesFor(*dump, 100, "a-long-t");
+  REQUIRE(note.size() == 1);
+  REQUIRE(note[0].code == 1);
+  REQUIRE(note[0].value == 2);
+
+  auto error = entriesFor(*dump, 100, "OpenProc");
+  REQUIRE(error.size() == 1);
+  auto line = recorder::formatEntry(error[0], dump->steadyTime);
+  REQUIRE(line.find("error  OpenProc 5 (0x5)") != std::string::npos);
+  REQUIRE(line.find(" ms  T") != std::string::npos);
+}
+
+TEST_CASE("Flight recorder keeps the newest entries", "[flightrecorder]") {
+  // A new thread gets a ring nobody else has written to.
+  std::thread{[] {
+    for (uint32_t i = 0; i < recorder::RingCapacity + 10; ++i) {
+      recorder::record(Kind::Note, 200, "step", i);
+    }
+  }}.join();
+
+  auto dump = recorder::parseDump(takeDump());
+  REQUIRE(dump);
+  auto steps = entriesFor(*dump, 200, "step");
+  REQUIRE(steps.size() == recorder::RingCapacity);
+  REQUIRE(steps.front().code == 10);
+  REQUIRE(steps.back().code == recorder::RingCapacity + 9);
+}
+
+TEST_CASE("Flight recorder dumps while threads record", "[flightrecorder]") {
+  constexpr uint32_t Threads = 4;
+  constexpr uint32_t Steps = 10000;
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < Threads; ++t) {
+    threads.emplace_back([t] {
+      for (uint32_t i = 0; i < Steps; ++i) {
+        recorder::record(Kind::Note, 300 + t, "work", i, i * 2);
+      }
+    });
+  }
+  // Entries being written during the dump are left out, never torn.
+  for (int i = 0; i < 20; ++i) {
+    auto dump = recorder::parseDump(takeDump());
+    REQUIRE(dump);
+    for (auto &entry : dump->entries) {
+      if (entry.tagName() == "work") {
+        REQUIRE(entry.value == entry.code * 2);
+      }
+    }
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  auto dump = recorder::parseDump(takeDump());
+  REQUIRE(dump);
+  for (uint32_t t = 0; t < Threads; ++t) {
+    auto work = entriesFor(*dump, 300 + t, "work");
+    REQUIRE(work.size() == recorder::RingCapacity);
+    REQUIRE(work.back().code == Steps - 1);
+  }
+}
+
+TEST_CASE("Damaged flight recorder dumps are rejected", "[flightrecorder]") {
+  recorder::record(Kind::State, 400, "reset");
+  auto data = takeDump();
+  REQUIRE(recorder::parseDump(data));
+
+  REQUIRE_FALSE(recorder::parseDump(""));
+  REQUIRE_FALSE(recorder::parseDump(data.substr(0, data.size() - 1)));
+  REQUIRE_FALSE(recorder::parseDump(data.substr(0, data.size() / 2)));
+  auto badMagic = data;
+  badMagic[0] = 'X';
+  REQUIRE_FALSE(recorder::parseDump(badMagic));
+}
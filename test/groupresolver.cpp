@@ -0,0 +1,91 @@
+#include "wsudo/groupresolver.h"
+
+#include <catch.hpp>
+#include <atomic>
+#include <thread>
+
+using namespace wsudo::session;
+using namespace std::chrono_literals;
+
+TEST_CASE("Group sets are sorted and case insensitive", "[groupresolver]") {
+  GroupSet groups{{"Users", "Administrators", "users"}};
+  REQUIRE(groups.names() ==
+          std::vector<std::string>{"administrators", "users"});
+  REQUIRE(groups.contains("USERS"));
+  REQUIRE_FALSE(groups.contains("guests"));
+
+  REQUIRE(groups.intersects(GroupSet{{"guests", "users"}}));
+  REQUIRE_FALSE(groups.intersects(GroupSet{{"guests"}}));
+  REQUIRE_FALSE(groups.intersects(GroupSet{}));
+}
+
+TEST_CASE("Group lookups are cached until they expire", "[groupresolver]") {
+  int lookups = 0;
+  GroupResolver resolver{
+    [&](const std::string &user) -> std::optional<std::vector<std::string>> {
+      ++lookups;
+      if (user == "ghost") {
+        return std::nullopt;
+      }
+      return std::vector<std::string>{"users"};
+    },
+    60s, 5s
+  };
+  auto now = GroupClock::time_point{} + 1h;
+
+  auto groups = resolver.resolve("alice", now);
+  REQUIRE(groups->contains("users"));
+  REQUIRE(resolver.resolve("ALICE", now + 59s) == groups);
+  REQUIRE(lookups == 1);
+  REQUIRE(resolver.resolve("alice", now + 60s) != groups);
+  REQUIRE(lookups == 2);
+
+  // Failures are remembered for the shorter TTL, and aren't mistaken for
+  // having no groups.
+  REQUIRE_FALSE(resolver.resolve("ghost", now));
+  resolver.resolve("ghost", now + 4s);
+  REQUIRE(lookups == 3);
+  resolver.resolve("ghost", now + 5s);
+  REQUIRE(lookups == 4);
+
+  resolver.clear();
+  resolver.resolve("alice", now + 61s);
+  REQUIRE(lookups == 5);
+
+  auto stats = resolver.stats();
+  REQUIRE(stats.hits == 2);
+  REQUIRE(stats.misses == 5);
+  REQUIRE(stats.failures == 2);
+}
+
+TEST_CASE("Concurrent lookups for a user are shared", "[groupresolver]") {
+  std::atomic<int> lookups{0};
+  std::atomic<bool> release{false};
+  GroupResolver resolver{
+    [&](const std::string &) -> std::optional<std::vector<std::string>> {
+      ++lookups;
+      while (!release) {
+        std::this_thread::yield();
+      }
+      return std::vector<std::string>{"users"};
+    }
+  };
+
+  std::vector<std::thread> threads;
+  std::vector<std::shared_ptr<const GroupSet>> results(8);
+  for (size_t i = 0; i < results.size(); ++i) {
+    threads.emplace_back([&, i] { results[i] = resolver.resolve("alice"); });
+  }
+  // Give every thread time to find the lookup in progress.
+  while (resolver.stats().hits + resolver.stats().misses < results.size()) {
+    std::this_thread::yield();
+  }
+  release = true;
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  REQUIRE(lookups == 1);
+  for (auto &result : results) {
+    REQUIRE(result == results[0]);
+  }
+}
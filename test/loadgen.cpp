@@ -0,0 +1,96 @@
+#include "wsudo/loadgen.h"
+
+#include <catch.hpp>
+
+using namespace wsudo;
+using namespace std::chrono_literals;
+using loadgen::Clock;
+using loadgen::Mix;
+using loadgen::Outcome;
+using loadgen::Request;
+
+TEST_CASE("Mixes parse weights by message type", "[loadgen]") {
+  auto mix = Mix::parse("qses=1,cred=2,bles=7");
+  REQUIRE(mix);
+  REQUIRE(mix->weight(Request::Query) == 1);
+  REQUIRE(mix->weight(Request::Credential) == 2);
+  REQUIRE(mix->weight(Request::Bless) == 7);
+  REQUIRE(mix->total() == 10);
+
+  auto blessOnly = Mix::parse("bles=3");
+  REQUIRE(blessOnly);
+  REQUIRE(blessOnly->weight(Request::Query) == 0);
+  REQUIRE(blessOnly->total() == 3);
+
+  REQUIRE_FALSE(Mix::parse(""));
+  REQUIRE_FALSE(Mix::parse("qses=0"));
+  REQUIRE_FALSE(Mix::parse("qses"));
+  REQUIRE_FALSE(Mix::parse("spwn=1"));
+  REQUIRE_FALSE(Mix::parse("qses=1,"));
+  REQUIRE_FALSE(Mix::parse("qses=-1"));
+  REQUIRE_FALSE(Mix::parse("qses=1x"));
+}
+
+TEST_CASE("Mixes pick types in proportion to their weights", "[loadgen]") {
+  auto mix = Mix::parse("qses=1,cred=0,bles=3");
+  REQUIRE(mix);
+  size_t picked[loadgen::RequestTypes]{};
+  for (uint32_t random = 0; random < 400; ++random) {
+    ++picked[static_cast<size_t>(mix->pick(random))];
+  }
+  REQUIRE(picked[static_cast<size_t>(Request::Query)] == 100);
+  REQUIRE(picked[static_cast<size_t>(Request::Credential)] == 0);
+  REQUIRE(picked[static_cast<size_t>(Request::Bless)] == 300);
+}
+
+TEST_CASE("Schedules space requests evenly", "[loadgen]") {
+  auto start = Clock::now();
+  loadgen::Schedule schedule{1000, start};
+
+  REQUIRE(schedule.at(0) == start);
+  REQUIRE(schedule.at(1) == start + 1ms);
+  REQUIRE(schedule.at(500) == start + 500ms);
+
+  REQUIRE(schedule.due(start - 1ms) == 0);
+  REQUIRE(schedule.due(start) == 1);
+  REQUIRE(schedule.due(start + 1ms - 1ns) == 1);
+  REQUIRE(schedule.due(start + 1ms) == 2);
+  REQUIRE(schedule.due(start + 1s) == 1001);
+
+  // Requests stay due however late they're looked at, so a stall delays
+  // them instead of skipping them.
+  loadgen::Schedule slow{3, start};
+  for (auto later : {0ms, 333ms, 334ms, 10000ms}) {
+    auto now = start + later;
+    auto due = slow.due(now);
+    REQUIRE(slow.at(due - 1) <= now);
+    REQUIRE(slow.at(due) > now);
+  }
+}
+
+TEST_CASE("Results keep latency for answered requests", "[loadgen]") {
+  loadgen::Results results;
+  for (int i = 0; i < 99; ++i) {
+    results.record(Request::Bless, Outcome::Success, 1ms);
+  }
+  results.record(Request::Bless, Outcome::Denied, 100ms);
+  results.record(Request::Bless, Outcome::Busy, 1us);
+  results.record(Request::Query, Outcome::Error, 1us);
+
+  REQUIRE(results.count(Request::Bless, Outcome::Success) == 99);
+  REQUIRE(results.count(Request::Bless, Outcome::Busy) == 1);
+  REQUIRE(results.count(Request::Query, Outcome::Error) == 1);
+
+  auto latency = results.latency(Request::Bless);
+  REQUIRE(latency.count == 100);
+  REQUIRE(latency.quantile(0.5) >= 1000000);
+  REQUIRE(latency.quantile(0.5) < 1200000);
+  REQUIRE(latency.quantile(0.999) >= 100000000);
+  REQUIRE(results.latency(Request::Query).count == 0);
+
+  auto report = results.report(1s);
+  REQUIRE(report.find("BLES") != std::string::npos);
+  REQUIRE(report.find("QSES") != std::string::npos);
+  REQUIRE(report.find("CRED") == std::string::npos);
+  REQUIRE(report.find("all") != std::string::npos);
+}
@@ -0,0 +1,112 @@
+#include "wsudo/metrics.h"
+
+#include <catch.hpp>
+#include <thread>
+#include <vector>
+
+using namespace wsudo;
+using metrics::Histogram;
+
+TEST_CASE("Sharded counters add up across threads", "[metrics]") {
+  metrics::Counter counter;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([&] {
+      for (int i = 0; i < 10000; ++i) {
+        counter.add();
+      }
+    });
+  }
+  // Reading while threads add is safe.
+  auto partial = counter.value();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  REQUIRE(partial <= 80000);
+  REQUIRE(counter.value() == 80000);
+}
+
+TEST_CASE("Histogram buckets are log-linear", "[metrics]") {
+  // Small values get a bucket each.
+  for (uint64_t v = 0; v < Histogram::SubBuckets; ++v) {
+    REQUIRE(Histogram::bucketIndex(v) == v);
+  }
+  // Every bucket holds exactly the values between its bounds.
+  for (size_t i = 0; i < Histogram::Buckets; ++i) {
+    auto low = Histogram::bucketLowerBound(i);
+    auto high = Histogram::bucketUpperBound(i);
+    REQUIRE(low <= high);
+    REQUIRE(Histogram::bucketIndex(low) == i);
+    REQUIRE(Histogram::bucketIndex(high) == i);
+    if (i + 1 < Histogram::Buckets) {
+      REQUIRE(high + 1 == Histogram::bucketLowerBound(i + 1));
+    }
+    // Relative bucket width stays bounded.
+    if (low >= Histogram::SubBuckets) {
+      REQUIRE((high - low) * Histogram::SubBuckets <= low);
+    }
+  }
+  REQUIRE(Histogram::bucketIndex(~uint64_t{0}) == Histogram::Buckets - 1);
+}
+
+TEST_CASE("Histogram quantiles", "[metrics]") {
+  Histogram histogram;
+  REQUIRE(histogram.snapshot().quantile(0.5) == 0);
+  for (uint64_t v = 1; v <= 1000; ++v) {
+    histogram.record(v * 1000);
+  }
+  auto snapshot = histogram.snapshot();
+  REQUIRE(snapshot.count == 1000);
+  REQUIRE(snapshot.sum == 500500 * 1000);
+  auto p50 = snapshot.quantile(0.5);
+  REQUIRE(p50 >= 500000);
+  REQUIRE(p50 <= 500000 * 9 / 8);
+  auto p99 = snapshot.quantile(0.99);
+  REQUIRE(p99 >= 990000);
+  REQUIRE(p99 <= 990000 * 9 / 8);
+  REQUIRE(snapshot.quantile(1.0) >= 1000000);
+}
+
+TEST_CASE("Registry exports Prometheus text", "[metrics]") {
+  metrics::Registry registry;
+  auto &allowed = registry.counter("wsudo_requests_total", "Requests.",
+                                   {{"type", "bless"}, {"outcome", "ok"}});
+  auto &denied = registry.counter("wsudo_requests_total", "Requests.",
+                                  {{"type", "bless"}, {"outcome", "de\"nied"}});
+  auto &sessions = registry.gauge("wsudo_sessions", "Sessions.");
+  auto &mirror = registry.counterGauge("wsudo_cache_hits_total", "Hits.");
+  auto &latency = registry.histogram("wsudo_latency_seconds", "Latency.",
+                                     {{"type", "bless"}});
+  int updates = 0;
+  registry.onSnapshot([&] {
+    ++updates;
+    sessions.set(3);
+  });
+
+  allowed.add(2);
+  denied.add();
+  mirror.set(7);
+  latency.record(2000000);
+
+  auto text = registry.snapshot();
+  REQUIRE(updates == 1);
+  REQUIRE(text.find("# HELP wsudo_requests_total Requests.\n"
+                    "# TYPE wsudo_requests_total counter\n"
+                    "wsudo_requests_total{type=\"bless\",outcome=\"ok\"} 2\n"
+                    "wsudo_requests_total{type=\"bless\","
+                    "outcome=\"de\\\"nied\"} 1\n")
+          != std::string::npos);
+  REQUIRE(text.find("# TYPE wsudo_sessions gauge\nwsudo_sessions 3\n")
+          != std::string::npos);
+  REQUIRE(text.find("# TYPE wsudo_cache_hits_total counter\n"
+                    "wsudo_cache_hits_total 7\n")
+          != std::string::npos);
+  REQUIRE(text.find("# TYPE wsudo_latency_seconds summary\n")
+          != std::string::npos);
+  REQUIRE(text.find("wsudo_latency_seconds{type=\"bless\",quantile=\"0.5\"} ")
+          != std::string::npos);
+  REQUIRE(text.find("wsudo_latency_seconds_sum{type=\"bless\"} 0.002\n")
+          != std::string::npos);
+  REQUIRE(text.find("wsudo_latency_seconds_count{type=\"bless\"} 1\n")
+          != std::string::npos);
+}
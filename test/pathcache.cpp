@@ -0,0 +1,122 @@
+#include "wsudo/pathcache.h"
+
+#include <catch.hpp>
+#include <map>
+
+using namespace wsudo;
+
+namespace {
+  // In-memory directories that count how often they're read.
+  class FakeFileSystem : public PathCache::FileSystem {
+  public:
+    struct Directory {
+      uint64_t time;
+      std::vector<std::wstring> names;
+    };
+
+    std::map<std::wstring, Directory> directories;
+    int timeReads = 0;
+    int listings = 0;
+
+    std::optional<uint64_t>
+    directoryTime(const std::wstring &directory) override {
+      ++timeReads;
+      auto it = directories.find(directory);
+      if (it == directories.end()) {
+        return std::nullopt;
+      }
+      return it->second.time;
+    }
+
+    std::optional<std::vector<std::wstring>>
+    list(const std::wstring &directory) override {
+      ++listings;
+      auto it = directories.find(directory);
+      if (it == directories.end()) {
+        return std::nullopt;
+      }
+      return it->second.names;
+    }
+  };
+
+  const std::wstring PathExt = L".COM;.EXE;.BAT";
+}
+
+TEST_CASE("Programs are found in PATH order", "[pathcache]") {
+  FakeFileSystem fs;
+  fs.directories[L"C:\\Tools"] = {1, {L"Deploy.bat", L"readme.txt"}};
+  fs.directories[L"C:\\Windows\\System32"] = {1, {L"whoami.exe",
+                                                  L"deploy.exe"}};
+  fs.directories[L"C:\\Windows"] = {1, {L"whoami.com"}};
+  auto path = splitPath(
+    L"C:\\Missing;\"C:\\Tools\";;C:\\Windows\\System32;C:\\Windows"
+  );
+  REQUIRE(path.size() == 4);
+
+  PathCache cache{fs, PathExt};
+  REQUIRE(cache.resolve(L"whoami", path) ==
+          L"C:\\Windows\\System32\\whoami.exe");
+  // Earlier directories win over better extensions.
+  REQUIRE(cache.resolve(L"DEPLOY", path) == L"C:\\Tools\\DEPLOY.bat");
+  // A name with an extension is tried as is first.
+  REQUIRE(cache.resolve(L"whoami.com", path) == L"C:\\Windows\\whoami.com");
+  // Only PATHEXT files are programs.
+  REQUIRE_FALSE(cache.resolve(L"readme.txt", path));
+  REQUIRE_FALSE(cache.resolve(L"readme", path));
+  REQUIRE_FALSE(cache.resolve(L"nothing", path));
+  // Names with a directory aren't looked up.
+  REQUIRE_FALSE(cache.resolve(L".\\whoami", path));
+  REQUIRE_FALSE(cache.resolve(L"C:whoami", path));
+}
+
+TEST_CASE("Directories are listed again only when they change",
+          "[pathcache]")
+{
+  FakeFileSystem fs;
+  fs.directories[L"C:\\A"] = {1, {L"a.exe"}};
+  fs.directories[L"C:\\B"] = {1, {L"b.exe"}};
+  std::vector<std::wstring> path{L"C:\\A", L"C:\\B"};
+
+  PathCache cache{fs, PathExt};
+  REQUIRE(cache.resolve(L"a", path));
+  REQUIRE(fs.listings == 1);
+  REQUIRE(cache.dirty());
+
+  // Warm lookups only read the directory times up to the match.
+  fs.timeReads = 0;
+  REQUIRE(cache.resolve(L"a", path));
+  REQUIRE(fs.timeReads == 1);
+  REQUIRE(fs.listings == 1);
+
+  fs.directories[L"C:\\A"] = {2, {L"a.exe", L"b.exe"}};
+  REQUIRE(cache.resolve(L"b", path) == L"C:\\A\\b.exe");
+  REQUIRE(fs.listings == 2);
+}
+
+TEST_CASE("Path caches survive being saved", "[pathcache]") {
+  FakeFileSystem fs;
+  fs.directories[L"C:\\A"] = {1, {L"a.exe", L"z.exe", L"m.bat"}};
+  std::vector<std::wstring> path{L"C:\\A"};
+
+  PathCache cache{fs, PathExt};
+  REQUIRE(cache.resolve(L"m", path));
+  auto saved = cache.save();
+
+  PathCache loaded{fs, PathExt};
+  REQUIRE(loaded.load(saved.data(), saved.size()));
+  REQUIRE_FALSE(loaded.dirty());
+  REQUIRE(loaded.resolve(L"z", path) == L"C:\\A\\z.exe");
+  REQUIRE(fs.listings == 1);
+
+  SECTION("Another PATHEXT invalidates the cache") {
+    PathCache other{fs, L".EXE"};
+    REQUIRE_FALSE(other.load(saved.data(), saved.size()));
+  }
+
+  SECTION("Truncated caches are rejected") {
+    for (size_t size = 0; size < saved.size(); ++size) {
+      PathCache truncated{fs, PathExt};
+      REQUIRE_FALSE(truncated.load(saved.data(), size));
+    }
+  }
+}
@@ -0,0 +1,199 @@
+#include "wsudo/policy.h"
+
+#include <catch.hpp>
+#include <cstring>
+
+using namespace wsudo::policy;
+
+namespace {
+  const std::vector<std::string> NoGroups;
+
+  Policy compileOrFail(std::string_view text) {
+    CompileError error;
+    auto policy = Policy::compile(text, &error);
+    INFO("line " << error.line << ": " << error.message);
+    REQUIRE(policy);
+    return std::move(*policy);
+  }
+}
+
+TEST_CASE("Policy rules match users, groups and paths", "[policy]") {
+  auto policy = compileOrFail(R"(
+# Comment
+alice = C:\Windows\System32\cmd.exe
+%Administrators = ALL
+bob, carol = C:\Tools\**
+carol = "C:\Program Files\Git\bin\git.exe" pull *
+dave = C:\Windows\System32\net.exe ""
+dave = C:\Windows\System32\*.msc
+ALL = !C:\Windows\System32\format.com
+)");
+  REQUIRE(policy.ruleCount() == 7);
+
+  SECTION("Users") {
+    auto decision = policy.evaluate("Alice", NoGroups,
+                                    "c:/windows/system32/CMD.EXE", "/c dir");
+    REQUIRE(decision);
+    REQUIRE(decision.line == 3);
+    REQUIRE_FALSE(policy.evaluate("alice", NoGroups,
+                                  "C:\\Windows\\System32\\notepad.exe", ""));
+    REQUIRE_FALSE(policy.evaluate("mallory", NoGroups,
+                                  "C:\\Windows\\System32\\cmd.exe", ""));
+  }
+
+  SECTION("Groups and ALL") {
+    std::vector<std::string> groups{"Users", "administrators"};
+    REQUIRE(policy.evaluate("mallory", groups, "D:\\anything.exe", "x"));
+    // The later deny rule wins.
+    auto decision = policy.evaluate("mallory", groups,
+                                    "C:\\Windows\\System32\\format.com", "");
+    REQUIRE_FALSE(decision);
+    REQUIRE(decision.line == 9);
+  }
+
+  SECTION("Subtrees") {
+    REQUIRE(policy.evaluate("bob", NoGroups, "C:\\Tools\\a\\b\\c.exe", ""));
+    REQUIRE(policy.evaluate("carol", NoGroups, "C:\\Tools\\x.exe", ""));
+    REQUIRE_FALSE(policy.evaluate("bob", NoGroups, "C:\\Tools", ""));
+    REQUIRE_FALSE(policy.evaluate("bob", NoGroups, "C:\\Toolsx\\a.exe", ""));
+  }
+
+  SECTION("Arguments") {
+    auto git = "C:\\Program Files\\Git\\bin\\git.exe";
+    REQUIRE(policy.evaluate("carol", NoGroups, git, "pull origin"));
+    REQUIRE_FALSE(policy.evaluate("carol", NoGroups, git, "push origin"));
+    REQUIRE_FALSE(policy.evaluate("carol", NoGroups, git, ""));
+
+    auto net = "C:\\Windows\\System32\\net.exe";
+    REQUIRE(policy.evaluate("dave", NoGroups, net, "  "));
+    REQUIRE_FALSE(policy.evaluate("dave", NoGroups, net, "user"));
+  }
+
+  SECTION("Segment globs") {
+    REQUIRE(policy.evaluate("dave", NoGroups,
+                            "C:\\Windows\\System32\\services.msc", ""));
+    REQUIRE_FALSE(policy.evaluate("dave", NoGroups,
+                                  "C:\\Windows\\System32\\a\\b.msc", ""));
+  }
+}
+
+TEST_CASE("Invalid policies report the line", "[policy]") {
+  auto check = [](std::string_view text, uint32_t line) {
+    CompileError error;
+    REQUIRE_FALSE(Policy::compile(text, &error));
+    REQUIRE(error.line == line);
+    REQUIRE_FALSE(error.message.empty());
+  };
+  check("alice C:\\x.exe", 1);
+  check("\n= C:\\x.exe", 2);
+  check("alice = relative.exe", 1);
+  check("alice = C:\\dir\\", 1);
+  check("alice = C:\\**\\x.exe", 1);
+  check("alice = \"C:\\x.exe", 1);
+  check("alice = ALL args", 1);
+  check("% = ALL", 1);
+  check("alice = sha256:abc C:\\x.exe", 1);
+  check("alice = sha256:" + std::string(64, 'g') + " C:\\x.exe", 1);
+}
+
+TEST_CASE("Digest rules only match the pinned file", "[policy]") {
+  Digest digest;
+  for (size_t i = 0; i < digest.size(); ++i) {
+    digest[i] = static_cast<unsigned char>(i * 7);
+  }
+  std::string hex;
+  for (auto byte : digest) {
+    hex += "0123456789ABCDEF"[byte >> 4];
+    hex += "0123456789abcdef"[byte & 15];
+  }
+  auto policy = compileOrFail(
+    "alice = sha256:" + hex + " C:\\Tools\\deploy.exe\n"
+    "bob = C:\\Tools\\deploy.exe\n"
+  );
+  REQUIRE(policy.usesDigests());
+  REQUIRE_FALSE(compileOrFail("bob = ALL").usesDigests());
+
+  auto other = digest;
+  other[31] ^= 1;
+  REQUIRE(policy.evaluate("alice", NoGroups, "C:\\Tools\\deploy.exe", "",
+                          &digest));
+  REQUIRE_FALSE(policy.evaluate("alice", NoGroups, "C:\\Tools\\deploy.exe",
+                                "", &other));
+  REQUIRE_FALSE(policy.evaluate("alice", NoGroups, "C:\\Tools\\deploy.exe",
+                                ""));
+  // Rules without a digest ignore it.
+  REQUIRE(policy.evaluate("bob", NoGroups, "C:\\Tools\\deploy.exe", "",
+                          &other));
+
+  auto image = Policy::compileImage(
+    "alice = sha256:" + hex + " C:\\Tools\\deploy.exe\n"
+  );
+  REQUIRE(image);
+  auto storage = std::make_shared<std::vector<char>>(std::move(*image));
+  auto loaded = Policy::load({storage, storage->data()}, storage->size());
+  REQUIRE(loaded);
+  REQUIRE(loaded->usesDigests());
+  REQUIRE(loaded->evaluate("alice", NoGroups, "C:\\Tools\\deploy.exe", "",
+                           &digest));
+}
+
+TEST_CASE("An empty policy denies everything", "[policy]") {
+  Policy empty;
+  REQUIRE_FALSE(empty.evaluate("alice", NoGroups, "C:\\x.exe", ""));
+  auto compiled = compileOrFail("# Nothing here.\n");
+  REQUIRE(compiled.ruleCount() == 0);
+  REQUIRE_FALSE(compiled.evaluate("alice", NoGroups, "C:\\x.exe", ""));
+}
+
+TEST_CASE("Globs match like fnmatch", "[policy]") {
+  REQUIRE(globMatch("*", ""));
+  REQUIRE(globMatch("a*b*c", "aXbYbZc"));
+  REQUIRE(globMatch("?x*", "ax"));
+  REQUIRE_FALSE(globMatch("?x*", "x"));
+  REQUIRE_FALSE(globMatch("a*b", "aXbY"));
+  REQUIRE(globMatch("pull *", "pull origin main"));
+}
+
+TEST_CASE("Policy images are used in place", "[policy]") {
+  auto image = Policy::compileImage(R"(
+alice = C:\Tools\**
+ALL = !C:\Tools\bad.exe
+)");
+  REQUIRE(image);
+
+  // Copy into storage the test owns, as a mapped file would be.
+  auto storage = std::make_shared<std::vector<uint64_t>>(
+    (image->size() + 7) / 8
+  );
+  std::memcpy(storage->data(), image->data(), image->size());
+  std::shared_ptr<const void> view{storage, storage->data()};
+  auto policy = Policy::load(view, image->size());
+  REQUIRE(policy);
+  REQUIRE(policy->ruleCount() == 2);
+  REQUIRE(policy->evaluate("alice", NoGroups, "C:\\Tools\\ok.exe", ""));
+  REQUIRE_FALSE(policy->evaluate("alice", NoGroups, "C:\\Tools\\bad.exe", ""));
+
+  SECTION("Bad headers are rejected") {
+    REQUIRE_FALSE(Policy::load(view, 16));
+    auto bytes = reinterpret_cast<char *>(storage->data());
+    bytes[4] ^= 1;
+    REQUIRE_FALSE(Policy::load(view, image->size()));
+  }
+
+  SECTION("Tables past the end are rejected") {
+    REQUIRE_FALSE(Policy::load(view, image->size() - 1));
+  }
+
+  SECTION("Corrupt tables can't read outside the image") {
+    // Scribble over everything after the header; lookups must stay in
+    // bounds and fail closed.
+    auto bytes = reinterpret_cast<unsigned char *>(storage->data());
+    for (size_t i = 80; i < image->size(); ++i) {
+      bytes[i] = static_cast<unsigned char>(i * 37);
+    }
+    auto corrupt = Policy::load(view, image->size());
+    if (corrupt) {
+      corrupt->evaluate("alice", NoGroups, "C:\\Tools\\ok.exe", "");
+    }
+  }
+}
@@ -0,0 +1,3 @@
+// Runner for the tests that don't depend on Windows. They build everywhere.
+#define CATCH_CONFIG_MAIN
+#include <catch.hpp>
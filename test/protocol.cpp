@@ -0,0 +1,204 @@
+#include "wsudo/server.h"
+#include "wsudo/client.h"
+#include "wsudo/loadtest.h"
+
+#include <catch.hpp>
+#include <sodium.h>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+
+using namespace wsudo;
+using namespace wsudo::server;
+using namespace wsudo::events;
+
+namespace {
+  const wchar_t *const ProtocolPipeName =
+    L"\\\\.\\pipe\\wsudo_test_protocol";
+
+  // A server on its own pipe, with its event loop on another thread. Its
+  // ticket keys only live in memory, and nothing is audited.
+  class TestServer {
+  public:
+    explicit TestServer(bool loadTest) {
+      _context = std::make_unique<ServerContext>(
+        60, std::wstring{}, std::wstring{}, nullptr
+      );
+      _context->loadTest = loadTest;
+      _context->ticketKeys.rotate(unixNow());
+
+      NamedPipeHandleFactory factory{ProtocolPipeName};
+      REQUIRE(factory.good());
+      _quitEvent = CreateEventW(nullptr, true, false, nullptr);
+      _listener.emplace(_quitEvent, [](EventListener &listener) {
+        listener.stop();
+        return EventStatus::Finished;
+      });
+      for (int id = 1; id <= MaxPipeConnections; ++id) {
+        _listener.emplace<ClientConnectionHandler>(factory(), id, *_context);
+      }
+      _thread = std::thread{[this] { _listener.run(); }};
+    }
+
+    ~TestServer() {
+      SetEvent(_quitEvent);
+      _thread.join();
+    }
+
+    ServerContext &context() { return *_context; }
+
+  private:
+    std::unique_ptr<ServerContext> _context;
+    EventListener _listener;
+    // Owned by the listener.
+    HANDLE _quitEvent;
+    std::thread _thread;
+  };
+
+  // Sends raw messages and returns the raw replies, so their lengths can be
+  // checked.
+  class TestClient {
+  public:
+    TestClient() {
+      HANDLE pipe = CreateFileW(ProtocolPipeName,
+                                GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+                                OPEN_EXISTING, 0, nullptr);
+      REQUIRE(pipe != INVALID_HANDLE_VALUE);
+      _pipe = pipe;
+      DWORD mode = PIPE_READMODE_MESSAGE;
+      REQUIRE(SetNamedPipeHandleState(_pipe, &mode, nullptr, nullptr));
+    }
+
+    std::string send(const char *header, std::string_view body = {}) {
+      std::string message{header};
+      message.append(body);
+      std::string reply(PipeBufferSize, '\0');
+      DWORD bytes;
+      REQUIRE(TransactNamedPipe(_pipe, message.data(),
+                                static_cast<DWORD>(message.size()),
+                                reply.data(), static_cast<DWORD>(reply.size()),
+                                &bytes, nullptr));
+      reply.resize(bytes);
+      return reply;
+    }
+
+  private:
+    HObject _pipe;
+  };
+
+  std::string_view header(std::string_view reply) {
+    return reply.substr(0, 4);
+  }
+
+  std::string credential(std::string_view username) {
+    std::string body{username};
+    body.push_back('\0');
+    body.append(LoadTestPassword);
+    return body;
+  }
+}
+
+TEST_CASE("Replies are exactly as long as their messages", "[protocol]") {
+  REQUIRE(sodium_init() >= 0);
+  TestServer server{true};
+  TestClient client;
+
+  auto reply = client.send(msg::client::Credential, credential("loadtest"));
+  REQUIRE(header(reply) == msg::server::Success);
+
+  // A bless reply has 4 bytes for each handle in the request, which is
+  // shorter than the request.
+  HANDLE processes[8];
+  std::fill(std::begin(processes), std::end(processes), GetCurrentProcess());
+  reply = client.send(msg::client::Bless, std::string_view{
+    reinterpret_cast<const char *>(processes), sizeof(processes)
+  });
+  REQUIRE(header(reply) == msg::server::Success);
+  REQUIRE(reply.size() == 4 + std::size(processes) * sizeof(uint32_t));
+  for (size_t i = 0; i < std::size(processes); ++i) {
+    uint32_t status;
+    std::memcpy(&status, reply.data() + 4 + i * sizeof(uint32_t),
+                sizeof(status));
+    REQUIRE(status == msg::BlessOk);
+  }
+
+  reply = client.send(msg::client::QuerySession);
+  REQUIRE(reply == msg::server::Success);
+}
+
+TEST_CASE("Tickets from a credential message resume a session",
+          "[protocol]")
+{
+  REQUIRE(sodium_init() >= 0);
+  TestServer server{true};
+
+  std::string ticket;
+  {
+    TestClient client;
+    auto reply = client.send(msg::client::Credential,
+                             credential("loadtest"));
+    REQUIRE(header(reply) == msg::server::Success);
+    ticket = reply.substr(4);
+    REQUIRE_FALSE(ticket.empty());
+  }
+
+  TestClient client;
+  REQUIRE(header(client.send(msg::client::QuerySession)) ==
+          msg::server::AccessDenied);
+  REQUIRE(client.send(msg::client::Resume, ticket) == msg::server::Success);
+  REQUIRE(client.send(msg::client::QuerySession) == msg::server::Success);
+}
+
+TEST_CASE("Spawn replies are exactly as long as their messages",
+          "[protocol]")
+{
+  REQUIRE(sodium_init() >= 0);
+  TestServer server{true};
+  TestClient client;
+
+  // Leave a long request in the buffer before the spawn reply.
+  auto reply = client.send(msg::client::Credential,
+                           credential(std::string(200, 'u')));
+  REQUIRE(header(reply) == msg::server::Success);
+
+  SpawnRequest request;
+  request.commandLine = L"cmd.exe /c exit 7";
+  auto body = encodeSpawnRequest(request);
+  reply = client.send(msg::client::Spawn, {body.data(), body.size()});
+  REQUIRE(reply == std::string{msg::server::AccessDenied} +
+                     "Spawning is disabled in load test mode.");
+}
+
+// Spawning for real needs the privileges the server runs with.
+TEST_CASE("Spawned processes are returned to the client",
+          "[protocol][.elevated]")
+{
+  REQUIRE(sodium_init() >= 0);
+  TestServer server{false};
+
+  // The server elevates with its own token, so a ticket for this logon
+  // session is all it takes to authenticate.
+  auto logonId = processLogonId(GetCurrentProcess());
+  REQUIRE(logonId);
+  auto ticket = issueTicket(
+    server.context().ticketKeys,
+    TicketClaims{"test", *logonId, unixNow() + TicketLifetime.count()}
+  );
+  ClientConnection client{ProtocolPipeName};
+  REQUIRE(client.good());
+  REQUIRE(client.resume(ticket));
+
+  SpawnRequest request;
+  request.commandLine = L"cmd.exe /c exit 7";
+  HObject process;
+  REQUIRE(client.spawn(request, process));
+  // The handle value and process ID, after the header.
+  REQUIRE(client.response().size() ==
+          4 + sizeof(uint64_t) + sizeof(uint32_t));
+  REQUIRE(WaitForSingleObject(process, 10000) == WAIT_OBJECT_0);
+  DWORD exitCode;
+  REQUIRE(GetExitCodeProcess(process, &exitCode));
+  REQUIRE(exitCode == 7);
+}
@@ -0,0 +1,109 @@
+#include "wsudo/securememory.h"
+
+#include <catch.hpp>
+#include <cstring>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace wsudo;
+
+TEST_CASE("Secure arena reuses released blocks", "[securememory]") {
+  SecureArena arena{4096};
+  auto first = arena.allocate(10);
+  REQUIRE(arena.stats().bytesInUse == SecureArena::MinBlockSize);
+  auto second = arena.allocate(100);
+  REQUIRE(arena.stats().bytesInUse == 3 * SecureArena::MinBlockSize);
+  REQUIRE(first != second);
+
+  std::memset(first, 'x', 10);
+  arena.deallocate(first, 10);
+  REQUIRE(arena.stats().bytesInUse == 2 * SecureArena::MinBlockSize);
+  // The same class gets the same block back, wiped.
+  auto third = static_cast<unsigned char *>(arena.allocate(64));
+  REQUIRE(third == first);
+  for (size_t i = 0; i < SecureArena::MinBlockSize; ++i) {
+    REQUIRE(third[i] == 0);
+  }
+  arena.deallocate(third, 64);
+  arena.deallocate(second, 100);
+  REQUIRE(arena.stats().bytesInUse == 0);
+  REQUIRE(arena.stats().fallbacks == 0);
+}
+
+TEST_CASE("Secure arena falls back when full", "[securememory]") {
+  SecureArena arena{SecureArena::MaxBlockSize};
+  auto whole = arena.allocate(SecureArena::MaxBlockSize);
+  REQUIRE(arena.stats().fallbacks == 0);
+  // The arena is full, and this is larger than any class.
+  auto small = arena.allocate(1);
+  auto large = arena.allocate(SecureArena::MaxBlockSize + 1);
+  REQUIRE(arena.stats().fallbacks == 2);
+  std::memset(small, 1, 1);
+  std::memset(large, 1, SecureArena::MaxBlockSize + 1);
+  arena.deallocate(large, SecureArena::MaxBlockSize + 1);
+  arena.deallocate(small, 1);
+  arena.deallocate(whole, SecureArena::MaxBlockSize);
+  REQUIRE(arena.stats().bytesInUse == 0);
+}
+
+TEST_CASE("Secure arena is thread safe", "[securememory]") {
+  SecureArena arena;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&arena, t] {
+      for (int i = 0; i < 2000; ++i) {
+        auto size = static_cast<size_t>(1 + (i * 37 + t) % 900);
+        auto block = static_cast<unsigned char *>(arena.allocate(size));
+        std::memset(block, t + 1, size);
+        arena.deallocate(block, size);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  REQUIRE(arena.stats().bytesInUse == 0);
+}
+
+TEST_CASE("Secure buffers have a fixed capacity", "[securememory]") {
+  SecureArena arena;
+  SecureBuffer<wchar_t> buffer{4, arena};
+  REQUIRE(buffer.capacity() == 4);
+  REQUIRE(buffer.push_back(L'a'));
+  REQUIRE(buffer.append(L"bcd", 3));
+  REQUIRE_FALSE(buffer.push_back(L'e'));
+  REQUIRE_FALSE(buffer.append(L"e", 1));
+  REQUIRE(buffer.view() == L"abcd");
+
+  buffer.pop_back();
+  REQUIRE(buffer.view() == L"abc");
+  // Removed elements are wiped.
+  REQUIRE(buffer.data()[3] == 0);
+  REQUIRE(buffer.resize(1));
+  REQUIRE(buffer.data()[1] == 0);
+  REQUIRE_FALSE(buffer.resize(5));
+  buffer.clear();
+  REQUIRE(buffer.empty());
+  REQUIRE(buffer.data()[0] == 0);
+}
+
+TEST_CASE("Secure buffers release their blocks", "[securememory]") {
+  SecureArena arena;
+  {
+    SecureBuffer<char> first{100, arena};
+    first.append("secret", 6);
+    REQUIRE(arena.stats().bytesInUse == 128);
+
+    auto second = std::move(first);
+    REQUIRE(first.data() == nullptr);
+    REQUIRE(second.view() == "secret");
+
+    SecureBuffer<char> third{10, arena};
+    third = std::move(second);
+    REQUIRE(third.view() == "secret");
+    REQUIRE(arena.stats().bytesInUse == 128);
+  }
+  REQUIRE(arena.stats().bytesInUse == 0);
+}
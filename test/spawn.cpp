@@ -0,0 +1,66 @@
+#include "wsudo/spawn.h"
+
+#include <catch.hpp>
+
+using namespace wsudo;
+
+namespace {
+  SpawnRequest request() {
+    SpawnRequest request;
+    request.input = 0x10;
+    request.output = 0x14;
+    request.error = 0x18;
+    request.commandLine = L"cmd.exe /c \"echo hi\"";
+    request.currentDirectory = L"C:\\Users";
+    request.environment = std::wstring{L"A=1\0PATH=C:\\\0\0", 15};
+    return request;
+  }
+
+  std::string_view view(const std::vector<char> &body) {
+    return std::string_view{body.data(), body.size()};
+  }
+}
+
+TEST_CASE("Spawn requests round trip", "[spawn]") {
+  auto body = encodeSpawnRequest(request());
+  auto decoded = decodeSpawnRequest(view(body));
+  REQUIRE(decoded);
+  REQUIRE(decoded->input == 0x10);
+  REQUIRE(decoded->output == 0x14);
+  REQUIRE(decoded->error == 0x18);
+  REQUIRE(decoded->commandLine == request().commandLine);
+  REQUIRE(decoded->currentDirectory == request().currentDirectory);
+  REQUIRE(decoded->environment == request().environment);
+
+  auto minimal = SpawnRequest{};
+  minimal.commandLine = L"a";
+  body = encodeSpawnRequest(minimal);
+  decoded = decodeSpawnRequest(view(body));
+  REQUIRE(decoded);
+  REQUIRE(decoded->currentDirectory.empty());
+  REQUIRE(decoded->environment.empty());
+}
+
+TEST_CASE("Malformed spawn requests are rejected", "[spawn]") {
+  auto body = encodeSpawnRequest(request());
+  REQUIRE_FALSE(decodeSpawnRequest(view(body).substr(0, body.size() - 1)));
+  REQUIRE_FALSE(decodeSpawnRequest(view(body).substr(0, 10)));
+  body.push_back(0);
+  REQUIRE_FALSE(decodeSpawnRequest(view(body)));
+
+  auto empty = SpawnRequest{};
+  REQUIRE_FALSE(decodeSpawnRequest(view(encodeSpawnRequest(empty))));
+
+  auto badEnv = request();
+  badEnv.environment = L"A=1";
+  REQUIRE_FALSE(decodeSpawnRequest(view(encodeSpawnRequest(badEnv))));
+
+  auto embeddedNul = request();
+  embeddedNul.commandLine.push_back(L'\0');
+  embeddedNul.commandLine.push_back(L'x');
+  REQUIRE_FALSE(decodeSpawnRequest(view(encodeSpawnRequest(embeddedNul))));
+
+  auto tooLong = request();
+  tooLong.commandLine.assign(MaxSpawnStringLength + 1, L'x');
+  REQUIRE_FALSE(decodeSpawnRequest(view(encodeSpawnRequest(tooLong))));
+}
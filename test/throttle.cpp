@@ -0,0 +1,104 @@
+#include "wsudo/throttle.h"
+
+#include <sodium.h>
+#include <catch.hpp>
+
+using namespace wsudo::server;
+using namespace std::chrono_literals;
+
+TEST_CASE("Token buckets refill over time", "[throttle]") {
+  TokenBucketTable table{3, 1000ms};
+  auto now = ThrottleClock::time_point{} + 1h;
+
+  REQUIRE(table.allowed(42, now));
+  REQUIRE(table.consume(42, now));
+  REQUIRE(table.consume(42, now));
+  REQUIRE(table.consume(42, now));
+  REQUIRE_FALSE(table.allowed(42, now));
+  REQUIRE_FALSE(table.consume(42, now));
+
+  // Other keys are unaffected.
+  REQUIRE(table.allowed(43, now));
+
+  REQUIRE_FALSE(table.allowed(42, now + 999ms));
+  REQUIRE(table.allowed(42, now + 1000ms));
+  REQUIRE(table.consume(42, now + 1000ms));
+  REQUIRE_FALSE(table.allowed(42, now + 1000ms));
+}
+
+TEST_CASE("Token bucket sets recycle the oldest slot", "[throttle]") {
+  TokenBucketTable table{1, 60s};
+  auto now = ThrottleClock::time_point{} + 1h;
+  constexpr auto stride = TokenBucketTable::Sets;
+
+  // Fill one set, oldest first.
+  for (uint64_t i = 1; i <= TokenBucketTable::Ways; ++i) {
+    REQUIRE(table.consume(i * stride, now + i * 1ms));
+  }
+  for (uint64_t i = 1; i <= TokenBucketTable::Ways; ++i) {
+    REQUIRE_FALSE(table.allowed(i * stride, now + 10ms));
+  }
+
+  // One more key in the same set evicts the first one.
+  const auto extra = (TokenBucketTable::Ways + 1) * stride;
+  REQUIRE(table.consume(extra, now + 10ms));
+  REQUIRE(table.allowed(stride, now + 10ms));
+  REQUIRE_FALSE(table.allowed(2 * stride, now + 10ms));
+}
+
+TEST_CASE("Negative cache entries expire", "[throttle]") {
+  NegativeCache cache{30s};
+  auto now = ThrottleClock::time_point{} + 1h;
+
+  REQUIRE_FALSE(cache.contains(7, now));
+  cache.insert(7, now);
+  REQUIRE(cache.contains(7, now + 29s));
+  REQUIRE_FALSE(cache.contains(7, now + 30s));
+}
+
+TEST_CASE("Usernames are normalized for the throttle", "[throttle]") {
+  for (auto name : {"alice", "Alice", ".\\alice", "HOST\\ALICE",
+                    "host\\alice", "alice@Host"})
+  {
+    REQUIRE(normalizeUsername(name, "HOST") == "alice");
+  }
+  REQUIRE(normalizeUsername("CORP\\Alice", "HOST") == "corp\\alice");
+  REQUIRE(normalizeUsername("alice@corp.example", "HOST") ==
+          "alice@corp.example");
+  REQUIRE(normalizeUsername("alice", "") == "alice");
+}
+
+TEST_CASE("Login throttle rejects repeated failures", "[throttle]") {
+  REQUIRE(sodium_init() >= 0);
+  LoginThrottle throttle;
+  auto now = ThrottleClock::time_point{} + 1h;
+
+  auto peer = throttle.hashPeer("peer", 4);
+  auto user = throttle.hashUser(peer, "alice");
+  auto bad = throttle.hashCredential("alice", "wrong");
+  auto good = throttle.hashCredential("alice", "right");
+  REQUIRE(bad != good);
+  REQUIRE(throttle.hashUser(peer, "alice") == user);
+
+  REQUIRE(throttle.check(user, peer, bad, now) == LoginThrottle::Allowed);
+  throttle.recordFailure(user, peer, bad, now);
+  REQUIRE(throttle.check(user, peer, bad, now) ==
+          LoginThrottle::RecentlyFailed);
+  REQUIRE(throttle.check(user, peer, good, now) == LoginThrottle::Allowed);
+
+  for (int i = 0; i < 10; ++i) {
+    throttle.recordFailure(user, peer,
+                           throttle.hashCredential("alice", "guess"), now);
+  }
+  REQUIRE(throttle.check(user, peer, good, now) ==
+          LoginThrottle::UserThrottled);
+
+  auto otherUser = throttle.hashUser(peer, "bob");
+  REQUIRE(throttle.check(otherUser, peer, good, now) ==
+          LoginThrottle::PeerThrottled);
+
+  // Another peer's failures for the same name don't lock the owner out.
+  auto owner = throttle.hashPeer("owner", 5);
+  REQUIRE(throttle.check(throttle.hashUser(owner, "alice"), owner, good,
+                         now) == LoginThrottle::Allowed);
+}
@@ -0,0 +1,76 @@
+#include "wsudo/ticket.h"
+
+#include <sodium.h>
+#include <catch.hpp>
+
+using namespace wsudo::server;
+
+namespace {
+  constexpr int64_t Now = 1700000000;
+
+  TicketClaims claims() {
+    return TicketClaims{"alice", 0x1234567890ABCDEF, Now + 600};
+  }
+
+  std::string_view view(const std::vector<char> &ticket) {
+    return std::string_view{ticket.data(), ticket.size()};
+  }
+}
+
+TEST_CASE("Tickets round trip", "[ticket]") {
+  REQUIRE(sodium_init() >= 0);
+  TicketKeyRing keys;
+  REQUIRE(issueTicket(keys, claims()).empty());
+  REQUIRE(keys.rotate(Now));
+  REQUIRE_FALSE(keys.rotate(Now + 1));
+
+  auto ticket = issueTicket(keys, claims());
+  REQUIRE_FALSE(ticket.empty());
+  auto opened = openTicket(keys, view(ticket), Now);
+  REQUIRE(opened);
+  REQUIRE(opened->username == "alice");
+  REQUIRE(opened->logonId == 0x1234567890ABCDEF);
+  REQUIRE(opened->expiresAt == Now + 600);
+}
+
+TEST_CASE("Tampered and expired tickets are rejected", "[ticket]") {
+  REQUIRE(sodium_init() >= 0);
+  TicketKeyRing keys;
+  keys.rotate(Now);
+  auto ticket = issueTicket(keys, claims());
+
+  REQUIRE_FALSE(openTicket(keys, view(ticket), Now + 600));
+
+  for (size_t i = 0; i < ticket.size(); ++i) {
+    auto tampered = ticket;
+    tampered[i] ^= 1;
+    REQUIRE_FALSE(openTicket(keys, view(tampered), Now));
+  }
+  REQUIRE_FALSE(openTicket(keys, view(ticket).substr(0, ticket.size() - 1),
+                           Now));
+  REQUIRE_FALSE(openTicket(keys, std::string_view{}, Now));
+
+  // Another server's keys can't open it.
+  TicketKeyRing otherKeys;
+  otherKeys.rotate(Now);
+  REQUIRE_FALSE(openTicket(otherKeys, view(ticket), Now));
+}
+
+TEST_CASE("Tickets survive one key rotation", "[ticket]") {
+  REQUIRE(sodium_init() >= 0);
+  TicketKeyRing keys;
+  keys.rotate(Now);
+  auto ticket = issueTicket(keys, claims());
+
+  auto later = Now + TicketKeyRotation.count();
+  REQUIRE(keys.rotate(later));
+  auto claimsLater = claims();
+  claimsLater.expiresAt = later + 600;
+  auto ticketLater = issueTicket(keys, claimsLater);
+  REQUIRE(openTicket(keys, view(ticket), Now));
+  REQUIRE(openTicket(keys, view(ticketLater), later));
+
+  REQUIRE(keys.rotate(later + TicketKeyRotation.count()));
+  REQUIRE_FALSE(openTicket(keys, view(ticket), Now));
+  REQUIRE(openTicket(keys, view(ticketLater), later));
+}
@@ -0,0 +1,105 @@
+#include "wsudo/trace.h"
+
+#include <catch.hpp>
+#include <thread>
+#include <vector>
+
+using namespace wsudo;
+
+namespace {
+  // Tracing is global; start each test from nothing.
+  struct TraceFixture {
+    TraceFixture() { trace::clear(); }
+    ~TraceFixture() {
+      trace::disable();
+      trace::clear();
+    }
+  };
+
+  size_t countOf(const std::string &text, const std::string &part) {
+    size_t count = 0;
+    for (auto pos = text.find(part); pos != std::string::npos;
+         pos = text.find(part, pos + 1))
+    {
+      ++count;
+    }
+    return count;
+  }
+}
+
+TEST_CASE("Spans aren't recorded while tracing is off", "[trace]") {
+  TraceFixture fixture;
+  trace::disable();
+  {
+    trace::Span span{"off", 1};
+  }
+  REQUIRE(trace::stats().recorded == 0);
+  REQUIRE(countOf(trace::exportJson(), "\"off\"") == 0);
+}
+
+TEST_CASE("Spans are exported as Chrome trace events", "[trace]") {
+  TraceFixture fixture;
+  trace::enable();
+  trace::nameTrack(7, "Client \"7\"");
+  {
+    trace::Span outer{"dispatch", 7};
+    trace::Span inner{"policy", 7};
+  }
+  trace::record("read", 7, 1000, 3500);
+  REQUIRE(trace::stats().recorded == 3);
+
+  auto json = trace::exportJson(42);
+  REQUIRE(json.rfind("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", 0) == 0);
+  REQUIRE(countOf(json, "\"ph\":\"X\"") == 3);
+  REQUIRE(countOf(json, "\"pid\":42,\"tid\":7") == 4);
+  REQUIRE(json.find("\"name\":\"dispatch\"") != std::string::npos);
+  REQUIRE(json.find("\"name\":\"policy\"") != std::string::npos);
+  // Microseconds, with the nanoseconds kept.
+  REQUIRE(json.find("\"name\":\"read\",\"cat\":\"wsudo\",\"ph\":\"X\","
+                    "\"pid\":42,\"tid\":7,\"ts\":1.000,\"dur\":2.500}")
+          != std::string::npos);
+  // Track names are escaped.
+  REQUIRE(json.find("\"args\":{\"name\":\"Client \\\"7\\\"\"}")
+          != std::string::npos);
+  // Sorted by start time, so the explicit span at 1 us comes first.
+  REQUIRE(json.find("\"read\"") < json.find("\"dispatch\""));
+}
+
+TEST_CASE("Trace rings keep the newest spans", "[trace]") {
+  TraceFixture fixture;
+  trace::enable(4);
+  // A new thread, so it gets a ring of the new size.
+  std::thread{[] {
+    for (uint64_t i = 0; i < 10; ++i) {
+      trace::record("step", 1, i * 1000, i * 1000 + 1);
+    }
+  }}.join();
+  auto stats = trace::stats();
+  REQUIRE(stats.recorded == 10);
+  REQUIRE(stats.overwritten == 6);
+  auto json = trace::exportJson();
+  REQUIRE(countOf(json, "\"step\"") == 4);
+  REQUIRE(json.find("\"ts\":5.000") == std::string::npos);
+  REQUIRE(json.find("\"ts\":6.000") != std::string::npos);
+  REQUIRE(json.find("\"ts\":9.000") != std::string::npos);
+}
+
+TEST_CASE("Spans from many threads are collected", "[trace]") {
+  TraceFixture fixture;
+  trace::enable();
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < 4; ++t) {
+    threads.emplace_back([t] {
+      for (int i = 0; i < 100; ++i) {
+        trace::Span span{"work", t};
+      }
+    });
+  }
+  // Exporting while threads record is safe.
+  auto partial = trace::exportJson();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  REQUIRE(countOf(partial, "\"work\"") <= 400);
+  REQUIRE(countOf(trace::exportJson(), "\"work\"") == 400);
+}
@@ -0,0 +1,219 @@
+#include "wsudo/utf.h"
+
+#include <catch.hpp>
+#include <iterator>
+#include <random>
+#include <string>
+
+using namespace wsudo;
+using namespace wsudo::utf;
+
+namespace {
+  // A deliberately simple reference decoder: take the bits a sequence's
+  // length implies, then reject anything that doesn't encode back the same
+  // way. Returns the code point and length, or nullopt if the sequence at
+  // `i` is invalid.
+  std::optional<std::pair<char32_t, size_t>>
+  referenceDecode(std::string_view s, size_t i) {
+    auto byte = [&](size_t k) { return static_cast<unsigned char>(s[k]); };
+    auto lead = byte(i);
+    size_t length = lead < 0x80 ? 1
+                  : (lead & 0xE0) == 0xC0 ? 2
+                  : (lead & 0xF0) == 0xE0 ? 3
+                  : (lead & 0xF8) == 0xF0 ? 4
+                  : 0;
+    if (length == 0 || i + length > s.size()) {
+      return std::nullopt;
+    }
+    char32_t codePoint = length == 1 ? lead : lead & (0x7F >> length);
+    for (size_t k = 1; k < length; ++k) {
+      if ((byte(i + k) & 0xC0) != 0x80) {
+        return std::nullopt;
+      }
+      codePoint = codePoint << 6 | (byte(i + k) & 0x3F);
+    }
+    size_t shortest = codePoint < 0x80 ? 1
+                    : codePoint < 0x800 ? 2
+                    : codePoint < 0x10000 ? 3
+                    : 4;
+    if (shortest != length || codePoint > 0x10FFFF ||
+        (codePoint >= 0xD800 && codePoint <= 0xDFFF))
+    {
+      return std::nullopt;
+    }
+    return std::pair{codePoint, length};
+  }
+
+  // UTF-16 for valid UTF-8, or nullopt.
+  std::optional<std::u16string> referenceUtf16(std::string_view s) {
+    std::u16string result;
+    for (size_t i = 0; i < s.size();) {
+      auto decoded = referenceDecode(s, i);
+      if (!decoded) {
+        return std::nullopt;
+      }
+      auto [codePoint, length] = *decoded;
+      if (codePoint < 0x10000) {
+        result.push_back(static_cast<char16_t>(codePoint));
+      } else {
+        result.push_back(
+          static_cast<char16_t>(0xD800 + ((codePoint - 0x10000) >> 10)));
+        result.push_back(
+          static_cast<char16_t>(0xDC00 + ((codePoint - 0x10000) & 0x3FF)));
+      }
+      i += length;
+    }
+    return result;
+  }
+
+  std::optional<std::u16string> toUtf16(std::string_view s,
+                                        Errors errors = Errors::Fail)
+  {
+    auto length = utf8ToUtf16(s, nullptr, 0, errors);
+    if (!length) {
+      return std::nullopt;
+    }
+    std::u16string result(*length, u'\0');
+    auto written = utf8ToUtf16(s, result.data(), result.size(), errors);
+    REQUIRE(written == length);
+    return result;
+  }
+
+  std::optional<std::string> toUtf8(std::u16string_view s,
+                                    Errors errors = Errors::Fail)
+  {
+    auto length = utf16ToUtf8(s, nullptr, 0, errors);
+    if (!length) {
+      return std::nullopt;
+    }
+    std::string result(*length, '\0');
+    auto written = utf16ToUtf8(s, result.data(), result.size(), errors);
+    REQUIRE(written == length);
+    return result;
+  }
+
+  // Bytes that matter to the decoder, with long ASCII runs mixed in so the
+  // vector paths see both clean and interrupted blocks.
+  std::string randomBytes(std::minstd_rand &random) {
+    static const unsigned char Interesting[] = {
+      0x00, 0x41, 0x7F, 0x80, 0x8F, 0x90, 0x9F, 0xA0, 0xBF, 0xC0, 0xC1, 0xC2,
+      0xDF, 0xE0, 0xE1, 0xED, 0xEE, 0xEF, 0xF0, 0xF1, 0xF4, 0xF5, 0xFF,
+    };
+    std::uniform_int_distribution<size_t> pick{0, std::size(Interesting) - 1};
+    std::uniform_int_distribution<size_t> run{0, 40};
+    std::uniform_int_distribution<int> coin{0, 3};
+    std::string s;
+    for (int pieces = 0; pieces < 8; ++pieces) {
+      if (coin(random) == 0) {
+        s.append(run(random), 'x');
+      } else {
+        s.push_back(static_cast<char>(Interesting[pick(random)]));
+      }
+    }
+    return s;
+  }
+
+  // Valid text built from code points of every length.
+  std::string randomText(std::minstd_rand &random) {
+    static const char32_t Ranges[][2] = {
+      {0x20, 0x7E}, {0x80, 0x7FF}, {0x800, 0xD7FF}, {0xE000, 0xFFFF},
+      {0x10000, 0x10FFFF},
+    };
+    std::uniform_int_distribution<size_t> pick{0, std::size(Ranges) - 1};
+    std::uniform_int_distribution<size_t> run{0, 70};
+    std::u16string s;
+    for (int pieces = 0; pieces < 6; ++pieces) {
+      auto [low, high] = Ranges[pick(random)];
+      std::uniform_int_distribution<char32_t> codePoint{low, high};
+      for (auto n = low == 0x20 ? run(random) : 2; n > 0; --n) {
+        auto c = codePoint(random);
+        if (c < 0x10000) {
+          s.push_back(static_cast<char16_t>(c));
+        } else {
+          s.push_back(static_cast<char16_t>(0xD800 + ((c - 0x10000) >> 10)));
+          s.push_back(static_cast<char16_t>(0xDC00 + ((c - 0x10000) & 0x3FF)));
+        }
+      }
+    }
+    return *toUtf8(s);
+  }
+}
+
+TEST_CASE("UTF conversions round trip", "[utf]") {
+  std::string ascii(100, 'a');
+  REQUIRE(toUtf16(ascii) == std::u16string(100, u'a'));
+  REQUIRE(toUtf8(std::u16string(100, u'a')) == ascii);
+  REQUIRE(toUtf16("") == u"");
+
+  const std::string text = "caf\xC3\xA9 \xE2\x82\xAC \xF0\x9F\x98\x80";
+  const std::u16string text16 = u"café € \U0001F600";
+  REQUIRE(toUtf16(text) == text16);
+  REQUIRE(toUtf8(text16) == text);
+
+  // ASCII long enough for the vector paths, then something that isn't.
+  auto mixed = ascii + text + ascii;
+  REQUIRE(toUtf8(*toUtf16(mixed)) == mixed);
+}
+
+TEST_CASE("Invalid UTF is rejected", "[utf]") {
+  for (std::string_view bad : {"\x80", "\xC0\xAF", "\xC1\xBF", "\xE0\x80\xAF",
+                               "\xED\xA0\x80", "\xF0\x8F\xBF\xBF",
+                               "\xF4\x90\x80\x80", "\xF5\x80\x80\x80",
+                               "\xE2\x82", "\xFF"})
+  {
+    INFO(std::string{bad});
+    REQUIRE_FALSE(toUtf16(bad));
+  }
+  REQUIRE_FALSE(toUtf8(u"a\xD800"));
+  REQUIRE_FALSE(toUtf8(u"\xDC00\xD800"));
+  REQUIRE(toUtf8(u"\xD800\xDC00") == "\xF0\x90\x80\x80");
+}
+
+TEST_CASE("Invalid UTF is replaced", "[utf]") {
+  // Each maximal invalid subsequence becomes one U+FFFD, as in the Unicode
+  // standard's own example.
+  REQUIRE(toUtf16("a\xF1\x80\x80\xE1\x80\xC2" "b\x80" "c\x80\xBF" "d",
+                  Errors::Replace) ==
+          u"a\uFFFD\uFFFD\uFFFDb\uFFFDc\uFFFD\uFFFDd");
+  REQUIRE(toUtf8(u"a\xD800" u"b\xDC00", Errors::Replace) ==
+          "a\xEF\xBF\xBD" "b\xEF\xBF\xBD");
+}
+
+TEST_CASE("UTF conversions respect capacity", "[utf]") {
+  std::u16string out(4, u'\0');
+  REQUIRE_FALSE(utf8ToUtf16(std::string(40, 'a'), out.data(), out.size()));
+  REQUIRE_FALSE(utf8ToUtf16("abc\xF0\x9F\x98\x80", out.data(), out.size()));
+  REQUIRE(utf8ToUtf16("ab\xF0\x9F\x98\x80", out.data(), out.size()) == 4u);
+
+  std::string bytes(3, '\0');
+  REQUIRE_FALSE(utf16ToUtf8(u"abé", bytes.data(), bytes.size()));
+  REQUIRE(utf16ToUtf8(u"aé", bytes.data(), bytes.size()) == 3u);
+}
+
+TEST_CASE("UTF conversions match a reference decoder", "[utf]") {
+  std::minstd_rand random{41};
+  for (int i = 0; i < 20000; ++i) {
+    auto bytes = randomBytes(random);
+    INFO(bytes);
+    auto expected = referenceUtf16(bytes);
+    auto actual = toUtf16(bytes);
+    REQUIRE(actual == expected);
+    // Replacing never fails and always produces something that converts
+    // back cleanly.
+    auto replaced = toUtf16(bytes, Errors::Replace);
+    REQUIRE(replaced);
+    REQUIRE(toUtf8(*replaced));
+    if (expected) {
+      REQUIRE(replaced == expected);
+      REQUIRE(toUtf8(*expected) == bytes);
+    }
+  }
+  for (int i = 0; i < 20000; ++i) {
+    auto text = randomText(random);
+    INFO(text);
+    auto expected = referenceUtf16(text);
+    REQUIRE(expected);
+    REQUIRE(toUtf16(text) == expected);
+    REQUIRE(toUtf8(*expected) == text);
+  }
+}
@@ -0,0 +1,109 @@
+#include "wsudo/watchdog.h"
+
+#include <catch.hpp>
+#include <vector>
+
+using namespace wsudo;
+using namespace std::chrono_literals;
+using watchdog::Clock;
+using watchdog::Heartbeat;
+using watchdog::Watchdog;
+
+TEST_CASE("Heartbeat only shows calls in progress", "[watchdog]") {
+  Heartbeat heartbeat;
+  REQUIRE_FALSE(heartbeat.current());
+
+  auto start = Clock::now();
+  heartbeat.begin(3, "read", start);
+  auto beat = heartbeat.current();
+  REQUIRE(beat);
+  REQUIRE(beat->handler == 3);
+  REQUIRE(std::string{beat->state} == "read");
+  REQUIRE(beat->start == start);
+
+  heartbeat.end();
+  REQUIRE_FALSE(heartbeat.current());
+}
+
+TEST_CASE("Stalls are reported once per handler call", "[watchdog]") {
+  Heartbeat heartbeat;
+  watchdog::Options options;
+  options.threshold = 100ms;
+  std::vector<watchdog::Stall> logged;
+  options.log = [&](const watchdog::Stall &stall, uint64_t) {
+    logged.push_back(stall);
+  };
+  options.sampleStack = [] { return std::string{"frame"}; };
+  Watchdog watchdog{heartbeat, options};
+
+  auto start = Clock::now();
+  heartbeat.begin(1, "respond", start);
+  REQUIRE_FALSE(watchdog.check(start + 50ms));
+
+  auto stall = watchdog.check(start + 150ms);
+  REQUIRE(stall);
+  REQUIRE(stall->handler == 1);
+  REQUIRE(std::string{stall->state} == "respond");
+  REQUIRE(stall->elapsed == 150ms);
+  REQUIRE(stall->stack == "frame");
+  REQUIRE(logged.size() == 1);
+
+  // Still the same call.
+  REQUIRE_FALSE(watchdog.check(start + 300ms));
+
+  heartbeat.end();
+  REQUIRE_FALSE(watchdog.check(start + 400ms));
+  REQUIRE(watchdog.stats().stalls == 1);
+}
+
+TEST_CASE("Stall logging is rate limited", "[watchdog]") {
+  Heartbeat heartbeat;
+  metrics::Counter counter;
+  watchdog::Options options;
+  options.threshold = 100ms;
+  options.logInterval = 10s;
+  options.stalls = &counter;
+  std::vector<uint64_t> suppressed;
+  options.log = [&](const watchdog::Stall &, uint64_t count) {
+    suppressed.push_back(count);
+  };
+  Watchdog watchdog{heartbeat, options};
+
+  auto now = Clock::now();
+  for (int i = 0; i < 4; ++i) {
+    heartbeat.begin(0, "handler", now);
+    REQUIRE(watchdog.check(now + 200ms));
+    heartbeat.end();
+    now += 1s;
+  }
+  // Only the first was logged; the rest are counted.
+  REQUIRE(suppressed == std::vector<uint64_t>{0});
+  REQUIRE(watchdog.stats().suppressed == 3);
+
+  now += 10s;
+  heartbeat.begin(0, "handler", now);
+  REQUIRE(watchdog.check(now + 200ms));
+  heartbeat.end();
+  REQUIRE(suppressed == std::vector<uint64_t>{0, 3});
+  REQUIRE(watchdog.stats().stalls == 5);
+  REQUIRE(counter.value() == 5);
+}
+
+TEST_CASE("Watchdog thread notices a stalled call", "[watchdog]") {
+  Heartbeat heartbeat;
+  watchdog::Options options;
+  options.threshold = 20ms;
+  std::atomic<int> logged{0};
+  options.log = [&](const watchdog::Stall &, uint64_t) { ++logged; };
+  Watchdog watchdog{heartbeat, options};
+  watchdog.start();
+
+  heartbeat.begin(0, "handler");
+  auto deadline = Clock::now() + 5s;
+  while (!logged && Clock::now() < deadline) {
+    std::this_thread::sleep_for(5ms);
+  }
+  heartbeat.end();
+  watchdog.stop();
+  REQUIRE(logged == 1);
+}